@@ -107,6 +107,11 @@ static bool bdrv_change_aio_context(BlockDriverState *bs, AioContext *ctx,
                                     GHashTable *visited, Transaction *tran,
                                     Error **errp);
 
+static BdrvBlockStatusCache *bdrv_bsc_new(void);
+static void bdrv_bsc_free(BdrvBlockStatusCache *bsc);
+static void bdrv_bsc_update_perm(BlockDriverState *bs);
+static void bdrv_bsc_clear(BlockDriverState *bs);
+
 /* If non-zero, use only whitelisted block drivers */
 static int use_bdrv_whitelist;
 
@@ -422,8 +427,7 @@ BlockDriverState *bdrv_new(void)
 
     qemu_co_queue_init(&bs->flush_queue);
 
-    qemu_co_mutex_init(&bs->bsc_modify_lock);
-    bs->block_status_cache = g_new0(BdrvBlockStatusCache, 1);
+    bs->block_status_cache = bdrv_bsc_new();
 
     for (i = 0; i < bdrv_drain_all_count; i++) {
         bdrv_drained_begin(bs);
@@ -2326,6 +2330,7 @@ static void bdrv_drv_set_perm_commit(void *opaque)
                                  &cumulative_shared_perms);
         bs->drv->bdrv_set_perm(bs, cumulative_perms, cumulative_shared_perms);
     }
+    bdrv_bsc_update_perm(bs);
 }
 
 static void bdrv_drv_set_perm_abort(void *opaque)
@@ -4995,7 +5000,7 @@ static void bdrv_close(BlockDriverState *bs)
     bs->explicit_options = NULL;
     qobject_unref(bs->full_open_options);
     bs->full_open_options = NULL;
-    g_free(bs->block_status_cache);
+    bdrv_bsc_free(bs->block_status_cache);
     bs->block_status_cache = NULL;
 
     bdrv_release_named_dirty_bitmaps(bs);
@@ -6256,6 +6261,28 @@ bool bdrv_chain_contains(BlockDriverState *top, BlockDriverState *base)
     return top != NULL;
 }
 
+/*
+ * Return true if the drivers of @bs and of all nodes below it can process
+ * requests from several threads at the same time.
+ */
+bool bdrv_supports_multiqueue(BlockDriverState *bs)
+{
+    BdrvChild *child;
+
+    GLOBAL_STATE_CODE();
+
+    if (!bs->drv || !bs->drv->supports_multiqueue) {
+        return false;
+    }
+
+    QLIST_FOREACH(child, &bs->children, next) {
+        if (!bdrv_supports_multiqueue(child->bs)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 BlockDriverState *bdrv_next_node(BlockDriverState *bs)
 {
     GLOBAL_STATE_CODE();
@@ -6672,6 +6699,9 @@ int bdrv_activate(BlockDriverState *bs, Error **errp)
             return ret;
         }
 
+        /* Other processes may have changed the image in the meantime */
+        bdrv_bsc_clear(bs);
+
         ret = bdrv_invalidate_cache(bs, errp);
         if (ret < 0) {
             bs->open_flags |= BDRV_O_INACTIVE;
@@ -8237,41 +8267,155 @@ BlockDriverState *bdrv_backing_chain_next(BlockDriverState *bs)
     return bdrv_skip_filters(bdrv_cow_bs(bdrv_skip_filters(bs)));
 }
 
-/**
- * Check whether [offset, offset + bytes) overlaps with the cached
- * block-status data region.
- *
- * If so, and @pnum is not NULL, set *pnum to `bsc.data_end - offset`,
- * which is what bdrv_bsc_is_data()'s interface needs.
- * Otherwise, *pnum is not touched.
+/*
+ * The block-status cache keeps at most this many extents per node.  Drivers
+ * usually report maximal extents, so even images with many holes only need
+ * a few extents per area that is being worked on.
+ */
+#define BDRV_BSC_MAX_EXTENTS 4096
+
+static BdrvBlockStatusCache *bdrv_bsc_new(void)
+{
+    BdrvBlockStatusCache *bsc = g_new0(BdrvBlockStatusCache, 1);
+
+    qemu_mutex_init(&bsc->lock);
+    QTAILQ_INIT(&bsc->lru);
+    return bsc;
+}
+
+static void bdrv_bsc_remove_locked(BdrvBlockStatusCache *bsc,
+                                   BdrvBlockStatusExtent *e)
+{
+    interval_tree_remove(&e->node, &bsc->extents);
+    QTAILQ_REMOVE(&bsc->lru, e, next);
+    qatomic_set(&bsc->num_extents, bsc->num_extents - 1);
+    g_free(e);
+}
+
+static BdrvBlockStatusExtent *
+bdrv_bsc_insert_locked(BdrvBlockStatusCache *bsc, uint64_t start,
+                       uint64_t last, int status)
+{
+    BdrvBlockStatusExtent *e;
+
+    if (bsc->num_extents >= BDRV_BSC_MAX_EXTENTS) {
+        bdrv_bsc_remove_locked(bsc, QTAILQ_FIRST(&bsc->lru));
+    }
+
+    e = g_new0(BdrvBlockStatusExtent, 1);
+    e->node.start = start;
+    e->node.last = last;
+    e->status = status;
+    interval_tree_insert(&e->node, &bsc->extents);
+    QTAILQ_INSERT_TAIL(&bsc->lru, e, next);
+    qatomic_set(&bsc->num_extents, bsc->num_extents + 1);
+    return e;
+}
+
+/*
+ * Drop [start, last] from the cache.  Extents that only partially overlap
+ * are trimmed, so that e.g. a small write into a large data area does not
+ * throw away what is known about the rest of it.
+ */
+static void bdrv_bsc_invalidate_locked(BdrvBlockStatusCache *bsc,
+                                       uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *node;
+
+    while ((node = interval_tree_iter_first(&bsc->extents, start, last))) {
+        BdrvBlockStatusExtent *e =
+            container_of(node, BdrvBlockStatusExtent, node);
+        uint64_t e_start = node->start;
+        uint64_t e_last = node->last;
+        int status = e->status;
+
+        bdrv_bsc_remove_locked(bsc, e);
+        if (e_start < start) {
+            bdrv_bsc_insert_locked(bsc, e_start, start - 1, status);
+        }
+        if (e_last > last) {
+            bdrv_bsc_insert_locked(bsc, last + 1, e_last, status);
+        }
+    }
+}
+
+static void bdrv_bsc_free(BdrvBlockStatusCache *bsc)
+{
+    if (!bsc) {
+        return;
+    }
+
+    bdrv_bsc_invalidate_locked(bsc, 0, UINT64_MAX);
+    qemu_mutex_destroy(&bsc->lock);
+    g_free(bsc);
+}
+
+/*
+ * Called whenever the permissions on @bs change: zero areas may only be
+ * cached as long as nobody else can write to the node behind our back,
+ * which the driver tells us in bs->exclusive_block_status.
  */
-static bool bdrv_bsc_range_overlaps_locked(BlockDriverState *bs,
-                                           int64_t offset, int64_t bytes,
-                                           int64_t *pnum)
+static void bdrv_bsc_update_perm(BlockDriverState *bs)
 {
-    BdrvBlockStatusCache *bsc = qatomic_rcu_read(&bs->block_status_cache);
-    bool overlaps;
+    BdrvBlockStatusCache *bsc = bs->block_status_cache;
+    BdrvBlockStatusExtent *e, *next_e;
+    GLOBAL_STATE_CODE();
 
-    overlaps =
-        qatomic_read(&bsc->valid) &&
-        ranges_overlap(offset, bytes, bsc->data_start,
-                       bsc->data_end - bsc->data_start);
+    if (!bsc) {
+        return;
+    }
 
-    if (overlaps && pnum) {
-        *pnum = bsc->data_end - offset;
+    QEMU_LOCK_GUARD(&bsc->lock);
+    bsc->cache_zeroes = bs->exclusive_block_status;
+    if (!bsc->cache_zeroes) {
+        QTAILQ_FOREACH_SAFE(e, &bsc->lru, next, next_e) {
+            if (e->status & BDRV_BLOCK_ZERO) {
+                bdrv_bsc_remove_locked(bsc, e);
+            }
+        }
     }
+}
+
+/*
+ * Drop everything, e.g. because another process may have changed the image
+ * while it was inactive.
+ */
+static void bdrv_bsc_clear(BlockDriverState *bs)
+{
+    BdrvBlockStatusCache *bsc = bs->block_status_cache;
+    GLOBAL_STATE_CODE();
 
-    return overlaps;
+    if (bsc) {
+        bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
+    }
 }
 
 /**
  * See block_int.h for this function's documentation.
  */
-bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
+int bdrv_bsc_lookup(BlockDriverState *bs, int64_t offset, int64_t *pnum)
 {
+    BdrvBlockStatusCache *bsc = bs->block_status_cache;
+    IntervalTreeNode *node;
+    BdrvBlockStatusExtent *e;
     IO_CODE();
-    RCU_READ_LOCK_GUARD();
-    return bdrv_bsc_range_overlaps_locked(bs, offset, 1, pnum);
+
+    if (!qatomic_read(&bsc->num_extents)) {
+        return 0;
+    }
+
+    QEMU_LOCK_GUARD(&bsc->lock);
+    node = interval_tree_iter_first(&bsc->extents, offset, offset);
+    if (!node) {
+        return 0;
+    }
+
+    e = container_of(node, BdrvBlockStatusExtent, node);
+    QTAILQ_REMOVE(&bsc->lru, e, next);
+    QTAILQ_INSERT_TAIL(&bsc->lru, e, next);
+
+    *pnum = node->last - offset + 1;
+    return e->status;
 }
 
 /**
@@ -8280,34 +8424,96 @@ bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
 void bdrv_bsc_invalidate_range(BlockDriverState *bs,
                                int64_t offset, int64_t bytes)
 {
+    BdrvBlockStatusCache *bsc = bs->block_status_cache;
+    uint64_t align = bs->bl.request_alignment ?: 1;
     IO_CODE();
-    RCU_READ_LOCK_GUARD();
 
-    if (bdrv_bsc_range_overlaps_locked(bs, offset, bytes, NULL)) {
-        qatomic_set(&bs->block_status_cache->valid, false);
+    if (!bytes) {
+        return;
     }
+
+    /*
+     * Pairs with the barrier in bdrv_bsc_fill(): Either the filler sees the
+     * new generation, or we see its extent.
+     */
+    qatomic_inc(&bsc->gen);
+    if (!qatomic_read(&bsc->num_extents)) {
+        return;
+    }
+
+    /*
+     * Keep the cached extents aligned to request_alignment even for
+     * unaligned discards, because that is what bdrv_co_block_status()
+     * must return.
+     */
+    QEMU_LOCK_GUARD(&bsc->lock);
+    bdrv_bsc_invalidate_locked(bsc, QEMU_ALIGN_DOWN((uint64_t)offset, align),
+                               ROUND_UP((uint64_t)offset + bytes, align) - 1);
 }
 
 /**
  * See block_int.h for this function's documentation.
  */
-void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes)
+uint64_t bdrv_bsc_generation(BlockDriverState *bs)
 {
-    BdrvBlockStatusCache *new_bsc = g_new(BdrvBlockStatusCache, 1);
-    BdrvBlockStatusCache *old_bsc;
     IO_CODE();
+    return qatomic_read(&bs->block_status_cache->gen);
+}
 
-    *new_bsc = (BdrvBlockStatusCache) {
-        .valid = true,
-        .data_start = offset,
-        .data_end = offset + bytes,
-    };
+/**
+ * See block_int.h for this function's documentation.
+ */
+void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                   int status, uint64_t gen)
+{
+    BdrvBlockStatusCache *bsc = bs->block_status_cache;
+    uint64_t start = offset;
+    uint64_t last = offset + bytes - 1;
+    IntervalTreeNode *node;
+    BdrvBlockStatusExtent *e;
+    IO_CODE();
+
+    assert(bytes > 0);
+    assert(status == (BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID) ||
+           status == (BDRV_BLOCK_ZERO | BDRV_BLOCK_OFFSET_VALID));
 
-    QEMU_LOCK_GUARD(&bs->bsc_modify_lock);
+    QEMU_LOCK_GUARD(&bsc->lock);
 
-    old_bsc = qatomic_rcu_read(&bs->block_status_cache);
-    qatomic_rcu_set(&bs->block_status_cache, new_bsc);
-    if (old_bsc) {
-        g_free_rcu(old_bsc, rcu);
+    if (((status & BDRV_BLOCK_ZERO) && !bsc->cache_zeroes) ||
+        qatomic_read(&bsc->gen) != gen)
+    {
+        return;
+    }
+
+    /* The driver may know better than what we have, so replace it */
+    bdrv_bsc_invalidate_locked(bsc, start, last);
+
+    /* Merge with adjacent extents of the same status */
+    if (start > 0) {
+        node = interval_tree_iter_first(&bsc->extents, start - 1, start - 1);
+        e = node ? container_of(node, BdrvBlockStatusExtent, node) : NULL;
+        if (e && e->status == status) {
+            start = node->start;
+            bdrv_bsc_remove_locked(bsc, e);
+        }
+    }
+    node = interval_tree_iter_first(&bsc->extents, last + 1, last + 1);
+    e = node ? container_of(node, BdrvBlockStatusExtent, node) : NULL;
+    if (e && e->status == status) {
+        last = node->last;
+        bdrv_bsc_remove_locked(bsc, e);
+    }
+
+    e = bdrv_bsc_insert_locked(bsc, start, last, status);
+
+    /*
+     * Pairs with the barrier in bdrv_bsc_invalidate_range(): A write that
+     * has finished since @gen was read may have skipped taking the lock
+     * because there were no extents yet, so check again now that there is
+     * one.
+     */
+    smp_mb();
+    if (qatomic_read(&bsc->gen) != gen) {
+        bdrv_bsc_remove_locked(bsc, e);
     }
 }
@@ -71,9 +71,23 @@ void block_acct_cleanup(BlockAcctStats *stats)
     QSLIST_FOREACH_SAFE(s, &stats->intervals, entries, next) {
         g_free(s);
     }
+    g_free(stats->queues);
     qemu_mutex_destroy(&stats->lock);
 }
 
+/*
+ * Keep separate statistics for each of the @nr_queues queues of the
+ * device attached to the BlockBackend, in addition to the global ones.
+ * The statistics of the previous queues are dropped, @nr_queues can be 0.
+ */
+void block_acct_set_queues(BlockAcctStats *stats, unsigned nr_queues)
+{
+    QEMU_LOCK_GUARD(&stats->lock);
+    g_free(stats->queues);
+    stats->queues = nr_queues ? g_new0(BlockAcctQueueStats, nr_queues) : NULL;
+    stats->nr_queues = nr_queues;
+}
+
 void block_acct_add_interval(BlockAcctStats *stats, unsigned interval_length)
 {
     BlockAcctTimedStats *s;
@@ -110,6 +124,20 @@ void block_acct_start(BlockAcctStats *stats, BlockAcctCookie *cookie,
     cookie->bytes = bytes;
     cookie->start_time_ns = qemu_clock_get_ns(clock_type);
     cookie->type = type;
+    cookie->queue = -1;
+}
+
+/*
+ * Like block_acct_start(), but also account the request to queue @queue
+ * of the device, if the device registered its queues with
+ * block_acct_set_queues().
+ */
+void block_acct_start_queue(BlockAcctStats *stats, BlockAcctCookie *cookie,
+                            int64_t bytes, enum BlockAcctType type,
+                            unsigned queue)
+{
+    block_acct_start(stats, cookie, bytes, type);
+    cookie->queue = queue;
 }
 
 /* block_latency_histogram_compare_func:
@@ -218,6 +246,12 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
     }
 
     WITH_QEMU_LOCK_GUARD(&stats->lock) {
+        BlockAcctQueueStats *q = NULL;
+
+        if (cookie->queue >= 0 && cookie->queue < stats->nr_queues) {
+            q = &stats->queues[cookie->queue];
+        }
+
         if (failed) {
             stats->failed_ops[cookie->type]++;
         } else {
@@ -225,6 +259,18 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
             stats->nr_ops[cookie->type]++;
         }
 
+        if (q) {
+            if (failed) {
+                q->failed_ops[cookie->type]++;
+            } else {
+                q->nr_bytes[cookie->type] += cookie->bytes;
+                q->nr_ops[cookie->type]++;
+            }
+            if (!failed || stats->account_failed) {
+                q->total_time_ns[cookie->type] += latency_ns;
+            }
+        }
+
         block_latency_histogram_account(&stats->latency_histogram[cookie->type],
                                         latency_ns);
 
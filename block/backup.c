@@ -44,6 +44,10 @@ typedef struct BackupBlockJob {
     uint64_t len;
     int64_t cluster_size;
     BackupPerf perf;
+    bool dedup;
+    /* Final dedup statistics, saved when bcs goes away */
+    uint64_t dedup_bytes;
+    uint64_t written_bytes;
 
     BlockCopyState *bcs;
 
@@ -101,6 +105,11 @@ static void backup_abort(Job *job)
 static void backup_clean(Job *job)
 {
     BackupBlockJob *s = container_of(job, BackupBlockJob, common.job);
+
+    /* bcs belongs to the filter, keep what query-block-jobs reports */
+    block_copy_get_dedup_stats(s->bcs, &s->dedup_bytes, &s->written_bytes);
+    s->bcs = NULL;
+
     block_job_remove_all_bdrv(&s->common);
     bdrv_cbw_drop(s->cbw);
 }
@@ -336,6 +345,25 @@ static bool backup_cancel(Job *job, bool force)
     return true;
 }
 
+static void backup_query(BlockJob *job, BlockJobInfo *info)
+{
+    BackupBlockJob *s = container_of(job, BackupBlockJob, common);
+
+    if (!s->dedup) {
+        return;
+    }
+
+    if (s->bcs) {
+        block_copy_get_dedup_stats(s->bcs, &s->dedup_bytes, &s->written_bytes);
+    }
+    info->u.backup = (BlockJobInfoBackup) {
+        .has_dedup_bytes = true,
+        .dedup_bytes = s->dedup_bytes,
+        .has_written_bytes = true,
+        .written_bytes = s->written_bytes,
+    };
+}
+
 static const BlockJobDriver backup_job_driver = {
     .job_driver = {
         .instance_size          = sizeof(BackupBlockJob),
@@ -350,13 +378,14 @@ static const BlockJobDriver backup_job_driver = {
         .cancel                 = backup_cancel,
     },
     .set_speed = backup_set_speed,
+    .query = backup_query,
 };
 
 BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *target, int64_t speed,
                   MirrorSyncMode sync_mode, BdrvDirtyBitmap *sync_bitmap,
                   BitmapSyncMode bitmap_mode,
-                  bool compress,
+                  bool compress, bool dedup,
                   const char *filter_node_name,
                   BackupPerf *perf,
                   BlockdevOnError on_source_error,
@@ -402,6 +431,18 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
         return NULL;
     }
 
+    if (dedup && !bdrv_backing_chain_next(target)) {
+        error_setg(errp, "Deduplication requires the target %s to have a "
+                   "backing file", bdrv_get_device_or_node_name(target));
+        return NULL;
+    }
+
+    if (dedup && bdrv_chain_contains(target, bs)) {
+        error_setg(errp, "Deduplication cannot be used when the source is in "
+                   "the backing chain of the target");
+        return NULL;
+    }
+
     if (bdrv_op_is_blocked(bs, BLOCK_OP_TYPE_BACKUP_SOURCE, errp)) {
         return NULL;
     }
@@ -486,8 +527,9 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     job->cluster_size = cluster_size;
     job->len = len;
     job->perf = *perf;
+    job->dedup = dedup;
 
-    block_copy_set_copy_opts(bcs, perf->use_copy_range, compress);
+    block_copy_set_copy_opts(bcs, perf->use_copy_range, compress, dedup);
     block_copy_set_progress_meter(bcs, &job->common.job.progress);
     block_copy_set_speed(bcs, speed);
 
@@ -84,6 +84,11 @@ struct BlockBackend {
     QemuMutex queued_requests_lock; /* protects queued_requests */
     CoQueue queued_requests;
     bool disable_request_queuing; /* atomic */
+    /*
+     * AIO requests are processed and completed in the AioContext of the
+     * submitting thread rather than in the BlockBackend's one (atomic)
+     */
+    bool aio_in_caller_context;
 
     VMChangeStateEntry *vmsh;
     bool force_allow_inactivate;
@@ -1256,6 +1261,29 @@ void blk_set_disable_request_queuing(BlockBackend *blk, bool disable)
     qatomic_set(&blk->disable_request_queuing, disable);
 }
 
+/*
+ * Process the blk_aio_*() requests of @blk, and run their completion, in
+ * the AioContext of the thread that submits them instead of the
+ * BlockBackend's one.  This lets a device submit requests from several
+ * IOThreads, each of them using its own submission state (e.g. Linux AIO
+ * or io_uring context).  The device must protect its own state and the
+ * block drivers in the graph must support requests from other threads.
+ */
+void blk_set_aio_in_caller_context(BlockBackend *blk, bool enable)
+{
+    IO_CODE();
+    qatomic_set(&blk->aio_in_caller_context, enable);
+}
+
+/* AioContext in which the blk_aio_*() requests of @blk are processed */
+static AioContext *blk_aio_em_get_context(BlockBackend *blk)
+{
+    if (qatomic_read(&blk->aio_in_caller_context)) {
+        return qemu_get_current_aio_context();
+    }
+    return blk_get_aio_context(blk);
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 blk_check_byte_request(BlockBackend *blk, int64_t offset, int64_t bytes)
 {
@@ -1533,7 +1561,7 @@ BlockAIOCB *blk_abort_aio_request(BlockBackend *blk,
     acb->blk = blk;
     acb->ret = ret;
 
-    replay_bh_schedule_oneshot_event(blk_get_aio_context(blk),
+    replay_bh_schedule_oneshot_event(blk_aio_em_get_context(blk),
                                      error_callback_bh, acb);
     return &acb->common;
 }
@@ -1541,6 +1569,8 @@ BlockAIOCB *blk_abort_aio_request(BlockBackend *blk,
 typedef struct BlkAioEmAIOCB {
     BlockAIOCB common;
     BlkRwCo rwco;
+    /* where the request is processed */
+    AioContext *ctx;
     int64_t bytes;
     bool has_returned;
 } BlkAioEmAIOCB;
@@ -1549,7 +1579,7 @@ static AioContext *blk_aio_em_aiocb_get_aio_context(BlockAIOCB *acb_)
 {
     BlkAioEmAIOCB *acb = container_of(acb_, BlkAioEmAIOCB, common);
 
-    return blk_get_aio_context(acb->rwco.blk);
+    return acb->ctx;
 }
 
 static const AIOCBInfo blk_aio_em_aiocb_info = {
@@ -1593,14 +1623,15 @@ static BlockAIOCB *blk_aio_prwv(BlockBackend *blk, int64_t offset,
     };
     acb->bytes = bytes;
     acb->has_returned = false;
+    acb->ctx = blk_aio_em_get_context(blk);
 
     co = qemu_coroutine_create(co_entry, acb);
-    aio_co_enter(blk_get_aio_context(blk), co);
+    aio_co_enter(acb->ctx, co);
 
     acb->has_returned = true;
     if (acb->rwco.ret != NOT_DONE) {
-        replay_bh_schedule_oneshot_event(blk_get_aio_context(blk),
-                                         blk_aio_complete_bh, acb);
+        replay_bh_schedule_oneshot_event(acb->ctx, blk_aio_complete_bh,
+                                         acb);
     }
 
     return &acb->common;
@@ -1899,14 +1930,15 @@ BlockAIOCB *blk_aio_zone_report(BlockBackend *blk, int64_t offset,
     };
     acb->bytes = (int64_t)(uintptr_t)nr_zones,
     acb->has_returned = false;
+    acb->ctx = blk_aio_em_get_context(blk);
 
     co = qemu_coroutine_create(blk_aio_zone_report_entry, acb);
-    aio_co_enter(blk_get_aio_context(blk), co);
+    aio_co_enter(acb->ctx, co);
 
     acb->has_returned = true;
     if (acb->rwco.ret != NOT_DONE) {
-        replay_bh_schedule_oneshot_event(blk_get_aio_context(blk),
-                                         blk_aio_complete_bh, acb);
+        replay_bh_schedule_oneshot_event(acb->ctx, blk_aio_complete_bh,
+                                         acb);
     }
 
     return &acb->common;
@@ -1940,14 +1972,15 @@ BlockAIOCB *blk_aio_zone_mgmt(BlockBackend *blk, BlockZoneOp op,
     };
     acb->bytes = len;
     acb->has_returned = false;
+    acb->ctx = blk_aio_em_get_context(blk);
 
     co = qemu_coroutine_create(blk_aio_zone_mgmt_entry, acb);
-    aio_co_enter(blk_get_aio_context(blk), co);
+    aio_co_enter(acb->ctx, co);
 
     acb->has_returned = true;
     if (acb->rwco.ret != NOT_DONE) {
-        replay_bh_schedule_oneshot_event(blk_get_aio_context(blk),
-                                         blk_aio_complete_bh, acb);
+        replay_bh_schedule_oneshot_event(acb->ctx, blk_aio_complete_bh,
+                                         acb);
     }
 
     return &acb->common;
@@ -1980,13 +2013,14 @@ BlockAIOCB *blk_aio_zone_append(BlockBackend *blk, int64_t *offset,
     };
     acb->bytes = (int64_t)(uintptr_t)offset;
     acb->has_returned = false;
+    acb->ctx = blk_aio_em_get_context(blk);
 
     co = qemu_coroutine_create(blk_aio_zone_append_entry, acb);
-    aio_co_enter(blk_get_aio_context(blk), co);
+    aio_co_enter(acb->ctx, co);
     acb->has_returned = true;
     if (acb->rwco.ret != NOT_DONE) {
-        replay_bh_schedule_oneshot_event(blk_get_aio_context(blk),
-                                         blk_aio_complete_bh, acb);
+        replay_bh_schedule_oneshot_event(acb->ctx, blk_aio_complete_bh,
+                                         acb);
     }
 
     return &acb->common;
@@ -28,6 +28,7 @@
 #include "block/aio_task.h"
 #include "qemu/error-report.h"
 #include "qemu/memalign.h"
+#include "qemu/stats64.h"
 
 #define BLOCK_COPY_MAX_COPY_RANGE (16 * MiB)
 #define BLOCK_COPY_MAX_BUFFER (1 * MiB)
@@ -129,6 +130,7 @@ typedef struct BlockCopyState {
     int64_t max_transfer;
     uint64_t len;
     BdrvRequestFlags write_flags;
+    bool is_fleecing;
 
     /*
      * Fields whose state changes throughout the execution
@@ -154,6 +156,13 @@ typedef struct BlockCopyState {
      * block_copy_reset_unallocated() every time it does.
      */
     bool skip_unallocated; /* atomic */
+    /*
+     * dedup: Only write clusters that the target does not already return
+     * from its backing chain.  Set by block_copy_set_copy_opts().
+     */
+    bool dedup;
+    Stat64 dedup_bytes;
+    Stat64 written_bytes;
     /* State fields that use a thread-safe API */
     BdrvDirtyBitmap *copy_bitmap;
     ProgressMeter *progress;
@@ -282,12 +291,19 @@ static uint32_t block_copy_max_transfer(BdrvChild *source, BdrvChild *target)
 }
 
 void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
-                              bool compress)
+                              bool compress, bool dedup)
 {
     /* Keep BDRV_REQ_SERIALISING set (or not set) in block_copy_state_new() */
     s->write_flags = (s->write_flags & BDRV_REQ_SERIALISING) |
         (compress ? BDRV_REQ_WRITE_COMPRESSED : 0);
 
+    /*
+     * For fleecing, the target's backing chain is the source itself, so
+     * everything would compare equal before the guest overwrites it.
+     */
+    assert(!dedup || !s->is_fleecing);
+    s->dedup = dedup;
+
     if (s->max_transfer < s->cluster_size) {
         /*
          * copy_range does not respect max_transfer. We don't want to bother
@@ -299,6 +315,9 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
     } else if (compress) {
         /* Compression supports only cluster-size writes and no copy-range. */
         s->method = COPY_READ_WRITE_CLUSTER;
+    } else if (dedup) {
+        /* The data has to be in our buffer to compare it */
+        s->method = COPY_READ_WRITE;
     } else {
         /*
          * If copy range enabled, start with COPY_RANGE_SMALL, until first
@@ -402,13 +421,14 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
         .cluster_size = cluster_size,
         .len = bdrv_dirty_bitmap_size(copy_bitmap),
         .write_flags = (is_fleecing ? BDRV_REQ_SERIALISING : 0),
+        .is_fleecing = is_fleecing,
         .mem = shres_create(BLOCK_COPY_MAX_MEM),
         .max_transfer = QEMU_ALIGN_DOWN(
                                     block_copy_max_transfer(source, target),
                                     cluster_size),
     };
 
-    block_copy_set_copy_opts(s, false, false);
+    block_copy_set_copy_opts(s, false, false, false);
 
     ratelimit_init(&s->rate_limit);
     qemu_co_mutex_init(&s->lock);
@@ -418,6 +438,13 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
     return s;
 }
 
+void block_copy_get_dedup_stats(BlockCopyState *s, uint64_t *dedup_bytes,
+                                uint64_t *written_bytes)
+{
+    *dedup_bytes = stat64_get(&s->dedup_bytes);
+    *written_bytes = stat64_get(&s->written_bytes);
+}
+
 /* Only set before running the job, no need for locking. */
 void block_copy_set_progress_meter(BlockCopyState *s, ProgressMeter *pm)
 {
@@ -433,6 +460,15 @@ void block_copy_set_progress_meter(BlockCopyState *s, ProgressMeter *pm)
  *          otherwise -ECANCELED if pool status is bad
  *          otherwise 0 (successfully scheduled)
  */
+/*
+ * Memory that @task takes from s->mem: its bounce buffer and, with dedup,
+ * the buffer that block_copy_write_dedup() reads target clusters into.
+ */
+static int64_t block_copy_task_mem(BlockCopyTask *task)
+{
+    return task->req.bytes + (task->s->dedup ? task->s->cluster_size : 0);
+}
+
 static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
                                             BlockCopyTask *task)
 {
@@ -445,7 +481,7 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
 
     aio_task_pool_wait_slot(pool);
     if (aio_task_pool_status(pool) < 0) {
-        co_put_to_shres(task->s->mem, task->req.bytes);
+        co_put_to_shres(task->s->mem, block_copy_task_mem(task));
         block_copy_task_end(task, -ECANCELED);
         g_free(task);
         return -ECANCELED;
@@ -456,6 +492,75 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
     return 0;
 }
 
+/*
+ * block_copy_write_dedup
+ *
+ * Write @bytes from @buf to the target at @offset, leaving out the clusters
+ * that are not allocated in the target's top layer and that its backing
+ * chain already returns with the same content.  The remaining clusters are
+ * written in as few requests as possible.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+block_copy_write_dedup(BlockCopyState *s, int64_t offset, int64_t bytes,
+                       uint8_t *buf)
+{
+    int64_t pos = 0, write_start = 0, dedup = 0;
+    uint8_t *cmp_buf;
+    int ret = 0;
+
+    /* Accounted for in s->mem by block_copy_task_mem() */
+    cmp_buf = qemu_blockalign(s->target->bs, s->cluster_size);
+
+    while (pos < bytes) {
+        int64_t chunk = MIN(s->cluster_size, bytes - pos);
+        int64_t pnum;
+
+        ret = bdrv_co_is_allocated(s->target->bs, offset + pos, chunk, &pnum);
+        if (ret < 0) {
+            goto out;
+        }
+
+        if (!ret && pnum == chunk) {
+            /* Unallocated in the top layer, so this reads the backing chain */
+            ret = bdrv_co_pread(s->target, offset + pos, chunk, cmp_buf, 0);
+            if (ret < 0) {
+                goto out;
+            }
+            if (!memcmp(buf + pos, cmp_buf, chunk)) {
+                if (pos > write_start) {
+                    ret = bdrv_co_pwrite(s->target, offset + write_start,
+                                         pos - write_start, buf + write_start,
+                                         s->write_flags);
+                    if (ret < 0) {
+                        goto out;
+                    }
+                }
+                write_start = pos + chunk;
+                dedup += chunk;
+            }
+        }
+
+        pos += chunk;
+    }
+
+    if (pos > write_start) {
+        ret = bdrv_co_pwrite(s->target, offset + write_start, pos - write_start,
+                             buf + write_start, s->write_flags);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
+    trace_block_copy_dedup(s, offset, bytes, dedup);
+    stat64_add(&s->dedup_bytes, dedup);
+    stat64_add(&s->written_bytes, bytes - dedup);
+    ret = 0;
+
+out:
+    qemu_vfree(cmp_buf);
+    return ret;
+}
+
 /*
  * block_copy_do_copy
  *
@@ -530,8 +635,12 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
             goto out;
         }
 
-        ret = bdrv_co_pwrite(s->target, offset, nbytes, bounce_buffer,
-                             s->write_flags);
+        if (s->dedup) {
+            ret = block_copy_write_dedup(s, offset, nbytes, bounce_buffer);
+        } else {
+            ret = bdrv_co_pwrite(s->target, offset, nbytes, bounce_buffer,
+                                 s->write_flags);
+        }
         if (ret < 0) {
             trace_block_copy_write_fail(s, offset, ret);
             *error_is_read = false;
@@ -576,7 +685,7 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
             progress_work_done(s->progress, t->req.bytes);
         }
     }
-    co_put_to_shres(s->mem, t->req.bytes);
+    co_put_to_shres(s->mem, block_copy_task_mem(t));
     block_copy_task_end(t, ret);
 
     return ret;
@@ -779,7 +888,7 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
 
         trace_block_copy_process(s, task->req.offset);
 
-        co_get_from_shres(s->mem, task->req.bytes);
+        co_get_from_shres(s->mem, block_copy_task_mem(task));
 
         offset = task_end(task);
         bytes = end - offset;
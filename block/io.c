@@ -1848,9 +1848,6 @@ bdrv_co_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
         return -EINVAL;
     }
 
-    /* Invalidate the cached block-status data range if this write overlaps */
-    bdrv_bsc_invalidate_range(bs, offset, bytes);
-
     assert(alignment % bs->bl.request_alignment == 0);
     head = offset % alignment;
     tail = (offset + bytes) % alignment;
@@ -2003,6 +2000,17 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, int64_t bytes,
 
     qatomic_inc(&bs->write_gen);
 
+    /*
+     * Drop the range from the block-status cache.  Do this even on failure,
+     * the request may have been partially executed.  Truncation invalidates
+     * everything behind the new end, in case the image grows again later.
+     */
+    if (req->type == BDRV_TRACKED_TRUNCATE) {
+        bdrv_bsc_invalidate_range(bs, offset, INT64_MAX - offset);
+    } else {
+        bdrv_bsc_invalidate_range(bs, offset, bytes);
+    }
+
     /*
      * Discard cannot extend the image, but in error handling cases, such as
      * when reverting a qcow2 cluster allocation, the discarded range can pass
@@ -2439,25 +2447,40 @@ bdrv_co_block_status(BlockDriverState *bs, bool want_zero,
          * drivers often need to get information from outside of qemu, so
          * we do not have control over the actual implementation.  There
          * have been cases where inquiring the status took an unreasonably
-         * long time, and we can do nothing in qemu to fix it.
-         * This is especially problematic for images with large data areas,
-         * because finding the few holes in them and giving them special
-         * treatment does not gain much performance.  Therefore, we try to
-         * cache the last-identified data region.
+         * long time, and we can do nothing in qemu to fix it.  Even when
+         * it is fast (e.g. lseek(SEEK_DATA/SEEK_HOLE) in file-posix), it is
+         * still a syscall per extent, and users like qemu-img convert,
+         * mirror and the NBD server ask for the same extents again and
+         * again.  Therefore, we cache the extents that were reported.
          *
          * Second, limiting ourselves to protocol nodes allows us to assume
-         * the block status for data regions to be DATA | OFFSET_VALID, and
-         * that the host offset is the same as the guest offset.
+         * the block status to be DATA | OFFSET_VALID or ZERO | OFFSET_VALID,
+         * and that the host offset is the same as the guest offset.
          *
          * Note that it is possible that external writers zero parts of
-         * the cached regions without the cache being invalidated, and so
-         * we may report zeroes as data.  This is not catastrophic,
-         * however, because reporting zeroes as data is fine.
+         * the cached data regions without the cache being invalidated, and
+         * so we may report zeroes as data.  This is not catastrophic,
+         * however, because reporting zeroes as data is fine.  The opposite
+         * is not, so zero regions are only cached while nobody can write
+         * to the node behind our back (see bdrv_bsc_update_perm()).
          */
-        if (QLIST_EMPTY(&bs->children) &&
-            bdrv_bsc_is_data(bs, aligned_offset, pnum))
-        {
-            ret = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
+        bool use_cache = QLIST_EMPTY(&bs->children);
+        uint64_t bsc_gen = 0;
+
+        ret = 0;
+        if (use_cache) {
+            bsc_gen = bdrv_bsc_generation(bs);
+            ret = bdrv_bsc_lookup(bs, aligned_offset, pnum);
+            if (ret) {
+                /* Unaligned discards may have left a partial block */
+                *pnum = QEMU_ALIGN_DOWN(*pnum, align);
+                if (!*pnum) {
+                    ret = 0;
+                }
+            }
+        }
+
+        if (ret) {
             local_file = bs;
             local_map = aligned_offset;
         } else {
@@ -2466,19 +2489,12 @@ bdrv_co_block_status(BlockDriverState *bs, bool want_zero,
                                                 &local_file);
 
             /*
-             * Note that checking QLIST_EMPTY(&bs->children) is also done when
-             * the cache is queried above.  Technically, we do not need to check
-             * it here; the worst that can happen is that we fill the cache for
-             * non-protocol nodes, and then it is never used.  However, filling
-             * the cache requires an RCU update, so double check here to avoid
-             * such an update if possible.
-             *
              * Check want_zero, because we only want to update the cache when we
              * have accurate information about what is zero and what is data.
              */
-            if (want_zero &&
-                ret == (BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID) &&
-                QLIST_EMPTY(&bs->children))
+            if (want_zero && use_cache &&
+                (ret == (BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID) ||
+                 ret == (BDRV_BLOCK_ZERO | BDRV_BLOCK_OFFSET_VALID)))
             {
                 /*
                  * When a protocol driver reports BLOCK_OFFSET_VALID, the
@@ -2493,7 +2509,7 @@ bdrv_co_block_status(BlockDriverState *bs, bool want_zero,
                  */
                 assert(local_file == bs);
                 assert(local_map == aligned_offset);
-                bdrv_bsc_fill(bs, aligned_offset, *pnum);
+                bdrv_bsc_fill(bs, aligned_offset, *pnum, ret, bsc_gen);
             }
         }
     } else {
@@ -3134,9 +3150,6 @@ int coroutine_fn bdrv_co_pdiscard(BdrvChild *child, int64_t offset,
         return 0;
     }
 
-    /* Invalidate the cached block-status data range if this discard overlaps */
-    bdrv_bsc_invalidate_range(bs, offset, bytes);
-
     /* Discard is advisory, but some devices track and coalesce
      * unaligned requests, so we must pass everything down rather than
      * round here.  Still, most devices will just silently ignore
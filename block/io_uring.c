@@ -8,6 +8,19 @@
  * This work is licensed under the terms of the GNU GPL, version 2 or later.
  * See the COPYING file in the top-level directory.
  */
+
+/*
+ * When the AioContext monitors file descriptors with io_uring, requests are
+ * submitted to that ring with aio_co_submit_fd_op().  This saves the
+ * io_uring_enter(2) calls for submitting requests and for reaping their
+ * completions: everything queued during one aio_poll() iteration goes out
+ * with the system call that waits for the next events.
+ *
+ * Otherwise, e.g. if the AioContext falls back to epoll(7) because the
+ * kernel lacks features that fd monitoring needs, the LuringState has its
+ * own ring whose completions are signalled through its file descriptor, and
+ * submission is batched with blk_io_plug_call().
+ */
 #include "qemu/osdep.h"
 #include <liburing.h>
 #include "block/aio.h"
@@ -28,6 +41,7 @@
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
+    AioFdOp fd_op; /* used when the ring is shared with the AioContext */
     ssize_t ret;
     QEMUIOVector *qiov;
     bool is_read;
@@ -51,7 +65,9 @@ typedef struct LuringQueue {
 typedef struct LuringState {
     AioContext *aio_context;
 
+    /* Only set up when the AioContext's ring cannot be used */
     struct io_uring ring;
+    bool has_ring;
 
     /* No locking required, only accessed from AioContext home thread */
     LuringQueue io_q;
@@ -72,13 +88,13 @@ static void luring_resubmit(LuringState *s, LuringAIOCB *luringcb)
 }
 
 /**
- * luring_resubmit_short_read:
+ * luring_prepare_short_read:
  *
- * Short reads are rare but may occur. The remaining read request needs to be
- * resubmitted.
+ * Short reads are rare but may occur. Update the request so that the
+ * remaining part can be resubmitted.
  */
-static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
-                                       int nread)
+static void luring_prepare_short_read(LuringState *s, LuringAIOCB *luringcb,
+                                      int nread)
 {
     QEMUIOVector *resubmit_qiov;
     size_t remaining;
@@ -103,8 +119,75 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     luringcb->sqeq.off += nread;
     luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
     luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+}
+
+/**
+ * luring_handle_result:
+ * @s: AIO state
+ * @luringcb: the request
+ * @ret: the result from the completion queue entry
+ *
+ * Returns true if the request has been prepared for resubmission.  Otherwise
+ * the request is complete and its return value is stored in luringcb->ret.
+ */
+static bool luring_handle_result(LuringState *s, LuringAIOCB *luringcb,
+                                 int ret)
+{
+    /* total_read is non-zero only for resubmitted read requests */
+    int total_bytes = ret + luringcb->total_read;
 
-    luring_resubmit(s, luringcb);
+    if (ret < 0) {
+        /*
+         * Only writev/readv/fsync requests on regular files or host block
+         * devices are submitted. Therefore -EAGAIN is not expected but it's
+         * known to happen sometimes with Linux SCSI. Submit again and hope
+         * the request completes successfully.
+         *
+         * For more information, see:
+         * https://lore.kernel.org/io-uring/20210727165811.284510-3-axboe@kernel.dk/T/#u
+         *
+         * If the code is changed to submit other types of requests in the
+         * future, then this workaround may need to be extended to deal with
+         * genuine -EAGAIN results that should not be resubmitted
+         * immediately.
+         */
+        if (ret == -EINTR || ret == -EAGAIN) {
+            return true;
+        }
+
+        /*
+         * Nothing cancels block requests on purpose.  Requests that share
+         * the io_uring of the AioContext are AioFdOps, so be robust against
+         * a cancellation meant for another one and submit again.
+         */
+        if (ret == -ECANCELED && luringcb->fd_op.prep) {
+            return true;
+        }
+    } else if (!luringcb->qiov) {
+        goto end;
+    } else if (total_bytes == luringcb->qiov->size) {
+        ret = 0;
+    /* Only read/write */
+    } else {
+        /* Short Read/Write */
+        if (luringcb->is_read) {
+            if (ret > 0) {
+                luring_prepare_short_read(s, luringcb, ret);
+                return true;
+            } else {
+                /* Pad with zeroes */
+                qemu_iovec_memset(luringcb->qiov, total_bytes, 0,
+                                  luringcb->qiov->size - total_bytes);
+                ret = 0;
+            }
+        } else {
+            ret = -ENOSPC;
+        }
+    }
+end:
+    luringcb->ret = ret;
+    qemu_iovec_destroy(&luringcb->resubmit_qiov);
+    return false;
 }
 
 /**
@@ -123,7 +206,6 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 static void luring_process_completions(LuringState *s)
 {
     struct io_uring_cqe *cqes;
-    int total_bytes;
     /*
      * Request completion callbacks can run the nested event loop.
      * Schedule ourselves so the nested event loop will "see" remaining
@@ -158,52 +240,10 @@ static void luring_process_completions(LuringState *s)
         s->io_q.in_flight--;
         trace_luring_process_completion(s, luringcb, ret);
 
-        /* total_read is non-zero only for resubmitted read requests */
-        total_bytes = ret + luringcb->total_read;
-
-        if (ret < 0) {
-            /*
-             * Only writev/readv/fsync requests on regular files or host block
-             * devices are submitted. Therefore -EAGAIN is not expected but it's
-             * known to happen sometimes with Linux SCSI. Submit again and hope
-             * the request completes successfully.
-             *
-             * For more information, see:
-             * https://lore.kernel.org/io-uring/20210727165811.284510-3-axboe@kernel.dk/T/#u
-             *
-             * If the code is changed to submit other types of requests in the
-             * future, then this workaround may need to be extended to deal with
-             * genuine -EAGAIN results that should not be resubmitted
-             * immediately.
-             */
-            if (ret == -EINTR || ret == -EAGAIN) {
-                luring_resubmit(s, luringcb);
-                continue;
-            }
-        } else if (!luringcb->qiov) {
-            goto end;
-        } else if (total_bytes == luringcb->qiov->size) {
-            ret = 0;
-        /* Only read/write */
-        } else {
-            /* Short Read/Write */
-            if (luringcb->is_read) {
-                if (ret > 0) {
-                    luring_resubmit_short_read(s, luringcb, ret);
-                    continue;
-                } else {
-                    /* Pad with zeroes */
-                    qemu_iovec_memset(luringcb->qiov, total_bytes, 0,
-                                      luringcb->qiov->size - total_bytes);
-                    ret = 0;
-                }
-            } else {
-                ret = -ENOSPC;
-            }
+        if (luring_handle_result(s, luringcb, ret)) {
+            luring_resubmit(s, luringcb);
+            continue;
         }
-end:
-        luringcb->ret = ret;
-        qemu_iovec_destroy(&luringcb->resubmit_qiov);
 
         /*
          * If the coroutine is already entered it must be in ioq_submit()
@@ -317,20 +357,17 @@ static void luring_unplug_fn(void *opaque)
 }
 
 /**
- * luring_do_submit:
+ * luring_prep_sqe:
  * @fd: file descriptor for I/O
  * @luringcb: AIO control block
- * @s: AIO state
  * @offset: offset for request
  * @type: type of request
  *
- * Fetches sqes from ring, adds to pending queue and preps them
- *
+ * Preps the sqe of the request
  */
-static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
-                            uint64_t offset, int type)
+static void luring_prep_sqe(int fd, LuringAIOCB *luringcb, uint64_t offset,
+                            int type)
 {
-    int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
 
     switch (type) {
@@ -355,6 +392,19 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
         abort();
     }
     io_uring_sqe_set_data(sqes, luringcb);
+}
+
+/**
+ * luring_do_submit:
+ * @luringcb: AIO control block
+ * @s: AIO state
+ *
+ * Adds the request to the pending queue and submits it, or leaves it to
+ * luring_unplug_fn() to submit it with other requests
+ */
+static int luring_do_submit(LuringAIOCB *luringcb, LuringState *s)
+{
+    int ret;
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
     s->io_q.in_queue++;
@@ -372,6 +422,53 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     return 0;
 }
 
+static void luring_attach_ring(LuringState *s)
+{
+    aio_set_fd_handler(s->aio_context, s->ring.ring_fd,
+                       qemu_luring_completion_cb, NULL,
+                       qemu_luring_poll_cb, qemu_luring_poll_ready, s);
+}
+
+static int luring_init_ring(LuringState *s, Error **errp)
+{
+    int rc;
+
+    rc = io_uring_queue_init(MAX_ENTRIES, &s->ring, 0);
+    if (rc < 0) {
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
+        return rc;
+    }
+
+    s->has_ring = true;
+    if (s->aio_context) {
+        luring_attach_ring(s);
+    }
+    return 0;
+}
+
+static void luring_prep_fd_op(struct io_uring_sqe *sqe, AioFdOp *op)
+{
+    LuringAIOCB *luringcb = container_of(op, LuringAIOCB, fd_op);
+
+    *sqe = luringcb->sqeq;
+}
+
+/* Submits the request to the io_uring of the AioContext and waits for it */
+static int coroutine_fn luring_co_submit_shared(AioContext *ctx,
+                                                LuringState *s,
+                                                LuringAIOCB *luringcb)
+{
+    int ret;
+
+    luringcb->fd_op.prep = luring_prep_fd_op;
+    do {
+        ret = aio_co_submit_fd_op(ctx, &luringcb->fd_op);
+        trace_luring_process_completion(s, luringcb, ret);
+    } while (luring_handle_result(s, luringcb, ret));
+
+    return luringcb->ret;
+}
+
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
                                   QEMUIOVector *qiov, int type)
 {
@@ -386,7 +483,21 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    luring_prep_sqe(fd, &luringcb, offset, type);
+
+    if (aio_fd_ops_supported(ctx)) {
+        return luring_co_submit_shared(ctx, s, &luringcb);
+    }
+
+    /* The AioContext has stopped using io_uring */
+    if (!s->has_ring) {
+        ret = luring_init_ring(s, NULL);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    ret = luring_do_submit(&luringcb, s);
 
     if (ret < 0) {
         return ret;
@@ -400,8 +511,10 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
 
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 {
-    aio_set_fd_handler(old_context, s->ring.ring_fd,
-                       NULL, NULL, NULL, NULL, s);
+    if (s->has_ring) {
+        aio_set_fd_handler(old_context, s->ring.ring_fd,
+                           NULL, NULL, NULL, NULL, s);
+    }
     qemu_bh_delete(s->completion_bh);
     s->aio_context = NULL;
 }
@@ -410,34 +523,32 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
 {
     s->aio_context = new_context;
     s->completion_bh = aio_bh_new(new_context, qemu_luring_completion_bh, s);
-    aio_set_fd_handler(s->aio_context, s->ring.ring_fd,
-                       qemu_luring_completion_cb, NULL,
-                       qemu_luring_poll_cb, qemu_luring_poll_ready, s);
+    if (s->has_ring) {
+        luring_attach_ring(s);
+    }
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(AioContext *ctx, Error **errp)
 {
-    int rc;
     LuringState *s = g_new0(LuringState, 1);
-    struct io_uring *ring = &s->ring;
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
-    if (rc < 0) {
-        error_setg_errno(errp, errno, "failed to init linux io_uring ring");
+    /* The ring of the AioContext is used instead if possible */
+    if (!aio_fd_ops_supported(ctx) && luring_init_ring(s, errp) < 0) {
         g_free(s);
         return NULL;
     }
 
     ioq_init(&s->io_q);
     return s;
-
 }
 
 void luring_cleanup(LuringState *s)
 {
-    io_uring_queue_exit(&s->ring);
+    if (s->has_ring) {
+        io_uring_queue_exit(&s->ring);
+    }
     trace_luring_cleanup_state(s);
     g_free(s);
 }
@@ -29,6 +29,18 @@
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
+/*
+ * With adaptive=true, the average latency of the copy operations is
+ * compared to the lowest one seen with the current chunk size after every
+ * window of max_in_flight completed operations.  If it is more than
+ * MIRROR_CONGESTION_FACTOR times as high, requests are just queueing up
+ * somewhere (in the target, on the network or in the source, competing
+ * with the guest), so the in-flight depth is halved.  Otherwise it is
+ * increased by one, and once it is at its limit, the chunk size is doubled
+ * for as long as that does not decrease throughput.
+ */
+#define MIRROR_CONGESTION_FACTOR 2
+
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
  */
@@ -85,6 +97,24 @@ typedef struct MirrorBlockJob {
     int64_t active_write_bytes_in_flight;
     bool prepared;
     bool in_drain;
+
+    /* Upper limit for and current value of the number of copy ops in flight */
+    int max_in_flight_limit;
+    int max_in_flight;
+    /* Limits for and current value of the size of a single copy op */
+    int min_chunk_size;
+    int max_chunk_size;
+    int chunk_size;
+    bool adaptive;
+    /* Copy ops completed in the current window, see MIRROR_CONGESTION_FACTOR */
+    int64_t window_start_ns;
+    int window_ops;
+    int64_t window_bytes;
+    int64_t window_latency_ns;
+    /* Lowest average latency seen with the current chunk size */
+    int64_t base_latency_ns;
+    /* Throughput of the previous window in bytes per second */
+    uint64_t last_throughput;
 } MirrorBlockJob;
 
 typedef struct MirrorBDSOpaque {
@@ -106,6 +136,8 @@ struct MirrorOp {
     bool is_pseudo_op;
     bool is_active_write;
     bool is_in_flight;
+    /* When a copy op was submitted, 0 for other ops */
+    int64_t start_ns;
     CoQueue waiting_requests;
     Coroutine *co;
     MirrorOp *waiting_for_op;
@@ -185,6 +217,67 @@ static void coroutine_fn mirror_wait_on_conflicts(MirrorOp *self,
     }
 }
 
+/* Adapt chunk size and in-flight depth to how long @op took */
+static void mirror_adapt(MirrorBlockJob *s, MirrorOp *op)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t avg_latency_ns;
+    uint64_t throughput;
+    int max_in_flight = s->max_in_flight;
+    int chunk_size = s->chunk_size;
+
+    s->window_ops++;
+    s->window_bytes += op->bytes;
+    s->window_latency_ns += now - op->start_ns;
+    if (s->window_ops < max_in_flight) {
+        return;
+    }
+
+    avg_latency_ns = s->window_latency_ns / s->window_ops;
+    throughput = s->window_bytes * NANOSECONDS_PER_SECOND /
+                 MAX(now - s->window_start_ns, 1);
+
+    /*
+     * Let the baseline age a bit, so that it follows the target if it
+     * permanently gets slower.
+     */
+    if (!s->base_latency_ns) {
+        s->base_latency_ns = avg_latency_ns;
+    } else {
+        s->base_latency_ns = MIN(avg_latency_ns,
+                                 s->base_latency_ns + s->base_latency_ns / 16);
+    }
+
+    if (avg_latency_ns > MIRROR_CONGESTION_FACTOR * s->base_latency_ns) {
+        if (max_in_flight > 1) {
+            max_in_flight = MAX(max_in_flight / 2, 1);
+        } else if (chunk_size > s->min_chunk_size) {
+            chunk_size = MAX(chunk_size / 2, s->min_chunk_size);
+        }
+    } else if (max_in_flight < s->max_in_flight_limit) {
+        max_in_flight++;
+    } else if (chunk_size < s->max_chunk_size &&
+               throughput >= s->last_throughput) {
+        chunk_size = MIN(chunk_size * 2, s->max_chunk_size);
+    }
+
+    if (chunk_size != s->chunk_size) {
+        /* Larger requests take longer, so start over with the baseline */
+        s->base_latency_ns = 0;
+    }
+
+    trace_mirror_adapt(s, avg_latency_ns, throughput, max_in_flight,
+                       chunk_size);
+    qatomic_set(&s->max_in_flight, max_in_flight);
+    qatomic_set(&s->chunk_size, chunk_size);
+
+    s->window_start_ns = now;
+    s->window_ops = 0;
+    s->window_bytes = 0;
+    s->window_latency_ns = 0;
+    s->last_throughput = throughput;
+}
+
 static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
@@ -209,6 +302,9 @@ static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
     bitmap_clear(s->in_flight_bitmap, chunk_num, nb_chunks);
     QTAILQ_REMOVE(&s->ops_in_flight, op, next);
     if (ret >= 0) {
+        if (s->adaptive && op->start_ns) {
+            mirror_adapt(s, op);
+        }
         if (s->cow_bitmap) {
             bitmap_set(s->cow_bitmap, chunk_num, nb_chunks);
         }
@@ -387,6 +483,7 @@ static void coroutine_fn mirror_co_read(void *opaque)
     s->in_flight++;
     s->bytes_in_flight += op->bytes;
     op->is_in_flight = true;
+    op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
     WITH_GRAPH_RDLOCK_GUARD() {
@@ -479,7 +576,7 @@ static void coroutine_fn mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int max_io_bytes = s->chunk_size;
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     offset = bdrv_dirty_iter_next(s->dbi);
@@ -587,7 +684,7 @@ static void coroutine_fn mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -847,7 +944,7 @@ static int coroutine_fn mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -988,6 +1085,24 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     }
     s->max_iov = MIN(bs->bl.max_iov, target_bs->bl.max_iov);
 
+    /*
+     * Copy ops are limited to buf_size and max_iov chunks, see
+     * mirror_co_read().  Without adaptive=true, each of them can use its
+     * share of the buffer, but at least MAX_IO_BYTES.
+     */
+    s->min_chunk_size = s->granularity;
+    s->max_chunk_size = MIN(MIN(s->buf_size,
+                                (uint64_t)s->granularity * s->max_iov),
+                            QEMU_ALIGN_DOWN(BDRV_REQUEST_MAX_BYTES,
+                                            s->granularity));
+    s->max_chunk_size = MAX(s->max_chunk_size, s->min_chunk_size);
+    s->chunk_size = MAX(s->buf_size / s->max_in_flight_limit, MAX_IO_BYTES);
+    if (s->adaptive) {
+        s->chunk_size = MIN(s->chunk_size, s->max_chunk_size);
+        s->max_in_flight = MIN(s->max_in_flight_limit, MAX_IN_FLIGHT);
+        s->window_start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    }
+
     s->buf = qemu_try_blockalign(bs, s->buf_size);
     if (s->buf == NULL) {
         ret = -ENOMEM;
@@ -1046,7 +1161,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1242,6 +1357,20 @@ static bool commit_active_cancel(Job *job, bool force)
     return force || !job_is_ready(job);
 }
 
+static void mirror_query(BlockJob *job, BlockJobInfo *info)
+{
+    MirrorBlockJob *s = container_of(job, MirrorBlockJob, common);
+
+    if (s->adaptive) {
+        info->u.mirror = (BlockJobInfoMirror) {
+            .has_max_in_flight = true,
+            .max_in_flight = qatomic_read(&s->max_in_flight),
+            .has_chunk_size = true,
+            .chunk_size = qatomic_read(&s->chunk_size),
+        };
+    }
+}
+
 static const BlockJobDriver mirror_job_driver = {
     .job_driver = {
         .instance_size          = sizeof(MirrorBlockJob),
@@ -1256,6 +1385,7 @@ static const BlockJobDriver mirror_job_driver = {
         .cancel                 = mirror_cancel,
     },
     .drained_poll           = mirror_drained_poll,
+    .query                  = mirror_query,
 };
 
 static const BlockJobDriver commit_active_job_driver = {
@@ -1661,6 +1791,7 @@ static BlockJob *mirror_start_job(
                              bool is_none_mode, BlockDriverState *base,
                              bool auto_complete, const char *filter_node_name,
                              bool is_mirror, MirrorCopyMode copy_mode,
+                             int max_in_flight, bool adaptive,
                              Error **errp)
 {
     MirrorBlockJob *s;
@@ -1685,6 +1816,10 @@ static BlockJob *mirror_start_job(
         buf_size = DEFAULT_MIRROR_BUF_SIZE;
     }
 
+    if (max_in_flight == 0) {
+        max_in_flight = MAX_IN_FLIGHT;
+    }
+
     if (bdrv_skip_filters(bs) == bdrv_skip_filters(target)) {
         error_setg(errp, "Can't mirror node into itself");
         return NULL;
@@ -1813,6 +1948,9 @@ static BlockJob *mirror_start_job(
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
     s->unmap = unmap;
+    s->max_in_flight_limit = max_in_flight;
+    s->max_in_flight = max_in_flight;
+    s->adaptive = adaptive;
     if (auto_complete) {
         s->should_complete = true;
     }
@@ -1924,7 +2062,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   bool unmap, const char *filter_node_name,
-                  MirrorCopyMode copy_mode, Error **errp)
+                  MirrorCopyMode copy_mode, int max_in_flight, bool adaptive,
+                  Error **errp)
 {
     bool is_none_mode;
     BlockDriverState *base;
@@ -1943,7 +2082,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                      speed, granularity, buf_size, backing_mode, zero_target,
                      on_source_error, on_target_error, unmap, NULL, NULL,
                      &mirror_job_driver, is_none_mode, base, false,
-                     filter_node_name, true, copy_mode, errp);
+                     filter_node_name, true, copy_mode, max_in_flight,
+                     adaptive, errp);
 }
 
 BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
@@ -1972,7 +2112,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
                      on_error, on_error, true, cb, opaque,
                      &commit_active_job_driver, false, base, auto_complete,
                      filter_node_name, false, MIRROR_COPY_MODE_BACKGROUND,
-                     errp);
+                     0, false, errp);
     if (!job) {
         goto error_restore_flags;
     }
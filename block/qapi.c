@@ -575,6 +575,33 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
     ds->account_invalid = stats->account_invalid;
     ds->account_failed = stats->account_failed;
 
+    WITH_QEMU_LOCK_GUARD(&stats->lock) {
+        BlockDeviceQueueStatsList **tail = &ds->queues;
+        unsigned i;
+
+        /* A single queue would just repeat the device statistics */
+        ds->has_queues = stats->nr_queues > 1;
+        for (i = 0; i < stats->nr_queues && ds->has_queues; i++) {
+            BlockAcctQueueStats *q = &stats->queues[i];
+            BlockDeviceQueueStats *qs = g_new0(BlockDeviceQueueStats, 1);
+            int t;
+
+            qs->queue = i;
+            qs->rd_bytes = q->nr_bytes[BLOCK_ACCT_READ];
+            qs->wr_bytes = q->nr_bytes[BLOCK_ACCT_WRITE];
+            qs->rd_operations = q->nr_ops[BLOCK_ACCT_READ];
+            qs->wr_operations = q->nr_ops[BLOCK_ACCT_WRITE];
+            qs->flush_operations = q->nr_ops[BLOCK_ACCT_FLUSH];
+            for (t = 0; t < BLOCK_MAX_IOTYPE; t++) {
+                qs->failed_operations += q->failed_ops[t];
+            }
+            qs->rd_total_time_ns = q->total_time_ns[BLOCK_ACCT_READ];
+            qs->wr_total_time_ns = q->total_time_ns[BLOCK_ACCT_WRITE];
+            qs->flush_total_time_ns = q->total_time_ns[BLOCK_ACCT_FLUSH];
+            QAPI_LIST_APPEND(tail, qs);
+        }
+    }
+
     while ((ts = block_acct_interval_next(stats, ts))) {
         BlockDeviceTimedStats *dev_stats = g_malloc0(sizeof(*dev_stats));
 
@@ -24,15 +24,19 @@
 
 #include "qemu/osdep.h"
 #include "block/block-io.h"
+#include "qemu/host-utils.h"
 #include "qemu/memalign.h"
 #include "qcow2.h"
 #include "trace.h"
 
 typedef struct Qcow2CachedTable {
     int64_t  offset;
-    uint64_t lru_counter;
+    int      next;          /* next entry in the same hash bucket */
     int      ref;
     bool     dirty;
+    bool     loading;
+    bool     referenced;    /* used since the clock hand last passed */
+    bool     readahead;     /* read ahead and not used yet */
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -42,8 +46,21 @@ struct Qcow2Cache {
     int                     table_size;
     bool                    depends_on_flush;
     void                   *table_array;
-    uint64_t                lru_counter;
-    uint64_t                cache_clean_lru_counter;
+    /* Hash of the cached table offsets, chained through entries[].next */
+    int                    *buckets;
+    int                     bucket_bits;
+    /* Next entry to consider for replacement */
+    int                     clock_hand;
+    uint64_t                hits;
+    uint64_t                misses;
+    uint64_t                evictions;
+    uint64_t                readahead;
+    uint64_t                readahead_hits;
+    uint64_t                readahead_wasted;
+    /* Number of tables that qcow2_cache_prefetch() is reading */
+    int                     nb_loading;
+    /* Coroutines waiting for a table that is being prefetched */
+    CoQueue                 loading_queue;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -59,6 +76,80 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static inline unsigned qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    return ((offset / c->table_size) * 0x9e3779b97f4a7c15ULL) >>
+           (64 - c->bucket_bits);
+}
+
+static int qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i;
+
+    for (i = c->buckets[qcow2_cache_hash(c, offset)]; i >= 0;
+         i = c->entries[i].next) {
+        if (c->entries[i].offset == offset) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Changes the offset of entry @i and moves it to the right hash bucket */
+static void qcow2_cache_set_offset(Qcow2Cache *c, int i, uint64_t offset)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    if (t->readahead) {
+        c->readahead_wasted++;
+        t->readahead = false;
+    }
+
+    if (t->offset) {
+        int *p = &c->buckets[qcow2_cache_hash(c, t->offset)];
+        while (*p != i) {
+            p = &c->entries[*p].next;
+        }
+        *p = t->next;
+    }
+
+    t->offset = offset;
+    t->next = -1;
+    if (offset) {
+        unsigned h = qcow2_cache_hash(c, offset);
+        t->next = c->buckets[h];
+        c->buckets[h] = i;
+    }
+}
+
+/*
+ * Picks the entry to replace with the CLOCK algorithm: entries that were
+ * used since the hand last passed them get a second chance.  Returns -1 if
+ * all entries are in use.
+ */
+static int qcow2_cache_find_victim(Qcow2Cache *c)
+{
+    int n;
+
+    for (n = 0; n < 2 * c->size; n++) {
+        Qcow2CachedTable *t = &c->entries[c->clock_hand];
+        int i = c->clock_hand;
+
+        if (++c->clock_hand == c->size) {
+            c->clock_hand = 0;
+        }
+        if (t->ref) {
+            continue;
+        }
+        if (t->offset && t->referenced) {
+            t->referenced = false;
+            continue;
+        }
+        return i;
+    }
+    return -1;
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -89,8 +180,7 @@ static void qcow2_cache_table_release(Qcow2Cache *c, int i, int num_tables)
 static inline bool can_clean_entry(Qcow2Cache *c, int i)
 {
     Qcow2CachedTable *t = &c->entries[i];
-    return t->ref == 0 && !t->dirty && t->offset != 0 &&
-        t->lru_counter <= c->cache_clean_lru_counter;
+    return t->ref == 0 && !t->dirty && t->offset != 0 && !t->referenced;
 }
 
 void qcow2_cache_clean_unused(Qcow2Cache *c)
@@ -106,8 +196,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
-            c->entries[i].lru_counter = 0;
+            qcow2_cache_set_offset(c, i, 0);
             i++;
             to_clean++;
         }
@@ -117,7 +206,10 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
         }
     }
 
-    c->cache_clean_lru_counter = c->lru_counter;
+    /* Entries that are not used until the next run can be cleaned then */
+    for (i = 0; i < c->size; i++) {
+        c->entries[i].referenced = false;
+    }
 }
 
 Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
@@ -137,12 +229,19 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
+    /* At least twice as many buckets as entries keeps the chains short */
+    c->bucket_bits = ctz32(pow2ceil(num_tables)) + 1;
+    c->buckets = g_try_new(int, 1 << c->bucket_bits);
+    qemu_co_queue_init(&c->loading_queue);
 
-    if (!c->entries || !c->table_array) {
+    if (!c->entries || !c->table_array || !c->buckets) {
         qemu_vfree(c->table_array);
         g_free(c->entries);
+        g_free(c->buckets);
         g_free(c);
         c = NULL;
+    } else {
+        memset(c->buckets, -1, sizeof(int) << c->bucket_bits);
     }
 
     return c;
@@ -158,6 +257,7 @@ int qcow2_cache_destroy(Qcow2Cache *c)
 
     qemu_vfree(c->table_array);
     g_free(c->entries);
+    g_free(c->buckets);
     g_free(c);
 
     return 0;
@@ -307,13 +407,18 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
+        if (c->entries[i].readahead) {
+            c->readahead_wasted++;
+        }
         c->entries[i].offset = 0;
-        c->entries[i].lru_counter = 0;
+        c->entries[i].referenced = false;
+        c->entries[i].readahead = false;
     }
+    memset(c->buckets, -1, sizeof(int) << c->bucket_bits);
 
     qcow2_cache_table_release(c, 0, c->size);
 
-    c->lru_counter = 0;
+    c->clock_hand = 0;
 
     return 0;
 }
@@ -324,9 +429,6 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     BDRVQcow2State *s = bs->opaque;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -340,30 +442,35 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
         return -EIO;
     }
 
+retry:
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
+    i = qcow2_cache_lookup(c, offset);
+    if (i >= 0) {
+        if (c->entries[i].loading) {
+            /*
+             * Only coroutines drop s->lock for a prefetch, and nothing
+             * outside a coroutine runs while guest requests are in flight
+             */
+            assert(qemu_in_coroutine());
+            qemu_co_queue_wait(&c->loading_queue, &s->lock);
+            goto retry;
         }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
+        c->hits++;
+        if (c->entries[i].readahead) {
+            c->readahead_hits++;
+            c->entries[i].readahead = false;
         }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
+    i = qcow2_cache_find_victim(c);
+    if (i == -1) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -374,11 +481,15 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    if (c->entries[i].offset) {
+        c->evictions++;
+    }
+    qcow2_cache_set_offset(c, i, 0);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
         }
+        c->misses++;
 
         ret = bdrv_pread(bs->file, offset, c->table_size,
                          qcow2_cache_get_table_addr(c, i), 0);
@@ -387,11 +498,12 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_set_offset(c, i, offset);
 
     /* And return the right table */
 found:
     c->entries[i].ref++;
+    c->entries[i].referenced = true;
     *table = qcow2_cache_get_table_addr(c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -400,6 +512,100 @@ found:
     return 0;
 }
 
+/*
+ * Make sure that the table at @offset is in the cache, reading it from disk
+ * if necessary.  In contrast to qcow2_cache_get(), s->lock is dropped while
+ * the table is read, so that requests touching other tables can go on in the
+ * meantime; lookups of the same table wait for the read to complete.
+ *
+ * This is only an optimisation: if no entry can be spared, or if the read
+ * fails, the table is simply left for qcow2_cache_get() to load.  Callers
+ * must not keep anything they looked up under s->lock across this call.
+ *
+ * @readahead is set for speculative reads of tables that no request needs
+ * yet; they are accounted separately, depending on whether a lookup uses
+ * them before they are evicted.
+ *
+ * Called with s->lock held.
+ */
+void coroutine_fn qcow2_cache_prefetch(BlockDriverState *bs, Qcow2Cache *c,
+                                       uint64_t offset, bool readahead)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int i;
+    int ret;
+
+    if (!QEMU_IS_ALIGNED(offset, c->table_size)) {
+        return;
+    }
+
+    /*
+     * Leave enough entries for callers that need several tables at once
+     * (e.g. COW of an L2 table)
+     */
+    if (c->nb_loading >= (c->size - 2) / 2) {
+        return;
+    }
+
+    i = qcow2_cache_lookup(c, offset);
+    if (i >= 0) {
+        if (c->entries[i].loading && !readahead) {
+            qemu_co_queue_wait(&c->loading_queue, &s->lock);
+        }
+        return;
+    }
+
+    i = qcow2_cache_find_victim(c);
+    if (i == -1) {
+        return;
+    }
+
+    if (qcow2_cache_entry_flush(bs, c, i) < 0) {
+        return;
+    }
+
+    trace_qcow2_cache_prefetch(qemu_coroutine_self(), c == s->l2_table_cache,
+                               offset, i);
+
+    if (c->entries[i].offset) {
+        c->evictions++;
+    }
+    if (!readahead) {
+        /* Tables read ahead are counted in c->readahead once loaded */
+        c->misses++;
+    }
+
+    /* The reference keeps the entry from being evicted during the read */
+    qcow2_cache_set_offset(c, i, offset);
+    c->entries[i].ref = 1;
+    c->entries[i].loading = true;
+    c->nb_loading++;
+
+    if (c == s->l2_table_cache) {
+        BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
+    }
+
+    qemu_co_mutex_unlock(&s->lock);
+    ret = bdrv_pread(bs->file, offset, c->table_size,
+                     qcow2_cache_get_table_addr(c, i), 0);
+    qemu_co_mutex_lock(&s->lock);
+
+    c->nb_loading--;
+    c->entries[i].loading = false;
+    c->entries[i].ref = 0;
+    if (ret < 0 || c->entries[i].offset != offset) {
+        /* Failed, or the table was discarded while it was being read */
+        qcow2_cache_set_offset(c, i, 0);
+    } else if (readahead) {
+        c->entries[i].readahead = true;
+        c->readahead++;
+    } else {
+        c->entries[i].referenced = true;
+    }
+
+    qemu_co_queue_restart_all(&c->loading_queue);
+}
+
 int qcow2_cache_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     void **table)
 {
@@ -420,7 +626,7 @@ void qcow2_cache_put(Qcow2Cache *c, void **table)
     *table = NULL;
 
     if (c->entries[i].ref == 0) {
-        c->entries[i].lru_counter = ++c->lru_counter;
+        c->entries[i].referenced = true;
     }
 
     assert(c->entries[i].ref >= 0);
@@ -435,25 +641,39 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int i = qcow2_cache_lookup(c, offset);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    return i >= 0 ? qcow2_cache_get_table_addr(c, i) : NULL;
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
 {
     int i = qcow2_cache_get_table_idx(c, table);
 
+    if (c->entries[i].loading) {
+        /* qcow2_cache_prefetch() drops the entry once the read completes */
+        qcow2_cache_set_offset(c, i, 0);
+        return;
+    }
+
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
-    c->entries[i].lru_counter = 0;
+    qcow2_cache_set_offset(c, i, 0);
+    c->entries[i].referenced = false;
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(c, i, 1);
 }
+
+void qcow2_cache_get_stats(Qcow2Cache *c, Qcow2CacheStats *stats)
+{
+    *stats = (Qcow2CacheStats) {
+        .size = c->size,
+        .hits = c->hits,
+        .misses = c->misses,
+        .evictions = c->evictions,
+        .readahead = c->readahead,
+        .readahead_hits = c->readahead_hits,
+        .readahead_wasted = c->readahead_wasted,
+    };
+}
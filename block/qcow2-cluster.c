@@ -218,6 +218,128 @@ static int l2_load(BlockDriverState *bs, uint64_t offset,
                            (void **)l2_slice);
 }
 
+/*
+ * Loads the L2 slice that maps the guest offset @offset into the cache,
+ * unless it is already there or the L2 table does not exist yet.  The
+ * slice is read with s->lock dropped (see qcow2_cache_prefetch()), so this
+ * must be called before anything is looked up under the lock.
+ *
+ * @readahead is set if no request needs the slice yet.
+ *
+ * Called with s->lock held.
+ */
+void coroutine_fn qcow2_co_prefetch_l2_slice(BlockDriverState *bs,
+                                             uint64_t offset, bool readahead)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t l1_index = offset_to_l1_index(s, offset);
+    uint64_t l2_offset;
+    int start_of_slice;
+
+    if (l1_index >= s->l1_size) {
+        return;
+    }
+
+    /* Corrupted tables are reported by the regular lookup */
+    l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
+    if (!l2_offset || offset_into_cluster(s, l2_offset)) {
+        return;
+    }
+
+    start_of_slice = l2_entry_size(s) *
+        (offset_to_l2_index(s, offset) - offset_to_l2_slice_index(s, offset));
+    qcow2_cache_prefetch(bs, s->l2_table_cache, l2_offset + start_of_slice,
+                         readahead);
+}
+
+typedef struct Qcow2L2ReadaheadCo {
+    BlockDriverState *bs;
+    uint64_t offset;
+} Qcow2L2ReadaheadCo;
+
+static void coroutine_fn qcow2_co_l2_readahead_entry(void *opaque)
+{
+    Qcow2L2ReadaheadCo *ra = opaque;
+    BlockDriverState *bs = ra->bs;
+    BDRVQcow2State *s = bs->opaque;
+
+    bdrv_graph_co_rdlock();
+    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_prefetch_l2_slice(bs, ra->offset, true);
+    qemu_co_mutex_unlock(&s->lock);
+    bdrv_graph_co_rdunlock();
+
+    bdrv_dec_in_flight(bs);
+    g_free(ra);
+}
+
+/*
+ * Detects sequential requests and reads the L2 slices that they are going
+ * to need in the background, up to s->l2_readahead slices beyond the one
+ * of the current request.  Interleaved streams (e.g. several readers of the
+ * same image) are told apart by where their next request is expected.
+ *
+ * Called with s->lock held.
+ */
+void coroutine_fn qcow2_co_l2_readahead(BlockDriverState *bs, uint64_t offset,
+                                        uint64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t slice_bytes = (uint64_t) s->l2_slice_size << s->cluster_bits;
+    uint64_t disk_size = bs->total_sectors * BDRV_SECTOR_SIZE;
+    Qcow2ReadaheadStream *st = NULL;
+    uint64_t start, end;
+    int i;
+
+    if (!s->l2_readahead || !bytes) {
+        return;
+    }
+
+    for (i = 0; i < QCOW2_READAHEAD_STREAMS; i++) {
+        if (s->readahead_streams[i].next_offset == offset) {
+            st = &s->readahead_streams[i];
+            break;
+        }
+    }
+
+    if (!st) {
+        /* Start tracking a new stream in place of the oldest one */
+        st = &s->readahead_streams[s->readahead_next_stream];
+        s->readahead_next_stream =
+            (s->readahead_next_stream + 1) % QCOW2_READAHEAD_STREAMS;
+        *st = (Qcow2ReadaheadStream) {
+            .next_offset = offset + bytes,
+        };
+        return;
+    }
+
+    st->next_offset = offset + bytes;
+    if (++st->seq < QCOW2_READAHEAD_MIN_SEQ) {
+        return;
+    }
+
+    /* The slice of the current request is loaded by the request itself */
+    start = QEMU_ALIGN_DOWN(offset + bytes - 1, slice_bytes) + slice_bytes;
+    end = MIN(start + s->l2_readahead * slice_bytes, disk_size);
+    start = MAX(start, st->readahead_end);
+
+    for (; start < end; start += slice_bytes) {
+        Qcow2L2ReadaheadCo *ra = g_new(Qcow2L2ReadaheadCo, 1);
+        Coroutine *co;
+
+        *ra = (Qcow2L2ReadaheadCo) {
+            .bs = bs,
+            .offset = start,
+        };
+
+        trace_qcow2_l2_readahead(qemu_coroutine_self(), start);
+        bdrv_inc_in_flight(bs);
+        co = qemu_coroutine_create(qcow2_co_l2_readahead_entry, ra);
+        aio_co_enter(qemu_get_current_aio_context(), co);
+        st->readahead_end = start + slice_bytes;
+    }
+}
+
 /*
  * Writes an L1 entry to disk (note that depending on the alignment
  * requirements this function may write more that just one entry in
@@ -1048,6 +1170,9 @@ int coroutine_fn qcow2_alloc_cluster_link_l2(BlockDriverState *bs,
         goto err;
     }
 
+    /* The slice may have been evicted while the guest data was written */
+    qcow2_co_prefetch_l2_slice(bs, m->offset, false);
+
     /* Update L2 table. */
     if (s->use_lazy_refcounts) {
         qcow2_mark_dirty(bs);
@@ -1795,6 +1920,8 @@ int coroutine_fn qcow2_alloc_host_offset(BlockDriverState *bs, uint64_t offset,
     trace_qcow2_alloc_clusters_offset(qemu_coroutine_self(), offset, *bytes);
 
 again:
+    qcow2_co_prefetch_l2_slice(bs, offset, false);
+
     start = offset;
     remaining = *bytes;
     cluster_offset = INV_OFFSET;
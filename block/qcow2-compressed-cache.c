@@ -0,0 +1,247 @@
+/*
+ * Cache of decompressed clusters for the QCOW2 format
+ *
+ * Copyright (c) 2023 QEMU contributors
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Compressed images are typically read-only templates that many guests
+ * read the same clusters from, e.g. several overlays that share the
+ * template as their backing node.  Keeping recently decompressed clusters
+ * means that each of them only needs to be read and decompressed once, and
+ * concurrent readers of a cluster that is being decompressed wait for that
+ * instead of doing the same work again.
+ *
+ * Entries are keyed by the host offset of the compressed data and replaced
+ * with the CLOCK algorithm.  Everything is protected by s->lock, which is
+ * also held when clusters are freed, so that stale entries can be dropped
+ * before the space is reused.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/memalign.h"
+#include "qcow2.h"
+#include "trace.h"
+
+typedef struct Qcow2CompressedCluster {
+    uint64_t coffset;       /* host offset of the compressed data, 0 if free */
+    int      csize;
+    bool     loading;       /* being read and decompressed */
+    bool     referenced;    /* used since the clock hand last passed */
+} Qcow2CompressedCluster;
+
+struct Qcow2CompressedCache {
+    Qcow2CompressedCluster *entries;
+    uint8_t                *buf;
+    size_t                  cluster_size;
+    int                     size;
+    int                     clock_hand;
+    /* Maps the coffset of each entry to the entry */
+    GHashTable             *index;
+    /* Coroutines waiting for a cluster that is being decompressed */
+    CoQueue                 loading_queue;
+    uint64_t                hits;
+    uint64_t                misses;
+    uint64_t                evictions;
+};
+
+static inline void *entry_buf(Qcow2CompressedCache *c,
+                              Qcow2CompressedCluster *e)
+{
+    return c->buf + (e - c->entries) * c->cluster_size;
+}
+
+static void entry_set_coffset(Qcow2CompressedCache *c,
+                              Qcow2CompressedCluster *e,
+                              uint64_t coffset, int csize)
+{
+    if (e->coffset) {
+        g_hash_table_remove(c->index, &e->coffset);
+    }
+
+    e->coffset = coffset;
+    e->csize = csize;
+    if (coffset) {
+        g_hash_table_insert(c->index, &e->coffset, e);
+    }
+}
+
+static Qcow2CompressedCluster *find_victim(Qcow2CompressedCache *c)
+{
+    int n;
+
+    for (n = 0; n < 2 * c->size; n++) {
+        Qcow2CompressedCluster *e = &c->entries[c->clock_hand];
+
+        if (++c->clock_hand == c->size) {
+            c->clock_hand = 0;
+        }
+        if (e->loading) {
+            continue;
+        }
+        if (e->coffset && e->referenced) {
+            e->referenced = false;
+            continue;
+        }
+        return e;
+    }
+    return NULL;
+}
+
+Qcow2CompressedCache *qcow2_compressed_cache_create(BlockDriverState *bs,
+                                                    int num_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressedCache *c;
+
+    assert(num_clusters > 0);
+
+    c = g_new0(Qcow2CompressedCache, 1);
+    c->size = num_clusters;
+    c->cluster_size = s->cluster_size;
+    c->entries = g_try_new0(Qcow2CompressedCluster, num_clusters);
+    c->buf = qemu_try_blockalign(bs, (size_t) num_clusters * c->cluster_size);
+    if (!c->entries || !c->buf) {
+        qemu_vfree(c->buf);
+        g_free(c->entries);
+        g_free(c);
+        return NULL;
+    }
+
+    c->index = g_hash_table_new(g_int64_hash, g_int64_equal);
+    qemu_co_queue_init(&c->loading_queue);
+
+    return c;
+}
+
+void qcow2_compressed_cache_destroy(Qcow2CompressedCache *c)
+{
+    int i;
+
+    for (i = 0; i < c->size; i++) {
+        assert(!c->entries[i].loading);
+    }
+
+    g_hash_table_destroy(c->index);
+    qemu_vfree(c->buf);
+    g_free(c->entries);
+    g_free(c);
+}
+
+/*
+ * Reads @bytes at @offset_in_cluster of the cluster whose compressed data
+ * is at @coffset into @qiov, going through the cache.
+ *
+ * Returns -ENOENT if the cluster is neither cached nor can be added because
+ * all entries are being loaded; the caller has to decompress it itself then.
+ *
+ * Called with s->lock held, which is dropped while the cluster is read and
+ * decompressed.
+ */
+int coroutine_fn GRAPH_RDLOCK
+qcow2_compressed_cache_read(BlockDriverState *bs, uint64_t coffset, int csize,
+                            size_t offset_in_cluster, size_t bytes,
+                            QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressedCache *c = s->compressed_cache;
+    Qcow2CompressedCluster *e;
+    int ret;
+
+retry:
+    e = g_hash_table_lookup(c->index, &coffset);
+    if (e) {
+        if (e->loading) {
+            qemu_co_queue_wait(&c->loading_queue, &s->lock);
+            goto retry;
+        }
+        c->hits++;
+        e->referenced = true;
+        qemu_iovec_from_buf(qiov, qiov_offset,
+                            entry_buf(c, e) + offset_in_cluster, bytes);
+        return 0;
+    }
+
+    e = find_victim(c);
+    if (!e) {
+        return -ENOENT;
+    }
+
+    trace_qcow2_compressed_cache_load(qemu_coroutine_self(), coffset,
+                                      (int) (e - c->entries));
+    if (e->coffset) {
+        c->evictions++;
+    }
+    c->misses++;
+    entry_set_coffset(c, e, coffset, csize);
+    e->loading = true;
+
+    qemu_co_mutex_unlock(&s->lock);
+    ret = qcow2_co_read_compressed_cluster(bs, coffset, csize,
+                                           entry_buf(c, e));
+    qemu_co_mutex_lock(&s->lock);
+
+    e->loading = false;
+    qemu_co_queue_restart_all(&c->loading_queue);
+
+    if (ret < 0) {
+        if (e->coffset == coffset) {
+            entry_set_coffset(c, e, 0, 0);
+        }
+        return ret;
+    }
+
+    /*
+     * Even if the cluster was freed in the meantime, the data was read for
+     * this request; it is just not kept for others.
+     */
+    e->referenced = true;
+    qemu_iovec_from_buf(qiov, qiov_offset,
+                        entry_buf(c, e) + offset_in_cluster, bytes);
+    return 0;
+}
+
+/*
+ * Drops all entries whose compressed data overlaps the host range
+ * [@offset, @offset + @bytes), because it is being freed.
+ */
+void qcow2_compressed_cache_discard(Qcow2CompressedCache *c, uint64_t offset,
+                                    uint64_t bytes)
+{
+    int i;
+
+    if (!c || !g_hash_table_size(c->index)) {
+        return;
+    }
+
+    for (i = 0; i < c->size; i++) {
+        Qcow2CompressedCluster *e = &c->entries[i];
+
+        if (e->coffset && e->coffset < offset + bytes &&
+            e->coffset + e->csize > offset) {
+            entry_set_coffset(c, e, 0, 0);
+            e->referenced = false;
+        }
+    }
+}
+
+void qcow2_compressed_cache_clear(Qcow2CompressedCache *c)
+{
+    if (c) {
+        qcow2_compressed_cache_discard(c, 0, UINT64_MAX);
+    }
+}
+
+void qcow2_compressed_cache_get_stats(Qcow2CompressedCache *c,
+                                      Qcow2CacheStats *stats)
+{
+    *stats = (Qcow2CacheStats) {
+        .size = c->size,
+        .hits = c->hits,
+        .misses = c->misses,
+        .evictions = c->evictions,
+    };
+}
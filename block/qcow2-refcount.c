@@ -903,6 +903,9 @@ static int update_refcount(BlockDriverState *bs,
                 qcow2_cache_discard(s->l2_table_cache, table);
             }
 
+            qcow2_compressed_cache_discard(s->compressed_cache, cluster_offset,
+                                           s->cluster_size);
+
             if (s->discard_passthrough[type]) {
                 update_refcount_discard(bs, cluster_offset, s->cluster_size);
             }
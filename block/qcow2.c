@@ -699,6 +699,8 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_L2_READAHEAD,
+    QCOW2_OPT_COMPRESSED_CACHE_SIZE,
     NULL
 };
 
@@ -815,6 +817,18 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_L2_READAHEAD,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of L2 cache entries to read ahead for "
+                    "sequential requests (0 = disabled)",
+        },
+        {
+            .name = QCOW2_OPT_COMPRESSED_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Maximum size of the decompressed cluster cache "
+                    "(0 = disabled)",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -971,12 +985,14 @@ static bool read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
 typedef struct Qcow2ReopenState {
     Qcow2Cache *l2_table_cache;
     Qcow2Cache *refcount_block_cache;
+    Qcow2CompressedCache *compressed_cache;
     int l2_slice_size; /* Number of entries in a slice of the L2 table */
     bool use_lazy_refcounts;
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    uint64_t l2_readahead;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -990,6 +1006,7 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
     uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
+    uint64_t compressed_cache_size;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -1078,6 +1095,32 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    compressed_cache_size =
+        qemu_opt_get_size(opts, QCOW2_OPT_COMPRESSED_CACHE_SIZE, 0);
+    compressed_cache_size /= s->cluster_size;
+    if (compressed_cache_size > INT_MAX) {
+        error_setg(errp, "Compressed cluster cache size too big");
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (compressed_cache_size > 0) {
+        r->compressed_cache = qcow2_compressed_cache_create(bs,
+                                                 compressed_cache_size);
+        if (!r->compressed_cache) {
+            error_setg(errp, "Could not allocate compressed cluster cache");
+            ret = -ENOMEM;
+            goto fail;
+        }
+    }
+
+    r->l2_readahead = qemu_opt_get_number(opts, QCOW2_OPT_L2_READAHEAD, 0);
+    if (r->l2_readahead > QCOW2_MAX_L2_READAHEAD) {
+        error_setg(errp, QCOW2_OPT_L2_READAHEAD " must not exceed %d",
+                   QCOW2_MAX_L2_READAHEAD);
+        ret = -EINVAL;
+        goto fail;
+    }
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1229,6 +1272,11 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     s->refcount_block_cache = r->refcount_block_cache;
     s->l2_slice_size = r->l2_slice_size;
 
+    if (s->compressed_cache) {
+        qcow2_compressed_cache_destroy(s->compressed_cache);
+    }
+    s->compressed_cache = r->compressed_cache;
+
     s->overlap_check = r->overlap_check;
     s->use_lazy_refcounts = r->use_lazy_refcounts;
 
@@ -1244,6 +1292,9 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    s->l2_readahead = r->l2_readahead;
+    memset(s->readahead_streams, 0, sizeof(s->readahead_streams));
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1257,6 +1308,9 @@ static void qcow2_update_options_abort(BlockDriverState *bs,
     if (r->refcount_block_cache) {
         qcow2_cache_destroy(r->refcount_block_cache);
     }
+    if (r->compressed_cache) {
+        qcow2_compressed_cache_destroy(r->compressed_cache);
+    }
     qapi_free_QCryptoBlockOpenOptions(r->crypto_opts);
 }
 
@@ -1898,6 +1952,10 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     if (s->refcount_block_cache) {
         qcow2_cache_destroy(s->refcount_block_cache);
     }
+    if (s->compressed_cache) {
+        qcow2_compressed_cache_destroy(s->compressed_cache);
+        s->compressed_cache = NULL;
+    }
     qcrypto_block_free(s->crypto);
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     return ret;
@@ -2135,6 +2193,7 @@ qcow2_co_block_status(BlockDriverState *bs, bool want_zero, int64_t offset,
     }
 
     bytes = MIN(INT_MAX, count);
+    qcow2_co_prefetch_l2_slice(bs, offset, false);
     ret = qcow2_get_host_offset(bs, offset, &bytes, &host_offset, &type);
     qemu_co_mutex_unlock(&s->lock);
     if (ret < 0) {
@@ -2367,6 +2426,12 @@ qcow2_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
     QCow2SubclusterType type;
     AioTaskPool *aio = NULL;
 
+    if (s->l2_readahead) {
+        qemu_co_mutex_lock(&s->lock);
+        qcow2_co_l2_readahead(bs, offset, bytes);
+        qemu_co_mutex_unlock(&s->lock);
+    }
+
     while (bytes != 0 && aio_task_pool_status(aio) == 0) {
         /* prepare next request */
         cur_bytes = MIN(bytes, INT_MAX);
@@ -2376,6 +2441,7 @@ qcow2_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
         }
 
         qemu_co_mutex_lock(&s->lock);
+        qcow2_co_prefetch_l2_slice(bs, offset, false);
         ret = qcow2_get_host_offset(bs, offset, &cur_bytes,
                                     &host_offset, &type);
         qemu_co_mutex_unlock(&s->lock);
@@ -2777,6 +2843,10 @@ static void qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     cache_clean_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    if (s->compressed_cache) {
+        qcow2_compressed_cache_destroy(s->compressed_cache);
+        s->compressed_cache = NULL;
+    }
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
@@ -4774,6 +4844,36 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
     return ret;
 }
 
+/*
+ * Reads the compressed data at @coffset and decompresses the whole cluster
+ * into @out_buf, which must be cluster sized.
+ */
+int coroutine_fn GRAPH_RDLOCK
+qcow2_co_read_compressed_cluster(BlockDriverState *bs, uint64_t coffset,
+                                 int csize, void *out_buf)
+{
+    BDRVQcow2State *s = bs->opaque;
+    g_autofree uint8_t *buf = NULL;
+    int ret;
+
+    buf = g_try_malloc(csize);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
+    ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
+        return -EIO;
+    }
+
+    return 0;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_preadv_compressed(BlockDriverState *bs,
                            uint64_t l2_entry,
@@ -4785,34 +4885,34 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
     BDRVQcow2State *s = bs->opaque;
     int ret = 0, csize;
     uint64_t coffset;
-    uint8_t *buf, *out_buf;
+    uint8_t *out_buf;
     int offset_in_cluster = offset_into_cluster(s, offset);
 
     qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
 
-    buf = g_try_malloc(csize);
-    if (!buf) {
-        return -ENOMEM;
+    if (s->compressed_cache) {
+        qemu_co_mutex_lock(&s->lock);
+        ret = qcow2_compressed_cache_read(bs, coffset, csize,
+                                          offset_in_cluster, bytes,
+                                          qiov, qiov_offset);
+        qemu_co_mutex_unlock(&s->lock);
+        if (ret != -ENOENT) {
+            return ret;
+        }
     }
 
-    out_buf = qemu_blockalign(bs, s->cluster_size);
-
-    BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
-    ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
-    if (ret < 0) {
-        goto fail;
+    out_buf = qemu_try_blockalign(bs, s->cluster_size);
+    if (!out_buf) {
+        return -ENOMEM;
     }
 
-    if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
-        ret = -EIO;
-        goto fail;
+    ret = qcow2_co_read_compressed_cluster(bs, coffset, csize, out_buf);
+    if (ret == 0) {
+        qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster,
+                            bytes);
     }
 
-    qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
-
-fail:
     qemu_vfree(out_buf);
-    g_free(buf);
 
     return ret;
 }
@@ -4841,6 +4941,8 @@ static int make_completely_empty(BlockDriverState *bs)
         goto fail;
     }
 
+    qcow2_compressed_cache_clear(s->compressed_cache);
+
     /* Refcounts will be broken utterly */
     ret = qcow2_mark_dirty(bs);
     if (ret < 0) {
@@ -5282,6 +5384,26 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs,
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BDRVQcow2State *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    stats->u.qcow2.l2_cache = g_new(Qcow2CacheStats, 1);
+    qcow2_cache_get_stats(s->l2_table_cache, stats->u.qcow2.l2_cache);
+    stats->u.qcow2.refcount_cache = g_new(Qcow2CacheStats, 1);
+    qcow2_cache_get_stats(s->refcount_block_cache,
+                          stats->u.qcow2.refcount_cache);
+    if (s->compressed_cache) {
+        stats->u.qcow2.compressed_cache = g_new(Qcow2CacheStats, 1);
+        qcow2_compressed_cache_get_stats(s->compressed_cache,
+                                         stats->u.qcow2.compressed_cache);
+    }
+
+    return stats;
+}
+
 static int qcow2_has_zero_init(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -6129,6 +6251,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure           = qcow2_measure,
     .bdrv_co_get_info       = qcow2_co_get_info,
     .bdrv_get_specific_info = qcow2_get_specific_info,
+    .bdrv_get_specific_stats = qcow2_get_specific_stats,
 
     .bdrv_co_save_vmstate   = qcow2_co_save_vmstate,
     .bdrv_co_load_vmstate   = qcow2_co_load_vmstate,
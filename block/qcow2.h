@@ -128,6 +128,15 @@
 
 #define DEFAULT_CLUSTER_SIZE 65536
 
+/* Upper limit for the l2-readahead option */
+#define QCOW2_MAX_L2_READAHEAD 64 /* cache entries */
+
+/* Number of sequential streams that are told apart for L2 readahead */
+#define QCOW2_READAHEAD_STREAMS 4
+
+/* Sequential requests in a stream before its L2 slices are read ahead */
+#define QCOW2_READAHEAD_MIN_SEQ 2
+
 #define QCOW2_OPT_DATA_FILE "data-file"
 #define QCOW2_OPT_LAZY_REFCOUNTS "lazy-refcounts"
 #define QCOW2_OPT_DISCARD_REQUEST "pass-discard-request"
@@ -150,6 +159,8 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_L2_READAHEAD "l2-readahead"
+#define QCOW2_OPT_COMPRESSED_CACHE_SIZE "compressed-cache-size"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -231,6 +242,8 @@ typedef struct QCowSnapshot {
 struct Qcow2Cache;
 typedef struct Qcow2Cache Qcow2Cache;
 
+typedef struct Qcow2CompressedCache Qcow2CompressedCache;
+
 typedef struct Qcow2CryptoHeaderExtension {
     uint64_t offset;
     uint64_t length;
@@ -324,6 +337,12 @@ typedef struct Qcow2BitmapHeaderExt {
 
 #define QCOW2_MAX_THREADS 4
 
+typedef struct Qcow2ReadaheadStream {
+    uint64_t next_offset;   /* where the next sequential request starts */
+    uint64_t readahead_end; /* guest offset mapped by the slices read ahead */
+    unsigned seq;           /* number of sequential requests so far */
+} Qcow2ReadaheadStream;
+
 typedef struct BDRVQcow2State {
     int cluster_bits;
     int cluster_size;
@@ -348,6 +367,15 @@ typedef struct BDRVQcow2State {
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
 
+    /* Decompressed clusters, NULL if disabled */
+    Qcow2CompressedCache *compressed_cache;
+
+    /* Number of L2 slices to read ahead */
+    int l2_readahead;
+    /* Sequential streams seen by qcow2_co_l2_readahead(), protected by lock */
+    Qcow2ReadaheadStream readahead_streams[QCOW2_READAHEAD_STREAMS];
+    int readahead_next_stream;
+
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
 
     uint64_t *refcount_table;
@@ -848,6 +876,10 @@ int qcow2_validate_table(BlockDriverState *bs, uint64_t offset,
                          int64_t max_size_bytes, const char *table_name,
                          Error **errp);
 
+int coroutine_fn GRAPH_RDLOCK
+qcow2_co_read_compressed_cluster(BlockDriverState *bs, uint64_t coffset,
+                                 int csize, void *out_buf);
+
 /* qcow2-refcount.c functions */
 int coroutine_fn GRAPH_RDLOCK qcow2_refcount_init(BlockDriverState *bs);
 void qcow2_refcount_close(BlockDriverState *bs);
@@ -913,6 +945,10 @@ int qcow2_write_l1_entry(BlockDriverState *bs, int l1_index);
 int qcow2_encrypt_sectors(BDRVQcow2State *s, int64_t sector_num,
                           uint8_t *buf, int nb_sectors, bool enc, Error **errp);
 
+void coroutine_fn qcow2_co_prefetch_l2_slice(BlockDriverState *bs,
+                                             uint64_t offset, bool readahead);
+void coroutine_fn qcow2_co_l2_readahead(BlockDriverState *bs, uint64_t offset,
+                                        uint64_t bytes);
 int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
                           unsigned int *bytes, uint64_t *host_offset,
                           QCow2SubclusterType *subcluster_type);
@@ -987,9 +1023,26 @@ int qcow2_cache_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     void **table);
 int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     void **table);
+void coroutine_fn qcow2_cache_prefetch(BlockDriverState *bs, Qcow2Cache *c,
+                                       uint64_t offset, bool readahead);
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+void qcow2_cache_get_stats(Qcow2Cache *c, Qcow2CacheStats *stats);
+
+/* qcow2-compressed-cache.c functions */
+Qcow2CompressedCache *qcow2_compressed_cache_create(BlockDriverState *bs,
+                                                    int num_clusters);
+void qcow2_compressed_cache_destroy(Qcow2CompressedCache *c);
+int coroutine_fn GRAPH_RDLOCK
+qcow2_compressed_cache_read(BlockDriverState *bs, uint64_t coffset, int csize,
+                            size_t offset_in_cluster, size_t bytes,
+                            QEMUIOVector *qiov, size_t qiov_offset);
+void qcow2_compressed_cache_discard(Qcow2CompressedCache *c, uint64_t offset,
+                                    uint64_t bytes);
+void qcow2_compressed_cache_clear(Qcow2CompressedCache *c);
+void qcow2_compressed_cache_get_stats(Qcow2CompressedCache *c,
+                                      Qcow2CacheStats *stats);
 
 /* qcow2-bitmap.c functions */
 int qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
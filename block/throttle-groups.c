@@ -439,7 +439,9 @@ static void throttle_group_restart_queue(ThrottleGroupMember *tgm, bool is_write
 
     qatomic_inc(&tgm->restart_pending);
 
-    co = qemu_coroutine_create(throttle_group_restart_queue_entry, rd);
+    /* Only wakes up queued requests, which then run on their own stacks */
+    co = qemu_coroutine_create_sized(throttle_group_restart_queue_entry, rd,
+                                     COROUTINE_STACK_SMALL);
     aio_co_enter(tgm->aio_context, co);
 }
 
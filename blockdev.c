@@ -2716,6 +2716,9 @@ static BlockJob *do_backup_common(BackupCommon *backup,
     if (!backup->has_compress) {
         backup->compress = false;
     }
+    if (!backup->has_dedup) {
+        backup->dedup = false;
+    }
 
     if (backup->x_perf) {
         if (backup->x_perf->has_use_copy_range) {
@@ -2800,7 +2803,7 @@ static BlockJob *do_backup_common(BackupCommon *backup,
 
     job = backup_job_create(backup->job_id, bs, target_bs, backup->speed,
                             backup->sync, bmap, backup->bitmap_mode,
-                            backup->compress,
+                            backup->compress, backup->dedup,
                             backup->filter_node_name,
                             &perf,
                             backup->on_source_error,
@@ -2862,6 +2865,9 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                                    bool has_copy_mode, MirrorCopyMode copy_mode,
                                    bool has_auto_finalize, bool auto_finalize,
                                    bool has_auto_dismiss, bool auto_dismiss,
+                                   bool has_max_in_flight,
+                                   int64_t max_in_flight,
+                                   bool has_adaptive, bool adaptive,
                                    Error **errp)
 {
     BlockDriverState *unfiltered_bs;
@@ -2897,7 +2903,18 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
     if (has_auto_dismiss && !auto_dismiss) {
         job_flags |= JOB_MANUAL_DISMISS;
     }
+    if (!has_max_in_flight) {
+        max_in_flight = 0;
+    }
+    if (!has_adaptive) {
+        adaptive = false;
+    }
 
+    if (has_max_in_flight && (max_in_flight < 1 || max_in_flight > 1024)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "max-in-flight",
+                   "a value in range [1, 1024]");
+        return;
+    }
     if (granularity != 0 && (granularity < 512 || granularity > 1048576 * 64)) {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "granularity",
                    "a value in range [512B, 64MB]");
@@ -2968,7 +2985,7 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                  replaces, job_flags,
                  speed, granularity, buf_size, sync, backing_mode, zero_target,
                  on_source_error, on_target_error, unmap, filter_node_name,
-                 copy_mode, errp);
+                 copy_mode, max_in_flight, adaptive, errp);
 }
 
 void qmp_drive_mirror(DriveMirror *arg, Error **errp)
@@ -3125,6 +3142,8 @@ void qmp_drive_mirror(DriveMirror *arg, Error **errp)
                            arg->has_copy_mode, arg->copy_mode,
                            arg->has_auto_finalize, arg->auto_finalize,
                            arg->has_auto_dismiss, arg->auto_dismiss,
+                           arg->has_max_in_flight, arg->max_in_flight,
+                           arg->has_adaptive, arg->adaptive,
                            errp);
     bdrv_unref(target_bs);
 out:
@@ -3146,6 +3165,8 @@ void qmp_blockdev_mirror(const char *job_id,
                          bool has_copy_mode, MirrorCopyMode copy_mode,
                          bool has_auto_finalize, bool auto_finalize,
                          bool has_auto_dismiss, bool auto_dismiss,
+                         bool has_max_in_flight, int64_t max_in_flight,
+                         bool has_adaptive, bool adaptive,
                          Error **errp)
 {
     BlockDriverState *bs;
@@ -3193,6 +3214,8 @@ void qmp_blockdev_mirror(const char *job_id,
                            has_copy_mode, copy_mode,
                            has_auto_finalize, auto_finalize,
                            has_auto_dismiss, auto_dismiss,
+                           has_max_in_flight, max_in_flight,
+                           has_adaptive, adaptive,
                            errp);
 out:
     aio_context_release(aio_context);
@@ -14,6 +14,7 @@
 #include "qemu/osdep.h"
 #include "qom/object_interfaces.h"
 #include "qapi/error.h"
+#include "qemu/thread-context.h"
 #include "block/thread-pool.h"
 #include "sysemu/event-loop-base.h"
 
@@ -77,6 +78,19 @@ static void event_loop_base_set_param(Object *obj, Visitor *v,
     return;
 }
 
+static void event_loop_base_check_thread_pool_context(const Object *obj,
+                                                      const char *name,
+                                                      Object *val,
+                                                      Error **errp)
+{
+    const EventLoopBase *base = EVENT_LOOP_BASE(obj);
+
+    if (base->complete) {
+        error_setg(errp, "%s can only be set when the event loop is created",
+                   name);
+    }
+}
+
 static void event_loop_base_complete(UserCreatable *uc, Error **errp)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_GET_CLASS(uc);
@@ -85,6 +99,7 @@ static void event_loop_base_complete(UserCreatable *uc, Error **errp)
     if (bc->init) {
         bc->init(base, errp);
     }
+    base->complete = true;
 }
 
 static bool event_loop_base_can_be_deleted(UserCreatable *uc)
@@ -117,6 +132,9 @@ static void event_loop_base_class_init(ObjectClass *klass, void *class_data)
                               event_loop_base_get_param,
                               event_loop_base_set_param,
                               NULL, &thread_pool_max_info);
+    object_class_property_add_link(klass, "thread-pool-context",
+        TYPE_THREAD_CONTEXT, offsetof(EventLoopBase, thread_pool_context),
+        event_loop_base_check_thread_pool_context, OBJ_PROP_LINK_STRONG);
 }
 
 static const TypeInfo event_loop_base_info = {
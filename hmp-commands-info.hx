@@ -540,6 +540,20 @@ SRST
     Show current migration parameters.
 ERST
 
+    {
+        .name       = "migrate_timeline",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show per-iteration migration statistics",
+        .cmd        = hmp_info_migrate_timeline,
+    },
+
+SRST
+  ``info migrate_timeline``
+    Show the statistics recorded at each iteration of the current or last
+    outgoing migration, when the ``timeline`` capability is enabled.
+ERST
+
     {
         .name       = "balloon",
         .args_type  = "",
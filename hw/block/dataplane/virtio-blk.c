@@ -43,13 +43,26 @@ struct VirtIOBlockDataPlane {
      */
     IOThread *iothread;
     AioContext *ctx;
+
+    /* IOThreads of the iothread-vq-mapping property */
+    IOThread **vq_iothreads;
+    unsigned num_vq_iothreads;
+    /* Keeps nodes that are not multiqueue-safe out of the graph */
+    Error *vq_mapping_blocker;
+    /* AioContext serving each virtqueue, s->ctx without iothread-vq-mapping */
+    AioContext **vq_aio_context;
 };
 
-/* Raise an interrupt to signal guest, if necessary */
+/*
+ * Raise an interrupt to signal guest, if necessary
+ *
+ * Requests of different virtqueues may complete in different IOThreads,
+ * hence the atomic accesses to batch_notify_vqs.
+ */
 void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
 {
     if (s->batch_notifications) {
-        set_bit(virtio_get_queue_index(vq), s->batch_notify_vqs);
+        set_bit_atomic(virtio_get_queue_index(vq), s->batch_notify_vqs);
         qemu_bh_schedule(s->bh);
     } else {
         virtio_notify_irqfd(s->vdev, vq);
@@ -60,14 +73,11 @@ static void notify_guest_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
     unsigned nvqs = s->conf->num_queues;
-    unsigned long bitmap[BITS_TO_LONGS(nvqs)];
     unsigned j;
 
-    memcpy(bitmap, s->batch_notify_vqs, sizeof(bitmap));
-    memset(s->batch_notify_vqs, 0, sizeof(bitmap));
-
     for (j = 0; j < nvqs; j += BITS_PER_LONG) {
-        unsigned long bits = bitmap[j / BITS_PER_LONG];
+        unsigned long *word = &s->batch_notify_vqs[j / BITS_PER_LONG];
+        unsigned long bits = qatomic_xchg(word, 0);
 
         while (bits != 0) {
             unsigned i = j + ctzl(bits);
@@ -80,6 +90,118 @@ static void notify_guest_bh(void *opaque)
     }
 }
 
+AioContext *virtio_blk_data_plane_vq_aio_context(VirtIOBlockDataPlane *s,
+                                                 unsigned vq_index)
+{
+    return s->vq_aio_context[vq_index];
+}
+
+static bool
+validate_iothread_vq_mapping_list(IOThreadVirtQueueMappingList *list,
+                                  uint16_t num_queues, Error **errp)
+{
+    g_autofree unsigned long *vqs = bitmap_new(num_queues);
+    g_autoptr(GHashTable) iothreads =
+        g_hash_table_new(g_str_hash, g_str_equal);
+    IOThreadVirtQueueMappingList *node;
+
+    for (node = list; node; node = node->next) {
+        const char *name = node->value->iothread;
+        uint16List *vq;
+
+        if (!iothread_by_id(name)) {
+            error_setg(errp, "IOThread \"%s\" object does not exist", name);
+            return false;
+        }
+
+        if (!g_hash_table_add(iothreads, (gpointer)name)) {
+            error_setg(errp,
+                       "duplicate IOThread name \"%s\" in iothread-vq-mapping",
+                       name);
+            return false;
+        }
+
+        if (node != list) {
+            if (!!node->value->vqs != !!list->value->vqs) {
+                error_setg(errp, "either all items in iothread-vq-mapping "
+                                 "must have vqs or none of them must have it");
+                return false;
+            }
+        }
+
+        for (vq = node->value->vqs; vq; vq = vq->next) {
+            if (vq->value >= num_queues) {
+                error_setg(errp, "vq index %u for IOThread \"%s\" must be "
+                           "less than num_queues %u in iothread-vq-mapping",
+                           vq->value, name, num_queues);
+                return false;
+            }
+
+            if (test_and_set_bit(vq->value, vqs)) {
+                error_setg(errp, "cannot assign vq %u to IOThread \"%s\" "
+                           "because it is already assigned", vq->value, name);
+                return false;
+            }
+        }
+    }
+
+    if (list->value->vqs) {
+        for (uint16_t i = 0; i < num_queues; i++) {
+            if (!test_bit(i, vqs)) {
+                error_setg(errp, "missing vq %u IOThread assignment in "
+                           "iothread-vq-mapping", i);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Fill s->vq_aio_context from the iothread-vq-mapping property, taking a
+ * reference to each IOThread.  Virtqueues are assigned round-robin when
+ * the mappings have no explicit vqs list.
+ */
+static void apply_iothread_vq_mapping(VirtIOBlockDataPlane *s,
+                                      IOThreadVirtQueueMappingList *list)
+{
+    IOThreadVirtQueueMappingList *node;
+    uint16_t num_queues = s->conf->num_queues;
+    unsigned num_iothreads = 0;
+    uint16_t cur_vq = 0;
+
+    for (node = list; node; node = node->next) {
+        num_iothreads++;
+    }
+
+    s->vq_iothreads = g_new(IOThread *, num_iothreads);
+
+    for (node = list; node; node = node->next) {
+        IOThread *iothread = iothread_by_id(node->value->iothread);
+        AioContext *ctx = iothread_get_aio_context(iothread);
+
+        object_ref(OBJECT(iothread));
+        s->vq_iothreads[s->num_vq_iothreads++] = iothread;
+
+        if (node->value->vqs) {
+            uint16List *vq;
+
+            /* Explicit vq:IOThread assignment */
+            for (vq = node->value->vqs; vq; vq = vq->next) {
+                s->vq_aio_context[vq->value] = ctx;
+            }
+        } else {
+            /* Round-robin vq:IOThread assignment */
+            for (unsigned i = cur_vq; i < num_queues; i += num_iothreads) {
+                s->vq_aio_context[i] = ctx;
+            }
+        }
+
+        cur_vq++;
+    }
+}
+
 /* Context: QEMU global mutex held */
 bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
                                   VirtIOBlockDataPlane **dataplane,
@@ -88,10 +210,17 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned i;
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->iothread_vq_mapping_list &&
+        !validate_iothread_vq_mapping_list(conf->iothread_vq_mapping_list,
+                                           conf->num_queues, errp)) {
+        return false;
+    }
+
+    if (conf->iothread || conf->iothread_vq_mapping_list) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -111,6 +240,21 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
             return false;
         }
     }
+    if (conf->iothread_vq_mapping_list) {
+        GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+        /*
+         * Requests run in the IOThread of their virtqueue and complete there
+         * without the AioContext lock of the BlockBackend, so every driver in
+         * the graph must be able to handle them concurrently.
+         */
+        if (!bdrv_supports_multiqueue(blk_bs(conf->conf.blk))) {
+            error_setg(errp, "iothread-vq-mapping is only supported with "
+                       "the file, host_device, null-co and raw block "
+                       "drivers");
+            return false;
+        }
+    }
     /* Don't try if transport does not support notifiers. */
     if (!virtio_device_ioeventfd_enabled(vdev)) {
         return false;
@@ -120,13 +264,34 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s->vdev = vdev;
     s->conf = conf;
 
-    if (conf->iothread) {
-        s->iothread = conf->iothread;
-        object_ref(OBJECT(s->iothread));
-        s->ctx = iothread_get_aio_context(s->iothread);
+    s->vq_aio_context = g_new(AioContext *, conf->num_queues);
+
+    if (conf->iothread_vq_mapping_list) {
+        apply_iothread_vq_mapping(s, conf->iothread_vq_mapping_list);
+        /* The BlockBackend lives in the IOThread of the first virtqueue */
+        s->ctx = s->vq_aio_context[0];
+        /* Keep each request in the IOThread of its virtqueue */
+        blk_set_aio_in_caller_context(conf->conf.blk, true);
+
+        /* Block jobs and snapshots would insert other nodes into the graph */
+        error_setg(&s->vq_mapping_blocker,
+                   "the device uses iothread-vq-mapping");
+        blk_op_block_all(conf->conf.blk, s->vq_mapping_blocker);
+        blk_op_unblock(conf->conf.blk, BLOCK_OP_TYPE_RESIZE,
+                       s->vq_mapping_blocker);
     } else {
-        s->ctx = qemu_get_aio_context();
+        if (conf->iothread) {
+            s->iothread = conf->iothread;
+            object_ref(OBJECT(s->iothread));
+            s->ctx = iothread_get_aio_context(s->iothread);
+        } else {
+            s->ctx = qemu_get_aio_context();
+        }
+        for (i = 0; i < conf->num_queues; i++) {
+            s->vq_aio_context[i] = s->ctx;
+        }
     }
+
     s->bh = aio_bh_new_guarded(s->ctx, notify_guest_bh, s,
                                &DEVICE(vdev)->mem_reentrancy_guard);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
@@ -140,6 +305,7 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
     VirtIOBlock *vblk;
+    unsigned i;
 
     if (!s) {
         return;
@@ -147,11 +313,21 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 
     vblk = VIRTIO_BLK(s->vdev);
     assert(!vblk->dataplane_started);
+    if (s->conf->iothread_vq_mapping_list) {
+        blk_op_unblock_all(s->conf->conf.blk, s->vq_mapping_blocker);
+        error_free(s->vq_mapping_blocker);
+        blk_set_aio_in_caller_context(s->conf->conf.blk, false);
+    }
     g_free(s->batch_notify_vqs);
     qemu_bh_delete(s->bh);
     if (s->iothread) {
         object_unref(OBJECT(s->iothread));
     }
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        object_unref(OBJECT(s->vq_iothreads[i]));
+    }
+    g_free(s->vq_iothreads);
+    g_free(s->vq_aio_context);
     g_free(s);
 }
 
@@ -251,7 +427,7 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
         for (i = 0; i < nvqs; i++) {
             VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-            virtio_queue_aio_attach_host_notifier(vq, s->ctx);
+            virtio_queue_aio_attach_host_notifier(vq, s->vq_aio_context[i]);
         }
         aio_context_release(s->ctx);
     }
@@ -278,27 +454,22 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     return -ENOSYS;
 }
 
-/* Stop notifications for new requests from guest.
+/* Stop notifications for new requests from guest on a virtqueue.
  *
- * Context: BH in IOThread
+ * Context: BH in the IOThread serving the virtqueue
  */
-static void virtio_blk_data_plane_stop_bh(void *opaque)
+static void virtio_blk_data_plane_stop_vq_bh(void *opaque)
 {
-    VirtIOBlockDataPlane *s = opaque;
-    unsigned i;
-
-    for (i = 0; i < s->conf->num_queues; i++) {
-        VirtQueue *vq = virtio_get_queue(s->vdev, i);
-        EventNotifier *host_notifier = virtio_queue_get_host_notifier(vq);
+    VirtQueue *vq = opaque;
+    EventNotifier *host_notifier = virtio_queue_get_host_notifier(vq);
 
-        virtio_queue_aio_detach_host_notifier(vq, s->ctx);
+    virtio_queue_aio_detach_host_notifier(vq, qemu_get_current_aio_context());
 
-        /*
-         * Test and clear notifier after disabling event, in case poll callback
-         * didn't have time to run.
-         */
-        virtio_queue_host_notifier_read(host_notifier);
-    }
+    /*
+     * Test and clear notifier after disabling event, in case poll callback
+     * didn't have time to run.
+     */
+    virtio_queue_host_notifier_read(host_notifier);
 }
 
 /* Context: QEMU global mutex held */
@@ -325,7 +496,12 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     trace_virtio_blk_data_plane_stop(s);
 
     if (!blk_in_drain(s->conf->conf.blk)) {
-        aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
+        for (i = 0; i < nvqs; i++) {
+            VirtQueue *vq = virtio_get_queue(s->vdev, i);
+
+            aio_wait_bh_oneshot(s->vq_aio_context[i],
+                                virtio_blk_data_plane_stop_vq_bh, vq);
+        }
     }
 
     aio_context_acquire(s->ctx);
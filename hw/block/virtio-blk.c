@@ -21,6 +21,7 @@
 #include "trace.h"
 #include "hw/block/block.h"
 #include "hw/qdev-properties.h"
+#include "hw/qdev-properties-system.h"
 #include "sysemu/blockdev.h"
 #include "sysemu/block-ram-registrar.h"
 #include "sysemu/sysemu.h"
@@ -53,6 +54,14 @@ static void virtio_blk_free_request(VirtIOBlockReq *req)
     g_free(req);
 }
 
+/* Account the request to the device and to its virtqueue */
+static void virtio_blk_acct_start(VirtIOBlockReq *req, int64_t bytes,
+                                  enum BlockAcctType type)
+{
+    block_acct_start_queue(blk_get_stats(req->dev->blk), &req->acct, bytes,
+                           type, virtio_get_queue_index(req->vq));
+}
+
 static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
 {
     VirtIOBlock *s = req->dev;
@@ -490,8 +499,7 @@ static void virtio_blk_handle_flush(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 {
     VirtIOBlock *s = req->dev;
 
-    block_acct_start(blk_get_stats(s->blk), &req->acct, 0,
-                     BLOCK_ACCT_FLUSH);
+    virtio_blk_acct_start(req, 0, BLOCK_ACCT_FLUSH);
 
     /*
      * Make sure all outstanding writes are posted to the backing device.
@@ -573,8 +581,7 @@ static uint8_t virtio_blk_handle_discard_write_zeroes(VirtIOBlockReq *req,
             blk_aio_flags |= BDRV_REQ_MAY_UNMAP;
         }
 
-        block_acct_start(blk_get_stats(s->blk), &req->acct, bytes,
-                         BLOCK_ACCT_WRITE);
+        virtio_blk_acct_start(req, bytes, BLOCK_ACCT_WRITE);
 
         blk_aio_pwrite_zeroes(s->blk, sector << BDRV_SECTOR_BITS,
                               bytes, blk_aio_flags,
@@ -932,8 +939,7 @@ static int virtio_blk_handle_zone_append(VirtIOBlockReq *req,
     data->zone_append_data.offset = offset;
     qemu_iovec_init_external(&req->qiov, out_iov, out_num);
 
-    block_acct_start(blk_get_stats(s->blk), &req->acct, len,
-                     BLOCK_ACCT_ZONE_APPEND);
+    virtio_blk_acct_start(req, len, BLOCK_ACCT_ZONE_APPEND);
 
     blk_aio_zone_append(s->blk, &data->zone_append_data.offset, &req->qiov, 0,
                         virtio_blk_zone_append_complete, data);
@@ -1014,8 +1020,8 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
             return 0;
         }
 
-        block_acct_start(blk_get_stats(s->blk), &req->acct, req->qiov.size,
-                         is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
+        virtio_blk_acct_start(req, req->qiov.size,
+                              is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
 
         /* merge would exceed maximum number of requests or IO direction
          * changes */
@@ -1511,7 +1517,6 @@ static void virtio_blk_drained_begin(void *opaque)
 {
     VirtIOBlock *s = opaque;
     VirtIODevice *vdev = VIRTIO_DEVICE(opaque);
-    AioContext *ctx = blk_get_aio_context(s->conf.conf.blk);
 
     if (!s->dataplane || !s->dataplane_started) {
         return;
@@ -1519,6 +1524,9 @@ static void virtio_blk_drained_begin(void *opaque)
 
     for (uint16_t i = 0; i < s->conf.num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(vdev, i);
+        AioContext *ctx = virtio_blk_data_plane_vq_aio_context(s->dataplane,
+                                                               i);
+
         virtio_queue_aio_detach_host_notifier(vq, ctx);
     }
 }
@@ -1528,7 +1536,6 @@ static void virtio_blk_drained_end(void *opaque)
 {
     VirtIOBlock *s = opaque;
     VirtIODevice *vdev = VIRTIO_DEVICE(opaque);
-    AioContext *ctx = blk_get_aio_context(s->conf.conf.blk);
 
     if (!s->dataplane || !s->dataplane_started) {
         return;
@@ -1536,6 +1543,9 @@ static void virtio_blk_drained_end(void *opaque)
 
     for (uint16_t i = 0; i < s->conf.num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(vdev, i);
+        AioContext *ctx = virtio_blk_data_plane_vq_aio_context(s->dataplane,
+                                                               i);
+
         virtio_queue_aio_attach_host_notifier(vq, ctx);
     }
 }
@@ -1565,6 +1575,11 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
     if (conf->num_queues == VIRTIO_BLK_AUTO_NUM_QUEUES) {
         conf->num_queues = 1;
     }
+    if (conf->iothread && conf->iothread_vq_mapping_list) {
+        error_setg(errp, "iothread and iothread-vq-mapping properties "
+                         "cannot be set at the same time");
+        return;
+    }
     if (!conf->num_queues) {
         error_setg(errp, "num-queues property must be larger than 0");
         return;
@@ -1654,6 +1669,7 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
 
     blk_ram_registrar_init(&s->blk_ram_registrar, s->blk);
     blk_set_dev_ops(s->blk, &virtio_block_ops, s);
+    block_acct_set_queues(blk_get_stats(s->blk), conf->num_queues);
 
     blk_iostatus_enable(s->blk);
 
@@ -1671,6 +1687,7 @@ static void virtio_blk_device_unrealize(DeviceState *dev)
     unsigned i;
 
     blk_drain(s->blk);
+    block_acct_set_queues(blk_get_stats(s->blk), 0);
     del_boot_device_lchs(dev, "/disk@0,0");
     virtio_blk_data_plane_destroy(s->dataplane);
     s->dataplane = NULL;
@@ -1722,6 +1739,8 @@ static Property virtio_blk_properties[] = {
     DEFINE_PROP_BOOL("seg-max-adjust", VirtIOBlock, conf.seg_max_adjust, true),
     DEFINE_PROP_LINK("iothread", VirtIOBlock, conf.iothread, TYPE_IOTHREAD,
                      IOThread *),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", VirtIOBlock,
+                                         conf.iothread_vq_mapping_list),
     DEFINE_PROP_BIT64("discard", VirtIOBlock, host_features,
                       VIRTIO_BLK_F_DISCARD, true),
     DEFINE_PROP_BOOL("report-discard-granularity", VirtIOBlock,
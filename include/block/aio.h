@@ -57,6 +57,31 @@ typedef void IOHandler(void *opaque);
 struct ThreadPool;
 struct LinuxAioState;
 struct LuringState;
+struct msghdr;
+struct io_uring_sqe;
+
+typedef struct AioFdOp AioFdOp;
+
+/* Fills in the io_uring submission queue entry for @op */
+typedef void AioFdOpPrepFn(struct io_uring_sqe *sqe, AioFdOp *op);
+
+/*
+ * A completion-based operation submitted with aio_co_submit_fd_op(), e.g.
+ * by aio_co_recvmsg() or aio_co_sendmsg().  It lives on the stack of the
+ * coroutine waiting for it, or is embedded in a larger request structure
+ * that @prep can get its parameters from.
+ */
+struct AioFdOp {
+    Coroutine *co;
+    AioFdOpPrepFn *prep;
+    int ret;
+    uint64_t tag; /* io_uring user_data, names the slot and its generation */
+    QSIMPLEQ_ENTRY(AioFdOp) next;
+
+    /* Parameters of aio_co_recvmsg() and aio_co_sendmsg() */
+    int fd;
+    struct msghdr *msg;
+};
 
 /* Is polling disabled? */
 bool aio_poll_disabled(AioContext *ctx);
@@ -106,6 +131,34 @@ typedef struct {
      * Returns: true if ->wait() should be called, false otherwise.
      */
     bool (*need_wait)(AioContext *ctx);
+
+    /*
+     * gsource_prepare:
+     * @ctx: the AioContext
+     *
+     * Called before glib's event loop waits for events on the GSource of
+     * @ctx, which then also polls file descriptors that the implementation
+     * added to the GSource itself.  Optional.
+     */
+    void (*gsource_prepare)(AioContext *ctx);
+
+    /*
+     * gsource_check:
+     * @ctx: the AioContext
+     *
+     * Returns: true if ->gsource_dispatch() has events to process.
+     */
+    bool (*gsource_check)(AioContext *ctx);
+
+    /*
+     * gsource_dispatch:
+     * @ctx: the AioContext
+     * @ready_list: list for handlers that become ready
+     *
+     * Process events when @ctx is run from glib's event loop and place
+     * handlers that became ready on @ready_list.
+     */
+    void (*gsource_dispatch)(AioContext *ctx, AioHandlerList *ready_list);
 } FDMonOps;
 
 /*
@@ -123,6 +176,24 @@ struct BHListSlice {
 
 typedef QSLIST_HEAD(, AioHandler) AioHandlerSList;
 
+/* Number of bins in AioPollStats::hit_hist */
+#define AIO_POLL_HIT_HIST_BINS 16
+
+/* Userspace polling statistics, see aio_context_get_poll_stats() */
+typedef struct AioPollStats {
+    uint64_t hits;          /* polling found an event */
+    uint64_t misses;        /* polling ran out of time without an event */
+    uint64_t poll_ns;       /* time spent polling, in nanoseconds */
+    uint64_t block_ns;      /* time spent blocked waiting for events */
+
+    /*
+     * Hits by the time spent polling until the event: bin 0 counts hits
+     * within the first microsecond, bin i > 0 those after [2^(i-1), 2^i)
+     * microseconds, and the last bin everything after that.
+     */
+    uint64_t hit_hist[AIO_POLL_HIT_HIST_BINS];
+} AioPollStats;
+
 struct AioContext {
     GSource source;
 
@@ -204,6 +275,8 @@ struct AioContext {
 
     int thread_pool_min;
     int thread_pool_max;
+    /* Thread context to create thread pool workers in, or NULL */
+    ThreadContext *thread_pool_context;
     /* Thread pool for performing work and receiving completion callbacks.
      * Has its own locking.
      */
@@ -211,13 +284,26 @@ struct AioContext {
 
 #ifdef CONFIG_LINUX_AIO
     struct LinuxAioState *linux_aio;
+    /* Setting up linux_aio failed, use the thread pool instead */
+    bool linux_aio_failed;
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     struct LuringState *linux_io_uring;
+    /* Setting up linux_io_uring failed, use the thread pool instead */
+    bool linux_io_uring_failed;
 
     /* State for file descriptor monitoring using Linux io_uring */
+    bool fdmon_io_uring_g_source; /* keep it when run from glib */
     struct io_uring fdmon_io_uring;
+    GPollFD fdmon_io_uring_pfd; /* polls the ring from glib's event loop */
     AioHandlerSList submit_list;
+
+    /* AioFdOps and their cancellations, only used in the home thread */
+    QSIMPLEQ_HEAD(, AioFdOp) fd_op_list; /* waiting to be submitted */
+    QSLIST_HEAD(, AioFdOpCancel) fd_op_cancel_list;
+    struct AioFdOpSlot *fd_op_slots; /* submitted or waiting AioFdOps */
+    unsigned int fd_op_nr_slots;
+    unsigned int fd_op_free_slot; /* head of the free list */
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -234,6 +320,16 @@ struct AioContext {
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
 
+    /*
+     * Polling statistics, see AioPollStats.  Only written by the home
+     * thread, with qatomic_set_u64() because other threads read them.
+     */
+    uint64_t poll_hits;
+    uint64_t poll_misses;
+    uint64_t poll_total_ns;
+    uint64_t poll_block_ns;
+    uint64_t poll_hit_hist[AIO_POLL_HIT_HIST_BINS];
+
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
 
@@ -518,14 +614,126 @@ struct ThreadPool *aio_get_thread_pool(AioContext *ctx);
 /* Setup the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
 
+/*
+ * Return the LinuxAioState bound to the current AioContext, setting it up
+ * on first use.  If that fails, the error is reported once and NULL is
+ * returned from then on.
+ */
+struct LinuxAioState *aio_try_current_linux_aio(void);
+
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
 /* Setup the LuringState bound to this AioContext */
 struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
+/* Same as aio_try_current_linux_aio() for io_uring */
+struct LuringState *aio_try_current_linux_io_uring(void);
+
 /* Return the LuringState bound to this AioContext */
 struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+#ifdef CONFIG_LINUX_IO_URING
+/**
+ * aio_fd_ops_supported:
+ * @ctx: the aio context
+ *
+ * Return whether @ctx monitors file descriptors with io_uring, so that
+ * aio_co_submit_fd_op(), aio_co_recvmsg() and aio_co_sendmsg() can be used
+ * in it.
+ */
+bool aio_fd_ops_supported(AioContext *ctx);
+
+/**
+ * aio_co_submit_fd_op:
+ * @ctx: the aio context, which must be the current one
+ * @op: the operation, which must stay valid until the function returns
+ *
+ * Queue @op for submission to the io_uring that @ctx uses for file
+ * descriptor monitoring and yield until it completes.  @op->prep is called
+ * to fill in the submission queue entry.  All operations that are queued
+ * before @ctx waits for events next are submitted with a single system call
+ * together with the file descriptor monitoring changes.
+ *
+ * Must only be called if aio_fd_ops_supported() returns true.
+ *
+ * Returns: the result of the operation as reported in its completion queue
+ * entry.  -ECANCELED means that the operation was cancelled by
+ * aio_fd_op_cancel().
+ */
+int coroutine_fn aio_co_submit_fd_op(AioContext *ctx, AioFdOp *op);
+
+/**
+ * aio_co_recvmsg:
+ * @ctx: the aio context, which must be the current one
+ * @op: the operation, which must stay valid until the function returns
+ * @fd: a socket
+ * @msg: the message header with the buffers to read into
+ *
+ * Submit a recvmsg(2) on @fd through the io_uring that @ctx uses for file
+ * descriptor monitoring and yield until it completes.  Unlike waiting for
+ * @fd to become readable and reading then, this does not need a separate
+ * system call to get the data.
+ *
+ * Must only be called if aio_fd_ops_supported() returns true.
+ *
+ * Returns: the number of bytes read, 0 on EOF, or a negative errno value.
+ * -ECANCELED means that the operation was cancelled by aio_fd_op_cancel().
+ */
+ssize_t coroutine_fn aio_co_recvmsg(AioContext *ctx, AioFdOp *op, int fd,
+                                    struct msghdr *msg);
+
+/**
+ * aio_co_sendmsg:
+ *
+ * Like aio_co_recvmsg(), but submits a sendmsg(2).
+ */
+ssize_t coroutine_fn aio_co_sendmsg(AioContext *ctx, AioFdOp *op, int fd,
+                                    struct msghdr *msg);
+
+/**
+ * aio_fd_op_cancel:
+ * @ctx: the aio context that @op was submitted in, which must be the current
+ *       one
+ * @op: the operation, whose coroutine must still be waiting for it
+ *
+ * Request cancellation of @op.  The kernel may complete @op before it sees
+ * the request, which then has no effect.  The request refers to the tag of
+ * @op rather than to its address, so it never cancels another operation that
+ * reuses the memory or the tag slot of @op later.
+ *
+ * Other threads can schedule a bottom half in @ctx that checks whether the
+ * operation is still in flight and calls this function.
+ */
+void aio_fd_op_cancel(AioContext *ctx, AioFdOp *op);
+#else
+static inline bool aio_fd_ops_supported(AioContext *ctx)
+{
+    return false;
+}
+
+static inline int coroutine_fn aio_co_submit_fd_op(AioContext *ctx,
+                                                   AioFdOp *op)
+{
+    return -ENOTSUP;
+}
+
+static inline ssize_t coroutine_fn
+aio_co_recvmsg(AioContext *ctx, AioFdOp *op, int fd, struct msghdr *msg)
+{
+    return -ENOTSUP;
+}
+
+static inline ssize_t coroutine_fn
+aio_co_sendmsg(AioContext *ctx, AioFdOp *op, int fd, struct msghdr *msg)
+{
+    return -ENOTSUP;
+}
+
+static inline void aio_fd_op_cancel(AioContext *ctx, AioFdOp *op)
+{
+}
+#endif
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -698,6 +906,20 @@ void aio_context_destroy(AioContext *ctx);
 /* Used internally, do not call outside AioContext code */
 void aio_context_use_g_source(AioContext *ctx);
 
+/**
+ * aio_context_set_g_source_io_uring:
+ * @ctx: the aio context
+ * @enable: whether to keep io_uring when @ctx is run from glib
+ *
+ * aio_get_g_source() makes @ctx fall back from io_uring to epoll or poll for
+ * file descriptor monitoring, unless this was enabled before.  Keeping
+ * io_uring lets AioFdOps and block I/O with aio=io_uring share the ring of
+ * @ctx also when glib's event loop runs it.
+ *
+ * Must be called before aio_get_g_source().
+ */
+void aio_context_set_g_source_io_uring(AioContext *ctx, bool enable);
+
 /**
  * aio_context_set_poll_params:
  * @ctx: the aio context
@@ -711,6 +933,15 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_get_poll_stats:
+ * @ctx: the aio context
+ * @stats: filled in with the polling statistics of @ctx
+ *
+ * May be called from any thread.
+ */
+void aio_context_get_poll_stats(AioContext *ctx, AioPollStats *stats);
+
 /**
  * aio_context_set_aio_params:
  * @ctx: the aio context
@@ -720,12 +951,31 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
                                 Error **errp);
 
+/**
+ * aio_context_set_io_uring_sqpoll:
+ * @ctx: the aio context
+ * @cpu: host CPU to pin the submission queue polling thread to
+ *
+ * Make the io_uring that @ctx uses for file descriptor monitoring and block
+ * I/O use a kernel thread that polls its submission queue, so that
+ * submitting requests does not need a system call.
+ *
+ * Must be called before @ctx is used for the first time.
+ *
+ * Returns: true on success, false with @errp set if io_uring is not used for
+ * @ctx or the kernel thread cannot be created.
+ */
+bool aio_context_set_io_uring_sqpoll(AioContext *ctx, int cpu, Error **errp);
+
 /**
  * aio_context_set_thread_pool_params:
  * @ctx: the aio context
  * @min: min number of threads to have readily available in the thread pool
  * @min: max number of threads the thread pool can contain
+ * @tc: thread context to create the threads in, which determines their CPU
+ * and NUMA node affinity, or NULL to inherit the affinity of @ctx's thread
  */
 void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
-                                        int64_t max, Error **errp);
+                                        int64_t max, ThreadContext *tc,
+                                        Error **errp);
 #endif
@@ -30,11 +30,18 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
 
 /* Function should be called prior any actual copy request */
 void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
-                              bool compress);
+                              bool compress, bool dedup);
 void block_copy_set_progress_meter(BlockCopyState *s, ProgressMeter *pm);
 
 void block_copy_state_free(BlockCopyState *s);
 
+/*
+ * Bytes that were left out because the target's backing chain already
+ * contained them, and bytes that had to be written, when dedup is enabled.
+ */
+void block_copy_get_dedup_stats(BlockCopyState *s, uint64_t *dedup_bytes,
+                                uint64_t *written_bytes);
+
 void block_copy_reset(BlockCopyState *s, int64_t offset, int64_t bytes);
 
 int64_t coroutine_fn GRAPH_RDLOCK
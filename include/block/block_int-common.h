@@ -28,6 +28,7 @@
 #include "block/block-common.h"
 #include "block/block-global-state.h"
 #include "block/snapshot.h"
+#include "qemu/interval-tree.h"
 #include "qemu/iov.h"
 #include "qemu/rcu.h"
 #include "qemu/stats64.h"
@@ -142,6 +143,13 @@ struct BlockDriver {
      */
     bool supports_zoned_children;
 
+    /*
+     * Set to true if the BlockDriver can process requests for the same node
+     * from several threads at the same time without relying on the
+     * AioContext lock, see blk_set_aio_in_caller_context().
+     */
+    bool supports_multiqueue;
+
     /*
      * Drivers not implementing bdrv_parse_filename nor bdrv_open should have
      * this field set to true, except ones that are defined only by their
@@ -1042,21 +1050,32 @@ struct BdrvChild {
 };
 
 /*
- * Allows bdrv_co_block_status() to cache one data region for a
- * protocol node.
+ * Allows bdrv_co_block_status() to cache the status of a protocol node's
+ * extents, so that repeated inquiries (e.g. from qemu-img convert, mirror
+ * and NBD block-status requests) do not need to go to the driver.
  *
- * @valid: Whether the cache is valid (should be accessed with atomic
- *         functions so this can be reset by RCU readers)
- * @data_start: Offset where we know (or strongly assume) is data
- * @data_end: Offset where the data region ends (which is not necessarily
- *            the start of a zeroed region)
+ * @lock: Protects the extents; never held across I/O
+ * @extents: Interval tree of BdrvBlockStatusExtent, which do not overlap
+ * @lru: All extents, least recently used first
+ * @num_extents: Number of cached extents (atomic, for lockless checks)
+ * @gen: Incremented by every invalidation (atomic), so that results from
+ *       driver inquiries that raced with a write are not entered
+ * @cache_zeroes: Whether zero areas may be cached, see
+ *                BlockDriverState.exclusive_block_status
  */
-typedef struct BdrvBlockStatusCache {
-    struct rcu_head rcu;
+typedef struct BdrvBlockStatusExtent {
+    IntervalTreeNode node;
+    int status;
+    QTAILQ_ENTRY(BdrvBlockStatusExtent) next;
+} BdrvBlockStatusExtent;
 
-    bool valid;
-    int64_t data_start;
-    int64_t data_end;
+typedef struct BdrvBlockStatusCache {
+    QemuMutex lock;
+    IntervalTreeRoot extents;
+    QTAILQ_HEAD(, BdrvBlockStatusExtent) lru;
+    int num_extents;
+    uint64_t gen;
+    bool cache_zeroes;
 } BdrvBlockStatusCache;
 
 struct BlockDriverState {
@@ -1242,9 +1261,16 @@ struct BlockDriverState {
     /* BdrvChild links to this node may never be frozen */
     bool never_freeze;
 
-    /* Lock for block-status cache RCU writers */
-    CoMutex bsc_modify_lock;
-    /* Always non-NULL, but must only be dereferenced under an RCU read guard */
+    /*
+     * Set by the driver when it updates the permissions if nobody outside
+     * of the block layer can change the block status of the node (e.g.
+     * because it holds an image lock that keeps other processes from
+     * writing).  The block-status cache then also keeps zero areas, not only
+     * data areas.
+     */
+    bool exclusive_block_status;
+
+    /* Non-NULL while the node is open */
     BdrvBlockStatusCache *block_status_cache;
 
     /* array of write pointers' location of each zone in the zoned device. */
@@ -141,6 +141,10 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
  * driver that the mirror job inserts into the graph above @bs. NULL means that
  * a node name should be autogenerated.
  * @copy_mode: When to trigger writes to the target.
+ * @max_in_flight: The maximum number of copy operations in flight, or 0 for
+ * the default.
+ * @adaptive: Whether to adapt the number of copy operations in flight and
+ * their size to the target's latency and throughput.
  * @errp: Error object.
  *
  * Start a mirroring operation on @bs.  Clusters that are allocated
@@ -157,7 +161,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   bool unmap, const char *filter_node_name,
-                  MirrorCopyMode copy_mode, Error **errp);
+                  MirrorCopyMode copy_mode, int max_in_flight, bool adaptive,
+                  Error **errp);
 
 /*
  * backup_job_create:
@@ -169,6 +174,9 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
  * @sync_mode: What parts of the disk image should be copied to the destination.
  * @sync_bitmap: The dirty bitmap if sync_mode is 'bitmap' or 'incremental'
  * @bitmap_mode: The bitmap synchronization policy to use.
+ * @compress: Whether to write compressed data to @target.
+ * @dedup: Whether to skip clusters that @target already returns from its
+ *         backing chain.
  * @perf: Performance options. All actual fields assumed to be present,
  *        all ".has_*" fields are ignored.
  * @on_source_error: The action to take upon error reading from the source.
@@ -187,7 +195,7 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
                             MirrorSyncMode sync_mode,
                             BdrvDirtyBitmap *sync_bitmap,
                             BitmapSyncMode bitmap_mode,
-                            bool compress,
+                            bool compress, bool dedup,
                             const char *filter_node_name,
                             BackupPerf *perf,
                             BlockdevOnError on_source_error,
@@ -162,29 +162,37 @@ static inline BlockDriverState *bdrv_primary_bs(BlockDriverState *bs)
 }
 
 /**
- * Check whether the given offset is in the cached block-status data
- * region.
+ * Look up the cached block status of the extent containing @offset.
  *
- * If it is, and @pnum is not NULL, *pnum is set to
- * `bsc.data_end - offset`, i.e. how many bytes, starting from
- * @offset, are data (according to the cache).
- * Otherwise, *pnum is not touched.
+ * If there is one, return its status (BDRV_BLOCK_DATA or BDRV_BLOCK_ZERO,
+ * together with BDRV_BLOCK_OFFSET_VALID) and set *pnum to the number of
+ * bytes, starting from @offset, that have this status.
+ * Otherwise, return 0 and leave *pnum untouched.
  */
-bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum);
+int bdrv_bsc_lookup(BlockDriverState *bs, int64_t offset, int64_t *pnum);
 
 /**
- * If [offset, offset + bytes) overlaps with the currently cached
- * block-status region, invalidate the cache.
+ * Drop [offset, offset + bytes) from the block-status cache.
  *
- * (To be used by I/O paths that cause data regions to be zero or
- * holes.)
+ * (To be used by all I/O paths that change the data or allocation status
+ * of the node.)
  */
 void bdrv_bsc_invalidate_range(BlockDriverState *bs,
                                int64_t offset, int64_t bytes);
 
 /**
- * Mark the range [offset, offset + bytes) as a data region.
+ * Return the current invalidation generation of the block-status cache.
+ * It must be read before inquiring the driver about the block status that
+ * is to be passed to bdrv_bsc_fill().
  */
-void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes);
+uint64_t bdrv_bsc_generation(BlockDriverState *bs);
+
+/**
+ * Enter [offset, offset + bytes) with @status into the block-status cache,
+ * unless the cache has been invalidated since @gen was returned by
+ * bdrv_bsc_generation().
+ */
+void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                   int status, uint64_t gen);
 
 #endif /* BLOCK_INT_IO_H */
@@ -67,6 +67,12 @@ struct BlockJobDriver {
     void (*attached_aio_context)(BlockJob *job, AioContext *new_context);
 
     void (*set_speed)(BlockJob *job, int64_t speed);
+
+    /*
+     * Called with job lock held to fill in the job type specific part of
+     * the information returned by query-block-jobs.
+     */
+    void (*query)(BlockJob *job, BlockJobInfo *info);
 };
 
 /*
@@ -45,6 +45,9 @@ typedef struct BlockExportDriver {
      * shutting down.
      */
     void (*request_shutdown)(BlockExport *);
+
+    /* Fills in the type-specific part of @info for query-block-exports */
+    void (*query)(BlockExport *, BlockExportInfo *info);
 } BlockExportDriver;
 
 struct BlockExport {
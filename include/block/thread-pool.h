@@ -26,6 +26,17 @@ typedef int ThreadPoolFunc(void *opaque);
 
 typedef struct ThreadPool ThreadPool;
 
+typedef struct ThreadPoolStats {
+    uint64_t workers;           /* worker threads */
+    uint64_t queue_depth;       /* requests waiting for a worker */
+    uint64_t max_queue_depth;
+    uint64_t completed;         /* requests run to completion */
+    uint64_t stolen;            /* requests moved by work stealing */
+    uint64_t queue_ns;          /* total time spent waiting for a worker */
+    uint64_t max_queue_ns;
+    uint64_t run_ns;            /* total time spent running requests */
+} ThreadPoolStats;
+
 ThreadPool *thread_pool_new(struct AioContext *ctx);
 void thread_pool_free(ThreadPool *pool);
 
@@ -40,4 +51,10 @@ void thread_pool_submit(ThreadPoolFunc *func, void *arg);
 
 void thread_pool_update_params(ThreadPool *pool, struct AioContext *ctx);
 
+/*
+ * thread_pool_get_stats: fill @stats with the statistics of @pool, or
+ * zeroes if @pool is NULL.  Can be called from any thread.
+ */
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats);
+
 #endif
@@ -75,6 +75,15 @@ struct RAMBlock {
      * could not have been valid on the source.
      */
     ram_addr_t postcopy_length;
+
+    /*
+     * Used by mapped-ram migration: bitmap of pages present in the
+     * migration file, and the file offsets where the bitmap and the
+     * pages of this RAMBlock are stored.
+     */
+    unsigned long *file_bmap;
+    off_t bitmap_offset;
+    uint64_t pages_offset;
 };
 #endif
 #endif
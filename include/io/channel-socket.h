@@ -49,6 +49,11 @@ struct QIOChannelSocket {
     socklen_t remoteAddrLen;
     ssize_t zero_copy_queued;
     ssize_t zero_copy_sent;
+    /*
+     * Copy the data instead of failing a QIO_CHANNEL_WRITE_FLAG_ZERO_COPY
+     * write when the process cannot lock more memory (ENOBUFS)
+     */
+    bool zero_copy_fallback;
 };
 
 
@@ -262,4 +267,42 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
 
+/**
+ * qio_channel_socket_set_zero_copy:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Enable QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY on a connected
+ * socket that was not set up with qio_channel_socket_connect_sync(),
+ * for example one returned by qio_channel_socket_accept().
+ *
+ * Returns: 0 on success, -1 if the host or the socket type
+ * does not support zero copy
+ */
+int
+qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                 Error **errp);
+
+
+/**
+ * qio_channel_socket_zero_copy_completed:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Collect the notifications for writes queued with
+ * QIO_CHANNEL_WRITE_FLAG_ZERO_COPY that the kernel has
+ * completed so far.  Unlike qio_channel_flush(), this does
+ * not wait for the writes that are still in progress.
+ *
+ * A buffer that was written with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY
+ * when @ioc->zero_copy_queued had reached a given value can be
+ * reused once the return value is at least that value.
+ *
+ * Returns: the number of completed zero copy writes, or -1 on error
+ */
+ssize_t
+qio_channel_socket_zero_copy_completed(QIOChannelSocket *ioc,
+                                       Error **errp);
+
+
 #endif /* QIO_CHANNEL_SOCKET_H */
@@ -44,6 +44,7 @@ enum QIOChannelFeature {
     QIO_CHANNEL_FEATURE_LISTEN,
     QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY,
     QIO_CHANNEL_FEATURE_READ_MSG_PEEK,
+    QIO_CHANNEL_FEATURE_SEEKABLE,
 };
 
 
@@ -84,6 +85,7 @@ struct QIOChannel {
     AioContext *ctx;
     Coroutine *read_coroutine;
     Coroutine *write_coroutine;
+    AioFdOp *read_op; /* completion-based read in qio_channel_yield_readv() */
 #ifdef _WIN32
     HANDLE event; /* For use with GSource on Win32 */
 #endif
@@ -146,6 +148,26 @@ struct QIOChannelClass {
                                   void *opaque);
     int (*io_flush)(QIOChannel *ioc,
                     Error **errp);
+    ssize_t (*io_pwritev)(QIOChannel *ioc,
+                          const struct iovec *iov,
+                          size_t niov,
+                          off_t offset,
+                          Error **errp);
+    ssize_t (*io_preadv)(QIOChannel *ioc,
+                         const struct iovec *iov,
+                         size_t niov,
+                         off_t offset,
+                         Error **errp);
+    ssize_t coroutine_fn (*io_co_readv)(QIOChannel *ioc,
+                                        AioFdOp *op,
+                                        const struct iovec *iov,
+                                        size_t niov,
+                                        Error **errp);
+    ssize_t coroutine_fn (*io_co_writev)(QIOChannel *ioc,
+                                         AioFdOp *op,
+                                         const struct iovec *iov,
+                                         size_t niov,
+                                         Error **errp);
 };
 
 /* General I/O handling functions */
@@ -612,6 +634,82 @@ off_t qio_channel_io_seek(QIOChannel *ioc,
                           int whence,
                           Error **errp);
 
+/**
+ * qio_channel_pwritev:
+ * @ioc: the channel object
+ * @iov: the array of memory regions to write data from
+ * @niov: the length of the @iov array
+ * @offset: offset in the channel where writes should begin
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Not all implementations will support this facility, so may report
+ * an error. To avoid errors, the caller may check for the feature
+ * flag QIO_CHANNEL_FEATURE_SEEKABLE prior to calling this method.
+ *
+ * Behaves as qio_channel_writev_full, apart from not supporting
+ * sending of file handles as well as beginning the write at the
+ * passed @offset. The current I/O position of the channel is not
+ * changed.
+ *
+ * Returns: the number of bytes written, or -1 on error
+ */
+ssize_t qio_channel_pwritev(QIOChannel *ioc, const struct iovec *iov,
+                            size_t niov, off_t offset, Error **errp);
+
+/**
+ * qio_channel_pwrite:
+ * @ioc: the channel object
+ * @buf: the memory region to write data from
+ * @buflen: the number of bytes in @buf
+ * @offset: offset in the channel where writes should begin
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Convenience wrapper around qio_channel_pwritev for a single
+ * buffer.
+ *
+ * Returns: the number of bytes written, or -1 on error
+ */
+ssize_t qio_channel_pwrite(QIOChannel *ioc, char *buf, size_t buflen,
+                           off_t offset, Error **errp);
+
+/**
+ * qio_channel_preadv:
+ * @ioc: the channel object
+ * @iov: the array of memory regions to read data into
+ * @niov: the length of the @iov array
+ * @offset: offset in the channel where reads should begin
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Not all implementations will support this facility, so may report
+ * an error. To avoid errors, the caller may check for the feature
+ * flag QIO_CHANNEL_FEATURE_SEEKABLE prior to calling this method.
+ *
+ * Behaves as qio_channel_readv_full, apart from not supporting
+ * receiving of file handles as well as beginning the read at the
+ * passed @offset. The current I/O position of the channel is not
+ * changed.
+ *
+ * Returns: the number of bytes read, or -1 on error
+ */
+ssize_t qio_channel_preadv(QIOChannel *ioc, const struct iovec *iov,
+                           size_t niov, off_t offset, Error **errp);
+
+/**
+ * qio_channel_pread:
+ * @ioc: the channel object
+ * @buf: the memory region to read data into
+ * @buflen: the number of bytes to read into @buf
+ * @offset: offset in the channel where reads should begin
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Convenience wrapper around qio_channel_preadv for a single
+ * buffer.
+ *
+ * Returns: the number of bytes read, or -1 on error
+ */
+ssize_t qio_channel_pread(QIOChannel *ioc, char *buf, size_t buflen,
+                          off_t offset, Error **errp);
+
 
 /**
  * qio_channel_create_watch:
@@ -757,13 +855,58 @@ void qio_channel_detach_aio_context(QIOChannel *ioc);
 void coroutine_fn qio_channel_yield(QIOChannel *ioc,
                                     GIOCondition condition);
 
+/**
+ * qio_channel_yield_readv:
+ * @ioc: the channel object
+ * @iov: the array of memory regions to read data into
+ * @niov: the length of the @iov array
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Wait until the channel becomes readable and read data into @iov, for use
+ * after qio_channel_readv() returned %QIO_CHANNEL_ERR_BLOCK.  If the channel
+ * and its #AioContext support completion-based I/O, the data is read as part
+ * of the wait, saving a system call.  Otherwise this is the same as
+ * qio_channel_yield() with %G_IO_IN, and the caller has to read the data
+ * itself.
+ *
+ * This must only be called from coroutine context.  The wait can be
+ * interrupted with qio_channel_wake_read().
+ *
+ * Returns: the number of bytes read, 0 on end-of-file,
+ * %QIO_CHANNEL_ERR_BLOCK if nothing was read and the caller should
+ * retry, or -1 on error
+ */
+ssize_t coroutine_fn qio_channel_yield_readv(QIOChannel *ioc,
+                                             const struct iovec *iov,
+                                             size_t niov,
+                                             Error **errp);
+
+/**
+ * qio_channel_yield_writev:
+ * @ioc: the channel object
+ * @iov: the array of memory regions to write data from
+ * @niov: the length of the @iov array
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Like qio_channel_yield_readv(), but waits until the channel becomes
+ * writable and writes data from @iov, for use after qio_channel_writev()
+ * returned %QIO_CHANNEL_ERR_BLOCK.
+ *
+ * Returns: the number of bytes written, %QIO_CHANNEL_ERR_BLOCK if nothing
+ * was written and the caller should retry, or -1 on error
+ */
+ssize_t coroutine_fn qio_channel_yield_writev(QIOChannel *ioc,
+                                              const struct iovec *iov,
+                                              size_t niov,
+                                              Error **errp);
+
 /**
  * qio_channel_wake_read:
  * @ioc: the channel object
  *
- * If qio_channel_yield() is currently waiting for the channel to become
- * readable, interrupt it and reenter immediately. This function is safe to call
- * from any thread.
+ * If qio_channel_yield() or qio_channel_yield_readv() is currently waiting
+ * for the channel to become readable, interrupt it and reenter immediately.
+ * This function is safe to call from any thread.
  */
 void qio_channel_wake_read(QIOChannel *ioc);
 
@@ -196,6 +196,19 @@ struct VMStateDescription {
      * a QEMU_VM_SECTION_START section.
      */
     bool early_setup;
+    /*
+     * The state of this VMSD can be loaded by a load thread, concurrently
+     * with the rest of the migration stream, when the parallel-device-load
+     * capability is enabled.  The load, including pre_load() and
+     * post_load(), must not need the BQL nor touch other devices' state.
+     */
+    bool parallel_load;
+    /*
+     * NULL-terminated list of the names of the VMSDs that must be loaded
+     * before this one.  Only entries coming earlier in the migration
+     * stream are waited for.  See docs/devel/migration.rst.
+     */
+    const char **load_deps;
     int version_id;
     int minimum_version_id;
     MigrationPriority priority;
@@ -1199,6 +1212,7 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
                          int version_id);
 
 bool vmstate_save_needed(const VMStateDescription *vmsd, void *opaque);
+uint64_t vmstate_size_estimate(const VMStateDescription *vmsd, void *opaque);
 
 #define  VMSTATE_INSTANCE_ID_ANY  -1
 
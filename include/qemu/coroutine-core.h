@@ -76,6 +76,28 @@ typedef void coroutine_fn CoroutineEntry(void *opaque);
  */
 Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque);
 
+/**
+ * Coroutine stack size classes
+ *
+ * Each class has its own coroutine pool.  Only use a small stack if the
+ * entry point and everything it calls is known to need little stack
+ * space; in particular, never for coroutines that call into block drivers
+ * or device emulation.
+ */
+typedef enum CoroutineStackClass {
+    COROUTINE_STACK_DEFAULT,    /* 1 MiB */
+    COROUTINE_STACK_SMALL,      /* 64 KiB */
+    COROUTINE_STACK__MAX,
+} CoroutineStackClass;
+
+/**
+ * Create a new coroutine with a stack of the given size class
+ *
+ * Like qemu_coroutine_create(), which uses COROUTINE_STACK_DEFAULT.
+ */
+Coroutine *qemu_coroutine_create_sized(CoroutineEntry *entry, void *opaque,
+                                       CoroutineStackClass stack_class);
+
 /**
  * Transfer control to a coroutine
  */
@@ -271,6 +271,25 @@ void qemu_co_sleep_wake(QemuCoSleep *w);
  */
 void coroutine_fn yield_until_fd_readable(int fd);
 
+typedef struct CoroutinePoolStats {
+    uint64_t stack_size;
+    uint64_t pool_hits;         /* coroutines created from the pool */
+    uint64_t pool_misses;       /* coroutines created with a new stack */
+    uint64_t in_use;            /* created and not terminated yet */
+    uint64_t allocated;         /* stacks, including pooled coroutines' */
+    uint64_t max_allocated;
+    uint64_t committed;         /* resident bytes of allocated stacks */
+    uint64_t max_depth;         /* deepest stack use in bytes */
+} CoroutinePoolStats;
+
+/**
+ * Get coroutine statistics for each stack size class
+ *
+ * @stats must have COROUTINE_STACK__MAX elements.  committed and max_depth
+ * are zero if the coroutine backend cannot measure them.
+ */
+void qemu_coroutine_get_stats(CoroutinePoolStats *stats);
+
 /**
  * Increase coroutine pool size
  */
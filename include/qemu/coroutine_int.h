@@ -34,6 +34,7 @@ extern __thread void *__safestack_unsafe_stack_ptr;
 #endif
 
 #define COROUTINE_STACK_SIZE (1 << 20)
+#define COROUTINE_SMALL_STACK_SIZE (64 << 10)
 
 typedef enum {
     COROUTINE_YIELD = 1,
@@ -46,6 +47,9 @@ struct Coroutine {
     void *entry_arg;
     Coroutine *caller;
 
+    /* Set by qemu_coroutine_new(), selects the pool.  */
+    CoroutineStackClass stack_class;
+
     /* Only used when the coroutine has terminated.  */
     QSLIST_ENTRY(Coroutine) pool_next;
 
@@ -69,9 +73,31 @@ struct Coroutine {
     QSLIST_ENTRY(Coroutine) co_scheduled_next;
 };
 
-Coroutine *qemu_coroutine_new(void);
+static inline size_t qemu_coroutine_stack_size(CoroutineStackClass stack_class)
+{
+    return stack_class == COROUTINE_STACK_SMALL ? COROUTINE_SMALL_STACK_SIZE :
+                                                  COROUTINE_STACK_SIZE;
+}
+
+Coroutine *qemu_coroutine_new(CoroutineStackClass stack_class);
 void qemu_coroutine_delete(Coroutine *co);
 CoroutineAction qemu_coroutine_switch(Coroutine *from, Coroutine *to,
                                       CoroutineAction action);
 
+/*
+ * Stack arena used by the ucontext and sigaltstack backends.  Like
+ * qemu_alloc_stack(), *sz is the requested size on input and the size of
+ * the returned area, including its guard page, on output.
+ */
+void *qemu_coroutine_stack_alloc(CoroutineStackClass stack_class, size_t *sz);
+void qemu_coroutine_stack_free(CoroutineStackClass stack_class, void *stack,
+                               size_t sz);
+
+/*
+ * Resident bytes of all allocated stacks of a class, and the deepest stack
+ * use seen.  Both are zero if the backend cannot measure them.
+ */
+void qemu_coroutine_stack_get_usage(CoroutineStackClass stack_class,
+                                    uint64_t *committed, uint64_t *max_depth);
+
 #endif
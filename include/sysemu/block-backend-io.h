@@ -30,6 +30,7 @@ BlockDriverState *blk_bs(BlockBackend *blk);
 void blk_set_allow_write_beyond_eof(BlockBackend *blk, bool allow);
 void blk_set_allow_aio_context_change(BlockBackend *blk, bool allow);
 void blk_set_disable_request_queuing(BlockBackend *blk, bool disable);
+void blk_set_aio_in_caller_context(BlockBackend *blk, bool enable);
 bool blk_iostatus_is_enabled(const BlockBackend *blk);
 
 char *blk_get_attached_dev_id(BlockBackend *blk);
@@ -34,4 +34,7 @@ void dirtylimit_set_vcpu(int cpu_index,
 void dirtylimit_set_all(uint64_t quota,
                         bool enable);
 void dirtylimit_vcpu_execute(CPUState *cpu);
+bool dirtylimit_migration_throttle(uint64_t target);
+void dirtylimit_migration_cancel(void);
+bool dirtylimit_migration_active(void);
 #endif
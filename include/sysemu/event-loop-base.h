@@ -30,11 +30,15 @@ struct EventLoopBaseClass {
 struct EventLoopBase {
     Object parent;
 
+    /* The event loop was created by user_creatable_complete() */
+    bool complete;
+
     /* AioContext AIO engine parameters */
     int64_t aio_max_batch;
 
     /* AioContext thread pool parameters */
     int64_t thread_pool_min;
     int64_t thread_pool_max;
+    ThreadContext *thread_pool_context; /* "thread-pool-context" link */
 };
 #endif
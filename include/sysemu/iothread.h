@@ -38,6 +38,11 @@ struct IOThread {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+
+    /* Keep io_uring for fd monitoring although glib runs the AioContext */
+    bool fdmon_io_uring;
+    /* Host CPU for the io_uring submission queue polling thread, or -1 */
+    int64_t io_uring_sqpoll_cpu;
 };
 typedef struct IOThread IOThread;
 
@@ -144,6 +144,29 @@ qio_channel_socket_new_fd(int fd,
 }
 
 
+int
+qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                 Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    int v = 1;
+
+    if (setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) < 0) {
+        error_setg_errno(errp, errno, "Unable to enable zero copy on socket");
+        return -1;
+    }
+
+    /* Zero copy available on host */
+    qio_channel_set_feature(QIO_CHANNEL(ioc),
+                            QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+    return 0;
+#else
+    error_setg(errp, "Zero copy not supported on this host");
+    return -1;
+#endif
+}
+
+
 int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
                                     SocketAddress *addr,
                                     Error **errp)
@@ -163,15 +186,8 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
-#ifdef QEMU_MSG_ZEROCOPY
-    int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
-    if (ret == 0) {
-        /* Zero copy available on host */
-        qio_channel_set_feature(QIO_CHANNEL(ioc),
-                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
-    }
-#endif
+    /* Zero copy is optional here, so ignore the error */
+    qio_channel_socket_set_zero_copy(ioc, NULL);
 
     qio_channel_set_feature(QIO_CHANNEL(ioc),
                             QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
@@ -451,6 +467,29 @@ static void qio_channel_socket_finalize(Object *obj)
 
 
 #ifndef WIN32
+#ifdef QEMU_MSG_ZEROCOPY
+static int qio_channel_socket_reap_zero_copy(QIOChannelSocket *sioc,
+                                             bool wait,
+                                             Error **errp);
+#endif
+
+/*
+ * Completed zero copy writes are reported on the error queue of the socket,
+ * which makes it poll as G_IO_ERR.  That wakes up anybody waiting for
+ * G_IO_IN, so collect the notifications before waiting for input again or
+ * the reader would be woken up over and over.
+ */
+static int qio_channel_socket_drain_errqueue(QIOChannelSocket *sioc,
+                                             Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    if (qio_channel_socket_reap_zero_copy(sioc, false, errp) < 0) {
+        return -1;
+    }
+#endif
+    return 0;
+}
+
 static void qio_channel_socket_copy_fds(struct msghdr *msg,
                                         int **fds, size_t *nfds)
 {
@@ -532,6 +571,9 @@ static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
     ret = recvmsg(sioc->fd, &msg, sflags);
     if (ret < 0) {
         if (errno == EAGAIN) {
+            if (qio_channel_socket_drain_errqueue(sioc, errp) < 0) {
+                return -1;
+            }
             return QIO_CHANNEL_ERR_BLOCK;
         }
         if (errno == EINTR) {
@@ -611,6 +653,12 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
             goto retry;
         case ENOBUFS:
             if (flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) {
+                if (sioc->zero_copy_fallback) {
+                    /* Nothing was queued, so just send a copy */
+                    flags &= ~QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
+                    sflags = 0;
+                    goto retry;
+                }
                 error_setg_errno(errp, errno,
                                  "Process can't lock enough memory for using MSG_ZEROCOPY");
                 return -1;
@@ -723,11 +771,94 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 #endif /* WIN32 */
 
 
-#ifdef QEMU_MSG_ZEROCOPY
-static int qio_channel_socket_flush(QIOChannel *ioc,
-                                    Error **errp)
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Turn the result of an AioFdOp into the return value of a QIOChannel I/O
+ * function.  Some kernels complete operations on non-blocking sockets with
+ * -EAGAIN instead of waiting, so wait for readiness in this case to avoid
+ * busy looping.
+ */
+static ssize_t coroutine_fn
+qio_channel_socket_fd_op_ret(QIOChannel *ioc, ssize_t ret,
+                             GIOCondition condition, Error **errp)
+{
+    switch (ret) {
+    case -EAGAIN:
+        if (condition == G_IO_IN &&
+            qio_channel_socket_drain_errqueue(QIO_CHANNEL_SOCKET(ioc),
+                                              errp) < 0) {
+            return -1;
+        }
+        qio_channel_yield(ioc, condition);
+        return QIO_CHANNEL_ERR_BLOCK;
+    case -EINTR:
+    case -ECANCELED:
+        return QIO_CHANNEL_ERR_BLOCK;
+    }
+
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, condition == G_IO_IN ?
+                         "Unable to read from socket" :
+                         "Unable to write to socket");
+        return -1;
+    }
+
+    return ret;
+}
+
+static ssize_t coroutine_fn
+qio_channel_socket_co_readv(QIOChannel *ioc, AioFdOp *op,
+                            const struct iovec *iov, size_t niov,
+                            Error **errp)
+{
+    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+    struct msghdr msg = {
+        .msg_iov = (struct iovec *)iov,
+        .msg_iovlen = niov,
+    };
+    ssize_t ret;
+
+    ret = aio_co_recvmsg(qemu_get_current_aio_context(), op, sioc->fd, &msg);
+    return qio_channel_socket_fd_op_ret(ioc, ret, G_IO_IN, errp);
+}
+
+static ssize_t coroutine_fn
+qio_channel_socket_co_writev(QIOChannel *ioc, AioFdOp *op,
+                             const struct iovec *iov, size_t niov,
+                             Error **errp)
 {
     QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+    struct msghdr msg = {
+        .msg_iov = (struct iovec *)iov,
+        .msg_iovlen = niov,
+    };
+    ssize_t ret;
+
+    ret = aio_co_sendmsg(qemu_get_current_aio_context(), op, sioc->fd, &msg);
+    if (ret == 0) {
+        /* Like sendmsg(2) returning 0 in qio_channel_socket_writev() */
+        error_setg(errp, "Unable to write to socket");
+        return -1;
+    }
+    return qio_channel_socket_fd_op_ret(ioc, ret, G_IO_OUT, errp);
+}
+#endif /* CONFIG_LINUX_IO_URING */
+
+
+#ifdef QEMU_MSG_ZEROCOPY
+/*
+ * Read zero copy notifications from the error queue of @sioc and
+ * account them in zero_copy_sent.  If @wait is true, block until
+ * all queued writes have completed, otherwise only consume the
+ * notifications that are already there.
+ *
+ * Returns -1 on error, 1 if every completed write was copied by
+ * the kernel after all, 0 otherwise.
+ */
+static int qio_channel_socket_reap_zero_copy(QIOChannelSocket *sioc,
+                                             bool wait,
+                                             Error **errp)
+{
     struct msghdr msg = {};
     struct sock_extended_err *serr;
     struct cmsghdr *cm;
@@ -750,8 +881,11 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
         if (received < 0) {
             switch (errno) {
             case EAGAIN:
+                if (!wait) {
+                    return ret;
+                }
                 /* Nothing on errqueue, wait until something is available */
-                qio_channel_wait(ioc, G_IO_ERR);
+                qio_channel_wait(QIO_CHANNEL(sioc), G_IO_ERR);
                 continue;
             case EINTR:
                 continue;
@@ -794,8 +928,27 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
     return ret;
 }
 
+static int qio_channel_socket_flush(QIOChannel *ioc,
+                                    Error **errp)
+{
+    return qio_channel_socket_reap_zero_copy(QIO_CHANNEL_SOCKET(ioc), true,
+                                             errp);
+}
+
 #endif /* QEMU_MSG_ZEROCOPY */
 
+ssize_t
+qio_channel_socket_zero_copy_completed(QIOChannelSocket *ioc,
+                                       Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    if (qio_channel_socket_reap_zero_copy(ioc, false, errp) < 0) {
+        return -1;
+    }
+#endif
+    return ioc->zero_copy_sent;
+}
+
 static int
 qio_channel_socket_set_blocking(QIOChannel *ioc,
                                 bool enabled,
@@ -928,6 +1081,10 @@ static void qio_channel_socket_class_init(ObjectClass *klass,
 #ifdef QEMU_MSG_ZEROCOPY
     ioc_klass->io_flush = qio_channel_socket_flush;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    ioc_klass->io_co_readv = qio_channel_socket_co_readv;
+    ioc_klass->io_co_writev = qio_channel_socket_co_writev;
+#endif
 }
 
 static const TypeInfo qio_channel_socket_info = {
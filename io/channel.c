@@ -157,12 +157,17 @@ int coroutine_mixed_fn qio_channel_readv_full_all_eof(QIOChannel *ioc,
         len = qio_channel_readv_full(ioc, local_iov, nlocal_iov, local_fds,
                                      local_nfds, 0, errp);
         if (len == QIO_CHANNEL_ERR_BLOCK) {
-            if (qemu_in_coroutine()) {
-                qio_channel_yield(ioc, G_IO_IN);
-            } else {
+            if (!qemu_in_coroutine()) {
                 qio_channel_wait(ioc, G_IO_IN);
+                continue;
+            } else if (local_fds) {
+                qio_channel_yield(ioc, G_IO_IN);
+                continue;
+            }
+            len = qio_channel_yield_readv(ioc, local_iov, nlocal_iov, errp);
+            if (len == QIO_CHANNEL_ERR_BLOCK) {
+                continue;
             }
-            continue;
         }
 
         if (len == 0) {
@@ -265,12 +270,17 @@ int coroutine_mixed_fn qio_channel_writev_full_all(QIOChannel *ioc,
                                             nfds, flags, errp);
 
         if (len == QIO_CHANNEL_ERR_BLOCK) {
-            if (qemu_in_coroutine()) {
-                qio_channel_yield(ioc, G_IO_OUT);
-            } else {
+            if (!qemu_in_coroutine()) {
                 qio_channel_wait(ioc, G_IO_OUT);
+                continue;
+            } else if (fds || flags) {
+                qio_channel_yield(ioc, G_IO_OUT);
+                continue;
+            }
+            len = qio_channel_yield_writev(ioc, local_iov, nlocal_iov, errp);
+            if (len == QIO_CHANNEL_ERR_BLOCK) {
+                continue;
             }
-            continue;
         }
         if (len < 0) {
             goto cleanup;
@@ -498,6 +508,64 @@ off_t qio_channel_io_seek(QIOChannel *ioc,
     return klass->io_seek(ioc, offset, whence, errp);
 }
 
+ssize_t qio_channel_pwritev(QIOChannel *ioc, const struct iovec *iov,
+                            size_t niov, off_t offset, Error **errp)
+{
+    QIOChannelClass *klass = QIO_CHANNEL_GET_CLASS(ioc);
+
+    if (!klass->io_pwritev) {
+        error_setg(errp, "Channel does not support pwritev");
+        return -1;
+    }
+
+    if (!qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_setg_errno(errp, EINVAL, "Requested channel is not seekable");
+        return -1;
+    }
+
+    return klass->io_pwritev(ioc, iov, niov, offset, errp);
+}
+
+ssize_t qio_channel_pwrite(QIOChannel *ioc, char *buf, size_t buflen,
+                           off_t offset, Error **errp)
+{
+    struct iovec iov = {
+        .iov_base = buf,
+        .iov_len = buflen
+    };
+
+    return qio_channel_pwritev(ioc, &iov, 1, offset, errp);
+}
+
+ssize_t qio_channel_preadv(QIOChannel *ioc, const struct iovec *iov,
+                           size_t niov, off_t offset, Error **errp)
+{
+    QIOChannelClass *klass = QIO_CHANNEL_GET_CLASS(ioc);
+
+    if (!klass->io_preadv) {
+        error_setg(errp, "Channel does not support preadv");
+        return -1;
+    }
+
+    if (!qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_setg_errno(errp, EINVAL, "Requested channel is not seekable");
+        return -1;
+    }
+
+    return klass->io_preadv(ioc, iov, niov, offset, errp);
+}
+
+ssize_t qio_channel_pread(QIOChannel *ioc, char *buf, size_t buflen,
+                          off_t offset, Error **errp)
+{
+    struct iovec iov = {
+        .iov_base = buf,
+        .iov_len = buflen
+    };
+
+    return qio_channel_preadv(ioc, &iov, 1, offset, errp);
+}
+
 int qio_channel_flush(QIOChannel *ioc,
                                 Error **errp)
 {
@@ -563,6 +631,7 @@ void qio_channel_attach_aio_context(QIOChannel *ioc,
 {
     assert(!ioc->read_coroutine);
     assert(!ioc->write_coroutine);
+    assert(!ioc->read_op);
     ioc->ctx = ctx;
 }
 
@@ -606,11 +675,90 @@ void coroutine_fn qio_channel_yield(QIOChannel *ioc,
     }
 }
 
+/*
+ * Use completion-based I/O if the channel supports it and the coroutine
+ * runs in an AioContext that can submit it.
+ */
+static bool qio_channel_use_fd_op(QIOChannel *ioc, bool write)
+{
+    QIOChannelClass *klass = QIO_CHANNEL_GET_CLASS(ioc);
+    AioContext *ioc_ctx = ioc->ctx ?: qemu_get_aio_context();
+
+    assert(qemu_in_coroutine());
+    assert(in_aio_context_home_thread(ioc_ctx));
+
+    return (write ? klass->io_co_writev : klass->io_co_readv) &&
+           ioc_ctx == qemu_get_current_aio_context() &&
+           aio_fd_ops_supported(ioc_ctx);
+}
+
+ssize_t coroutine_fn qio_channel_yield_readv(QIOChannel *ioc,
+                                             const struct iovec *iov,
+                                             size_t niov,
+                                             Error **errp)
+{
+    QIOChannelClass *klass = QIO_CHANNEL_GET_CLASS(ioc);
+    AioFdOp op;
+    ssize_t ret;
+
+    if (!qio_channel_use_fd_op(ioc, false)) {
+        qio_channel_yield(ioc, G_IO_IN);
+        return QIO_CHANNEL_ERR_BLOCK;
+    }
+
+    /* qio_channel_wake_read() cancels the operation */
+    assert(!ioc->read_op);
+    qatomic_set(&ioc->read_op, &op);
+    ret = klass->io_co_readv(ioc, &op, iov, niov, errp);
+    qatomic_set(&ioc->read_op, NULL);
+
+    return ret;
+}
+
+ssize_t coroutine_fn qio_channel_yield_writev(QIOChannel *ioc,
+                                              const struct iovec *iov,
+                                              size_t niov,
+                                              Error **errp)
+{
+    QIOChannelClass *klass = QIO_CHANNEL_GET_CLASS(ioc);
+    AioFdOp op;
+
+    if (!qio_channel_use_fd_op(ioc, true)) {
+        qio_channel_yield(ioc, G_IO_OUT);
+        return QIO_CHANNEL_ERR_BLOCK;
+    }
+
+    return klass->io_co_writev(ioc, &op, iov, niov, errp);
+}
+
+static void qio_channel_cancel_read_bh(void *opaque)
+{
+    QIOChannel *ioc = opaque;
+
+    /* read_op is only changed in this thread, so it is still in flight */
+    if (ioc->read_op) {
+        aio_fd_op_cancel(qemu_get_current_aio_context(), ioc->read_op);
+    }
+    object_unref(OBJECT(ioc));
+}
+
 void qio_channel_wake_read(QIOChannel *ioc)
 {
     Coroutine *co = qatomic_xchg(&ioc->read_coroutine, NULL);
+
     if (co) {
         aio_co_wake(co);
+        return;
+    }
+
+    /*
+     * The operation may complete at any time in the thread that submitted
+     * it, so only that thread can look at it and cancel it.
+     */
+    if (qatomic_read(&ioc->read_op)) {
+        object_ref(OBJECT(ioc));
+        aio_bh_schedule_oneshot(ioc->ctx ?: qemu_get_aio_context(),
+                                qio_channel_cancel_read_bh, ioc);
     }
 }
 
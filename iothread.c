@@ -17,6 +17,7 @@
 #include "qemu/module.h"
 #include "block/aio.h"
 #include "block/block.h"
+#include "block/thread-pool.h"
 #include "sysemu/event-loop-base.h"
 #include "sysemu/iothread.h"
 #include "qapi/error.h"
@@ -103,6 +104,7 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->io_uring_sqpoll_cpu = -1;
     iothread->thread_id = -1;
     qemu_sem_init(&iothread->init_done_sem, 0);
     /* By default, we don't run gcontext */
@@ -172,7 +174,8 @@ static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
                                errp);
 
     aio_context_set_thread_pool_params(iothread->ctx, base->thread_pool_min,
-                                       base->thread_pool_max, errp);
+                                       base->thread_pool_max,
+                                       base->thread_pool_context, errp);
 }
 
 
@@ -182,6 +185,11 @@ static void iothread_init(EventLoopBase *base, Error **errp)
     IOThread *iothread = IOTHREAD(base);
     char *thread_name;
 
+    if (iothread->io_uring_sqpoll_cpu >= 0 && !iothread->fdmon_io_uring) {
+        error_setg(errp, "io-uring-sqpoll-cpu requires fdmon-io-uring=on");
+        return;
+    }
+
     iothread->stopping = false;
     iothread->running = true;
     iothread->ctx = aio_context_new(errp);
@@ -189,6 +197,17 @@ static void iothread_init(EventLoopBase *base, Error **errp)
         return;
     }
 
+    aio_context_set_g_source_io_uring(iothread->ctx, iothread->fdmon_io_uring);
+
+    if (iothread->io_uring_sqpoll_cpu >= 0 &&
+        !aio_context_set_io_uring_sqpoll(iothread->ctx,
+                                         iothread->io_uring_sqpoll_cpu,
+                                         errp)) {
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
     /*
      * Init one GMainContext for the iothread unconditionally, even if
      * it's not used
@@ -291,6 +310,58 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 }
 
+static void iothread_get_io_uring_sqpoll_cpu(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    visit_type_int64(v, name, &iothread->io_uring_sqpoll_cpu, errp);
+}
+
+static void iothread_set_io_uring_sqpoll_cpu(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    int64_t value;
+
+    if (!visit_type_int64(v, name, &value, errp)) {
+        return;
+    }
+
+    if (value < -1 || value > INT_MAX) {
+        error_setg(errp, "%s value must be in range [-1, %d]", name, INT_MAX);
+        return;
+    }
+
+    if (iothread->ctx) {
+        error_setg(errp, "%s can only be set when the iothread is created",
+                   name);
+        return;
+    }
+
+    iothread->io_uring_sqpoll_cpu = value;
+}
+
+static bool iothread_get_fdmon_io_uring(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return iothread->fdmon_io_uring;
+}
+
+static void iothread_set_fdmon_io_uring(Object *obj, bool value, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (iothread->ctx) {
+        error_setg(errp, "fdmon-io-uring can only be set when the iothread "
+                   "is created");
+        return;
+    }
+
+    iothread->fdmon_io_uring = value;
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_CLASS(klass);
@@ -310,6 +381,13 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add_bool(klass, "fdmon-io-uring",
+                                   iothread_get_fdmon_io_uring,
+                                   iothread_set_fdmon_io_uring);
+    object_class_property_add(klass, "io-uring-sqpoll-cpu", "int",
+                              iothread_get_io_uring_sqpoll_cpu,
+                              iothread_set_io_uring_sqpoll_cpu,
+                              NULL, NULL);
 }
 
 static const TypeInfo iothread_info = {
@@ -338,6 +416,47 @@ AioContext *iothread_get_aio_context(IOThread *iothread)
     return iothread->ctx;
 }
 
+static IOThreadPollStats *iothread_get_poll_stats(IOThread *iothread)
+{
+    IOThreadPollStats *info = g_new0(IOThreadPollStats, 1);
+    uint64List **tail = &info->hit_histogram;
+    AioPollStats stats;
+    int i;
+
+    aio_context_get_poll_stats(iothread->ctx, &stats);
+
+    info->hits = stats.hits;
+    info->misses = stats.misses;
+    info->poll_ns = stats.poll_ns;
+    info->block_ns = stats.block_ns;
+    for (i = 0; i < AIO_POLL_HIT_HIST_BINS; i++) {
+        QAPI_LIST_APPEND(tail, stats.hit_hist[i]);
+    }
+
+    return info;
+}
+
+static ThreadPoolInfo *iothread_get_thread_pool_stats(IOThread *iothread)
+{
+    ThreadPoolInfo *info = g_new0(ThreadPoolInfo, 1);
+    ThreadPoolStats stats;
+
+    /* Pairs with the store in aio_get_thread_pool() */
+    thread_pool_get_stats(qatomic_load_acquire(&iothread->ctx->thread_pool),
+                          &stats);
+
+    info->workers = stats.workers;
+    info->queue_depth = stats.queue_depth;
+    info->max_queue_depth = stats.max_queue_depth;
+    info->completed = stats.completed;
+    info->stolen = stats.stolen;
+    info->queue_ns = stats.queue_ns;
+    info->max_queue_ns = stats.max_queue_ns;
+    info->run_ns = stats.run_ns;
+
+    return info;
+}
+
 static int query_one_iothread(Object *object, void *opaque)
 {
     IOThreadInfoList ***tail = opaque;
@@ -356,6 +475,8 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
     info->aio_max_batch = iothread->parent_obj.aio_max_batch;
+    info->poll_stats = iothread_get_poll_stats(iothread);
+    info->thread_pool_stats = iothread_get_thread_pool_stats(iothread);
 
     QAPI_LIST_APPEND(*tail, info);
     return 0;
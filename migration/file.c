@@ -0,0 +1,120 @@
+/*
+ * QEMU live migration to/from a regular file
+ *
+ * Copyright (c) 2023 QEMU contributors
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qapi/error.h"
+#include "channel.h"
+#include "file.h"
+#include "migration.h"
+#include "io/channel-file.h"
+#include "io/channel-util.h"
+#include "trace.h"
+
+#define OFFSET_OPTION ",offset="
+
+/*
+ * Split "<path>[,offset=<size>]" into its components. On success
+ * *filename must be freed by the caller.
+ */
+static int file_parse_filespec(const char *filespec, char **filename,
+                               uint64_t *offset, Error **errp)
+{
+    const char *opt = strstr(filespec, OFFSET_OPTION);
+    int ret;
+
+    *offset = 0;
+
+    if (!opt) {
+        *filename = g_strdup(filespec);
+        return 0;
+    }
+
+    ret = qemu_strtosz(opt + strlen(OFFSET_OPTION), NULL, offset);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "file URI has an invalid offset");
+        return ret;
+    }
+
+    *filename = g_strndup(filespec, opt - filespec);
+    return 0;
+}
+
+static QIOChannelFile *file_open_channel(const char *filespec, int flags,
+                                         Error **errp)
+{
+    g_autofree char *filename = NULL;
+    QIOChannelFile *fioc;
+    uint64_t offset;
+
+    if (file_parse_filespec(filespec, &filename, &offset, errp)) {
+        return NULL;
+    }
+
+    fioc = qio_channel_file_new_path(filename, flags, 0600, errp);
+    if (!fioc) {
+        return NULL;
+    }
+
+    if (offset &&
+        qio_channel_io_seek(QIO_CHANNEL(fioc), offset, SEEK_SET, errp) < 0) {
+        object_unref(OBJECT(fioc));
+        return NULL;
+    }
+
+    return fioc;
+}
+
+void file_start_outgoing_migration(MigrationState *s, const char *filespec,
+                                   Error **errp)
+{
+    QIOChannelFile *fioc;
+    QIOChannel *ioc;
+
+    trace_migration_file_outgoing(filespec);
+
+    fioc = file_open_channel(filespec, O_CREAT | O_WRONLY | O_TRUNC, errp);
+    if (!fioc) {
+        return;
+    }
+
+    ioc = QIO_CHANNEL(fioc);
+    qio_channel_set_name(ioc, "migration-file-outgoing");
+    migration_channel_connect(s, ioc, NULL, NULL);
+    object_unref(OBJECT(fioc));
+}
+
+static gboolean file_accept_incoming_migration(QIOChannel *ioc,
+                                               GIOCondition condition,
+                                               gpointer opaque)
+{
+    migration_channel_process_incoming(ioc);
+    object_unref(OBJECT(ioc));
+    return G_SOURCE_REMOVE;
+}
+
+void file_start_incoming_migration(const char *filespec, Error **errp)
+{
+    QIOChannelFile *fioc;
+    QIOChannel *ioc;
+
+    trace_migration_file_incoming(filespec);
+
+    fioc = file_open_channel(filespec, O_RDONLY, errp);
+    if (!fioc) {
+        return;
+    }
+
+    ioc = QIO_CHANNEL(fioc);
+    qio_channel_set_name(ioc, "migration-file-incoming");
+    qio_channel_add_watch_full(ioc, G_IO_IN,
+                               file_accept_incoming_migration,
+                               NULL, NULL,
+                               g_main_context_get_thread_default());
+}
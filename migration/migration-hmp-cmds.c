@@ -83,6 +83,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, "expected downtime: %" PRIu64 " ms\n",
                            info->expected_downtime);
         }
+        if (info->has_predicted_downtime) {
+            monitor_printf(mon, "predicted downtime: %" PRIu64 " ms\n",
+                           info->predicted_downtime);
+        }
         if (info->has_downtime) {
             monitor_printf(mon, "downtime: %" PRIu64 " ms\n",
                            info->downtime);
@@ -112,6 +116,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->ram->normal_bytes >> 10);
         monitor_printf(mon, "dirty sync count: %" PRIu64 "\n",
                        info->ram->dirty_sync_count);
+        monitor_printf(mon, "dirty sync time: %" PRIu64 " us "
+                       "(total %" PRIu64 " us)\n",
+                       info->ram->dirty_sync_time,
+                       info->ram->dirty_sync_total_time);
         monitor_printf(mon, "page size: %" PRIu64 " kbytes\n",
                        info->ram->page_size >> 10);
         monitor_printf(mon, "multifd bytes: %" PRIu64 " kbytes\n",
@@ -185,11 +193,59 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->compression->compression_rate);
     }
 
+    if (info->multifd_compression) {
+        monitor_printf(mon, "multifd compression method: %s\n",
+                       MultiFDCompression_str(
+                           info->multifd_compression->method));
+        monitor_printf(mon, "multifd compression pages: %" PRIu64 " pages\n",
+                       info->multifd_compression->pages);
+        monitor_printf(mon, "multifd compressed size: %" PRIu64 " kbytes\n",
+                       info->multifd_compression->compressed_size >> 10);
+        monitor_printf(mon, "multifd compression rate: %0.2f\n",
+                       info->multifd_compression->compression_rate);
+        monitor_printf(mon, "multifd compression time: %" PRIu64 " us\n",
+                       info->multifd_compression->compression_time);
+        monitor_printf(mon, "multifd compression throughput: %0.2f MiB/s\n",
+                       info->multifd_compression->throughput);
+    }
+
+    if (info->switchover_devices) {
+        MigrationSwitchoverDeviceList *dev;
+
+        monitor_printf(mon, "switchover devices:\n");
+        for (dev = info->switchover_devices; dev; dev = dev->next) {
+            MigrationSwitchoverDevice *d = dev->value;
+
+            monitor_printf(mon, "  %s/%u: predicted %" PRIu64 " bytes %"
+                           PRIu64 " us", d->idstr, d->instance_id,
+                           d->predicted_size, d->predicted_downtime);
+            if (d->has_size) {
+                monitor_printf(mon, ", actual %" PRIu64 " bytes %" PRIu64
+                               " us", d->size, d->downtime);
+            }
+            monitor_printf(mon, "\n");
+        }
+    }
+
     if (info->has_cpu_throttle_percentage) {
         monitor_printf(mon, "cpu throttle percentage: %" PRIu64 "\n",
                        info->cpu_throttle_percentage);
     }
 
+    if (info->has_dirty_limit_target) {
+        DirtyLimitInfoList *limit;
+
+        monitor_printf(mon, "dirty limit target: %" PRIu64 " MB/s\n",
+                       info->dirty_limit_target);
+        for (limit = info->dirty_limit_vcpus; limit; limit = limit->next) {
+            monitor_printf(mon, "  vcpu[%" PRIi64 "]: limit rate %" PRIu64
+                           " MB/s, current rate %" PRIu64 " MB/s\n",
+                           limit->value->cpu_index,
+                           limit->value->limit_rate,
+                           limit->value->current_rate);
+        }
+    }
+
     if (info->has_postcopy_blocktime) {
         monitor_printf(mon, "postcopy blocktime: %u\n",
                        info->postcopy_blocktime);
@@ -227,6 +283,53 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
     qapi_free_MigrationInfo(info);
 }
 
+void hmp_info_migrate_timeline(Monitor *mon, const QDict *qdict)
+{
+    MigrationTimelineSampleList *samples, *l;
+
+    samples = qmp_query_migrate_timeline(NULL);
+
+    if (!samples) {
+        monitor_printf(mon, "No migration timeline, enable the timeline "
+                       "capability before starting the migration\n");
+        return;
+    }
+
+    for (l = samples; l; l = l->next) {
+        MigrationTimelineSample *sample = l->value;
+        MigrationTimelineRAMBlockList *block;
+        uint64List *bytes;
+        int channel = 0;
+
+        monitor_printf(mon, "iteration %" PRIu64 " at %" PRIu64 " ms:\n",
+                       sample->iteration, sample->time);
+        monitor_printf(mon, "  dirty pages: %" PRIu64 "\n",
+                       sample->dirty_pages);
+        for (block = sample->ramblocks; block; block = block->next) {
+            monitor_printf(mon, "    %s: %" PRIu64 "\n",
+                           block->value->name, block->value->dirty_pages);
+        }
+        monitor_printf(mon, "  sync time: %" PRIu64 " us\n",
+                       sample->sync_time);
+        monitor_printf(mon, "  transferred: %" PRIu64 " kbytes\n",
+                       sample->transferred >> 10);
+        for (bytes = sample->multifd_bytes; bytes; bytes = bytes->next) {
+            monitor_printf(mon, "    multifd channel %d: %" PRIu64 " kbytes\n",
+                           channel++, bytes->value >> 10);
+        }
+        if (sample->has_compression_ratio) {
+            monitor_printf(mon, "  compression ratio: %0.2f\n",
+                           sample->compression_ratio);
+        }
+        monitor_printf(mon, "  cpu throttle percentage: %" PRId64 "\n",
+                       sample->cpu_throttle_percentage);
+        monitor_printf(mon, "  write stall time: %" PRIu64 " us\n",
+                       sample->write_stall_time);
+    }
+
+    qapi_free_MigrationTimelineSampleList(samples);
+}
+
 void hmp_info_migrate_capabilities(Monitor *mon, const QDict *qdict)
 {
     MigrationCapabilityStatusList *caps, *cap;
@@ -329,12 +432,22 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %s\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MULTIFD_COMPRESSION),
             MultiFDCompression_str(params->multifd_compression));
+        assert(params->has_zero_page_detection);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_ZERO_PAGE_DETECTION),
+            ZeroPageDetection_str(params->zero_page_detection));
         monitor_printf(mon, "%s: %" PRIu64 " bytes\n",
             MigrationParameter_str(MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE),
             params->xbzrle_cache_size);
         monitor_printf(mon, "%s: %" PRIu64 "\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MAX_POSTCOPY_BANDWIDTH),
             params->max_postcopy_bandwidth);
+        monitor_printf(mon, "%s: %" PRIu64 " bytes\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_POSTCOPY_PREFETCH_WINDOW),
+            params->postcopy_prefetch_window);
+        monitor_printf(mon, "%s: %" PRIu64 " bytes\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_POSTCOPY_HOT_SET_SIZE),
+            params->postcopy_hot_set_size);
         monitor_printf(mon, "%s: '%s'\n",
             MigrationParameter_str(MIGRATION_PARAMETER_TLS_AUTHZ),
             params->tls_authz);
@@ -577,6 +690,11 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         visit_type_MultiFDCompression(v, param, &p->multifd_compression,
                                       &err);
         break;
+    case MIGRATION_PARAMETER_ZERO_PAGE_DETECTION:
+        p->has_zero_page_detection = true;
+        visit_type_ZeroPageDetection(v, param, &p->zero_page_detection,
+                                     &err);
+        break;
     case MIGRATION_PARAMETER_MULTIFD_ZLIB_LEVEL:
         p->has_multifd_zlib_level = true;
         visit_type_uint8(v, param, &p->multifd_zlib_level, &err);
@@ -600,6 +718,14 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_max_postcopy_bandwidth = true;
         visit_type_size(v, param, &p->max_postcopy_bandwidth, &err);
         break;
+    case MIGRATION_PARAMETER_POSTCOPY_PREFETCH_WINDOW:
+        p->has_postcopy_prefetch_window = true;
+        visit_type_size(v, param, &p->postcopy_prefetch_window, &err);
+        break;
+    case MIGRATION_PARAMETER_POSTCOPY_HOT_SET_SIZE:
+        p->has_postcopy_hot_set_size = true;
+        visit_type_size(v, param, &p->postcopy_hot_set_size, &err);
+        break;
     case MIGRATION_PARAMETER_ANNOUNCE_INITIAL:
         p->has_announce_initial = true;
         visit_type_size(v, param, &p->announce_initial, &err);
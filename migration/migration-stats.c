@@ -12,6 +12,9 @@
 
 #include "qemu/osdep.h"
 #include "qemu/stats64.h"
+#include "qemu/lockable.h"
+#include "qapi/clone-visitor.h"
+#include "qapi/qapi-visit-migration.h"
 #include "qemu-file.h"
 #include "trace.h"
 #include "migration-stats.h"
@@ -66,3 +69,68 @@ uint64_t migration_transferred_bytes(QEMUFile *f)
     trace_migration_transferred_bytes(qemu_file, multifd);
     return qemu_file + multifd;
 }
+
+/*
+ * The samples are recorded by the migration thread and read by the
+ * monitor, the lock protects everything but @enabled.
+ */
+static struct {
+    QemuMutex lock;
+    bool enabled;
+    MigrationTimelineSample *samples[MIGRATION_TIMELINE_SIZE];
+    /* Number of samples recorded since the reset */
+    uint64_t count;
+} timeline;
+
+static void __attribute__((__constructor__)) migration_timeline_init(void)
+{
+    qemu_mutex_init(&timeline.lock);
+}
+
+void migration_timeline_reset(bool enable)
+{
+    int i;
+
+    QEMU_LOCK_GUARD(&timeline.lock);
+    for (i = 0; i < MIGRATION_TIMELINE_SIZE; i++) {
+        qapi_free_MigrationTimelineSample(timeline.samples[i]);
+        timeline.samples[i] = NULL;
+    }
+    timeline.count = 0;
+    qatomic_set(&timeline.enabled, enable);
+}
+
+bool migration_timeline_enabled(void)
+{
+    return qatomic_read(&timeline.enabled);
+}
+
+void migration_timeline_record(MigrationTimelineSample *sample)
+{
+    MigrationTimelineSample **slot;
+
+    QEMU_LOCK_GUARD(&timeline.lock);
+    slot = &timeline.samples[timeline.count % MIGRATION_TIMELINE_SIZE];
+    qapi_free_MigrationTimelineSample(*slot);
+    *slot = sample;
+    timeline.count++;
+}
+
+MigrationTimelineSampleList *migration_timeline_get(void)
+{
+    MigrationTimelineSampleList *head = NULL;
+    uint64_t first, i;
+
+    QEMU_LOCK_GUARD(&timeline.lock);
+    first = timeline.count > MIGRATION_TIMELINE_SIZE ?
+            timeline.count - MIGRATION_TIMELINE_SIZE : 0;
+    /* Walk backwards so that prepending leaves the oldest sample first */
+    for (i = timeline.count; i > first; i--) {
+        MigrationTimelineSample *sample =
+            timeline.samples[(i - 1) % MIGRATION_TIMELINE_SIZE];
+
+        QAPI_LIST_PREPEND(head, QAPI_CLONE(MigrationTimelineSample, sample));
+    }
+
+    return head;
+}
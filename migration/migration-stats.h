@@ -14,6 +14,7 @@
 #define QEMU_MIGRATION_STATS_H
 
 #include "qemu/stats64.h"
+#include "qapi/qapi-types-migration.h"
 
 /*
  * Amount of time to allocate to each "chunk" of bandwidth-throttled
@@ -55,6 +56,18 @@ typedef struct {
      * copy.
      */
     Stat64 dirty_sync_missed_zero_copy;
+    /*
+     * Time taken by the last synchronization of the guest bitmaps, and
+     * by all of them, in microseconds.
+     */
+    Stat64 dirty_sync_time_us;
+    Stat64 dirty_sync_total_time_us;
+    /*
+     * Time spent writing to the migration channels, in nanoseconds,
+     * summed over all channels.  Only accounted while the migration
+     * timeline is recorded.
+     */
+    Stat64 channel_write_time_ns;
     /*
      * Number of bytes sent at migration completion stage while the
      * guest is stopped.
@@ -64,6 +77,17 @@ typedef struct {
      * Number of bytes sent through multifd channels.
      */
     Stat64 multifd_bytes;
+    /*
+     * Number of bytes handed to the multifd compression method, and
+     * number of bytes it produced.
+     */
+    Stat64 multifd_compress_in_bytes;
+    Stat64 multifd_compress_out_bytes;
+    /*
+     * Time spent in the multifd compression method, in nanoseconds,
+     * summed over all channels.
+     */
+    Stat64 multifd_compress_time_ns;
     /*
      * Number of pages transferred that were not full of zeros.
      */
@@ -136,4 +160,38 @@ void migration_rate_set(uint64_t new_rate);
  * channel, multifd, qemu_file, rdma, ....
  */
 uint64_t migration_transferred_bytes(QEMUFile *f);
+
+/* Number of samples kept by the migration timeline */
+#define MIGRATION_TIMELINE_SIZE 256
+
+/**
+ * migration_timeline_reset: Start a new migration timeline.
+ *
+ * Drops the samples of the previous migration.
+ *
+ * @enable: whether samples will be recorded
+ */
+void migration_timeline_reset(bool enable);
+
+/**
+ * migration_timeline_enabled: Return whether samples are recorded.
+ */
+bool migration_timeline_enabled(void);
+
+/**
+ * migration_timeline_record: Add a sample to the migration timeline.
+ *
+ * The oldest sample is dropped once MIGRATION_TIMELINE_SIZE samples
+ * have been recorded.
+ *
+ * @sample: the sample, which is owned by the timeline afterwards
+ */
+void migration_timeline_record(MigrationTimelineSample *sample);
+
+/**
+ * migration_timeline_get: Return a copy of the migration timeline.
+ *
+ * Returns the recorded samples, oldest first.
+ */
+MigrationTimelineSampleList *migration_timeline_get(void);
 #endif
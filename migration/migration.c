@@ -17,13 +17,16 @@
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/units.h"
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/dirtylimit.h"
 #include "rdma.h"
 #include "ram.h"
 #include "ram-compress.h"
@@ -117,6 +120,11 @@ migration_channels_and_uri_compatible(const char *uri, Error **errp)
         return false;
     }
 
+    if (migrate_mapped_ram() && !strstart(uri, "file:", NULL)) {
+        error_setg(errp, "Mapped-ram migration requires a file: URI");
+        return false;
+    }
+
     return true;
 }
 
@@ -305,17 +313,17 @@ static int migrate_send_rp_message(MigrationIncomingState *mis,
     return ret;
 }
 
-/* Request one page from the source VM at the given start address.
+/* Request pages from the source VM at the given start address.
  *   rb: the RAMBlock to request the page in
  *   Start: Address offset within the RB
  *   Len: Length in bytes required - must be a multiple of pagesize
  */
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start)
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len)
 {
     uint8_t bufc[12 + 1 + 255]; /* start (8), len (4), rbname up to 256 */
     size_t msglen = 12; /* start + len */
-    size_t len = qemu_ram_pagesize(rb);
     enum mig_rp_message_type msg_type;
     const char *rbname;
     int rbname_len;
@@ -375,7 +383,8 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis,
         return 0;
     }
 
-    return migrate_send_rp_message_req_pages(mis, rb, start);
+    return migrate_send_rp_message_req_pages(mis, rb, start,
+                                             qemu_ram_pagesize(rb));
 }
 
 static bool migration_colo_enabled;
@@ -442,6 +451,8 @@ static void qemu_start_incoming_migration(const char *uri, Error **errp)
         exec_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -924,6 +935,10 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         stat64_get(&mig_stats.dirty_sync_count);
     info->ram->dirty_sync_missed_zero_copy =
         stat64_get(&mig_stats.dirty_sync_missed_zero_copy);
+    info->ram->dirty_sync_time =
+        stat64_get(&mig_stats.dirty_sync_time_us);
+    info->ram->dirty_sync_total_time =
+        stat64_get(&mig_stats.dirty_sync_total_time_us);
     info->ram->postcopy_requests =
         stat64_get(&mig_stats.postcopy_requests);
     info->ram->page_size = page_size;
@@ -955,11 +970,36 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
                                     compression_counters.compression_rate;
     }
 
+    if (migrate_multifd() &&
+        migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE) {
+        uint64_t in = stat64_get(&mig_stats.multifd_compress_in_bytes);
+        uint64_t out = stat64_get(&mig_stats.multifd_compress_out_bytes);
+        uint64_t time_ns = stat64_get(&mig_stats.multifd_compress_time_ns);
+
+        info->multifd_compression =
+            g_malloc0(sizeof(*info->multifd_compression));
+        info->multifd_compression->method = migrate_multifd_compression();
+        info->multifd_compression->pages = in / page_size;
+        info->multifd_compression->compressed_size = out;
+        info->multifd_compression->compression_rate =
+            out ? (double)in / out : 0;
+        info->multifd_compression->compression_time = time_ns / SCALE_US;
+        info->multifd_compression->throughput = time_ns ?
+            ((double)in / MiB) / ((double)time_ns / NANOSECONDS_PER_SECOND) :
+            0;
+    }
+
     if (cpu_throttle_active()) {
         info->has_cpu_throttle_percentage = true;
         info->cpu_throttle_percentage = cpu_throttle_get_percentage();
     }
 
+    if (migrate_dirty_limit() && dirtylimit_migration_active()) {
+        info->has_dirty_limit_target = true;
+        info->dirty_limit_target = s->dirty_limit_target;
+        info->dirty_limit_vcpus = qmp_query_vcpu_dirty_limit(NULL);
+    }
+
     if (s->state != MIGRATION_STATUS_COMPLETED) {
         info->ram->remaining = ram_bytes_remaining();
         info->ram->dirty_pages_rate =
@@ -977,6 +1017,13 @@ static void populate_disk_info(MigrationInfo *info)
     }
 }
 
+static void populate_switchover_info(MigrationInfo *info)
+{
+    info->predicted_downtime =
+        qemu_savevm_state_stopcopy_info(&info->switchover_devices);
+    info->has_predicted_downtime = true;
+}
+
 static void fill_source_migration_info(MigrationInfo *info)
 {
     MigrationState *s = migrate_get_current();
@@ -1021,6 +1068,7 @@ static void fill_source_migration_info(MigrationInfo *info)
         populate_ram_info(info, s);
         populate_disk_info(info);
         populate_vfio_info(info);
+        populate_switchover_info(info);
         break;
     case MIGRATION_STATUS_COLO:
         info->has_status = true;
@@ -1030,6 +1078,7 @@ static void fill_source_migration_info(MigrationInfo *info)
         populate_time_info(info, s);
         populate_ram_info(info, s);
         populate_vfio_info(info);
+        populate_switchover_info(info);
         break;
     case MIGRATION_STATUS_FAILED:
         info->has_status = true;
@@ -1089,6 +1138,11 @@ MigrationInfo *qmp_query_migrate(Error **errp)
     return info;
 }
 
+MigrationTimelineSampleList *qmp_query_migrate_timeline(Error **errp)
+{
+    return migration_timeline_get();
+}
+
 void qmp_migrate_start_postcopy(Error **errp)
 {
     MigrationState *s = migrate_get_current();
@@ -1405,6 +1459,8 @@ void migrate_init(MigrationState *s)
     s->vm_old_state = -1;
     s->iteration_initial_bytes = 0;
     s->threshold_size = 0;
+    s->bandwidth = 0;
+    s->dirty_limit_target = 0;
 }
 
 int migrate_add_blocker_internal(Error *reason, Error **errp)
@@ -1621,6 +1677,7 @@ static bool migrate_prepare(MigrationState *s, bool blk, bool blk_inc,
      */
     memset(&mig_stats, 0, sizeof(mig_stats));
     memset(&compression_counters, 0, sizeof(compression_counters));
+    migration_timeline_reset(migrate_timeline());
 
     return true;
 }
@@ -1662,6 +1719,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         exec_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         if (!(has_resume && resume)) {
             yank_unregister_instance(MIGRATION_YANK_INSTANCE);
@@ -2113,6 +2172,7 @@ static int postcopy_start(MigrationState *ms)
      */
     if (migrate_postcopy_ram()) {
         ram_postcopy_send_discard_bitmap(ms);
+        ram_postcopy_queue_hot_set();
     }
 
     /*
@@ -2665,6 +2725,7 @@ static void migration_update_counters(MigrationState *s,
     transferred = current_bytes - s->iteration_initial_bytes;
     time_spent = current_time - s->iteration_start_time;
     bandwidth = (double)transferred / time_spent;
+    s->bandwidth = bandwidth;
     s->threshold_size = bandwidth * migrate_downtime_limit();
 
     s->mbps = (((double) transferred * 8.0) /
@@ -2708,20 +2769,26 @@ static MigIterateState migration_iteration_run(MigrationState *s)
 {
     uint64_t must_precopy, can_postcopy;
     bool in_postcopy = s->state == MIGRATION_STATUS_POSTCOPY_ACTIVE;
+    /*
+     * Device state that is only sent once the guest is stopped, and
+     * the fixed cost of stopping each device, count against the
+     * downtime just like the remaining RAM does.
+     */
+    uint64_t stopcopy_size = qemu_savevm_state_stopcopy_size(s->bandwidth);
 
     qemu_savevm_state_pending_estimate(&must_precopy, &can_postcopy);
     uint64_t pending_size = must_precopy + can_postcopy;
 
     trace_migrate_pending_estimate(pending_size, must_precopy, can_postcopy);
 
-    if (must_precopy <= s->threshold_size) {
+    if (must_precopy + stopcopy_size <= s->threshold_size) {
         qemu_savevm_state_pending_exact(&must_precopy, &can_postcopy);
         pending_size = must_precopy + can_postcopy;
         trace_migrate_pending_exact(pending_size, must_precopy, can_postcopy);
     }
 
-    if (!pending_size || pending_size < s->threshold_size) {
-        trace_migration_thread_low_pending(pending_size);
+    if (!pending_size || pending_size + stopcopy_size < s->threshold_size) {
+        trace_migration_thread_low_pending(pending_size, stopcopy_size);
         migration_completion(s);
         return MIG_ITERATE_BREAK;
     }
@@ -2746,6 +2813,10 @@ static void migration_iteration_finish(MigrationState *s)
     cpu_throttle_stop();
 
     qemu_mutex_lock_iothread();
+    /* Likewise for the vCPU quotas set by dirty-limit */
+    if (migrate_dirty_limit()) {
+        dirtylimit_migration_cancel();
+    }
     switch (s->state) {
     case MIGRATION_STATUS_COMPLETED:
         migration_calculate_complete(s);
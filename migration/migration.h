@@ -66,6 +66,22 @@ typedef struct {
     bool all_zero;
 } PostcopyTmpPage;
 
+/* Number of sequential fault streams tracked for postcopy prefetch */
+#define POSTCOPY_PREFETCH_STREAMS 8
+
+/* A run of sequential faults seen by the postcopy fault thread */
+typedef struct {
+    RAMBlock *rb;
+    /* Offset of the last fault of the stream */
+    ram_addr_t last;
+    /* End of what has been requested so far for the stream */
+    ram_addr_t end;
+    /* How much to request ahead of the next fault */
+    uint64_t window;
+    /* Last use, to pick the stream to recycle */
+    uint64_t stamp;
+} PostcopyPrefetchStream;
+
 typedef enum {
     PREEMPT_THREAD_NONE = 0,
     PREEMPT_THREAD_CREATED,
@@ -210,6 +226,10 @@ struct MigrationIncomingState {
      * contains valid information.
      */
     QemuMutex page_request_mutex;
+
+    /* Streams for postcopy-prefetch-window, only used by the fault thread */
+    PostcopyPrefetchStream prefetch_streams[POSTCOPY_PREFETCH_STREAMS];
+    uint64_t prefetch_stamp;
 };
 
 MigrationIncomingState *migration_incoming_get_current(void);
@@ -279,6 +299,10 @@ struct MigrationState {
      * measured bandwidth
      */
     int64_t threshold_size;
+    /* bandwidth measured in the last iteration, in bytes per millisecond */
+    double bandwidth;
+    /* aggregate dirty page rate aimed at by dirty-limit, in MB/s */
+    uint64_t dirty_limit_target;
 
     /* params from 'migrate-set-parameters' */
     MigrationParameters parameters;
@@ -423,6 +447,14 @@ struct MigrationState {
      * Default value is false. (since 8.1)
      */
     bool multifd_flush_after_each_section;
+    /*
+     * Let the multifd send threads delta encode pages with XBZRLE when
+     * the xbzrle capability is set.  This adds MULTIFD_FLAG_XBZRLE
+     * packets to the stream, which older QEMUs reject, so it is off for
+     * older machine types.  Without it XBZRLE is not used with multifd.
+     * Default value is true. (since 8.1)
+     */
+    bool multifd_xbzrle;
     /*
      * This decides the size of guest memory chunk that will be used
      * to track dirty bitmap clearing.  The size of memory chunk will
@@ -476,7 +508,8 @@ void migrate_send_rp_pong(MigrationIncomingState *mis,
 int migrate_send_rp_req_pages(MigrationIncomingState *mis, RAMBlock *rb,
                               ram_addr_t start, uint64_t haddr);
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start);
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len);
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
                                  char *block_name);
 void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value);
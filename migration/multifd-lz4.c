@@ -0,0 +1,282 @@
+/*
+ * Multifd lz4 compression implementation
+ *
+ * Copyright (c) 2023 QEMU contributors
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <lz4.h>
+#include "qemu/rcu.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "options.h"
+#include "multifd.h"
+
+/*
+ * Every packet is compressed as a single lz4 block: the normal pages
+ * of the packet are first gathered into a contiguous buffer so that
+ * matches can span page boundaries, and the compressor only runs once
+ * per packet instead of once per page.
+ *
+ * Each channel keeps an lz4 stream, so the tail of the previous packet
+ * of the same channel acts as dictionary for the next one.  lz4
+ * requires the previous block to stay at the same address, hence the
+ * two gather buffers that are used alternately on both sides.  Packets
+ * are processed in order on a channel, which keeps both streams in
+ * step.
+ */
+
+/* lz4 default, favour speed over ratio */
+#define MULTIFD_LZ4_ACCELERATION 1
+
+struct lz4_data {
+    /* stream for compression */
+    LZ4_stream_t *stream;
+    /* stream for decompression */
+    LZ4_streamDecode_t *dstream;
+    /* gather buffers, used alternately */
+    uint8_t *buf[2];
+    /* index of the gather buffer to use for the next packet */
+    unsigned int cur;
+    /* size of each gather buffer */
+    uint32_t buf_len;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+};
+
+static void lz4_data_free(struct lz4_data *z)
+{
+    if (z->stream) {
+        LZ4_freeStream(z->stream);
+    }
+    if (z->dstream) {
+        LZ4_freeStreamDecode(z->dstream);
+    }
+    g_free(z->buf[0]);
+    g_free(z->buf[1]);
+    g_free(z->zbuff);
+    g_free(z);
+}
+
+static bool lz4_alloc_buffers(struct lz4_data *z, uint32_t page_count,
+                              uint32_t page_size)
+{
+    z->buf_len = page_count * page_size;
+    z->buf[0] = g_try_malloc(z->buf_len);
+    z->buf[1] = g_try_malloc(z->buf_len);
+    z->zbuff_len = LZ4_compressBound(z->buf_len);
+    z->zbuff = g_try_malloc(z->zbuff_len);
+
+    return z->buf[0] && z->buf[1] && z->zbuff;
+}
+
+/* Multifd lz4 compression */
+
+/**
+ * lz4_send_setup: setup send side
+ *
+ * Setup each channel with lz4 compression.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->stream = LZ4_createStream();
+    if (!z->stream) {
+        lz4_data_free(z);
+        error_setg(errp, "multifd %u: lz4 createStream failed", p->id);
+        return -1;
+    }
+
+    if (!lz4_alloc_buffers(z, p->page_count, p->page_size)) {
+        lz4_data_free(z);
+        error_setg(errp, "multifd %u: out of memory for lz4 buffers", p->id);
+        return -1;
+    }
+
+    p->data = z;
+    return 0;
+}
+
+/**
+ * lz4_send_cleanup: cleanup send side
+ *
+ * Close the channel and return memory.
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void lz4_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    lz4_data_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_send_prepare: prepare date to be able to send
+ *
+ * Gather all the pages that we are going to send and compress them
+ * with a single call.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = p->data;
+    uint8_t *src = z->buf[z->cur];
+    uint32_t in_len = p->normal_num * p->page_size;
+    uint32_t i;
+    int ret;
+
+    for (i = 0; i < p->normal_num; i++) {
+        memcpy(src + i * p->page_size, p->pages->block->host + p->normal[i],
+               p->page_size);
+    }
+
+    ret = LZ4_compress_fast_continue(z->stream, (const char *)src,
+                                     (char *)z->zbuff, in_len, z->zbuff_len,
+                                     MULTIFD_LZ4_ACCELERATION);
+    if (ret <= 0) {
+        error_setg(errp, "multifd %u: lz4 compression failed", p->id);
+        return -1;
+    }
+    z->cur ^= 1;
+
+    p->iov[p->iovs_num].iov_base = z->zbuff;
+    p->iov[p->iovs_num].iov_len = ret;
+    p->iovs_num++;
+    p->next_packet_size = ret;
+    p->flags |= MULTIFD_FLAG_LZ4;
+
+    return 0;
+}
+
+/**
+ * lz4_recv_setup: setup receive side
+ *
+ * Create the decompression stream and buffers.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->dstream = LZ4_createStreamDecode();
+    if (!z->dstream) {
+        lz4_data_free(z);
+        error_setg(errp, "multifd %u: lz4 createStreamDecode failed", p->id);
+        return -1;
+    }
+
+    if (!lz4_alloc_buffers(z, p->page_count, p->page_size)) {
+        lz4_data_free(z);
+        error_setg(errp, "multifd %u: out of memory for lz4 buffers", p->id);
+        return -1;
+    }
+
+    p->data = z;
+    return 0;
+}
+
+/**
+ * lz4_recv_cleanup: cleanup receive side
+ *
+ * Close the channel and return memory.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_recv_cleanup(MultiFDRecvParams *p)
+{
+    lz4_data_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the compressed buffer, uncompress it and scatter it into the
+ * actual pages.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv_pages(MultiFDRecvParams *p, Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    uint32_t expected_size = p->normal_num * p->page_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    struct lz4_data *z = p->data;
+    uint8_t *dst = z->buf[z->cur];
+    uint32_t i;
+    int ret;
+
+    if (flags != MULTIFD_FLAG_LZ4) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_LZ4);
+        return -1;
+    }
+
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %u: compressed size %u exceeds bound %u",
+                   p->id, in_size, z->zbuff_len);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    ret = LZ4_decompress_safe_continue(z->dstream, (const char *)z->zbuff,
+                                       (char *)dst, in_size, expected_size);
+    if (ret < 0 || (uint32_t)ret != expected_size) {
+        error_setg(errp, "multifd %u: packet size received %d size expected %u",
+                   p->id, ret, expected_size);
+        return -1;
+    }
+    z->cur ^= 1;
+
+    for (i = 0; i < p->normal_num; i++) {
+        memcpy(p->host + p->normal[i], dst + i * p->page_size, p->page_size);
+    }
+
+    return 0;
+}
+
+static MultiFDMethods multifd_lz4_ops = {
+    .send_setup = lz4_send_setup,
+    .send_cleanup = lz4_send_cleanup,
+    .send_prepare = lz4_send_prepare,
+    .recv_setup = lz4_recv_setup,
+    .recv_cleanup = lz4_recv_cleanup,
+    .recv_pages = lz4_recv_pages
+};
+
+static void multifd_lz4_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_LZ4, &multifd_lz4_ops);
+}
+
+migration_init(multifd_lz4_register);
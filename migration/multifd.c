@@ -11,7 +11,9 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/cutils.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
@@ -30,6 +32,7 @@
 #include "qemu/yank.h"
 #include "io/channel-socket.h"
 #include "yank_functions.h"
+#include "xbzrle.h"
 
 /* Multiple fd's */
 
@@ -47,10 +50,49 @@ typedef struct {
 
 /* Multifd without compression */
 
+/*
+ * With the xbzrle capability, once the first round of the migration is
+ * done, the normal pages of a packet are delta encoded against the copy
+ * kept in the XBZRLE cache (see xbzrle_multifd_encode_page()).  The data
+ * of the packet is then an array with the big endian length of each
+ * page, followed by the pages: a length of 0 means the page did not
+ * change, a length of page_size means the page is sent as is, anything
+ * else is XBZRLE encoded data to apply on the current page.
+ */
+typedef struct {
+    /* copy of the page being encoded */
+    uint8_t *current;
+    /* length of each page, big endian */
+    uint32_t *len;
+    /* encoded or plain pages */
+    uint8_t *buf;
+} MultiFDXbzrle;
+
+static MultiFDXbzrle *multifd_xbzrle_new(uint32_t page_count,
+                                         uint32_t page_size)
+{
+    MultiFDXbzrle *x = g_new0(MultiFDXbzrle, 1);
+
+    x->current = g_malloc(page_size);
+    x->len = g_new(uint32_t, page_count);
+    x->buf = g_malloc((size_t)page_count * page_size);
+    return x;
+}
+
+static void multifd_xbzrle_free(MultiFDXbzrle *x)
+{
+    if (x) {
+        g_free(x->current);
+        g_free(x->len);
+        g_free(x->buf);
+        g_free(x);
+    }
+}
+
 /**
  * nocomp_send_setup: setup send side
  *
- * For no compression this function does nothing.
+ * For no compression this only allocates the XBZRLE buffers if needed.
  *
  * Returns 0 for success or -1 for error
  *
@@ -59,20 +101,67 @@ typedef struct {
  */
 static int nocomp_send_setup(MultiFDSendParams *p, Error **errp)
 {
+    if (migrate_multifd_xbzrle()) {
+        p->data = multifd_xbzrle_new(p->page_count, p->page_size);
+    }
     return 0;
 }
 
 /**
  * nocomp_send_cleanup: cleanup send side
  *
- * For no compression this function does nothing.
+ * For no compression this only frees the XBZRLE buffers.
  *
  * @p: Params for the channel that we are using
  * @errp: pointer to an error
  */
 static void nocomp_send_cleanup(MultiFDSendParams *p, Error **errp)
 {
-    return;
+    multifd_xbzrle_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * nocomp_send_prepare_xbzrle: delta encode the pages of the packet
+ *
+ * Pages are copied out of guest memory before being encoded, so that
+ * what is sent matches what is cached.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void nocomp_send_prepare_xbzrle(MultiFDSendParams *p)
+{
+    MultiFDXbzrle *x = p->data;
+    RAMBlock *block = p->pages->block;
+    uint32_t used = 0;
+
+    for (int i = 0; i < p->normal_num; i++) {
+        uint8_t *out = x->buf + used;
+        int len;
+
+        memcpy(x->current, block->host + p->normal[i], p->page_size);
+        /* Keep encoded pages shorter than a plain one */
+        len = xbzrle_multifd_encode_page(block->offset + p->normal[i],
+                                         x->current, out, p->page_size - 1);
+        if (len < 0) {
+            memcpy(out, x->current, p->page_size);
+            len = p->page_size;
+        }
+        x->len[i] = cpu_to_be32(len);
+        used += len;
+    }
+
+    p->iov[p->iovs_num].iov_base = x->len;
+    p->iov[p->iovs_num].iov_len = p->normal_num * sizeof(uint32_t);
+    p->iovs_num++;
+    if (used) {
+        p->iov[p->iovs_num].iov_base = x->buf;
+        p->iov[p->iovs_num].iov_len = used;
+        p->iovs_num++;
+    }
+
+    p->next_packet_size = p->normal_num * sizeof(uint32_t) + used;
+    p->flags |= MULTIFD_FLAG_NOCOMP | MULTIFD_FLAG_XBZRLE;
 }
 
 /**
@@ -90,6 +179,11 @@ static int nocomp_send_prepare(MultiFDSendParams *p, Error **errp)
 {
     MultiFDPages_t *pages = p->pages;
 
+    if (p->data && xbzrle_multifd_active()) {
+        nocomp_send_prepare_xbzrle(p);
+        return 0;
+    }
+
     for (int i = 0; i < p->normal_num; i++) {
         p->iov[p->iovs_num].iov_base = pages->block->host + p->normal[i];
         p->iov[p->iovs_num].iov_len = p->page_size;
@@ -125,6 +219,77 @@ static int nocomp_recv_setup(MultiFDRecvParams *p, Error **errp)
  */
 static void nocomp_recv_cleanup(MultiFDRecvParams *p)
 {
+    multifd_xbzrle_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * nocomp_recv_pages_xbzrle: read and apply XBZRLE encoded pages
+ *
+ * The destination pages still hold what was sent for them last, which
+ * is what the source encoded against.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int nocomp_recv_pages_xbzrle(MultiFDRecvParams *p, Error **errp)
+{
+    uint32_t len_size = p->normal_num * sizeof(uint32_t);
+    uint64_t total = 0;
+    MultiFDXbzrle *x;
+    uint8_t *src;
+    int ret;
+
+    if (!p->data) {
+        p->data = multifd_xbzrle_new(p->page_count, p->page_size);
+    }
+    x = p->data;
+
+    ret = qio_channel_read_all(p->c, (void *)x->len, len_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (int i = 0; i < p->normal_num; i++) {
+        x->len[i] = be32_to_cpu(x->len[i]);
+        if (x->len[i] > p->page_size) {
+            error_setg(errp, "multifd %u: xbzrle page length %u exceeds %u",
+                       p->id, x->len[i], p->page_size);
+            return -1;
+        }
+        total += x->len[i];
+    }
+    if (total + len_size != p->next_packet_size) {
+        error_setg(errp, "multifd %u: xbzrle packet size %" PRIu64
+                   " expected %u", p->id, total + len_size,
+                   p->next_packet_size);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)x->buf, total, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    src = x->buf;
+    for (int i = 0; i < p->normal_num; i++) {
+        uint8_t *host = p->host + p->normal[i];
+
+        if (x->len[i] == p->page_size) {
+            memcpy(host, src, p->page_size);
+        } else if (x->len[i] &&
+                   xbzrle_decode_buffer(src, x->len[i], host,
+                                        p->page_size) < 0) {
+            error_setg(errp, "multifd %u: failed to decode xbzrle page "
+                       "at offset 0x%" PRIx64, p->id, (uint64_t)p->normal[i]);
+            return -1;
+        }
+        src += x->len[i];
+    }
+
+    return 0;
 }
 
 /**
@@ -146,6 +311,9 @@ static int nocomp_recv_pages(MultiFDRecvParams *p, Error **errp)
                    p->id, flags, MULTIFD_FLAG_NOCOMP);
         return -1;
     }
+    if (p->flags & MULTIFD_FLAG_XBZRLE) {
+        return nocomp_recv_pages_xbzrle(p, errp);
+    }
     for (int i = 0; i < p->normal_num; i++) {
         p->iov[i].iov_base = p->host + p->normal[i];
         p->iov[i].iov_len = p->page_size;
@@ -266,6 +434,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->flags = cpu_to_be32(p->flags);
     packet->pages_alloc = cpu_to_be32(p->pages->allocated);
     packet->normal_pages = cpu_to_be32(p->normal_num);
+    packet->zero_pages = cpu_to_be32(p->zero_num);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
 
@@ -279,6 +448,13 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
 
         packet->offset[i] = cpu_to_be64(temp);
     }
+
+    for (i = 0; i < p->zero_num; i++) {
+        /* there are architectures where ram_addr_t is 32 bit */
+        uint64_t temp = p->zero[i];
+
+        packet->offset[p->normal_num + i] = cpu_to_be64(temp);
+    }
 }
 
 static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
@@ -324,10 +500,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->zero_num = be32_to_cpu(packet->zero_pages);
+    if (p->zero_num > packet->pages_alloc - p->normal_num) {
+        error_setg(errp, "multifd: received packet "
+                   "with %u zero pages and expected maximum zero pages are %u",
+                   p->zero_num, packet->pages_alloc - p->normal_num) ;
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->normal_num == 0) {
+    if (p->normal_num == 0 && p->zero_num == 0) {
         return 0;
     }
 
@@ -353,9 +537,75 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->normal[i] = offset;
     }
 
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t offset = be64_to_cpu(packet->offset[p->normal_num + i]);
+
+        if (offset > (p->block->used_length - p->page_size)) {
+            error_setg(errp, "multifd: offset too long %" PRIu64
+                       " (max " RAM_ADDR_FMT ")",
+                       offset, p->block->used_length);
+            return -1;
+        }
+        p->zero[i] = offset;
+    }
+
     return 0;
 }
 
+/**
+ * multifd_send_zero_page_detect: split the pages to send into normal
+ * and zero pages
+ *
+ * When zero page detection is done by the multifd threads, the
+ * migration thread queues every dirty page and each channel checks its
+ * own pages here.  Zero pages are then only sent as an offset in the
+ * packet header.
+ *
+ * @p: Params for the channel that we are using
+ * @use_zero_page_detection: whether this channel has to check for zero
+ *                           pages
+ */
+static void multifd_send_zero_page_detect(MultiFDSendParams *p,
+                                          bool use_zero_page_detection)
+{
+    MultiFDPages_t *pages = p->pages;
+
+    p->normal_num = 0;
+    p->zero_num = 0;
+
+    for (int i = 0; i < pages->num; i++) {
+        ram_addr_t offset = pages->offset[i];
+
+        if (use_zero_page_detection &&
+            buffer_is_zero(pages->block->host + offset, p->page_size)) {
+            p->zero[p->zero_num] = offset;
+            p->zero_num++;
+        } else {
+            p->normal[p->normal_num] = offset;
+            p->normal_num++;
+        }
+    }
+}
+
+/**
+ * multifd_recv_zero_page_process: zero the pages received as zero pages
+ *
+ * Pages that the destination never touched are already zero, so we
+ * only write to the pages that are not.  That avoids allocating memory
+ * for the zero pages of the guest.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_recv_zero_page_process(MultiFDRecvParams *p)
+{
+    for (int i = 0; i < p->zero_num; i++) {
+        void *page = p->host + p->zero[i];
+
+        ram_handle_compressed(page, 0, p->page_size);
+        ramblock_recv_bitmap_set(p->block, page);
+    }
+}
+
 struct {
     MultiFDSendParams *params;
     /* array of pages to sent */
@@ -469,6 +719,23 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset)
     return 1;
 }
 
+/**
+ * multifd_send_channel_bytes: bytes sent through a multifd channel
+ *
+ * Only accounted while the migration timeline is recorded.
+ *
+ * Returns the number of bytes, 0 if the channels are not set up
+ *
+ * @id: channel number
+ */
+uint64_t multifd_send_channel_bytes(int id)
+{
+    if (!multifd_send_state) {
+        return 0;
+    }
+    return stat64_get(&multifd_send_state->params[id].bytes_sent);
+}
+
 static void multifd_send_terminate_threads(Error *err)
 {
     int i;
@@ -548,6 +815,8 @@ void multifd_save_cleanup(void)
         p->iov = NULL;
         g_free(p->normal);
         p->normal = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         multifd_send_state->ops->send_cleanup(p, &local_err);
         if (local_err) {
             migrate_set_error(migrate_get_current(), local_err);
@@ -650,6 +919,9 @@ static void *multifd_send_thread(void *opaque)
     Error *local_err = NULL;
     int ret = 0;
     bool use_zero_copy_send = migrate_zero_copy_send();
+    bool use_zero_page_detection =
+        migrate_zero_page_detection() == ZERO_PAGE_DETECTION_MULTIFD;
+    bool use_timeline = migration_timeline_enabled();
 
     thread = MigrationThreadAdd(p->name, qemu_get_thread_id());
 
@@ -674,8 +946,8 @@ static void *multifd_send_thread(void *opaque)
 
         if (p->pending_job) {
             uint64_t packet_num = p->packet_num;
+            int64_t write_start_ns = 0;
             uint32_t flags;
-            p->normal_num = 0;
 
             if (use_zero_copy_send) {
                 p->iovs_num = 0;
@@ -683,29 +955,50 @@ static void *multifd_send_thread(void *opaque)
                 p->iovs_num = 1;
             }
 
-            for (int i = 0; i < p->pages->num; i++) {
-                p->normal[p->normal_num] = p->pages->offset[i];
-                p->normal_num++;
+            multifd_send_zero_page_detect(p, use_zero_page_detection);
+            if (p->zero_num && xbzrle_multifd_active()) {
+                /* Do not leave stale copies of these pages in the cache */
+                for (int i = 0; i < p->zero_num; i++) {
+                    xbzrle_cache_zero_page(p->pages->block->offset +
+                                           p->zero[i]);
+                }
             }
 
+            p->next_packet_size = 0;
             if (p->normal_num) {
+                int64_t start_ns = get_clock();
+
                 ret = multifd_send_state->ops->send_prepare(p, &local_err);
                 if (ret != 0) {
                     qemu_mutex_unlock(&p->mutex);
                     break;
                 }
+                stat64_add(&mig_stats.multifd_compress_time_ns,
+                           get_clock() - start_ns);
+                stat64_add(&mig_stats.multifd_compress_in_bytes,
+                           (uint64_t)p->normal_num * p->page_size);
+                stat64_add(&mig_stats.multifd_compress_out_bytes,
+                           p->next_packet_size);
             }
             multifd_send_fill_packet(p);
             flags = p->flags;
             p->flags = 0;
             p->num_packets++;
             p->total_normal_pages += p->normal_num;
+            p->total_zero_pages += p->zero_num;
             p->pages->num = 0;
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
-            trace_multifd_send(p->id, packet_num, p->normal_num, flags,
-                               p->next_packet_size);
+            stat64_add(&mig_stats.normal_pages, p->normal_num);
+            stat64_add(&mig_stats.zero_pages, p->zero_num);
+
+            trace_multifd_send(p->id, packet_num, p->normal_num, p->zero_num,
+                               flags, p->next_packet_size);
+
+            if (use_timeline) {
+                write_start_ns = get_clock();
+            }
 
             if (use_zero_copy_send) {
                 /* Send header first, without zerocopy */
@@ -730,6 +1023,12 @@ static void *multifd_send_thread(void *opaque)
 
             stat64_add(&mig_stats.multifd_bytes, p->next_packet_size);
             stat64_add(&mig_stats.transferred, p->next_packet_size);
+            if (use_timeline) {
+                stat64_add(&mig_stats.channel_write_time_ns,
+                           get_clock() - write_start_ns);
+                stat64_add(&p->bytes_sent,
+                           p->packet_len + p->next_packet_size);
+            }
             qemu_mutex_lock(&p->mutex);
             p->pending_job--;
             qemu_mutex_unlock(&p->mutex);
@@ -768,7 +1067,8 @@ out:
 
     rcu_unregister_thread();
     MigrationThreadDel(thread);
-    trace_multifd_send_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_send_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -942,6 +1242,7 @@ int multifd_save_setup(Error **errp)
         /* We need one extra place for the packet header */
         p->iov = g_new0(struct iovec, page_count + 1);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
         p->page_size = qemu_target_page_size();
         p->page_count = page_count;
 
@@ -1059,6 +1360,8 @@ void multifd_load_cleanup(void)
         p->iov = NULL;
         g_free(p->normal);
         p->normal = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         multifd_recv_state->ops->recv_cleanup(p);
     }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
@@ -1127,10 +1430,11 @@ static void *multifd_recv_thread(void *opaque)
         flags = p->flags;
         /* recv methods don't know how to handle the SYNC flag */
         p->flags &= ~MULTIFD_FLAG_SYNC;
-        trace_multifd_recv(p->id, p->packet_num, p->normal_num, flags,
-                           p->next_packet_size);
+        trace_multifd_recv(p->id, p->packet_num, p->normal_num, p->zero_num,
+                           flags, p->next_packet_size);
         p->num_packets++;
         p->total_normal_pages += p->normal_num;
+        p->total_zero_pages += p->zero_num;
         qemu_mutex_unlock(&p->mutex);
 
         if (p->normal_num) {
@@ -1138,6 +1442,13 @@ static void *multifd_recv_thread(void *opaque)
             if (ret != 0) {
                 break;
             }
+            for (int i = 0; i < p->normal_num; i++) {
+                ramblock_recv_bitmap_set(p->block, p->host + p->normal[i]);
+            }
+        }
+
+        if (p->zero_num) {
+            multifd_recv_zero_page_process(p);
         }
 
         if (flags & MULTIFD_FLAG_SYNC) {
@@ -1155,7 +1466,8 @@ static void *multifd_recv_thread(void *opaque)
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -1194,6 +1506,7 @@ int multifd_load_setup(Error **errp)
         p->name = g_strdup_printf("multifdrecv_%d", i);
         p->iov = g_new0(struct iovec, page_count);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
         p->page_count = page_count;
         p->page_size = qemu_target_page_size();
     }
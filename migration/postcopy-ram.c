@@ -762,6 +762,85 @@ static int postcopy_request_page(MigrationIncomingState *mis, RAMBlock *rb,
     return migrate_send_rp_req_pages(mis, rb, start, haddr);
 }
 
+/*
+ * Ask the source for the pages following a fault that continues a run
+ * of sequential faults, see postcopy-prefetch-window.
+ *
+ * Faults are matched against a few streams: a fault just after the last
+ * one of a stream (at most one host page past what was already
+ * requested for it) extends it and doubles its window.  Any other fault
+ * starts a new stream in place of the least recently used one, without
+ * prefetching anything yet.
+ *
+ * The pages are requested as a single range, starting after what is
+ * already there and stopping at the first page that is either received
+ * or discarded.  They are not tracked in page_requested: if they are
+ * lost in a network failure, the faults will ask for them again.
+ */
+static void postcopy_prefetch(MigrationIncomingState *mis, RAMBlock *rb,
+                              ram_addr_t offset)
+{
+    uint64_t max_window = migrate_postcopy_prefetch_window();
+    size_t pagesize = qemu_ram_pagesize(rb);
+    PostcopyPrefetchStream *stream = NULL;
+    PostcopyPrefetchStream *victim = &mis->prefetch_streams[0];
+    ram_addr_t start, end, limit;
+    int i;
+
+    if (!max_window) {
+        return;
+    }
+
+    for (i = 0; i < POSTCOPY_PREFETCH_STREAMS; i++) {
+        PostcopyPrefetchStream *s = &mis->prefetch_streams[i];
+
+        if (s->rb == rb && offset > s->last && offset <= s->end + pagesize) {
+            stream = s;
+            break;
+        }
+        if (s->stamp < victim->stamp) {
+            victim = s;
+        }
+    }
+
+    mis->prefetch_stamp++;
+    if (!stream) {
+        victim->rb = rb;
+        victim->last = offset;
+        victim->end = offset + pagesize;
+        victim->window = pagesize;
+        victim->stamp = mis->prefetch_stamp;
+        return;
+    }
+
+    stream->last = offset;
+    stream->stamp = mis->prefetch_stamp;
+    stream->window = MIN(stream->window * 2, max_window);
+
+    /* The length of a request is 32 bits on the wire */
+    limit = offset + pagesize +
+            MIN(stream->window, ROUND_DOWN(UINT32_MAX, pagesize));
+    limit = ROUND_DOWN(MIN(limit, rb->used_length), pagesize);
+
+    start = MAX(offset + pagesize, stream->end);
+    while (start < limit && ramblock_recv_bitmap_test_byte_offset(rb, start)) {
+        start += pagesize;
+    }
+    for (end = start; end < limit; end += pagesize) {
+        if (ramblock_recv_bitmap_test_byte_offset(rb, end) ||
+            ramblock_page_is_discarded(rb, end)) {
+            break;
+        }
+    }
+    stream->end = MAX(stream->end, end);
+
+    if (end > start) {
+        trace_postcopy_prefetch(qemu_ram_get_idstr(rb), offset, start,
+                                end - start);
+        migrate_send_rp_message_req_pages(mis, rb, start, end - start);
+    }
+}
+
 /*
  * Callback from shared fault handlers to ask for a page,
  * the page must be specified by a RAMBlock and an offset in that rb
@@ -1071,6 +1150,7 @@ retry:
                 postcopy_pause_fault_thread(mis);
                 goto retry;
             }
+            postcopy_prefetch(mis, rb, rb_offset);
         }
 
         /* Now handle any requests from external processes on shared memory */
@@ -1217,6 +1297,9 @@ int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
         return -1;
     }
 
+    memset(mis->prefetch_streams, 0, sizeof(mis->prefetch_streams));
+    mis->prefetch_stamp = 0;
+
     postcopy_thread_create(mis, &mis->fault_thread, "fault-default",
                            postcopy_ram_fault_thread, QEMU_THREAD_JOINABLE);
     mis->have_fault_thread = true;
@@ -26,6 +26,7 @@
 #include "qemu/madvise.h"
 #include "qemu/error-report.h"
 #include "qemu/iov.h"
+#include "qemu/timer.h"
 #include "migration.h"
 #include "migration-stats.h"
 #include "qemu-file.h"
@@ -286,6 +287,9 @@ void qemu_fflush(QEMUFile *f)
     }
     if (f->iovcnt > 0) {
         Error *local_error = NULL;
+        bool timed = migration_timeline_enabled();
+        int64_t start_ns = timed ? get_clock() : 0;
+
         if (qio_channel_writev_all(f->ioc,
                                    f->iov, f->iovcnt,
                                    &local_error) < 0) {
@@ -294,6 +298,10 @@ void qemu_fflush(QEMUFile *f)
             uint64_t size = iov_size(f->iov, f->iovcnt);
             f->total_transferred += size;
         }
+        if (timed) {
+            stat64_add(&mig_stats.channel_write_time_ns,
+                       get_clock() - start_ns);
+        }
 
         qemu_iovec_release_ram(f);
     }
@@ -532,6 +540,102 @@ void qemu_put_buffer(QEMUFile *f, const uint8_t *buf, size_t size)
     }
 }
 
+void qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
+                        off_t pos)
+{
+    Error *err = NULL;
+    ssize_t ret;
+
+    if (f->last_error) {
+        return;
+    }
+
+    qemu_fflush(f);
+    ret = qio_channel_pwrite(f->ioc, (char *)buf, buflen, pos, &err);
+
+    if (err) {
+        qemu_file_set_error_obj(f, -EIO, err);
+        return;
+    }
+
+    if ((ssize_t)buflen != ret) {
+        error_setg(&err, "Partial write of size %zd, expected %zu", ret,
+                   buflen);
+        qemu_file_set_error_obj(f, -EIO, err);
+        return;
+    }
+
+    f->total_transferred += buflen;
+}
+
+size_t qemu_get_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
+                          off_t pos)
+{
+    Error *err = NULL;
+    ssize_t ret;
+
+    if (f->last_error) {
+        return 0;
+    }
+
+    ret = qio_channel_pread(f->ioc, (char *)buf, buflen, pos, &err);
+    if (ret == -1 || err) {
+        goto error;
+    }
+
+    if ((ssize_t)buflen != ret) {
+        error_setg(&err, "Partial read of size %zd, expected %zu", ret,
+                   buflen);
+        goto error;
+    }
+
+    f->total_transferred += buflen;
+    return buflen;
+
+ error:
+    qemu_file_set_error_obj(f, -EIO, err);
+    return 0;
+}
+
+void qemu_set_offset(QEMUFile *f, off_t off, int whence)
+{
+    Error *err = NULL;
+    off_t ret;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        /* Drop all cached buffers if existed; will trigger a re-fill later */
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    ret = qio_channel_io_seek(f->ioc, off, whence, &err);
+    if (ret == (off_t)-1) {
+        qemu_file_set_error_obj(f, -EIO, err);
+    }
+}
+
+off_t qemu_get_offset(QEMUFile *f)
+{
+    Error *err = NULL;
+    off_t ret;
+
+    qemu_fflush(f);
+
+    ret = qio_channel_io_seek(f->ioc, 0, SEEK_CUR, &err);
+    if (ret == (off_t)-1) {
+        qemu_file_set_error_obj(f, -EIO, err);
+        return ret;
+    }
+
+    /* Account for any data that was read ahead but not yet consumed */
+    if (!qemu_file_is_writable(f)) {
+        ret -= f->buf_size - f->buf_index;
+    }
+    return ret;
+}
+
 void qemu_put_byte(QEMUFile *f, int v)
 {
     if (f->last_error) {
@@ -159,4 +159,35 @@ size_t ram_control_save_page(QEMUFile *f, ram_addr_t block_offset,
                              uint64_t *bytes_sent);
 QIOChannel *qemu_file_get_ioc(QEMUFile *file);
 
+/*
+ * qemu_put_buffer_at:
+ *
+ * Write @buflen bytes from @buf at offset @pos of the underlying
+ * channel, without moving the current file position. Requires a
+ * seekable channel. Any error is latched on @f.
+ */
+void qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
+                        off_t pos);
+
+/*
+ * qemu_get_buffer_at:
+ *
+ * Read @buflen bytes into @buf from offset @pos of the underlying
+ * channel, bypassing the internal buffer and without moving the
+ * current file position.
+ *
+ * Returns: @buflen on success, 0 on error (which is latched on @f)
+ */
+size_t qemu_get_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
+                          off_t pos);
+
+/*
+ * qemu_set_offset / qemu_get_offset:
+ *
+ * Move or report the current position in the stream. Pending writes
+ * are flushed and read-ahead data is discarded before seeking.
+ */
+void qemu_set_offset(QEMUFile *f, off_t off, int whence);
+off_t qemu_get_offset(QEMUFile *f);
+
 #endif
@@ -31,6 +31,7 @@
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
+#include "qemu/units.h"
 #include "qemu/main-loop.h"
 #include "xbzrle.h"
 #include "ram-compress.h"
@@ -54,6 +55,7 @@
 #include "migration/colo.h"
 #include "block.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/dirtylimit.h"
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
@@ -90,6 +92,52 @@
 #define RAM_SAVE_FLAG_MULTIFD_FLUSH    0x200
 /* We can't use any flag that is bigger than 0x200 */
 
+/*
+ * mapped-ram migration supports O_DIRECT, so we need to make sure the
+ * userspace buffer, the IO operation size and the file offset are
+ * aligned according to the underlying device's block size. The first
+ * two are already aligned to page size, but we need to add padding to
+ * the file to align the offset.  We cannot read the block size
+ * dynamically because the migration file can be moved between
+ * different systems, so use 1M to cover most block sizes and to keep
+ * the file offset aligned at page size as well.
+ */
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+
+/*
+ * When doing mapped-ram migration, this is the amount we read from
+ * the pages region in the migration file at a time.
+ */
+#define MAPPED_RAM_LOAD_BUF_SIZE 0x100000
+
+/*
+ * Minimum amount of guest memory handed to each restore thread; below
+ * this the thread creation overhead dominates and the ramblock is read
+ * inline.
+ */
+#define MAPPED_RAM_LOAD_MIN_BYTES_PER_THREAD (64 * MiB)
+
+#define MAPPED_RAM_HDR_VERSION 1
+struct MappedRamHeader {
+    uint32_t version;
+    /*
+     * The target's page size, so we know how many pages are in the
+     * bitmap.
+     */
+    uint64_t page_size;
+    /*
+     * The offset in the migration file where the pages bitmap is
+     * stored.
+     */
+    uint64_t bitmap_offset;
+    /*
+     * The offset in the migration file where the actual pages (data)
+     * are stored.
+     */
+    uint64_t pages_offset;
+} QEMU_PACKED;
+typedef struct MappedRamHeader MappedRamHeader;
+
 XBZRLECacheStats xbzrle_counters;
 
 /* used by the search for pages to send */
@@ -112,6 +160,28 @@ struct PageSearchStatus {
 };
 typedef struct PageSearchStatus PageSearchStatus;
 
+/* Upper bound on the number of XBZRLE cache shards */
+#define XBZRLE_MAX_SHARDS 64
+
+/*
+ * A slice of the XBZRLE cache.  Pages are spread over the shards by a
+ * hash of their address, so that the multifd send threads can encode
+ * pages in parallel without contending on a single lock.
+ */
+typedef struct {
+    /* Protects the cache and counters of the shard */
+    QemuMutex lock;
+    PageCache *cache;
+    /*
+     * Counters of the multifd send threads, folded into xbzrle_counters
+     * by the migration thread
+     */
+    uint64_t pages;
+    uint64_t cache_miss;
+    uint64_t overflow;
+    uint64_t bytes;
+} XBZRLEShard;
+
 /* struct contains XBZRLE cache and a static page
    used by the compression */
 static struct {
@@ -119,8 +189,12 @@ static struct {
     uint8_t *encoded_buf;
     /* buffer for storing page content */
     uint8_t *current_buf;
-    /* Cache for XBZRLE, Protected by lock. */
-    PageCache *cache;
+    /* Cache for XBZRLE, split in nr_shards shards */
+    XBZRLEShard shards[XBZRLE_MAX_SHARDS];
+    unsigned int nr_shards;
+    /* Whether the multifd send threads do the encoding */
+    bool multifd;
+    /* Protects setup, cleanup and resizing of the cache */
     QemuMutex lock;
     /* it will store a page full of zeros */
     uint8_t *zero_target_page;
@@ -142,6 +216,77 @@ static void XBZRLE_cache_unlock(void)
     }
 }
 
+static XBZRLEShard *xbzrle_shard(ram_addr_t addr)
+{
+    uint64_t page = addr >> TARGET_PAGE_BITS;
+
+    /*
+     * The cache slot within the shard is picked from the low bits of the
+     * page number, so use the high bits of a multiplicative hash here to
+     * keep each shard evenly filled.
+     */
+    return &XBZRLE.shards[((page * 0x9e3779b97f4a7c15ULL) >> 32) &
+                          (XBZRLE.nr_shards - 1)];
+}
+
+/*
+ * Allocate one cache per shard, @size being the total for all of them.
+ * Called with XBZRLE.lock held.
+ */
+static bool xbzrle_caches_new(PageCache **caches, uint64_t size, Error **errp)
+{
+    unsigned int i;
+
+    for (i = 0; i < XBZRLE.nr_shards; i++) {
+        caches[i] = cache_init(size / XBZRLE.nr_shards, TARGET_PAGE_SIZE,
+                               errp);
+        if (!caches[i]) {
+            while (i--) {
+                cache_fini(caches[i]);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Install @caches in the shards, freeing the previous ones.  @caches
+ * may be NULL to drop the caches.  Called with XBZRLE.lock held.
+ */
+static void xbzrle_caches_set(PageCache **caches)
+{
+    unsigned int i;
+
+    for (i = 0; i < XBZRLE.nr_shards; i++) {
+        XBZRLEShard *shard = &XBZRLE.shards[i];
+
+        qemu_mutex_lock(&shard->lock);
+        if (shard->cache) {
+            cache_fini(shard->cache);
+        }
+        shard->cache = caches ? caches[i] : NULL;
+        qemu_mutex_unlock(&shard->lock);
+    }
+}
+
+/* Called from the migration thread */
+static void xbzrle_counters_fold(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < XBZRLE.nr_shards; i++) {
+        XBZRLEShard *shard = &XBZRLE.shards[i];
+
+        QEMU_LOCK_GUARD(&shard->lock);
+        xbzrle_counters.pages += shard->pages;
+        xbzrle_counters.cache_miss += shard->cache_miss;
+        xbzrle_counters.overflow += shard->overflow;
+        xbzrle_counters.bytes += shard->bytes;
+        shard->pages = shard->cache_miss = shard->overflow = shard->bytes = 0;
+    }
+}
+
 /**
  * xbzrle_cache_resize: resize the xbzrle cache
  *
@@ -157,7 +302,7 @@ static void XBZRLE_cache_unlock(void)
  */
 int xbzrle_cache_resize(uint64_t new_size, Error **errp)
 {
-    PageCache *new_cache;
+    PageCache *new_caches[XBZRLE_MAX_SHARDS];
     int64_t ret = 0;
 
     /* Check for truncation */
@@ -174,15 +319,13 @@ int xbzrle_cache_resize(uint64_t new_size, Error **errp)
 
     XBZRLE_cache_lock();
 
-    if (XBZRLE.cache != NULL) {
-        new_cache = cache_init(new_size, TARGET_PAGE_SIZE, errp);
-        if (!new_cache) {
+    if (XBZRLE.shards[0].cache != NULL) {
+        if (!xbzrle_caches_new(new_caches, new_size, errp)) {
             ret = -1;
             goto out;
         }
 
-        cache_fini(XBZRLE.cache);
-        XBZRLE.cache = new_cache;
+        xbzrle_caches_set(new_caches);
     }
 out:
     XBZRLE_cache_unlock();
@@ -348,6 +491,11 @@ struct RAMState {
     uint32_t last_version;
     /* How many times we have dirty too many pages */
     int dirty_rate_high_cnt;
+    /*
+     * Percentage of the migration bandwidth the guest dirty page rate
+     * is aimed at by dirty-limit, zero until dirty-limit kicks in
+     */
+    uint64_t dirty_limit_pct;
     /* these variables are used for bitmap sync */
     /* last time we did a full bitmap_sync */
     int64_t time_last_bitmap_sync;
@@ -391,6 +539,17 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /*
+     * Regions sent first when postcopy starts, see postcopy-hot-set-size.
+     * Only used by the migration thread.
+     */
+    QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_hot_pages;
+    /* Counters at the previous sample of the migration timeline */
+    uint64_t timeline_transferred_prev;
+    uint64_t timeline_compress_in_prev;
+    uint64_t timeline_compress_out_prev;
+    uint64_t timeline_write_time_prev;
+    uint64_t *timeline_multifd_bytes_prev;
 };
 typedef struct RAMState RAMState;
 
@@ -558,7 +717,6 @@ void mig_throttle_counter_reset(void)
 /**
  * xbzrle_cache_zero_page: insert a zero page in the XBZRLE cache
  *
- * @rs: current RAM state
  * @current_addr: address for the zero page
  *
  * Update the xbzrle cache to reflect a page that's been sent as all 0.
@@ -567,12 +725,85 @@ void mig_throttle_counter_reset(void)
  * As a bonus, if the page wasn't in the cache it gets added so that
  * when a small write is made into the 0'd page it gets XBZRLE sent.
  */
-static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
+void xbzrle_cache_zero_page(ram_addr_t current_addr)
 {
-    /* We don't care if this fails to allocate a new cache page
-     * as long as it updated an old one */
-    cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
-                 stat64_get(&mig_stats.dirty_sync_count));
+    XBZRLEShard *shard = xbzrle_shard(current_addr);
+
+    QEMU_LOCK_GUARD(&shard->lock);
+    if (shard->cache) {
+        /* We don't care if this fails to allocate a new cache page
+         * as long as it updated an old one */
+        cache_insert(shard->cache, current_addr, XBZRLE.zero_target_page,
+                     stat64_get(&mig_stats.dirty_sync_count));
+    }
+}
+
+/**
+ * xbzrle_multifd_active: whether pages are delta encoded by the multifd
+ *   send threads
+ *
+ * That is the case after the first round of a migration with both the
+ * xbzrle and multifd capabilities, without multifd compression.
+ */
+bool xbzrle_multifd_active(void)
+{
+    return qatomic_read(&XBZRLE.multifd);
+}
+
+/**
+ * xbzrle_multifd_encode_page: delta encode a page from a multifd thread
+ *
+ * Encode @current against the cached copy of the page and update the
+ * cache with it.  @current must be a private copy of the guest page, so
+ * that the data sent is the data cached even if the guest writes to
+ * the page meanwhile.
+ *
+ * Returns the length of the encoded data written in @dst, 0 if the page
+ * did not change, or -1 if the page has to be sent as is (cache miss or
+ * encoded data larger than @dlen).
+ *
+ * @addr: ram address of the page
+ * @current: copy of the page
+ * @dst: where to write the encoded data
+ * @dlen: size of @dst
+ */
+int xbzrle_multifd_encode_page(ram_addr_t addr, uint8_t *current,
+                               uint8_t *dst, int dlen)
+{
+    XBZRLEShard *shard = xbzrle_shard(addr);
+    uint64_t generation = stat64_get(&mig_stats.dirty_sync_count);
+    uint8_t *prev_cached_page;
+    int encoded_len;
+
+    QEMU_LOCK_GUARD(&shard->lock);
+
+    if (!shard->cache) {
+        /* Migration is being torn down */
+        return -1;
+    }
+
+    if (!cache_is_cached(shard->cache, addr, generation)) {
+        shard->cache_miss++;
+        cache_insert(shard->cache, addr, current, generation);
+        return -1;
+    }
+
+    shard->pages++;
+    prev_cached_page = get_cached_data(shard->cache, addr);
+    encoded_len = xbzrle_encode_buffer(prev_cached_page, current,
+                                       TARGET_PAGE_SIZE, dst, dlen);
+    if (encoded_len != 0) {
+        memcpy(prev_cached_page, current, TARGET_PAGE_SIZE);
+    }
+
+    if (encoded_len == -1) {
+        shard->overflow++;
+        shard->bytes += TARGET_PAGE_SIZE;
+    } else {
+        shard->bytes += encoded_len;
+    }
+
+    return encoded_len;
 }
 
 #define ENCODING_FLAG_XBZRLE 0x1
@@ -599,17 +830,22 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
     uint8_t *prev_cached_page;
     QEMUFile *file = pss->pss_channel;
     uint64_t generation = stat64_get(&mig_stats.dirty_sync_count);
+    /*
+     * Only the migration thread uses the cache when the pages are not
+     * sent through multifd, XBZRLE.lock held by the caller is enough.
+     */
+    PageCache *cache = xbzrle_shard(current_addr)->cache;
 
-    if (!cache_is_cached(XBZRLE.cache, current_addr, generation)) {
+    if (!cache_is_cached(cache, current_addr, generation)) {
         xbzrle_counters.cache_miss++;
         if (!rs->last_stage) {
-            if (cache_insert(XBZRLE.cache, current_addr, *current_data,
+            if (cache_insert(cache, current_addr, *current_data,
                              generation) == -1) {
                 return -1;
             } else {
                 /* update *current_data when the page has been
                    inserted into cache */
-                *current_data = get_cached_data(XBZRLE.cache, current_addr);
+                *current_data = get_cached_data(cache, current_addr);
             }
         }
         return -1;
@@ -627,7 +863,7 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
      * guest page is good for xbzrle encoding.
      */
     xbzrle_counters.pages++;
-    prev_cached_page = get_cached_data(XBZRLE.cache, current_addr);
+    prev_cached_page = get_cached_data(cache, current_addr);
 
     /* save current buffer into memory */
     memcpy(XBZRLE.current_buf, *current_data, TARGET_PAGE_SIZE);
@@ -894,13 +1130,212 @@ bool ramblock_page_is_discarded(RAMBlock *rb, ram_addr_t start)
 }
 
 /* Called with RCU critical section */
-static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
+static uint64_t ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
 {
     uint64_t new_dirty_pages =
         cpu_physical_memory_sync_dirty_bitmap(rb, 0, rb->used_length);
 
     rs->migration_dirty_pages += new_dirty_pages;
     rs->num_dirty_pages_period += new_dirty_pages;
+
+    return new_dirty_pages;
+}
+
+/*
+ * Appends the dirty pages of @rb to the timeline sample list at @tail,
+ * if any, and returns the new tail.
+ */
+static MigrationTimelineRAMBlockList **
+timeline_add_ramblock(MigrationTimelineRAMBlockList **tail, RAMBlock *rb,
+                      uint64_t dirty_pages)
+{
+    MigrationTimelineRAMBlock *entry;
+
+    if (!tail || !dirty_pages) {
+        return tail;
+    }
+
+    entry = g_new0(MigrationTimelineRAMBlock, 1);
+    entry->name = g_strdup(rb->idstr);
+    entry->dirty_pages = dirty_pages;
+    QAPI_LIST_APPEND(tail, entry);
+
+    return tail;
+}
+
+/*
+ * The dirty bitmaps of large guests are merged by several threads, each
+ * thread taking care of at least that much guest memory.  Below that,
+ * the thread creation overhead dominates.
+ */
+#define BITMAP_SYNC_MIN_BYTES_PER_THREAD (16 * GiB)
+#define BITMAP_SYNC_MAX_THREADS 8
+/* Unit of work of the threads, a multiple of BITS_PER_LONG pages */
+#define BITMAP_SYNC_CHUNK_SIZE (1 * GiB)
+
+typedef struct {
+    RAMBlock *rb;
+    ram_addr_t start;
+    ram_addr_t length;
+    /* Written by the thread that merged the chunk */
+    uint64_t new_dirty_pages;
+} BitmapSyncChunk;
+
+typedef struct {
+    GArray *chunks;
+    /* Next chunk to process, shared by all the threads */
+    unsigned int next;
+} BitmapSyncJob;
+
+typedef struct {
+    QemuThread thread;
+    BitmapSyncJob *job;
+    uint64_t new_dirty_pages;
+} BitmapSyncWorker;
+
+static uint64_t bitmap_sync_job_run(BitmapSyncJob *job)
+{
+    uint64_t new_dirty_pages = 0;
+    unsigned int i;
+
+    RCU_READ_LOCK_GUARD();
+
+    while ((i = qatomic_fetch_inc(&job->next)) < job->chunks->len) {
+        BitmapSyncChunk *c = &g_array_index(job->chunks, BitmapSyncChunk, i);
+
+        c->new_dirty_pages = cpu_physical_memory_sync_dirty_bitmap(c->rb,
+                                                                   c->start,
+                                                                   c->length);
+        new_dirty_pages += c->new_dirty_pages;
+    }
+
+    return new_dirty_pages;
+}
+
+static void *bitmap_sync_thread(void *opaque)
+{
+    BitmapSyncWorker *w = opaque;
+
+    rcu_register_thread();
+    w->new_dirty_pages = bitmap_sync_job_run(w->job);
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+/*
+ * Whether parts of the bitmap of @rb can be merged concurrently: that is
+ * when cpu_physical_memory_sync_dirty_bitmap() works on whole words of
+ * both bitmaps and postpones the clearing of the dirty log, so that the
+ * threads never touch the same word of rb->bmap nor call into the memory
+ * listeners.  A single bit of rb->clear_bmap covers many chunks, but
+ * clear_bmap_set() sets it atomically.
+ */
+static bool ramblock_sync_parallel_ok(RAMBlock *rb)
+{
+    return rb->clear_bmap &&
+           QEMU_IS_ALIGNED(rb->offset >> TARGET_PAGE_BITS, BITS_PER_LONG) &&
+           QEMU_IS_ALIGNED(rb->used_length >> TARGET_PAGE_BITS,
+                           BITS_PER_LONG);
+}
+
+/**
+ * ram_sync_dirty_bitmaps: merge the dirty log into the migration bitmaps
+ *
+ * Large RAMBlocks are cut into chunks that a few threads merge in
+ * parallel, the calling thread being one of them.  Other RAMBlocks are
+ * merged by the calling thread first.
+ *
+ * Called with RCU critical section and the bitmap_mutex held
+ *
+ * @rs: current RAM state
+ * @tail: where to append the dirty pages of each RAMBlock for the
+ *        migration timeline, or NULL
+ */
+static void ram_sync_dirty_bitmaps(RAMState *rs,
+                                   MigrationTimelineRAMBlockList **tail)
+{
+    g_autoptr(GArray) chunks = NULL;
+    g_autofree BitmapSyncWorker *workers = NULL;
+    BitmapSyncJob job = { };
+    uint64_t parallel_bytes = 0, new_dirty_pages;
+    RAMBlock *block;
+    int nthreads, i;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (ramblock_sync_parallel_ok(block)) {
+            parallel_bytes += block->used_length;
+        }
+    }
+
+    nthreads = MIN(BITMAP_SYNC_MAX_THREADS,
+                   parallel_bytes / BITMAP_SYNC_MIN_BYTES_PER_THREAD);
+    if (nthreads <= 1) {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            tail = timeline_add_ramblock(tail, block,
+                                         ramblock_sync_dirty_bitmap(rs, block));
+        }
+        return;
+    }
+
+    chunks = g_array_new(false, false, sizeof(BitmapSyncChunk));
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t start;
+
+        if (!ramblock_sync_parallel_ok(block)) {
+            tail = timeline_add_ramblock(tail, block,
+                                         ramblock_sync_dirty_bitmap(rs, block));
+            continue;
+        }
+        for (start = 0; start < block->used_length;
+             start += BITMAP_SYNC_CHUNK_SIZE) {
+            BitmapSyncChunk c = {
+                .rb = block,
+                .start = start,
+                .length = MIN(BITMAP_SYNC_CHUNK_SIZE,
+                              block->used_length - start),
+            };
+
+            g_array_append_val(chunks, c);
+        }
+    }
+
+    trace_ram_sync_dirty_bitmaps_parallel(nthreads, chunks->len);
+
+    job.chunks = chunks;
+    workers = g_new0(BitmapSyncWorker, nthreads - 1);
+    for (i = 0; i < nthreads - 1; i++) {
+        workers[i].job = &job;
+        qemu_thread_create(&workers[i].thread, "mig/bitmap-sync",
+                           bitmap_sync_thread, &workers[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    new_dirty_pages = bitmap_sync_job_run(&job);
+
+    for (i = 0; i < nthreads - 1; i++) {
+        qemu_thread_join(&workers[i].thread);
+        new_dirty_pages += workers[i].new_dirty_pages;
+    }
+
+    rs->migration_dirty_pages += new_dirty_pages;
+    rs->num_dirty_pages_period += new_dirty_pages;
+
+    if (tail) {
+        /* The chunks of a RAMBlock are consecutive */
+        uint64_t block_pages = 0;
+
+        for (i = 0; i < chunks->len; i++) {
+            BitmapSyncChunk *c = &g_array_index(chunks, BitmapSyncChunk, i);
+
+            block_pages += c->new_dirty_pages;
+            if (i + 1 == chunks->len ||
+                g_array_index(chunks, BitmapSyncChunk, i + 1).rb != c->rb) {
+                tail = timeline_add_ramblock(tail, c->rb, block_pages);
+                block_pages = 0;
+            }
+        }
+    }
 }
 
 /**
@@ -948,6 +1383,7 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
     if (migrate_xbzrle()) {
         double encoded_size, unencoded_size;
 
+        xbzrle_counters_fold();
         xbzrle_counters.cache_miss_rate = (double)(xbzrle_counters.cache_miss -
             rs->xbzrle_cache_miss_prev) / page_count;
         rs->xbzrle_cache_miss_prev = xbzrle_counters.cache_miss;
@@ -984,6 +1420,50 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
     }
 }
 
+/*
+ * migration_dirty_limit_guest: throttle the heaviest dirtying vCPUs
+ *
+ * The first time, the aggregate dirty page rate is aimed at
+ * DIRTY_LIMIT_INITIAL_PCT of the measured bandwidth; every time the
+ * guest still dirties too much, that percentage is halved.  Only the
+ * vCPUs dirtying more than their share of the target get a quota.
+ *
+ * Returns false if nothing was throttled because the bandwidth or the
+ * per-vCPU dirty page rates have not been measured yet.
+ *
+ * @rs: current RAM state
+ */
+#define DIRTY_LIMIT_INITIAL_PCT 50
+
+static bool migration_dirty_limit_guest(RAMState *rs)
+{
+    MigrationState *s = migrate_get_current();
+    uint64_t target, pct;
+
+    if (!s->bandwidth) {
+        /* Nothing measured yet */
+        return false;
+    }
+
+    if (!rs->dirty_limit_pct) {
+        pct = DIRTY_LIMIT_INITIAL_PCT;
+    } else {
+        pct = MAX(rs->dirty_limit_pct / 2, 1);
+    }
+
+    /* bandwidth is in bytes per millisecond, quotas in MB/s */
+    target = s->bandwidth * 1000 / MiB * pct / 100;
+    if (!dirtylimit_migration_throttle(target)) {
+        /* Keep the percentage until the vCPU rates are known */
+        return false;
+    }
+
+    rs->dirty_limit_pct = pct;
+    s->dirty_limit_target = target;
+    trace_migration_dirty_limit_guest(pct, target);
+    return true;
+}
+
 static void migration_trigger_throttle(RAMState *rs)
 {
     uint64_t threshold = migrate_throttle_trigger_threshold();
@@ -1009,13 +1489,91 @@ static void migration_trigger_throttle(RAMState *rs)
             mig_throttle_guest_down(bytes_dirty_period,
                                     bytes_dirty_threshold);
         }
+    } else if (migrate_dirty_limit() && !blk_mig_bulk_active()) {
+        /*
+         * Same detection as auto-converge, per vCPU reaction.  Try again
+         * on the next period if the vCPU rates were not measured yet.
+         */
+        if ((bytes_dirty_period > bytes_dirty_threshold) &&
+            (++rs->dirty_rate_high_cnt >= 2) &&
+            migration_dirty_limit_guest(rs)) {
+            rs->dirty_rate_high_cnt = 0;
+        }
     }
 }
 
+/**
+ * migration_timeline_sample: record a sample of the migration timeline
+ *
+ * Called after each synchronization of the dirty bitmap, the counters
+ * are the difference with the previous sample.
+ *
+ * @rs: current RAM state
+ * @ramblocks: dirty pages of each RAMBlock during the synchronization
+ * @dirty_pages: dirty pages found by the synchronization
+ */
+static void migration_timeline_sample(RAMState *rs,
+                                      MigrationTimelineRAMBlockList *ramblocks,
+                                      uint64_t dirty_pages)
+{
+    MigrationTimelineSample *sample = g_new0(MigrationTimelineSample, 1);
+    uint64_t transferred = stat64_get(&mig_stats.transferred);
+    uint64_t compress_in = stat64_get(&mig_stats.multifd_compress_in_bytes);
+    uint64_t compress_out = stat64_get(&mig_stats.multifd_compress_out_bytes);
+    uint64_t write_time = stat64_get(&mig_stats.channel_write_time_ns);
+
+    sample->iteration = stat64_get(&mig_stats.dirty_sync_count);
+    sample->time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) -
+                   migrate_get_current()->start_time;
+    sample->dirty_pages = dirty_pages;
+    sample->ramblocks = ramblocks;
+    sample->sync_time = stat64_get(&mig_stats.dirty_sync_time_us);
+    sample->transferred = transferred - rs->timeline_transferred_prev;
+    sample->cpu_throttle_percentage = cpu_throttle_get_percentage();
+    sample->write_stall_time =
+        (write_time - rs->timeline_write_time_prev) / SCALE_US;
+
+    if (migrate_multifd()) {
+        int channels = migrate_multifd_channels();
+        uint64List **tail = &sample->multifd_bytes;
+        int i;
+
+        if (!rs->timeline_multifd_bytes_prev) {
+            rs->timeline_multifd_bytes_prev = g_new0(uint64_t, channels);
+        }
+        sample->has_multifd_bytes = true;
+        for (i = 0; i < channels; i++) {
+            uint64_t bytes = multifd_send_channel_bytes(i);
+
+            QAPI_LIST_APPEND(tail, bytes - rs->timeline_multifd_bytes_prev[i]);
+            rs->timeline_multifd_bytes_prev[i] = bytes;
+        }
+    }
+
+    if (compress_out > rs->timeline_compress_out_prev) {
+        sample->has_compression_ratio = true;
+        sample->compression_ratio =
+            (double)(compress_in - rs->timeline_compress_in_prev) /
+            (compress_out - rs->timeline_compress_out_prev);
+    }
+
+    rs->timeline_transferred_prev = transferred;
+    rs->timeline_compress_in_prev = compress_in;
+    rs->timeline_compress_out_prev = compress_out;
+    rs->timeline_write_time_prev = write_time;
+
+    trace_migration_timeline_sample(sample->iteration, dirty_pages,
+                                    sample->transferred,
+                                    sample->write_stall_time);
+    migration_timeline_record(sample);
+}
+
 static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 {
-    RAMBlock *block;
-    int64_t end_time;
+    MigrationTimelineRAMBlockList *ramblocks = NULL;
+    bool timeline = migration_timeline_enabled();
+    uint64_t dirty_pages_before = rs->num_dirty_pages_period;
+    int64_t end_time, sync_start, log_end, sync_end;
 
     stat64_add(&mig_stats.dirty_sync_count, 1);
 
@@ -1024,19 +1582,28 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
     }
 
     trace_migration_bitmap_sync_start();
+    sync_start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     memory_global_dirty_log_sync(last_stage);
+    log_end = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
-        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-            ramblock_sync_dirty_bitmap(rs, block);
-        }
+        ram_sync_dirty_bitmaps(rs, timeline ? &ramblocks : NULL);
         stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
     }
     qemu_mutex_unlock(&rs->bitmap_mutex);
 
     memory_global_after_dirty_log_sync();
-    trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
+    sync_end = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    stat64_set(&mig_stats.dirty_sync_time_us, sync_end - sync_start);
+    stat64_add(&mig_stats.dirty_sync_total_time_us, sync_end - sync_start);
+    trace_migration_bitmap_sync_end(rs->num_dirty_pages_period,
+                                    log_end - sync_start, sync_end - log_end);
+    if (timeline) {
+        migration_timeline_sample(rs, ramblocks,
+                                  rs->num_dirty_pages_period -
+                                  dirty_pages_before);
+    }
 
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
@@ -1113,6 +1680,25 @@ static int save_zero_page_to_file(PageSearchStatus *pss, QEMUFile *file,
     return len;
 }
 
+/**
+ * save_zero_page_legacy: check if zero pages are detected by the
+ * migration thread
+ *
+ * With multifd zero page detection, every page is queued as is and
+ * the multifd sender threads take care of the zero pages.
+ */
+static bool save_zero_page_legacy(void)
+{
+    switch (migrate_zero_page_detection()) {
+    case ZERO_PAGE_DETECTION_NONE:
+        return false;
+    case ZERO_PAGE_DETECTION_MULTIFD:
+        return !migrate_multifd() || migration_in_postcopy();
+    default:
+        return true;
+    }
+}
+
 /**
  * save_zero_page: send the zero page to the stream
  *
@@ -1125,7 +1711,27 @@ static int save_zero_page_to_file(PageSearchStatus *pss, QEMUFile *file,
 static int save_zero_page(PageSearchStatus *pss, QEMUFile *f, RAMBlock *block,
                           ram_addr_t offset)
 {
-    int len = save_zero_page_to_file(pss, f, block, offset);
+    int len;
+
+    if (!save_zero_page_legacy()) {
+        return -1;
+    }
+
+    if (migrate_mapped_ram()) {
+        if (!buffer_is_zero(block->host + offset, TARGET_PAGE_SIZE)) {
+            return -1;
+        }
+        /*
+         * The page may have been written to the file in an earlier
+         * iteration; clearing its bit makes the destination skip it
+         * and keep the zero-filled memory.
+         */
+        clear_bit(offset >> TARGET_PAGE_BITS, block->file_bmap);
+        stat64_add(&mig_stats.zero_pages, 1);
+        return 1;
+    }
+
+    len = save_zero_page_to_file(pss, f, block, offset);
 
     if (len) {
         stat64_add(&mig_stats.zero_pages, 1);
@@ -1189,6 +1795,15 @@ static int save_normal_page(PageSearchStatus *pss, RAMBlock *block,
 {
     QEMUFile *file = pss->pss_channel;
 
+    if (migrate_mapped_ram()) {
+        qemu_put_buffer_at(file, buf, TARGET_PAGE_SIZE,
+                           block->pages_offset + offset);
+        set_bit(offset >> TARGET_PAGE_BITS, block->file_bmap);
+        ram_transferred_add(TARGET_PAGE_SIZE);
+        stat64_add(&mig_stats.normal_pages, 1);
+        return 1;
+    }
+
     ram_transferred_add(save_page_header(pss, pss->pss_channel, block,
                                          offset | RAM_SAVE_FLAG_PAGE));
     if (async) {
@@ -1252,10 +1867,10 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss)
 static int ram_save_multifd_page(QEMUFile *file, RAMBlock *block,
                                  ram_addr_t offset)
 {
+    /* Page accounting is done by the multifd sender threads */
     if (multifd_queue_page(file, block, offset) < 0) {
         return -1;
     }
-    stat64_add(&mig_stats.normal_pages, 1);
 
     return 1;
 }
@@ -1385,6 +2000,10 @@ static int find_dirty_block(RAMState *rs, PageSearchStatus *pss)
             /* After the first round, enable XBZRLE. */
             if (migrate_xbzrle()) {
                 rs->xbzrle_started = true;
+                if (migrate_multifd_xbzrle() &&
+                    migrate_multifd_compression() == MULTIFD_COMPRESSION_NONE) {
+                    qatomic_set(&XBZRLE.multifd, true);
+                }
             }
         }
         /* Didn't find anything this time, but try again on the new block */
@@ -1439,6 +2058,44 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
     return block;
 }
 
+/**
+ * unqueue_hot_page: get the next dirty page of the postcopy hot set
+ *
+ * Returns the RAMBlock of the page, or NULL if the hot set is empty
+ *
+ * @rs: current RAM state
+ * @offset: used to return the offset within the RAMBlock
+ */
+static RAMBlock *unqueue_hot_page(RAMState *rs, ram_addr_t *offset)
+{
+    struct RAMSrcPageRequest *entry;
+
+    while ((entry = QSIMPLEQ_FIRST(&rs->src_hot_pages))) {
+        RAMBlock *block = entry->rb;
+        unsigned long end = (entry->offset + entry->len) >> TARGET_PAGE_BITS;
+        unsigned long page = find_next_bit(block->bmap, end,
+                                           entry->offset >> TARGET_PAGE_BITS);
+
+        if (page < end - 1) {
+            *offset = page << TARGET_PAGE_BITS;
+            entry->offset = *offset + TARGET_PAGE_SIZE;
+            entry->len = (end - page - 1) << TARGET_PAGE_BITS;
+            return block;
+        }
+
+        QSIMPLEQ_REMOVE_HEAD(&rs->src_hot_pages, next_req);
+        memory_region_unref(block->mr);
+        g_free(entry);
+
+        if (page < end) {
+            *offset = page << TARGET_PAGE_BITS;
+            return block;
+        }
+    }
+
+    return NULL;
+}
+
 #if defined(__linux__)
 /**
  * poll_fault_page: try to get next UFFD write fault page and, if pending fault
@@ -1861,6 +2518,15 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
 
     } while (block && !dirty);
 
+    if (!block) {
+        /* Nothing asked by the destination, go on with the hot set */
+        block = unqueue_hot_page(rs, &offset);
+        if (block) {
+            trace_get_queued_page(block->idstr, (uint64_t)offset,
+                                  offset >> TARGET_PAGE_BITS);
+        }
+    }
+
     if (!block) {
         /*
          * Poll write faults too if background snapshot is enabled; that's
@@ -1908,6 +2574,11 @@ static void migration_page_queue_free(RAMState *rs)
         QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
         g_free(mspr);
     }
+    QSIMPLEQ_FOREACH_SAFE(mspr, &rs->src_hot_pages, next_req, next_mspr) {
+        memory_region_unref(mspr->rb->mr);
+        QSIMPLEQ_REMOVE_HEAD(&rs->src_hot_pages, next_req);
+        g_free(mspr);
+    }
 }
 
 /**
@@ -1995,15 +2666,15 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
                 break;
             }
             /*
-             * NOTE: after ram_save_host_page_urgent() succeeded, pss->page
-             * will automatically be moved and point to the next host page
-             * we're going to send, so no need to update here.
-             *
-             * Normally QEMU never sends >1 host page in requests, so
-             * logically we don't even need that as the loop should only
-             * run once, but just to be consistent.
+             * NOTE: after ram_save_host_page_urgent() returns, pss->page
+             * points to the next dirty page, which can be way beyond the
+             * requested range.  Restart from the next host page instead,
+             * as the destination may ask for a range of them when it
+             * prefetches (see postcopy-prefetch-window).
              */
             len -= page_size;
+            page_start += page_size >> TARGET_PAGE_BITS;
+            pss_init(pss, ramblock, page_start);
         };
         qemu_mutex_unlock(&rs->bitmap_mutex);
 
@@ -2107,7 +2778,7 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
          */
         if (rs->xbzrle_started) {
             XBZRLE_cache_lock();
-            xbzrle_cache_zero_page(rs, block->offset + offset);
+            xbzrle_cache_zero_page(block->offset + offset);
             XBZRLE_cache_unlock();
         }
         return res;
@@ -2420,6 +3091,7 @@ static void ram_state_cleanup(RAMState **rsp)
         migration_page_queue_free(*rsp);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
+        g_free((*rsp)->timeline_multifd_bytes_prev);
         g_free(*rsp);
         *rsp = NULL;
     }
@@ -2428,12 +3100,16 @@ static void ram_state_cleanup(RAMState **rsp)
 static void xbzrle_cleanup(void)
 {
     XBZRLE_cache_lock();
-    if (XBZRLE.cache) {
-        cache_fini(XBZRLE.cache);
+    if (XBZRLE.shards[0].cache) {
+        /*
+         * The multifd send threads may still be running, drop the caches
+         * under the shard locks before the zero page goes away.
+         */
+        qatomic_set(&XBZRLE.multifd, false);
+        xbzrle_caches_set(NULL);
         g_free(XBZRLE.encoded_buf);
         g_free(XBZRLE.current_buf);
         g_free(XBZRLE.zero_target_page);
-        XBZRLE.cache = NULL;
         XBZRLE.encoded_buf = NULL;
         XBZRLE.current_buf = NULL;
         XBZRLE.zero_target_page = NULL;
@@ -2466,6 +3142,8 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
@@ -2684,6 +3362,95 @@ void ram_postcopy_send_discard_bitmap(MigrationState *ms)
     trace_ram_postcopy_send_discard_bitmap();
 }
 
+/* Granularity at which the postcopy hot set is picked */
+#define POSTCOPY_HOT_SET_CHUNK (2 * MiB)
+
+typedef struct {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    ram_addr_t len;
+    unsigned long dirty;
+} RAMHotChunk;
+
+static gint ram_hot_chunk_cmp(gconstpointer a, gconstpointer b)
+{
+    const RAMHotChunk *ca = a, *cb = b;
+
+    /* Most dirty first */
+    if (ca->dirty != cb->dirty) {
+        return ca->dirty > cb->dirty ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * ram_postcopy_queue_hot_set: pick the guest memory to send first in
+ *   postcopy
+ *
+ * The chunks of guest memory with the most dirty pages left after the
+ * last bitmap sync are the ones the guest was writing to the most, and
+ * so the most likely to be accessed once it runs on the destination.
+ * Queue them, up to postcopy-hot-set-size bytes of dirty pages, so that
+ * they are sent before the background scan and only after the pages
+ * the destination explicitly asks for.
+ *
+ * Must be called after ram_postcopy_send_discard_bitmap().
+ */
+void ram_postcopy_queue_hot_set(void)
+{
+    RAMState *rs = ram_state;
+    uint64_t budget = migrate_postcopy_hot_set_size();
+    g_autoptr(GArray) chunks = NULL;
+    RAMBlock *block;
+    guint i;
+
+    if (!budget) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    chunks = g_array_new(false, false, sizeof(RAMHotChunk));
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t chunk = MAX(POSTCOPY_HOT_SET_CHUNK,
+                               qemu_ram_pagesize(block));
+        ram_addr_t offset;
+
+        for (offset = 0; offset < block->used_length; offset += chunk) {
+            RAMHotChunk c = {
+                .rb = block,
+                .offset = offset,
+                .len = MIN(chunk, block->used_length - offset),
+            };
+
+            c.dirty = bitmap_count_one_with_offset(block->bmap,
+                                                   offset >> TARGET_PAGE_BITS,
+                                                   c.len >> TARGET_PAGE_BITS);
+            if (c.dirty) {
+                g_array_append_val(chunks, c);
+            }
+        }
+    }
+
+    g_array_sort(chunks, ram_hot_chunk_cmp);
+
+    for (i = 0; i < chunks->len && budget; i++) {
+        RAMHotChunk *c = &g_array_index(chunks, RAMHotChunk, i);
+        struct RAMSrcPageRequest *entry = g_new0(struct RAMSrcPageRequest, 1);
+        uint64_t bytes = (uint64_t)c->dirty << TARGET_PAGE_BITS;
+
+        entry->rb = c->rb;
+        entry->offset = c->offset;
+        entry->len = c->len;
+        memory_region_ref(c->rb->mr);
+        QSIMPLEQ_INSERT_TAIL(&rs->src_hot_pages, entry, next_req);
+
+        trace_ram_postcopy_queue_hot_set(c->rb->idstr, c->offset, c->len,
+                                         c->dirty);
+        budget -= MIN(budget, bytes);
+    }
+}
+
 /**
  * ram_discard_range: discard dirtied pages at the beginning of postcopy
  *
@@ -2725,6 +3492,9 @@ int ram_discard_range(const char *rbname, uint64_t start, size_t length)
 static int xbzrle_init(void)
 {
     Error *local_err = NULL;
+    PageCache *caches[XBZRLE_MAX_SHARDS];
+    uint64_t cache_size = migrate_xbzrle_cache_size();
+    unsigned int i;
 
     if (!migrate_xbzrle()) {
         return 0;
@@ -2738,12 +3508,31 @@ static int xbzrle_init(void)
         goto err_out;
     }
 
-    XBZRLE.cache = cache_init(migrate_xbzrle_cache_size(),
-                              TARGET_PAGE_SIZE, &local_err);
-    if (!XBZRLE.cache) {
+    /*
+     * With multifd, give each channel a shard, as long as each shard
+     * still holds at least one page.
+     */
+    XBZRLE.multifd = false;
+    XBZRLE.nr_shards = 1;
+    if (migrate_multifd_xbzrle()) {
+        XBZRLE.nr_shards = MIN(pow2floor(migrate_multifd_channels()),
+                               XBZRLE_MAX_SHARDS);
+        while (XBZRLE.nr_shards > 1 &&
+               cache_size / XBZRLE.nr_shards < TARGET_PAGE_SIZE) {
+            XBZRLE.nr_shards >>= 1;
+        }
+    }
+    for (i = 0; i < XBZRLE.nr_shards; i++) {
+        XBZRLEShard *shard = &XBZRLE.shards[i];
+
+        shard->pages = shard->cache_miss = shard->overflow = shard->bytes = 0;
+    }
+
+    if (!xbzrle_caches_new(caches, cache_size, &local_err)) {
         error_report_err(local_err);
         goto free_zero_page;
     }
+    xbzrle_caches_set(caches);
 
     XBZRLE.encoded_buf = g_try_malloc0(TARGET_PAGE_SIZE);
     if (!XBZRLE.encoded_buf) {
@@ -2765,8 +3554,7 @@ free_encoded_buf:
     g_free(XBZRLE.encoded_buf);
     XBZRLE.encoded_buf = NULL;
 free_cache:
-    cache_fini(XBZRLE.cache);
-    XBZRLE.cache = NULL;
+    xbzrle_caches_set(NULL);
 free_zero_page:
     g_free(XBZRLE.zero_target_page);
     XBZRLE.zero_target_page = NULL;
@@ -2787,6 +3575,7 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
+    QSIMPLEQ_INIT(&(*rsp)->src_hot_pages);
     (*rsp)->ram_bytes_total = ram_bytes_total();
 
     /*
@@ -2835,6 +3624,9 @@ static void ram_list_init_bitmaps(void)
             bitmap_set(block->bmap, 0, pages);
             block->clear_bmap_shift = shift;
             block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
+            if (migrate_mapped_ram()) {
+                block->file_bmap = bitmap_new(pages);
+            }
         }
     }
 }
@@ -2980,6 +3772,51 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
  * granularity of these critical sections.
  */
 
+static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
+{
+    g_autofree MappedRamHeader *header = NULL;
+    size_t header_size, bitmap_size;
+    long num_pages;
+
+    header = g_new0(MappedRamHeader, 1);
+    header_size = sizeof(MappedRamHeader);
+
+    num_pages = block->used_length >> TARGET_PAGE_BITS;
+    bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+
+    /*
+     * Save the file offsets of where the bitmap and the pages should
+     * go as they are written at the end of migration and during the
+     * iterative phase, respectively.
+     */
+    block->bitmap_offset = qemu_get_offset(file) + header_size;
+    block->pages_offset = ROUND_UP(block->bitmap_offset +
+                                   bitmap_size,
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    header->version = cpu_to_be32(MAPPED_RAM_HDR_VERSION);
+    header->page_size = cpu_to_be64(TARGET_PAGE_SIZE);
+    header->bitmap_offset = cpu_to_be64(block->bitmap_offset);
+    header->pages_offset = cpu_to_be64(block->pages_offset);
+
+    qemu_put_buffer(file, (uint8_t *) header, header_size);
+
+    /* prepare offset for next ramblock */
+    qemu_set_offset(file, block->pages_offset + block->used_length, SEEK_SET);
+}
+
+static void mapped_ram_write_bitmap(QEMUFile *file, RAMBlock *block)
+{
+    long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+    g_autofree unsigned long *le_bitmap = bitmap_new(num_pages);
+
+    bitmap_to_le(le_bitmap, block->file_bmap, num_pages);
+    qemu_put_buffer_at(file, (uint8_t *)le_bitmap, bitmap_size,
+                       block->bitmap_offset);
+    ram_transferred_add(bitmap_size);
+}
+
 /**
  * ram_save_setup: Setup RAM for migration
  *
@@ -3022,6 +3859,10 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+
+            if (migrate_mapped_ram()) {
+                mapped_ram_setup_ramblock(f, block);
+            }
         }
     }
 
@@ -3224,6 +4065,26 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         return ret;
     }
 
+    if (migrate_xbzrle()) {
+        /* All the pages are out, account for the multifd ones */
+        xbzrle_counters_fold();
+    }
+
+    if (migrate_mapped_ram()) {
+        RAMBlock *block;
+
+        WITH_RCU_READ_LOCK_GUARD() {
+            RAMBLOCK_FOREACH_MIGRATABLE(block) {
+                mapped_ram_write_bitmap(f, block);
+            }
+        }
+
+        ret = qemu_file_get_error(f);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
     if (!migrate_multifd_flush_after_each_section()) {
         qemu_put_be64(f, RAM_SAVE_FLAG_MULTIFD_FLUSH);
     }
@@ -3826,6 +4687,229 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+typedef struct MappedRamLoadWorker {
+    QemuThread thread;
+    QIOChannel *ioc;
+    RAMBlock *block;
+    unsigned long *bitmap;
+    /* Range of pages [start, end) handled by this worker */
+    unsigned long start;
+    unsigned long end;
+    Error *err;
+} MappedRamLoadWorker;
+
+/*
+ * Read all pages marked in @bitmap within [@start, @end) from the
+ * pages region of @block straight into guest memory.
+ */
+static bool mapped_ram_read_range(QIOChannel *ioc, RAMBlock *block,
+                                  unsigned long *bitmap, unsigned long start,
+                                  unsigned long end, Error **errp)
+{
+    unsigned long set_bit_idx, clear_bit_idx;
+    ram_addr_t offset;
+    size_t size, chunk;
+    ssize_t read;
+    uint8_t *host;
+
+    for (set_bit_idx = find_next_bit(bitmap, end, start);
+         set_bit_idx < end;
+         set_bit_idx = find_next_bit(bitmap, end, clear_bit_idx + 1)) {
+
+        clear_bit_idx = find_next_zero_bit(bitmap, end, set_bit_idx + 1);
+
+        offset = (ram_addr_t)set_bit_idx << TARGET_PAGE_BITS;
+        size = (size_t)(clear_bit_idx - set_bit_idx) << TARGET_PAGE_BITS;
+
+        host = host_from_ram_block_offset(block, offset);
+        if (!host) {
+            error_setg(errp, "page outside of ramblock %s range",
+                       block->idstr);
+            return false;
+        }
+
+        while (size) {
+            chunk = MIN(size, MAPPED_RAM_LOAD_BUF_SIZE);
+            read = qio_channel_pread(ioc, (char *)host, chunk,
+                                     block->pages_offset + offset, errp);
+            if (read <= 0) {
+                if (read == 0) {
+                    error_setg(errp, "unexpected end of file reading "
+                               "ramblock %s", block->idstr);
+                } else if (read == QIO_CHANNEL_ERR_BLOCK) {
+                    error_setg(errp, "unexpected blocking read of "
+                               "ramblock %s", block->idstr);
+                }
+                return false;
+            }
+
+            ramblock_recv_bitmap_set_range(block, host,
+                                           read >> TARGET_PAGE_BITS);
+            offset += read;
+            host += read;
+            size -= read;
+        }
+    }
+
+    return true;
+}
+
+static void *mapped_ram_load_thread(void *opaque)
+{
+    MappedRamLoadWorker *w = opaque;
+
+    rcu_register_thread();
+    mapped_ram_read_range(w->ioc, w->block, w->bitmap, w->start, w->end,
+                          &w->err);
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+/*
+ * Restore the pages of @block. Since every page has a fixed position
+ * in the file, the page range is split between up to multifd-channels
+ * threads that read their share concurrently.
+ */
+static bool mapped_ram_read_ramblock(QEMUFile *f, RAMBlock *block,
+                                     unsigned long *bitmap,
+                                     unsigned long num_pages, Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    unsigned long min_pages = MAPPED_RAM_LOAD_MIN_BYTES_PER_THREAD >>
+                              TARGET_PAGE_BITS;
+    g_autofree MappedRamLoadWorker *workers = NULL;
+    unsigned long per_thread;
+    int nthreads, i;
+    bool ret = true;
+
+    nthreads = MIN(migrate_multifd_channels(),
+                   DIV_ROUND_UP(num_pages, min_pages));
+    if (nthreads <= 1) {
+        return mapped_ram_read_range(ioc, block, bitmap, 0, num_pages, errp);
+    }
+
+    trace_ram_load_mapped_ram_parallel(block->idstr, num_pages, nthreads);
+
+    /* Keep each worker's range aligned to a whole bitmap word */
+    per_thread = ROUND_UP(DIV_ROUND_UP(num_pages, nthreads), BITS_PER_LONG);
+    workers = g_new0(MappedRamLoadWorker, nthreads);
+
+    for (i = 0; i < nthreads; i++) {
+        MappedRamLoadWorker *w = &workers[i];
+
+        w->ioc = ioc;
+        w->block = block;
+        w->bitmap = bitmap;
+        w->start = MIN(i * per_thread, num_pages);
+        w->end = MIN(w->start + per_thread, num_pages);
+        qemu_thread_create(&w->thread, "mapped-ram-load",
+                           mapped_ram_load_thread, w,
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        MappedRamLoadWorker *w = &workers[i];
+
+        qemu_thread_join(&w->thread);
+        if (w->err) {
+            if (ret) {
+                error_propagate(errp, w->err);
+                ret = false;
+            } else {
+                error_free(w->err);
+            }
+        }
+    }
+
+    return ret;
+}
+
+static bool mapped_ram_read_header(QEMUFile *file, MappedRamHeader *header,
+                                   Error **errp)
+{
+    size_t size, header_size = sizeof(MappedRamHeader);
+
+    size = qemu_get_buffer(file, (uint8_t *)header, header_size);
+    if (size != header_size) {
+        error_setg(errp, "Could not read whole mapped-ram migration header "
+                   "(expected %zd, got %zd bytes)", header_size, size);
+        return false;
+    }
+
+    /* migration stream is big-endian */
+    header->version = be32_to_cpu(header->version);
+
+    if (header->version > MAPPED_RAM_HDR_VERSION) {
+        error_setg(errp, "Migration mapped-ram capability version not "
+                   "supported (expected <= %d, got %d)",
+                   MAPPED_RAM_HDR_VERSION, header->version);
+        return false;
+    }
+
+    header->page_size = be64_to_cpu(header->page_size);
+    header->bitmap_offset = be64_to_cpu(header->bitmap_offset);
+    header->pages_offset = be64_to_cpu(header->pages_offset);
+
+    return true;
+}
+
+static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                      ram_addr_t length, Error **errp)
+{
+    g_autofree unsigned long *le_bitmap = NULL;
+    g_autofree unsigned long *bitmap = NULL;
+    MappedRamHeader header;
+    size_t bitmap_size;
+    long num_pages;
+
+    if (!mapped_ram_read_header(f, &header, errp)) {
+        return;
+    }
+
+    if (header.page_size != TARGET_PAGE_SIZE) {
+        error_setg(errp, "Mapped-ram page size mismatch for ramblock %s "
+                   "(expected %" PRIu64 ", got %d)", block->idstr,
+                   header.page_size, TARGET_PAGE_SIZE);
+        return;
+    }
+
+    block->pages_offset = header.pages_offset;
+
+    /*
+     * Check the alignment of the file region that contains pages. We
+     * don't enforce MAPPED_RAM_FILE_OFFSET_ALIGNMENT to allow that
+     * value to change in the future. Do only a sanity check with page
+     * size alignment.
+     */
+    if (!QEMU_IS_ALIGNED(block->pages_offset, TARGET_PAGE_SIZE)) {
+        error_setg(errp, "Error reading ramblock %s pages, region has "
+                   "bad alignment", block->idstr);
+        return;
+    }
+
+    num_pages = length / header.page_size;
+    bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+
+    le_bitmap = g_malloc0(bitmap_size);
+    bitmap = g_malloc0(bitmap_size);
+
+    if (qemu_get_buffer_at(f, (uint8_t *)le_bitmap, bitmap_size,
+                           header.bitmap_offset) != bitmap_size) {
+        error_setg(errp, "Error reading dirty bitmap of ramblock %s",
+                   block->idstr);
+        return;
+    }
+    bitmap_from_le(bitmap, le_bitmap, num_pages);
+
+    if (!mapped_ram_read_ramblock(f, block, bitmap, num_pages, errp)) {
+        return;
+    }
+
+    /* Skip pages array */
+    qemu_set_offset(f, block->pages_offset + length, SEEK_SET);
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -3967,6 +5051,16 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_mapped_ram()) {
+                        Error *local_err = NULL;
+
+                        parse_ramblock_mapped_ram(f, block, length,
+                                                  &local_err);
+                        if (local_err) {
+                            error_report_err(local_err);
+                            ret = -EINVAL;
+                        }
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -4307,7 +5401,12 @@ static RAMBlockNotifier ram_mig_ram_notifier = {
 
 void ram_mig_init(void)
 {
+    int i;
+
     qemu_mutex_init(&XBZRLE.lock);
+    for (i = 0; i < XBZRLE_MAX_SHARDS; i++) {
+        qemu_mutex_init(&XBZRLE.shards[i].lock);
+    }
     register_savevm_live("ram", 0, 4, &savevm_ram_handlers, &ram_state);
     ram_block_notifier_add(&ram_mig_ram_notifier);
 }
@@ -52,6 +52,7 @@
 #include "exec/target_page.h"
 #include "trace.h"
 #include "qemu/iov.h"
+#include "qemu/lockable.h"
 #include "qemu/job.h"
 #include "qemu/main-loop.h"
 #include "block/snapshot.h"
@@ -217,6 +218,24 @@ typedef struct SaveStateEntry {
     void *opaque;
     CompatEntry *compat;
     int is_ram;
+
+    /*
+     * Stop-copy accounting: what this entry is expected to send while
+     * the guest is stopped, and what it actually sent on the last
+     * switchover.  Sizes are in bytes and times in microseconds.  The
+     * overhead is the part of the last stop-copy time that the amount
+     * of data does not explain (e.g. device quiescing); it is kept
+     * across migrations to improve the next prediction.
+     */
+    uint64_t stopcopy_predicted_size;
+    uint64_t stopcopy_predicted_time;
+    uint64_t stopcopy_size;
+    uint64_t stopcopy_time;
+    uint64_t stopcopy_overhead;
+    bool stopcopy_done;
+
+    /* Last parallel load job of this entry, see LoadvmParallel */
+    struct LoadvmParallelJob *load_job;
 } SaveStateEntry;
 
 typedef struct SaveState {
@@ -229,6 +248,14 @@ typedef struct SaveState {
     uint32_t caps_count;
     MigrationCapability *capabilities;
     QemuUUID uuid;
+
+    /*
+     * Protects the stop-copy accounting in the entries, which the
+     * migration thread updates while query-migrate reads it.
+     */
+    QemuMutex stopcopy_lock;
+    /* bandwidth of the last iteration in bytes/ms, under stopcopy_lock */
+    double stopcopy_bandwidth;
 } SaveState;
 
 static SaveState savevm_state = {
@@ -237,6 +264,11 @@ static SaveState savevm_state = {
     .global_section_id = 0,
 };
 
+static void __attribute__((constructor)) savevm_state_init(void)
+{
+    qemu_mutex_init(&savevm_state.stopcopy_lock);
+}
+
 static bool should_validate_capability(int capability)
 {
     assert(capability >= 0 && capability < MIGRATION_CAPABILITY__MAX);
@@ -917,11 +949,19 @@ void vmstate_unregister(VMStateIf *obj, const VMStateDescription *vmsd,
 
 static int vmstate_load(QEMUFile *f, SaveStateEntry *se)
 {
+    int64_t start_ns = get_clock();
+    int ret;
+
     trace_vmstate_load(se->idstr, se->vmsd ? se->vmsd->name : "(old)");
     if (!se->vmsd) {         /* Old style */
-        return se->ops->load_state(f, se->opaque, se->load_version_id);
+        ret = se->ops->load_state(f, se->opaque, se->load_version_id);
+    } else {
+        ret = vmstate_load_state(f, se->vmsd, se->opaque,
+                                 se->load_version_id);
     }
-    return vmstate_load_state(f, se->vmsd, se->opaque, se->load_version_id);
+    trace_vmstate_load_done(se->idstr, se->instance_id, ret,
+                            (get_clock() - start_ns) / SCALE_US);
+    return ret;
 }
 
 static void vmstate_save_old_style(QEMUFile *f, SaveStateEntry *se,
@@ -953,6 +993,7 @@ static void save_section_header(QEMUFile *f, SaveStateEntry *se,
     qemu_put_be32(f, se->section_id);
 
     if (section_type == QEMU_VM_SECTION_FULL ||
+        section_type == QEMU_VM_SECTION_FULL_BUFFERED ||
         section_type == QEMU_VM_SECTION_START) {
         /* ID string */
         size_t len = strlen(se->idstr);
@@ -976,6 +1017,67 @@ static void save_section_footer(QEMUFile *f, SaveStateEntry *se)
     }
 }
 
+static bool vmstate_save_buffered_allowed(SaveStateEntry *se)
+{
+    return migrate_parallel_device_load() && se->vmsd &&
+           se->vmsd->parallel_load;
+}
+
+/*
+ * Save a device section as QEMU_VM_SECTION_FULL_BUFFERED: the state is
+ * prefixed with its length so that the destination can read it off the
+ * stream without parsing it, and hand it to a load thread.
+ */
+static int vmstate_save_buffered(QEMUFile *f, SaveStateEntry *se,
+                                 JSONWriter *vmdesc)
+{
+    QIOChannelBuffer *bioc;
+    QEMUFile *bf;
+    int ret;
+
+    if (!vmstate_save_needed(se->vmsd, se->opaque)) {
+        trace_savevm_section_skip(se->idstr, se->section_id);
+        return 0;
+    }
+
+    bioc = qio_channel_buffer_new(4096);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-savevm-buffer");
+    bf = qemu_file_new_output(QIO_CHANNEL(bioc));
+
+    trace_savevm_section_start(se->idstr, se->section_id);
+    if (vmdesc) {
+        json_writer_start_object(vmdesc, NULL);
+        json_writer_str(vmdesc, "name", se->idstr);
+        json_writer_int64(vmdesc, "instance_id", se->instance_id);
+    }
+
+    trace_vmstate_save(se->idstr, se->vmsd->name);
+    ret = vmstate_save_state(bf, se->vmsd, se->opaque, vmdesc);
+    if (!ret) {
+        /* Keeps the subsection lookup from running past the buffer */
+        qemu_put_byte(bf, QEMU_VM_EOF);
+        qemu_fflush(bf);
+        ret = qemu_file_get_error(bf);
+    }
+    if (ret) {
+        goto out;
+    }
+
+    save_section_header(f, se, QEMU_VM_SECTION_FULL_BUFFERED);
+    qemu_put_be32(f, bioc->usage);
+    qemu_put_buffer(f, (uint8_t *)bioc->data, bioc->usage);
+    trace_savevm_section_end(se->idstr, se->section_id, 0);
+    save_section_footer(f, se);
+    if (vmdesc) {
+        json_writer_end_object(vmdesc);
+    }
+
+out:
+    qemu_fclose(bf);
+    object_unref(OBJECT(bioc));
+    return ret;
+}
+
 static int vmstate_save(QEMUFile *f, SaveStateEntry *se, JSONWriter *vmdesc)
 {
     int ret;
@@ -1233,6 +1335,152 @@ bool qemu_savevm_state_guest_unplug_pending(void)
     return false;
 }
 
+/* Whether the state_pending_* handlers account for this entry's data */
+static bool savevm_stopcopy_is_iterable(SaveStateEntry *se)
+{
+    return se->ops &&
+           (se->ops->state_pending_estimate || se->ops->state_pending_exact);
+}
+
+/* Predicted stop-copy time in microseconds, @bandwidth in bytes/ms */
+static uint64_t savevm_stopcopy_predict(SaveStateEntry *se, double bandwidth)
+{
+    uint64_t time = se->stopcopy_overhead;
+
+    if (bandwidth > 0) {
+        time += se->stopcopy_predicted_size / bandwidth * 1000;
+    }
+    return time;
+}
+
+/*
+ * Estimate the size of the non-iterable device state.  Iterable
+ * entries report theirs through the state_pending_* handlers.
+ */
+static void qemu_savevm_state_stopcopy_setup(void)
+{
+    SaveStateEntry *se;
+
+    QEMU_LOCK_GUARD(&savevm_state.stopcopy_lock);
+    savevm_state.stopcopy_bandwidth = 0;
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        se->stopcopy_done = false;
+        se->stopcopy_predicted_size = 0;
+        se->stopcopy_predicted_time = 0;
+
+        if (savevm_stopcopy_is_iterable(se)) {
+            continue;
+        }
+
+        if (se->vmsd) {
+            if (!se->vmsd->early_setup &&
+                vmstate_save_needed(se->vmsd, se->opaque)) {
+                se->stopcopy_predicted_size =
+                    vmstate_size_estimate(se->vmsd, se->opaque);
+            }
+        } else if (se->ops && se->ops->save_state) {
+            /* Nothing to walk, assume it sends what it sent last time */
+            se->stopcopy_predicted_size = se->stopcopy_size;
+        }
+    }
+}
+
+static void savevm_stopcopy_account(SaveStateEntry *se, QEMUFile *f,
+                                    uint64_t start_bytes, int64_t start_ns)
+{
+    double bandwidth;
+    uint64_t transfer_time;
+
+    QEMU_LOCK_GUARD(&savevm_state.stopcopy_lock);
+    bandwidth = savevm_state.stopcopy_bandwidth;
+    se->stopcopy_predicted_time = savevm_stopcopy_predict(se, bandwidth);
+    se->stopcopy_size = qemu_file_transferred_fast(f) - start_bytes;
+    se->stopcopy_time = (get_clock() - start_ns) / SCALE_US;
+    se->stopcopy_done = true;
+
+    /*
+     * Without a bandwidth measurement (e.g. savevm) the time cannot be
+     * split between transfer and overhead, so keep the previous value.
+     */
+    if (bandwidth > 0) {
+        transfer_time = se->stopcopy_size / bandwidth * 1000;
+        se->stopcopy_overhead = se->stopcopy_time > transfer_time ?
+                                se->stopcopy_time - transfer_time : 0;
+    }
+
+    trace_savevm_stopcopy(se->idstr, se->instance_id,
+                          se->stopcopy_predicted_size, se->stopcopy_size,
+                          se->stopcopy_predicted_time, se->stopcopy_time);
+}
+
+/*
+ * Return the stop-copy cost that the state_pending_* handlers do not
+ * report, converted to bytes at @bandwidth (bytes/ms): the estimated
+ * non-iterable device state plus the per-entry overhead measured on
+ * the last switchover.
+ */
+uint64_t qemu_savevm_state_stopcopy_size(double bandwidth)
+{
+    SaveStateEntry *se;
+    uint64_t size = 0;
+
+    QEMU_LOCK_GUARD(&savevm_state.stopcopy_lock);
+    savevm_state.stopcopy_bandwidth = bandwidth;
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (!savevm_stopcopy_is_iterable(se)) {
+            size += se->stopcopy_predicted_size;
+        }
+        size += se->stopcopy_overhead * bandwidth / 1000;
+    }
+
+    return size;
+}
+
+/*
+ * Fill @list with the predicted and, once the switchover happened,
+ * achieved stop-copy cost of every entry that has one.  Returns the
+ * total predicted downtime in milliseconds.  The prediction uses the
+ * bandwidth last passed to qemu_savevm_state_stopcopy_size().
+ */
+int64_t qemu_savevm_state_stopcopy_info(MigrationSwitchoverDeviceList **list)
+{
+    MigrationSwitchoverDeviceList **tail = list;
+    SaveStateEntry *se;
+    uint64_t total = 0;
+    double bandwidth;
+
+    QEMU_LOCK_GUARD(&savevm_state.stopcopy_lock);
+    bandwidth = savevm_state.stopcopy_bandwidth;
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        MigrationSwitchoverDevice *dev;
+        uint64_t predicted;
+
+        if (!se->stopcopy_predicted_size && !se->stopcopy_overhead &&
+            !se->stopcopy_done) {
+            continue;
+        }
+
+        predicted = se->stopcopy_done ? se->stopcopy_predicted_time :
+                    savevm_stopcopy_predict(se, bandwidth);
+        total += predicted;
+
+        dev = g_new0(MigrationSwitchoverDevice, 1);
+        dev->idstr = g_strdup(se->idstr);
+        dev->instance_id = se->instance_id;
+        dev->predicted_size = se->stopcopy_predicted_size;
+        dev->predicted_downtime = predicted;
+        if (se->stopcopy_done) {
+            dev->has_size = true;
+            dev->size = se->stopcopy_size;
+            dev->has_downtime = true;
+            dev->downtime = se->stopcopy_time;
+        }
+        QAPI_LIST_APPEND(tail, dev);
+    }
+
+    return total / 1000;
+}
+
 void qemu_savevm_state_setup(QEMUFile *f)
 {
     MigrationState *ms = migrate_get_current();
@@ -1274,6 +1522,10 @@ void qemu_savevm_state_setup(QEMUFile *f)
         }
     }
 
+    qemu_mutex_lock_iothread();
+    qemu_savevm_state_stopcopy_setup();
+    qemu_mutex_unlock_iothread();
+
     if (precopy_notify(PRECOPY_NOTIFY_SETUP, &local_err)) {
         error_report_err(local_err);
     }
@@ -1416,6 +1668,8 @@ static
 int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
 {
     SaveStateEntry *se;
+    uint64_t start_bytes;
+    int64_t start_ns;
     int ret;
 
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
@@ -1433,11 +1687,15 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
         }
         trace_savevm_section_start(se->idstr, se->section_id);
 
+        start_bytes = qemu_file_transferred_fast(f);
+        start_ns = get_clock();
+
         save_section_header(f, se, QEMU_VM_SECTION_END);
 
         ret = se->ops->save_live_complete_precopy(f, se->opaque);
         trace_savevm_section_end(se->idstr, se->section_id, ret);
         save_section_footer(f, se);
+        savevm_stopcopy_account(se, f, start_bytes, start_ns);
         if (ret < 0) {
             qemu_file_set_error(f, ret);
             return -1;
@@ -1455,6 +1713,8 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
     JSONWriter *vmdesc = ms->vmdesc;
     int vmdesc_len;
     SaveStateEntry *se;
+    uint64_t start_bytes;
+    int64_t start_ns;
     int ret;
 
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
@@ -1463,7 +1723,16 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
             continue;
         }
 
-        ret = vmstate_save(f, se, vmdesc);
+        start_bytes = qemu_file_transferred_fast(f);
+        start_ns = get_clock();
+        if (!in_postcopy && vmstate_save_buffered_allowed(se)) {
+            ret = vmstate_save_buffered(f, se, vmdesc);
+        } else {
+            ret = vmstate_save(f, se, vmdesc);
+        }
+        if (!ret && qemu_file_transferred_fast(f) != start_bytes) {
+            savevm_stopcopy_account(se, f, start_bytes, start_ns);
+        }
         if (ret) {
             qemu_file_set_error(f, ret);
             return ret;
@@ -1548,6 +1817,7 @@ void qemu_savevm_state_pending_estimate(uint64_t *must_precopy,
                                         uint64_t *can_postcopy)
 {
     SaveStateEntry *se;
+    uint64_t before;
 
     *must_precopy = 0;
     *can_postcopy = 0;
@@ -1561,7 +1831,11 @@ void qemu_savevm_state_pending_estimate(uint64_t *must_precopy,
                 continue;
             }
         }
+        before = *must_precopy;
         se->ops->state_pending_estimate(se->opaque, must_precopy, can_postcopy);
+        WITH_QEMU_LOCK_GUARD(&savevm_state.stopcopy_lock) {
+            se->stopcopy_predicted_size = *must_precopy - before;
+        }
     }
 }
 
@@ -1569,6 +1843,7 @@ void qemu_savevm_state_pending_exact(uint64_t *must_precopy,
                                      uint64_t *can_postcopy)
 {
     SaveStateEntry *se;
+    uint64_t before;
 
     *must_precopy = 0;
     *can_postcopy = 0;
@@ -1582,7 +1857,11 @@ void qemu_savevm_state_pending_exact(uint64_t *must_precopy,
                 continue;
             }
         }
+        before = *must_precopy;
         se->ops->state_pending_exact(se->opaque, must_precopy, can_postcopy);
+        WITH_QEMU_LOCK_GUARD(&savevm_state.stopcopy_lock) {
+            se->stopcopy_predicted_size = *must_precopy - before;
+        }
     }
 }
 
@@ -1619,6 +1898,11 @@ static int qemu_savevm_state(QEMUFile *f, Error **errp)
         return -EINVAL;
     }
 
+    if (migrate_mapped_ram()) {
+        error_setg(errp, "savevm does not support mapped-ram");
+        return -EINVAL;
+    }
+
     migrate_init(ms);
     memset(&mig_stats, 0, sizeof(mig_stats));
     memset(&compression_counters, 0, sizeof(compression_counters));
@@ -2128,7 +2412,8 @@ static gboolean postcopy_sync_page_req(gpointer key, gpointer value,
         return FALSE;
     }
 
-    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset);
+    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset,
+                                            qemu_ram_pagesize(rb));
     if (ret) {
         /* Please refer to above comment. */
         error_report("%s: send rp message failed for addr %p",
@@ -2444,8 +2729,265 @@ static bool check_section_footer(QEMUFile *f, SaveStateEntry *se)
     return true;
 }
 
-static int
-qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
+/*
+ * Parallel device state load
+ *
+ * QEMU_VM_SECTION_FULL_BUFFERED sections of devices that set
+ * parallel_load are read off the stream by the main thread and loaded by
+ * a pool of load threads, while the main thread goes on with the rest of
+ * the stream.  A section, parallel or not, first waits for the sections
+ * named in its load_deps that came before it in the stream.  Jobs are
+ * picked in stream order, so a load thread only ever waits for jobs that
+ * are already running or done.  qemu_loadvm_state() waits for all of
+ * them before returning, that is before the guest can be started.
+ */
+#define LOADVM_PARALLEL_THREADS_MAX 8
+
+typedef struct LoadvmParallelJob {
+    SaveStateEntry *se;
+    QIOChannelBuffer *bioc;
+    /* jobs that must be done before this one is loaded */
+    GPtrArray *deps;
+    QemuEvent done;
+    int ret;
+    QSIMPLEQ_ENTRY(LoadvmParallelJob) next;
+} LoadvmParallelJob;
+
+typedef struct LoadvmParallel {
+    QemuThread *threads;
+    int nthreads;
+    /* protects pending and quit */
+    QemuMutex lock;
+    QemuCond cond;
+    /* jobs not picked by a load thread yet */
+    QSIMPLEQ_HEAD(, LoadvmParallelJob) pending;
+    /* all the submitted jobs, released by the final barrier */
+    GPtrArray *jobs;
+    bool quit;
+} LoadvmParallel;
+
+static LoadvmParallel *loadvm_parallel;
+
+static void loadvm_parallel_collect_deps(SaveStateEntry *se, GPtrArray *deps)
+{
+    const char * const *dep;
+    SaveStateEntry *d;
+
+    if (!loadvm_parallel || !se->vmsd || !se->vmsd->load_deps) {
+        return;
+    }
+
+    for (dep = se->vmsd->load_deps; *dep; dep++) {
+        QTAILQ_FOREACH(d, &savevm_state.handlers, entry) {
+            if (d->load_job && d->vmsd && !strcmp(d->vmsd->name, *dep)) {
+                g_ptr_array_add(deps, d->load_job);
+            }
+        }
+    }
+}
+
+static int loadvm_parallel_wait(GPtrArray *deps)
+{
+    int i;
+
+    for (i = 0; i < deps->len; i++) {
+        LoadvmParallelJob *job = g_ptr_array_index(deps, i);
+
+        qemu_event_wait(&job->done);
+        if (job->ret < 0) {
+            return job->ret;
+        }
+    }
+
+    return 0;
+}
+
+/* Wait for the parallel loads @se depends on, from the main thread */
+static int loadvm_parallel_wait_deps(SaveStateEntry *se)
+{
+    g_autoptr(GPtrArray) deps = g_ptr_array_new();
+
+    loadvm_parallel_collect_deps(se, deps);
+    return loadvm_parallel_wait(deps);
+}
+
+/* Load the payload of a QEMU_VM_SECTION_FULL_BUFFERED section */
+static int vmstate_load_buffered(SaveStateEntry *se, QIOChannelBuffer *bioc)
+{
+    QEMUFile *f = qemu_file_new_input(QIO_CHANNEL(bioc));
+    int ret;
+
+    ret = vmstate_load(f, se);
+    if (ret == 0 && qemu_get_byte(f) != QEMU_VM_EOF) {
+        error_report("Trailing data in buffered section '%s'", se->idstr);
+        ret = -EINVAL;
+    }
+    if (ret == 0) {
+        ret = qemu_file_get_error(f);
+    }
+    qemu_fclose(f);
+
+    if (ret < 0) {
+        error_report("error while loading state for instance 0x%"PRIx32" of"
+                     " device '%s'", se->instance_id, se->idstr);
+    }
+    return ret;
+}
+
+static void loadvm_parallel_run(LoadvmParallelJob *job)
+{
+    SaveStateEntry *se = job->se;
+    int64_t start_ns = get_clock();
+    int ret;
+
+    ret = loadvm_parallel_wait(job->deps);
+    trace_loadvm_parallel_load(se->idstr, se->instance_id,
+                               (get_clock() - start_ns) / SCALE_US);
+    if (ret == 0) {
+        ret = vmstate_load_buffered(se, job->bioc);
+    }
+
+    job->ret = ret;
+    qemu_event_set(&job->done);
+}
+
+static void *loadvm_parallel_thread(void *opaque)
+{
+    LoadvmParallel *lp = opaque;
+    LoadvmParallelJob *job;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock(&lp->lock);
+    while (true) {
+        job = QSIMPLEQ_FIRST(&lp->pending);
+        if (!job) {
+            if (lp->quit) {
+                break;
+            }
+            qemu_cond_wait(&lp->cond, &lp->lock);
+            continue;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&lp->pending, next);
+        qemu_mutex_unlock(&lp->lock);
+
+        loadvm_parallel_run(job);
+
+        qemu_mutex_lock(&lp->lock);
+    }
+    qemu_mutex_unlock(&lp->lock);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static LoadvmParallel *loadvm_parallel_get(void)
+{
+    LoadvmParallel *lp = loadvm_parallel;
+    int i;
+
+    if (lp) {
+        return lp;
+    }
+
+    lp = g_new0(LoadvmParallel, 1);
+    lp->nthreads = MIN(g_get_num_processors(), LOADVM_PARALLEL_THREADS_MAX);
+    lp->threads = g_new0(QemuThread, lp->nthreads);
+    qemu_mutex_init(&lp->lock);
+    qemu_cond_init(&lp->cond);
+    QSIMPLEQ_INIT(&lp->pending);
+    lp->jobs = g_ptr_array_new();
+
+    for (i = 0; i < lp->nthreads; i++) {
+        qemu_thread_create(&lp->threads[i], "loadvm-parallel",
+                           loadvm_parallel_thread, lp, QEMU_THREAD_JOINABLE);
+    }
+
+    loadvm_parallel = lp;
+    return lp;
+}
+
+static void loadvm_parallel_submit(SaveStateEntry *se,
+                                   QIOChannelBuffer *bioc)
+{
+    LoadvmParallel *lp = loadvm_parallel_get();
+    LoadvmParallelJob *job = g_new0(LoadvmParallelJob, 1);
+
+    job->se = se;
+    job->bioc = bioc;
+    job->deps = g_ptr_array_new();
+    loadvm_parallel_collect_deps(se, job->deps);
+    qemu_event_init(&job->done, false);
+
+    trace_loadvm_parallel_submit(se->idstr, se->instance_id, bioc->usage,
+                                 job->deps->len);
+
+    se->load_job = job;
+    g_ptr_array_add(lp->jobs, job);
+
+    qemu_mutex_lock(&lp->lock);
+    QSIMPLEQ_INSERT_TAIL(&lp->pending, job, next);
+    qemu_cond_signal(&lp->cond);
+    qemu_mutex_unlock(&lp->lock);
+}
+
+/*
+ * Barrier: wait for all the sections handed to the load threads and
+ * stop the threads.
+ *
+ * Returns the first error of the parallel loads, 0 if none
+ */
+static int loadvm_parallel_finish(void)
+{
+    LoadvmParallel *lp = loadvm_parallel;
+    int64_t start_ns = get_clock();
+    int ret = 0;
+    int i;
+
+    if (!lp) {
+        return 0;
+    }
+
+    qemu_mutex_lock(&lp->lock);
+    lp->quit = true;
+    qemu_cond_broadcast(&lp->cond);
+    qemu_mutex_unlock(&lp->lock);
+
+    for (i = 0; i < lp->nthreads; i++) {
+        qemu_thread_join(&lp->threads[i]);
+    }
+
+    for (i = 0; i < lp->jobs->len; i++) {
+        LoadvmParallelJob *job = g_ptr_array_index(lp->jobs, i);
+
+        if (ret == 0 && job->ret < 0) {
+            ret = job->ret;
+        }
+        job->se->load_job = NULL;
+        qemu_event_destroy(&job->done);
+        g_ptr_array_free(job->deps, true);
+        object_unref(OBJECT(job->bioc));
+        g_free(job);
+    }
+
+    trace_loadvm_parallel_finish(lp->jobs->len, lp->nthreads,
+                                 (get_clock() - start_ns) / SCALE_US, ret);
+
+    g_ptr_array_free(lp->jobs, true);
+    qemu_cond_destroy(&lp->cond);
+    qemu_mutex_destroy(&lp->lock);
+    g_free(lp->threads);
+    g_free(lp);
+    loadvm_parallel = NULL;
+
+    return ret;
+}
+
+/*
+ * Read the header of a QEMU_VM_SECTION_START/FULL/FULL_BUFFERED section
+ * and look up the matching entry.
+ */
+static int qemu_loadvm_section_header(QEMUFile *f, SaveStateEntry **sep)
 {
     uint32_t instance_id, version_id, section_id;
     SaveStateEntry *se;
@@ -2496,10 +3038,40 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
         return -EINVAL;
     }
 
+    *sep = se;
+    return 0;
+}
+
+static int qemu_loadvm_section_load(QEMUFile *f, SaveStateEntry *se)
+{
+    int ret;
+
+    ret = loadvm_parallel_wait_deps(se);
+    if (ret < 0) {
+        return ret;
+    }
+
     ret = vmstate_load(f, se);
     if (ret < 0) {
         error_report("error while loading state for instance 0x%"PRIx32" of"
-                     " device '%s'", instance_id, idstr);
+                     " device '%s'", se->instance_id, se->idstr);
+    }
+    return ret;
+}
+
+static int
+qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
+{
+    SaveStateEntry *se;
+    int ret;
+
+    ret = qemu_loadvm_section_header(f, &se);
+    if (ret) {
+        return ret;
+    }
+
+    ret = qemu_loadvm_section_load(f, se);
+    if (ret < 0) {
         return ret;
     }
     if (!check_section_footer(f, se)) {
@@ -2509,6 +3081,53 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
     return 0;
 }
 
+static int
+qemu_loadvm_section_full_buffered(QEMUFile *f, MigrationIncomingState *mis)
+{
+    QIOChannelBuffer *bioc;
+    SaveStateEntry *se;
+    size_t length;
+    size_t len;
+    int ret;
+
+    ret = qemu_loadvm_section_header(f, &se);
+    if (ret) {
+        return ret;
+    }
+
+    length = qemu_get_be32(f);
+    bioc = qio_channel_buffer_new(length);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-loadvm-buffer");
+    len = qemu_get_buffer(f, (uint8_t *)bioc->data, length);
+    if (len != length) {
+        object_unref(OBJECT(bioc));
+        error_report("%s: Failed to read section '%s': %zu of %zu bytes",
+                     __func__, se->idstr, len, length);
+        ret = qemu_file_get_error(f);
+        return ret ? ret : -EIO;
+    }
+    bioc->usage = length;
+
+    if (!check_section_footer(f, se)) {
+        object_unref(OBJECT(bioc));
+        return -EINVAL;
+    }
+
+    if (se->vmsd && se->vmsd->parallel_load) {
+        loadvm_parallel_submit(se, bioc);
+        return 0;
+    }
+
+    /* Not independent on this side, load it in place */
+    ret = loadvm_parallel_wait_deps(se);
+    if (ret == 0) {
+        ret = vmstate_load_buffered(se, bioc);
+    }
+    object_unref(OBJECT(bioc));
+
+    return ret;
+}
+
 static int
 qemu_loadvm_section_part_end(QEMUFile *f, MigrationIncomingState *mis)
 {
@@ -2717,6 +3336,12 @@ retry:
                 goto out;
             }
             break;
+        case QEMU_VM_SECTION_FULL_BUFFERED:
+            ret = qemu_loadvm_section_full_buffered(f, mis);
+            if (ret < 0) {
+                goto out;
+            }
+            break;
         case QEMU_VM_SECTION_PART:
         case QEMU_VM_SECTION_END:
             ret = qemu_loadvm_section_part_end(f, mis);
@@ -2773,6 +3398,7 @@ int qemu_loadvm_state(QEMUFile *f)
 {
     MigrationIncomingState *mis = migration_incoming_get_current();
     Error *local_err = NULL;
+    int parallel_ret;
     int ret;
 
     if (qemu_savevm_state_blocked(&local_err)) {
@@ -2792,6 +3418,11 @@ int qemu_loadvm_state(QEMUFile *f)
     cpu_synchronize_all_pre_loadvm();
 
     ret = qemu_loadvm_state_main(f, mis);
+    /* Device state must be complete before the guest can run */
+    parallel_ret = loadvm_parallel_finish();
+    if (ret == 0) {
+        ret = parallel_ret;
+    }
     qemu_event_set(&mis->main_thread_load_event);
 
     trace_qemu_loadvm_state_post_main(ret);
@@ -2849,10 +3480,15 @@ int qemu_loadvm_state(QEMUFile *f)
 int qemu_load_device_state(QEMUFile *f)
 {
     MigrationIncomingState *mis = migration_incoming_get_current();
+    int parallel_ret;
     int ret;
 
     /* Load QEMU_VM_SECTION_FULL section */
     ret = qemu_loadvm_state_main(f, mis);
+    parallel_ret = loadvm_parallel_finish();
+    if (ret == 0) {
+        ret = parallel_ret;
+    }
     if (ret < 0) {
         error_report("Failed to load device state: %d", ret);
         return ret;
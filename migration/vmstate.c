@@ -312,6 +312,61 @@ bool vmstate_save_needed(const VMStateDescription *vmsd, void *opaque)
 }
 
 
+/*
+ * Estimate how many bytes vmstate_save_state() would write for
+ * @opaque.  No pre_save/post_save hook is called, and fields with a
+ * custom put() are accounted with their declared size, so the result
+ * is only an approximation of the real section size.
+ */
+uint64_t vmstate_size_estimate(const VMStateDescription *vmsd, void *opaque)
+{
+    const VMStateDescription **sub = vmsd->subsections;
+    const VMStateField *field = vmsd->fields;
+    uint64_t total = 0;
+
+    while (field->name) {
+        if ((field->field_exists &&
+             field->field_exists(opaque, vmsd->version_id)) ||
+            (!field->field_exists &&
+             field->version_id <= vmsd->version_id)) {
+            void *first_elem = opaque + field->offset;
+            int i, n_elems = vmstate_n_elems(opaque, field);
+            int size = vmstate_size(opaque, field);
+
+            if (field->flags & VMS_POINTER) {
+                first_elem = *(void **)first_elem;
+            }
+
+            if (!(field->flags & (VMS_STRUCT | VMS_VSTRUCT))) {
+                total += (uint64_t)n_elems * size;
+            } else if (first_elem) {
+                for (i = 0; i < n_elems; i++) {
+                    void *curr_elem = first_elem + size * i;
+
+                    if (field->flags & VMS_ARRAY_OF_POINTER) {
+                        curr_elem = *(void **)curr_elem;
+                    }
+                    if (curr_elem) {
+                        total += vmstate_size_estimate(field->vmsd, curr_elem);
+                    }
+                }
+            }
+        }
+        field++;
+    }
+
+    while (sub && *sub) {
+        if (vmstate_save_needed(*sub, opaque)) {
+            /* QEMU_VM_SUBSECTION, name length, name and version */
+            total += 2 + strlen((*sub)->name) + 4 +
+                     vmstate_size_estimate(*sub, opaque);
+        }
+        sub++;
+    }
+
+    return total;
+}
+
 int vmstate_save_state(QEMUFile *f, const VMStateDescription *vmsd,
                        void *opaque, JSONWriter *vmdesc_id)
 {
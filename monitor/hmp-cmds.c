@@ -227,6 +227,16 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
         monitor_printf(mon, "  aio-max-batch=%" PRId64 "\n",
                        value->aio_max_batch);
+        monitor_printf(mon, "  poll-hits=%" PRIu64 " poll-misses=%" PRIu64
+                       "\n", value->poll_stats->hits,
+                       value->poll_stats->misses);
+        monitor_printf(mon, "  poll-ns=%" PRIu64 " block-ns=%" PRIu64 "\n",
+                       value->poll_stats->poll_ns,
+                       value->poll_stats->block_ns);
+        monitor_printf(mon, "  thread-pool-workers=%" PRIu64
+                       " thread-pool-queue-depth=%" PRIu64 "\n",
+                       value->thread_pool_stats->workers,
+                       value->thread_pool_stats->queue_depth);
     }
 
     qapi_free_IOThreadInfoList(info_list);
@@ -14,6 +14,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/coroutine.h"
 #include "qemu/sockets.h"
 #include "monitor-internal.h"
 #include "monitor/qdev.h"
@@ -41,6 +42,29 @@ NameInfo *qmp_query_name(Error **errp)
     return info;
 }
 
+CoroutineStackStatsList *qmp_query_coroutine_stats(Error **errp)
+{
+    CoroutinePoolStats stats[COROUTINE_STACK__MAX];
+    CoroutineStackStatsList *head = NULL, **tail = &head;
+    int i;
+
+    qemu_coroutine_get_stats(stats);
+    for (i = 0; i < COROUTINE_STACK__MAX; i++) {
+        CoroutineStackStats *info = g_new0(CoroutineStackStats, 1);
+
+        info->stack_size = stats[i].stack_size;
+        info->pool_hits = stats[i].pool_hits;
+        info->pool_misses = stats[i].pool_misses;
+        info->in_use = stats[i].in_use;
+        info->allocated = stats[i].allocated;
+        info->max_allocated = stats[i].max_allocated;
+        info->committed = stats[i].committed;
+        info->max_depth = stats[i].max_depth;
+        QAPI_LIST_APPEND(tail, info);
+    }
+    return head;
+}
+
 void qmp_quit(Error **errp)
 {
     shutdown_action = SHUTDOWN_ACTION_POWEROFF;
@@ -1434,9 +1434,12 @@ nbd_read_eof(BlockDriverState *bs, QIOChannel *ioc, void *buffer, size_t size,
 
         len = qio_channel_readv(ioc, &iov, 1, errp);
         if (len == QIO_CHANNEL_ERR_BLOCK) {
-            qio_channel_yield(ioc, G_IO_IN);
-            continue;
-        } else if (len < 0) {
+            len = qio_channel_yield_readv(ioc, &iov, 1, errp);
+            if (len == QIO_CHANNEL_ERR_BLOCK) {
+                continue;
+            }
+        }
+        if (len < 0) {
             return -EIO;
         } else if (len == 0) {
             if (partial) {
@@ -28,6 +28,7 @@
 #include "nbd-internal.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "qemu/stats64.h"
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -82,9 +83,33 @@ typedef struct NBDRequestData NBDRequestData;
 struct NBDRequestData {
     NBDClient *client;
     uint8_t *data;
+    uint32_t len;       /* size of data */
+    bool zero_copy;     /* data may be sent with MSG_ZEROCOPY */
     bool complete;
 };
 
+/*
+ * Don't bother with zero copy for small replies, pinning the pages and
+ * processing the completion costs more than copying them
+ */
+#define NBD_ZERO_COPY_MIN_SIZE      (16 * KiB)
+
+/*
+ * Maximum number of bytes in read buffers that wait for the kernel to
+ * complete their zero copy send.  Beyond that, replies are copied.  This
+ * can be more than the locked memory limit allows; sends that the kernel
+ * rejects with ENOBUFS are copied as well.
+ */
+#define NBD_ZERO_COPY_MAX_PENDING   (64 * MiB)
+
+/* A read buffer that may still be referenced by a zero copy send */
+typedef struct NBDZeroCopyBuf {
+    void *data;
+    size_t size;
+    ssize_t seq;        /* client->sioc->zero_copy_queued when released */
+    QSIMPLEQ_ENTRY(NBDZeroCopyBuf) next;
+} NBDZeroCopyBuf;
+
 struct NBDExport {
     BlockExport common;
 
@@ -101,6 +126,9 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    bool zero_copy;
+    Stat64 zero_copy_bytes; /* read data sent with MSG_ZEROCOPY */
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -149,6 +177,14 @@ struct NBDClient {
     uint32_t opt; /* Current option being negotiated */
     uint32_t optlen; /* remaining length of data in ioc for the option being
                         negotiated now */
+
+    /*
+     * Read replies are sent with MSG_ZEROCOPY.  Their buffers are kept in
+     * zero_copy_bufs until the kernel reports that it is done with them.
+     */
+    bool zero_copy;
+    QSIMPLEQ_HEAD(, NBDZeroCopyBuf) zero_copy_bufs;
+    size_t zero_copy_pending; /* bytes in zero_copy_bufs */
 };
 
 static void nbd_client_receive_next_request(NBDClient *client);
@@ -1384,13 +1420,16 @@ nbd_read_eof(NBDClient *client, void *buffer, size_t size, Error **errp)
         len = qio_channel_readv(client->ioc, &iov, 1, errp);
         if (len == QIO_CHANNEL_ERR_BLOCK) {
             client->read_yielding = true;
-            qio_channel_yield(client->ioc, G_IO_IN);
+            len = qio_channel_yield_readv(client->ioc, &iov, 1, errp);
             client->read_yielding = false;
-            if (client->quiescing) {
-                return -EAGAIN;
+            if (len == QIO_CHANNEL_ERR_BLOCK) {
+                if (client->quiescing) {
+                    return -EAGAIN;
+                }
+                continue;
             }
-            continue;
-        } else if (len < 0) {
+        }
+        if (len < 0) {
             return -EIO;
         } else if (len == 0) {
             if (partial) {
@@ -1457,6 +1496,70 @@ void nbd_client_get(NBDClient *client)
     client->refcount++;
 }
 
+/*
+ * Free the read buffers whose zero copy sends the kernel has completed.
+ * Completions are reported in the order in which the sends were queued,
+ * and so are the buffers in zero_copy_bufs.
+ */
+static void nbd_zero_copy_reap(NBDClient *client)
+{
+    NBDZeroCopyBuf *buf;
+    ssize_t completed;
+
+    if (QSIMPLEQ_EMPTY(&client->zero_copy_bufs)) {
+        return;
+    }
+
+    completed = qio_channel_socket_zero_copy_completed(client->sioc, NULL);
+    if (completed < 0) {
+        /* The buffers are freed when the client goes away */
+        return;
+    }
+
+    while ((buf = QSIMPLEQ_FIRST(&client->zero_copy_bufs)) &&
+           buf->seq <= completed) {
+        QSIMPLEQ_REMOVE_HEAD(&client->zero_copy_bufs, next);
+        client->zero_copy_pending -= buf->size;
+        qemu_vfree(buf->data);
+        g_free(buf);
+    }
+}
+
+/*
+ * Free @data once all zero copy sends that were queued so far have
+ * completed, because any of them may still reference it.
+ */
+static void nbd_zero_copy_release(NBDClient *client, void *data, size_t size)
+{
+    NBDZeroCopyBuf *buf = g_new(NBDZeroCopyBuf, 1);
+
+    *buf = (NBDZeroCopyBuf) {
+        .data = data,
+        .size = size,
+        .seq = client->sioc->zero_copy_queued,
+    };
+    QSIMPLEQ_INSERT_TAIL(&client->zero_copy_bufs, buf, next);
+    client->zero_copy_pending += size;
+
+    nbd_zero_copy_reap(client);
+}
+
+/*
+ * Called when the client goes away.  The socket is closed at this point,
+ * so there is nobody left who would care what is sent from the buffers.
+ */
+static void nbd_zero_copy_free_all(NBDClient *client)
+{
+    NBDZeroCopyBuf *buf;
+
+    while ((buf = QSIMPLEQ_FIRST(&client->zero_copy_bufs))) {
+        QSIMPLEQ_REMOVE_HEAD(&client->zero_copy_bufs, next);
+        qemu_vfree(buf->data);
+        g_free(buf);
+    }
+    client->zero_copy_pending = 0;
+}
+
 void nbd_client_put(NBDClient *client)
 {
     if (--client->refcount == 0) {
@@ -1472,6 +1575,7 @@ void nbd_client_put(NBDClient *client)
             object_unref(OBJECT(client->tlscreds));
         }
         g_free(client->tlsauthz);
+        nbd_zero_copy_free_all(client);
         if (client->exp) {
             QTAILQ_REMOVE(&client->exp->clients, client, next);
             blk_exp_unref(&client->exp->common);
@@ -1519,7 +1623,11 @@ static void nbd_request_put(NBDRequestData *req)
     NBDClient *client = req->client;
 
     if (req->data) {
-        qemu_vfree(req->data);
+        if (req->zero_copy) {
+            nbd_zero_copy_release(client, req->data, req->len);
+        } else {
+            qemu_vfree(req->data);
+        }
     }
     g_free(req);
 
@@ -1770,6 +1878,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -1859,12 +1968,23 @@ static void nbd_export_delete(BlockExport *blk_exp)
     }
 }
 
+static void nbd_export_query(BlockExport *blk_exp, BlockExportInfo *info)
+{
+    NBDExport *exp = container_of(blk_exp, NBDExport, common);
+
+    if (exp->zero_copy) {
+        info->u.nbd.has_zero_copy_bytes = true;
+        info->u.nbd.zero_copy_bytes = stat64_get(&exp->zero_copy_bytes);
+    }
+}
+
 const BlockExportDriver blk_exp_nbd = {
     .type               = BLOCK_EXPORT_TYPE_NBD,
     .instance_size      = sizeof(NBDExport),
     .create             = nbd_export_create,
     .delete             = nbd_export_delete,
     .request_shutdown   = nbd_export_request_shutdown,
+    .query              = nbd_export_query,
 };
 
 static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
@@ -1884,6 +2004,57 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Like nbd_co_send_iov(), for replies that carry read data in
+ * @iov[1..@niov-1].  If the client uses zero copy, the data is sent with
+ * MSG_ZEROCOPY; nbd_request_put() then keeps the read buffer alive until
+ * the kernel is done with it.  The header in @iov[0] lives on the stack, so
+ * it is always copied.
+ */
+static int coroutine_fn nbd_co_send_iov_payload(NBDClient *client,
+                                                struct iovec *iov,
+                                                unsigned niov, Error **errp)
+{
+    size_t size = iov_size(iov + 1, niov - 1);
+    ssize_t queued;
+    int ret;
+
+    if (!client->zero_copy) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    nbd_zero_copy_reap(client);
+    if (size < NBD_ZERO_COPY_MIN_SIZE ||
+        client->zero_copy_pending > NBD_ZERO_COPY_MAX_PENDING) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    trace_nbd_co_send_zero_copy(size);
+    queued = client->sioc->zero_copy_queued;
+    ret = qio_channel_writev_all(client->ioc, iov, 1, errp);
+    if (ret == 0) {
+        ret = qio_channel_writev_full_all(client->ioc, iov + 1, niov - 1,
+                                          NULL, 0,
+                                          QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                          errp);
+    }
+    ret = ret < 0 ? -EIO : 0;
+
+    /* Sends that failed with ENOBUFS were copied and are not queued */
+    if (ret == 0 && client->sioc->zero_copy_queued != queued) {
+        stat64_add(&client->exp->zero_copy_bytes, size);
+    }
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t handle)
 {
@@ -1910,7 +2081,10 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    len);
     set_be_simple_reply(&reply, nbd_err, handle);
 
-    return nbd_co_send_iov(client, iov, len ? 2 : 1, errp);
+    if (len) {
+        return nbd_co_send_iov_payload(client, iov, 2, errp);
+    }
+    return nbd_co_send_iov(client, iov, 1, errp);
 }
 
 static inline void set_be_chunk(NBDStructuredReplyChunk *chunk, uint16_t flags,
@@ -1959,7 +2133,7 @@ static int coroutine_fn nbd_co_send_structured_read(NBDClient *client,
                  sizeof(chunk) - sizeof(chunk.h) + size);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_iov_payload(client, iov, 2, errp);
 }
 
 static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
@@ -2338,6 +2512,9 @@ static int coroutine_fn nbd_co_receive_request(NBDRequestData *req, NBDRequest *
                 error_setg(errp, "No memory");
                 return -ENOMEM;
             }
+            req->len = request->len;
+            req->zero_copy = client->zero_copy &&
+                             request->type == NBD_CMD_READ;
         }
     }
 
@@ -2731,6 +2908,20 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
         return;
     }
 
+    /* With TLS, the data must go through the TLS channel to be encrypted */
+    if (client->exp->zero_copy && client->ioc == QIO_CHANNEL(client->sioc)) {
+        if (qio_channel_socket_set_zero_copy(client->sioc, &local_err) < 0) {
+            trace_nbd_zero_copy_unavailable(client->exp->name,
+                                            error_get_pretty(local_err));
+            error_free(local_err);
+            local_err = NULL;
+        } else {
+            /* Rather copy than fail when we are over RLIMIT_MEMLOCK */
+            client->sioc->zero_copy_fallback = true;
+            client->zero_copy = true;
+        }
+    }
+
     nbd_client_receive_next_request(client);
 }
 
@@ -2754,6 +2945,7 @@ void nbd_client_new(QIOChannelSocket *sioc,
         object_ref(OBJECT(client->tlscreds));
     }
     client->tlsauthz = g_strdup(tlsauthz);
+    QSIMPLEQ_INIT(&client->zero_copy_bufs);
     client->sioc = sioc;
     qio_channel_set_delay(QIO_CHANNEL(sioc), false);
     object_ref(OBJECT(client->sioc));
@@ -5655,7 +5655,7 @@ SRST
 
             CN=laptop.example.com,O=Example Home,L=London,ST=London,C=GB
 
-    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,aio-max-batch=aio-max-batch``
+    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,aio-max-batch=aio-max-batch,fdmon-io-uring=on|off,io-uring-sqpoll-cpu=cpu``
         Creates a dedicated event loop thread that devices can be
         assigned to. This is known as an IOThread. By default device
         emulation happens in vCPU threads or the main event loop thread.
@@ -5675,7 +5675,12 @@ SRST
         latency. Instead of entering a blocking system call to monitor
         file descriptors and then pay the cost of being woken up when an
         event occurs, the polling algorithm spins waiting for events for
-        a short time. The algorithm's default parameters are suitable
+        a short time. The polling time is adapted separately for each
+        event source, such as a virtqueue, based on how long it waits for
+        its events, and sources that would not benefit from polling stop
+        being polled. The ``query-iothreads`` QMP command reports how
+        often polling finds an event and the time spent polling versus
+        blocking. The algorithm's default parameters are suitable
         for many cases but can be adjusted based on knowledge of the
         workload and/or host device latency.
 
@@ -5695,7 +5700,20 @@ SRST
         in a batch for the AIO engine, 0 means that the engine will use
         its default.
 
-        The IOThread parameters can be modified at run-time using the
+        The ``fdmon-io-uring`` parameter keeps io_uring for file
+        descriptor monitoring in the IOThread, which otherwise falls back
+        to epoll or poll because the IOThread also runs a glib event loop.
+        Block I/O with ``aio=io_uring`` then shares this ring. It can only
+        be set when the IOThread is created.
+
+        The ``io-uring-sqpoll-cpu`` parameter makes the io_uring that the
+        IOThread uses for file descriptor monitoring and block I/O poll
+        its submission queue with a kernel thread on the given host CPU,
+        so that submitting requests does not need system calls. That CPU
+        is kept busy while there is I/O. It can only be set when the
+        IOThread is created.
+
+        The other IOThread parameters can be modified at run-time using the
         ``qom-set`` command (where ``iothread1`` is the IOThread's
         ``id``):
 
@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+#
+# Benchmark qcow2 metadata handling under concurrent requests.
+#
+# Compares two qemu-img binaries running 'qemu-img bench' at several queue
+# depths.  The interesting cases are the ones where the qcow2 driver has to
+# touch metadata for almost every request: allocating writes to a fresh
+# image, and requests that miss the L2 cache because they are spread over
+# many L2 tables.  Metadata I/O that is done with the image lock held
+# serializes these requests, so their throughput should scale with the
+# queue depth only if the lock is not held across that I/O.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import subprocess
+import simplebench
+from results_to_text import results_to_text
+
+
+IMAGE_SIZE = 16 * 1024 * 1024 * 1024
+CLUSTER_SIZE = 64 * 1024
+
+# With 64k clusters, a 4k L2 slice maps 32M of guest data.  Stepping a bit
+# further than that makes every request use a different L2 slice.
+L2_SLICE_STEP = 32 * 1024 * 1024 + CLUSTER_SIZE
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_qcow2_metadata(env['qemu_img'], env['image_name'],
+                                case['workload'], case['depth'])
+
+
+def qemu_img_pipe(*args):
+    '''Run qemu-img and return its output'''
+    subp = subprocess.Popen(list(args),
+                            stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    exitcode = subp.wait()
+    if exitcode < 0:
+        sys.stderr.write('qemu-img received signal %i: %s\n'
+                         % (-exitcode, ' '.join(list(args))))
+    return subp.communicate()[0]
+
+
+def bench_qcow2_metadata(qemu_img, image_name, workload, depth):
+    """Benchmark qcow2 metadata updates at a given queue depth
+
+    qemu_img   -- path to qemu_img executable file
+    image_name -- QCOW2 image name to create
+    workload   -- 'alloc-write': 4k writes to a fresh image, each of them
+                  allocating a new cluster
+                  'l2-miss-read', 'l2-miss-write': 4k requests to an image
+                  with preallocated metadata, each of them in a different
+                  L2 slice, with an L2 cache that is too small to hold them
+    depth      -- number of requests in flight
+
+    Returns {'seconds': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    if not os.path.isfile(qemu_img):
+        print(f'File not found: {qemu_img}')
+        sys.exit(1)
+
+    image_dir = os.path.dirname(os.path.abspath(image_name))
+    if not os.path.isdir(image_dir):
+        print(f'Path not found: {image_name}')
+        sys.exit(1)
+
+    create_opts = f'cluster_size={CLUSTER_SIZE}'
+    image_opts = f'driver=qcow2,file.filename={image_name}'
+
+    if workload == 'alloc-write':
+        count = 64 * 1024
+        step = CLUSTER_SIZE
+        rw = ['-w']
+    else:
+        create_opts += ',preallocation=metadata'
+        image_opts += ',l2-cache-size=256k'
+        count = 16 * 1024
+        step = L2_SLICE_STEP
+        rw = ['-w'] if workload == 'l2-miss-write' else []
+
+    args_create = [qemu_img, 'create', '-f', 'qcow2', '-o', create_opts,
+                   image_name, str(IMAGE_SIZE)]
+
+    args_bench = [qemu_img, 'bench', *rw, '-n', '-t', 'none', '-i', 'native',
+                  '-c', str(count), '-d', str(depth), '-s', '4096',
+                  '-S', str(step), '--image-opts', image_opts]
+
+    try:
+        qemu_img_pipe(*args_create)
+    except OSError as e:
+        os.remove(image_name)
+        return {'error': 'qemu_img create failed: ' + str(e)}
+
+    try:
+        ret = qemu_img_pipe(*args_bench)
+    except OSError as e:
+        os.remove(image_name)
+        return {'error': 'qemu_img bench failed: ' + str(e)}
+
+    os.remove(image_name)
+
+    if 'seconds' in ret:
+        ret_list = ret.split()
+        index = ret_list.index('seconds.')
+        return {'seconds': float(ret_list[index-1])}
+    else:
+        return {'error': 'qemu_img bench failed: ' + ret}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 4:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-img binary file> '
+              '<path to another qemu-img to compare performance with> '
+              '<full or relative name for QCOW2 image to create>')
+        exit(1)
+
+    # Test-cases are "rows" in benchmark resulting table, 'id' is a caption
+    # for the row, other fields are handled by bench_func.
+    test_cases = []
+    for workload in ('alloc-write', 'l2-miss-read', 'l2-miss-write'):
+        for depth in (1, 16, 64):
+            test_cases.append({
+                'id': f'<{workload}, depth {depth}>',
+                'workload': workload,
+                'depth': depth
+            })
+
+    # Test-envs are "columns" in benchmark resulting table, 'id is a caption
+    # for the column, other fields are handled by bench_func.
+    test_envs = [
+        {
+            'id': '<qemu-img binary 1>',
+            'qemu_img': f'{sys.argv[1]}',
+            'image_name': f'{sys.argv[3]}'
+        },
+        {
+            'id': '<qemu-img binary 2>',
+            'qemu_img': f'{sys.argv[2]}',
+            'image_name': f'{sys.argv[3]}'
+        },
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
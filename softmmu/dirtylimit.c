@@ -42,10 +42,24 @@
  * composed of dirty ring full and sleep time.
  */
 #define DIRTYLIMIT_THROTTLE_PCT_MAX 99
+/*
+ * Lowest quota migration hands out to a vcpu, so that
+ * a vcpu is never stalled completely.
+ */
+#define DIRTYLIMIT_MIGRATION_QUOTA_MIN  1   /* MB/s */
+/*
+ * A vcpu limited by migration whose dirty page rate
+ * is above this percentage of its quota is assumed to
+ * be held back by the limit, i.e. its real demand is
+ * unknown and it keeps being limited.
+ */
+#define DIRTYLIMIT_MIGRATION_SATURATED_PCT  90
 
 struct {
     VcpuStat stat;
     bool running;
+    /* Number of completed measurements, zero until rates are valid */
+    unsigned int samples;
     QemuThread thread;
 } *vcpu_dirty_rate_stat;
 
@@ -65,8 +79,16 @@ struct {
     int max_cpus;
     /* Number of vcpu under dirtylimit */
     int limited_nvcpu;
+    /* Quotas are set by migration rather than by the user */
+    bool migration;
 } *dirtylimit_state;
 
+typedef struct VcpuDirtyDemand {
+    int cpu_index;
+    /* Dirty page rate the vcpu would reach if unlimited, MB/s */
+    uint64_t demand;
+} VcpuDirtyDemand;
+
 /* protect dirtylimit_state */
 static QemuMutex dirtylimit_mutex;
 
@@ -89,6 +111,7 @@ static void vcpu_dirty_rate_stat_collect(void)
         vcpu_dirty_rate_stat->stat.rates[i].dirty_rate =
             stat.rates[i].dirty_rate;
     }
+    qatomic_inc(&vcpu_dirty_rate_stat->samples);
 
     free(stat.rates);
 }
@@ -426,6 +449,108 @@ static void dirtylimit_cleanup(void)
     dirtylimit_state_finalize();
 }
 
+static int dirtylimit_demand_cmp(const void *a, const void *b)
+{
+    const VcpuDirtyDemand *da = a, *db = b;
+
+    if (da->demand == db->demand) {
+        return 0;
+    }
+    return da->demand < db->demand ? -1 : 1;
+}
+
+/*
+ * Share @target (MB/s) among the vcpus max-min fairly: going from the
+ * lightest to the heaviest dirtier, a vcpu that dirties less than an
+ * equal share of what is left is not limited at all, and the remaining
+ * budget is split evenly as quota among the heavier ones.
+ *
+ * The first call starts measuring the per-vcpu dirty page rates.  No
+ * quota is set and false is returned until a measurement completed,
+ * since every rate reads zero before that.
+ *
+ * Must be called with the iothread lock held.
+ */
+bool dirtylimit_migration_throttle(uint64_t target)
+{
+    MachineState *ms = MACHINE(qdev_get_machine());
+    g_autofree VcpuDirtyDemand *demands =
+        g_new0(VcpuDirtyDemand, ms->smp.max_cpus);
+    uint64_t left = target;
+    uint64_t quota = 0;
+    CPUState *cpu;
+    int n = 0, i;
+
+    dirtylimit_state_lock();
+
+    if (!dirtylimit_in_service()) {
+        dirtylimit_init();
+    }
+    dirtylimit_state->migration = true;
+
+    if (!qatomic_read(&vcpu_dirty_rate_stat->samples)) {
+        dirtylimit_state_unlock();
+        return false;
+    }
+
+    CPU_FOREACH(cpu) {
+        VcpuDirtyLimitState *state = dirtylimit_vcpu_get_state(cpu->cpu_index);
+        uint64_t rate = vcpu_dirty_rate_get(cpu->cpu_index);
+
+        if (state->enabled &&
+            rate * 100 >= state->quota * DIRTYLIMIT_MIGRATION_SATURATED_PCT) {
+            rate = UINT64_MAX;
+        }
+        demands[n].cpu_index = cpu->cpu_index;
+        demands[n].demand = rate;
+        n++;
+    }
+
+    qsort(demands, n, sizeof(*demands), dirtylimit_demand_cmp);
+
+    for (i = 0; i < n; i++) {
+        if (demands[i].demand > left / (n - i)) {
+            break;
+        }
+        left -= demands[i].demand;
+        dirtylimit_set_vcpu(demands[i].cpu_index, 0, false);
+    }
+
+    if (i < n) {
+        quota = MAX(left / (n - i), DIRTYLIMIT_MIGRATION_QUOTA_MIN);
+    }
+    trace_dirtylimit_migration_throttle(target, n - i, quota);
+
+    for (; i < n; i++) {
+        dirtylimit_set_vcpu(demands[i].cpu_index, quota, true);
+    }
+
+    dirtylimit_state_unlock();
+    return true;
+}
+
+/*
+ * Drop the limits set by dirtylimit_migration_throttle().
+ *
+ * Must be called with the iothread lock held.
+ */
+void dirtylimit_migration_cancel(void)
+{
+    dirtylimit_state_lock();
+
+    if (dirtylimit_in_service() && dirtylimit_state->migration) {
+        dirtylimit_set_all(0, false);
+        dirtylimit_cleanup();
+    }
+
+    dirtylimit_state_unlock();
+}
+
+bool dirtylimit_migration_active(void)
+{
+    return dirtylimit_in_service() && dirtylimit_state->migration;
+}
+
 void qmp_cancel_vcpu_dirty_limit(bool has_cpu_index,
                                  int64_t cpu_index,
                                  Error **errp)
@@ -445,6 +570,12 @@ void qmp_cancel_vcpu_dirty_limit(bool has_cpu_index,
 
     dirtylimit_state_lock();
 
+    if (dirtylimit_state->migration) {
+        error_setg(errp, "dirty page rate limit is managed by migration");
+        dirtylimit_state_unlock();
+        return;
+    }
+
     if (has_cpu_index) {
         dirtylimit_set_vcpu(cpu_index, 0, false);
     } else {
@@ -498,6 +629,10 @@ void qmp_set_vcpu_dirty_limit(bool has_cpu_index,
 
     if (!dirtylimit_in_service()) {
         dirtylimit_init();
+    } else if (dirtylimit_state->migration) {
+        error_setg(errp, "dirty page rate limit is managed by migration");
+        dirtylimit_state_unlock();
+        return;
     }
 
     if (has_cpu_index) {
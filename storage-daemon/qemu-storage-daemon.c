@@ -100,7 +100,7 @@ static void help(void)
 "                         once startup is complete\n"
 "\n"
 "  --export [type=]nbd,id=<id>,node-name=<node-name>[,name=<export-name>]\n"
-"           [,writable=on|off][,bitmap=<name>]\n"
+"           [,writable=on|off][,bitmap=<name>][,zero-copy=on|off]\n"
 "                         export the specified block node over NBD\n"
 "                         (requires --nbd-server)\n"
 "\n"
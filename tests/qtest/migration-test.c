@@ -769,6 +769,7 @@ static void test_migrate_end(QTestState *from, QTestState *to, bool test_dest)
 
     cleanup("bootsect");
     cleanup("migsocket");
+    cleanup("migfile");
     cleanup("src_serial");
     cleanup("dest_serial");
 }
@@ -1234,6 +1235,35 @@ static void test_postcopy_preempt(void)
     test_postcopy_common(&args);
 }
 
+static void *
+test_postcopy_prefetch_start(QTestState *from,
+                             QTestState *to)
+{
+    migrate_set_parameter_int(from, "postcopy-hot-set-size", 16 * 1024 * 1024);
+    migrate_set_parameter_int(to, "postcopy-prefetch-window", 1024 * 1024);
+
+    return NULL;
+}
+
+static void test_postcopy_prefetch(void)
+{
+    MigrateCommon args = {
+        .start_hook = test_postcopy_prefetch_start,
+    };
+
+    test_postcopy_common(&args);
+}
+
+static void test_postcopy_preempt_prefetch(void)
+{
+    MigrateCommon args = {
+        .start_hook = test_postcopy_prefetch_start,
+        .postcopy_preempt = true,
+    };
+
+    test_postcopy_common(&args);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_postcopy_tls_psk(void)
 {
@@ -1492,6 +1522,96 @@ static void test_precopy_common(MigrateCommon *args)
     test_migrate_end(from, to, args->result == MIG_TEST_SUCCEED);
 }
 
+static void test_file_common(MigrateCommon *args, bool stop_src)
+{
+    QTestState *from, *to;
+    void *data_hook = NULL;
+
+    if (test_migrate_start(&from, &to, args->listen_uri, &args->start)) {
+        return;
+    }
+
+    /*
+     * File migration is never live. We can keep the source VM running
+     * during migration, but the destination will not be running
+     * concurrently.
+     */
+    g_assert_false(args->live);
+
+    if (args->start_hook) {
+        data_hook = args->start_hook(from, to);
+    }
+
+    migrate_ensure_converge(from);
+    wait_for_serial("src_serial");
+
+    if (stop_src) {
+        qtest_qmp_assert_success(from, "{ 'execute' : 'stop'}");
+        if (!got_src_stop) {
+            qtest_qmp_eventwait(from, "STOP");
+        }
+    }
+
+    migrate_qmp(from, args->connect_uri, "{}");
+    wait_for_migration_complete(from);
+
+    /*
+     * We need to wait for the source to finish before starting the
+     * destination.
+     */
+    qtest_qmp_assert_success(to, "{ 'execute': 'migrate-incoming',"
+                             "  'arguments': { 'uri': %s }}",
+                             args->connect_uri);
+    wait_for_migration_complete(to);
+
+    if (stop_src) {
+        qtest_qmp_assert_success(to, "{ 'execute' : 'cont'}");
+    }
+    if (!got_dst_resume) {
+        qtest_qmp_eventwait(to, "RESUME");
+    }
+
+    wait_for_serial("dest_serial");
+
+    if (args->finish_hook) {
+        args->finish_hook(from, to, data_hook);
+    }
+
+    test_migrate_end(from, to, args->result == MIG_TEST_SUCCEED);
+}
+
+static void *
+migrate_mapped_ram_start(QTestState *from, QTestState *to)
+{
+    migrate_set_capability(from, "mapped-ram", true);
+    migrate_set_capability(to, "mapped-ram", true);
+
+    return NULL;
+}
+
+static void test_precopy_file(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+    };
+
+    test_file_common(&args, true);
+}
+
+static void test_precopy_file_mapped_ram(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_mapped_ram_start,
+    };
+
+    test_file_common(&args, false);
+}
+
 static void test_precopy_unix_plain(void)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
@@ -1642,6 +1762,138 @@ static void test_precopy_unix_xbzrle(void)
     test_precopy_common(&args);
 }
 
+static void *
+test_migrate_parallel_device_load_start(QTestState *from,
+                                        QTestState *to)
+{
+    /* Only the source needs it, the destination follows the stream */
+    migrate_set_capability(from, "parallel-device-load", true);
+
+    return NULL;
+}
+
+static void test_precopy_unix_parallel_device_load(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+        .start_hook = test_migrate_parallel_device_load_start,
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
+static void *
+test_migrate_timeline_start(QTestState *from,
+                            QTestState *to)
+{
+    migrate_set_capability(from, "timeline", true);
+
+    return NULL;
+}
+
+static void test_migrate_timeline_finish(QTestState *from,
+                                         QTestState *to,
+                                         void *opaque)
+{
+    QDict *rsp;
+    QList *samples;
+    const QListEntry *entry;
+    int64_t iteration = 0;
+    uint64_t dirty_pages = 0, transferred = 0;
+
+    rsp = qtest_qmp(from, "{ 'execute': 'query-migrate-timeline' }");
+    samples = qdict_get_qlist(rsp, "return");
+    g_assert(samples && !qlist_empty(samples));
+
+    QLIST_FOREACH_ENTRY(samples, entry) {
+        QDict *sample = qobject_to(QDict, qlist_entry_obj(entry));
+
+        g_assert(sample);
+        g_assert_cmpint(qdict_get_int(sample, "iteration"), >, iteration);
+        iteration = qdict_get_int(sample, "iteration");
+        dirty_pages += qdict_get_int(sample, "dirty-pages");
+        transferred += qdict_get_int(sample, "transferred");
+    }
+
+    /* The guest keeps dirtying memory while the migration runs */
+    g_assert_cmpint(dirty_pages, >, 0);
+    g_assert_cmpint(transferred, >, 0);
+    qobject_unref(rsp);
+
+    /* Nothing is recorded on the destination */
+    rsp = qtest_qmp(to, "{ 'execute': 'query-migrate-timeline' }");
+    g_assert(qlist_empty(qdict_get_qlist(rsp, "return")));
+    qobject_unref(rsp);
+}
+
+static void test_precopy_unix_timeline(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+        .start_hook = test_migrate_timeline_start,
+        .finish_hook = test_migrate_timeline_finish,
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
+static void test_migrate_switchover_finish(QTestState *from,
+                                           QTestState *to,
+                                           void *opaque)
+{
+    QDict *rsp, *info;
+    QList *devices;
+    const QListEntry *entry;
+    bool found_ram = false;
+
+    rsp = qtest_qmp(from, "{ 'execute': 'query-migrate' }");
+    info = qdict_get_qdict(rsp, "return");
+    g_assert_cmpstr(qdict_get_str(info, "status"), ==, "completed");
+    g_assert(qdict_haskey(info, "predicted-downtime"));
+    g_assert_cmpint(qdict_get_int(info, "predicted-downtime"), >=, 0);
+
+    devices = qdict_get_qlist(info, "switchover-devices");
+    g_assert(devices && !qlist_empty(devices));
+
+    QLIST_FOREACH_ENTRY(devices, entry) {
+        QDict *dev = qobject_to(QDict, qlist_entry_obj(entry));
+
+        g_assert(dev);
+        g_assert(qdict_haskey(dev, "predicted-size"));
+        g_assert(qdict_haskey(dev, "predicted-downtime"));
+        g_assert_cmpint(qdict_haskey(dev, "size"), ==,
+                        qdict_haskey(dev, "downtime"));
+
+        if (!strcmp(qdict_get_str(dev, "idstr"), "ram")) {
+            /* RAM is always saved at switchover, at least its EOS marker */
+            g_assert(qdict_haskey(dev, "size"));
+            g_assert_cmpint(qdict_get_int(dev, "size"), >, 0);
+            found_ram = true;
+        }
+    }
+    g_assert(found_ram);
+    qobject_unref(rsp);
+}
+
+static void test_precopy_unix_switchover(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+        .finish_hook = test_migrate_switchover_finish,
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
 static void test_precopy_unix_compress(void)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
@@ -2066,6 +2318,23 @@ test_migrate_precopy_tcp_multifd_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_zero_page_start(QTestState *from,
+                                                 QTestState *to)
+{
+    test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+    migrate_set_parameter_str(from, "zero-page-detection", "multifd");
+    return NULL;
+}
+
+static void *
+test_migrate_precopy_tcp_multifd_xbzrle_start(QTestState *from,
+                                              QTestState *to)
+{
+    test_migrate_xbzrle_start(from, to);
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+}
+
 static void *
 test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
                                             QTestState *to)
@@ -2082,6 +2351,15 @@ test_migrate_precopy_tcp_multifd_zstd_start(QTestState *from,
 }
 #endif /* CONFIG_ZSTD */
 
+#ifdef CONFIG_LZ4
+static void *
+test_migrate_precopy_tcp_multifd_lz4_start(QTestState *from,
+                                           QTestState *to)
+{
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "lz4");
+}
+#endif /* CONFIG_LZ4 */
+
 static void test_multifd_tcp_none(void)
 {
     MigrateCommon args = {
@@ -2097,6 +2375,28 @@ static void test_multifd_tcp_none(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_zero_page_multifd(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_zero_page_start,
+        .live = true,
+    };
+    test_precopy_common(&args);
+}
+
+static void test_multifd_tcp_xbzrle(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_xbzrle_start,
+        .iterations = 2,
+        /* Pages need to change between rounds to be delta encoded */
+        .live = true,
+    };
+    test_precopy_common(&args);
+}
+
 static void test_multifd_tcp_zlib(void)
 {
     MigrateCommon args = {
@@ -2117,6 +2417,17 @@ static void test_multifd_tcp_zstd(void)
 }
 #endif
 
+#ifdef CONFIG_LZ4
+static void test_multifd_tcp_lz4(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_lz4_start,
+    };
+    test_precopy_common(&args);
+}
+#endif
+
 #ifdef CONFIG_GNUTLS
 static void *
 test_migrate_multifd_tcp_tls_psk_start_match(QTestState *from,
@@ -2609,6 +2920,80 @@ static void test_vcpu_dirty_limit(void)
     dirtylimit_stop_vm(vm);
 }
 
+/*
+ * Check that dirty-limit caps the dirtying vCPU instead of throttling
+ * the whole guest, and that the quota is dropped after migration.
+ */
+static void test_migrate_dirty_limit(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateStart args = {
+        .use_dirty_ring = true,
+    };
+    QTestState *from, *to;
+    QDict *rsp;
+    QList *vcpus;
+
+    if (test_migrate_start(&from, &to, uri, &args)) {
+        return;
+    }
+
+    migrate_set_capability(from, "dirty-limit", true);
+
+    /*
+     * Set the initial parameters so that the migration could not converge
+     * without throttling.
+     */
+    migrate_ensure_non_converge(from);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, uri, "{}");
+
+    /* Wait until the dirtying vCPU gets a quota */
+    do {
+        rsp = migrate_query_not_failed(from);
+        vcpus = qdict_haskey(rsp, "dirty-limit-vcpus") ?
+            qdict_get_qlist(rsp, "dirty-limit-vcpus") : NULL;
+        if (vcpus && !qlist_empty(vcpus)) {
+            g_assert(qdict_haskey(rsp, "dirty-limit-target"));
+            qobject_unref(rsp);
+            break;
+        }
+        qobject_unref(rsp);
+        usleep(1000 * 100);
+        g_assert_false(got_src_stop);
+    } while (true);
+
+    /* cpu-throttle must not be involved */
+    g_assert_cmpint(read_migrate_property_int(from,
+                                              "cpu-throttle-percentage"),
+                    ==, 0);
+
+    /* The quota is managed by migration while it runs */
+    rsp = qtest_qmp(from, "{ 'execute': 'set-vcpu-dirty-limit',"
+                    "'arguments': { 'dirty-rate': 1000 } }");
+    g_assert(qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+
+    /* Now, when we tested that throttling works, let it converge */
+    migrate_ensure_converge(from);
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    /* The limits are dropped once migration is done */
+    rsp = query_vcpu_dirty_limit(from);
+    vcpus = qdict_get_qlist(rsp, "return");
+    g_assert(qlist_empty(vcpus));
+    qobject_unref(rsp);
+
+    test_migrate_end(from, to, true);
+}
+
 static bool kvm_dirty_ring_supported(void)
 {
 #if defined(__linux__) && defined(HOST_X86_64)
@@ -2689,6 +3074,10 @@ int main(int argc, char **argv)
         qtest_add_func("/migration/postcopy/preempt/plain", test_postcopy_preempt);
         qtest_add_func("/migration/postcopy/preempt/recovery/plain",
                        test_postcopy_preempt_recovery);
+        qtest_add_func("/migration/postcopy/prefetch",
+                       test_postcopy_prefetch);
+        qtest_add_func("/migration/postcopy/preempt/prefetch",
+                       test_postcopy_preempt_prefetch);
         if (getenv("QEMU_TEST_FLAKY_TESTS")) {
             qtest_add_func("/migration/postcopy/compress/plain",
                            test_postcopy_compress);
@@ -2700,6 +3089,15 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix/plain", test_precopy_unix_plain);
     qtest_add_func("/migration/precopy/unix/xbzrle", test_precopy_unix_xbzrle);
+    qtest_add_func("/migration/precopy/unix/parallel-device-load",
+                   test_precopy_unix_parallel_device_load);
+    qtest_add_func("/migration/precopy/unix/timeline",
+                   test_precopy_unix_timeline);
+    qtest_add_func("/migration/precopy/unix/switchover",
+                   test_precopy_unix_switchover);
+    qtest_add_func("/migration/precopy/file", test_precopy_file);
+    qtest_add_func("/migration/precopy/file/mapped-ram",
+                   test_precopy_file_mapped_ram);
     /*
      * Compression fails from time to time.
      * Put test here but don't enable it until everything is fixed.
@@ -2778,6 +3176,8 @@ int main(int argc, char **argv)
     }
     qtest_add_func("/migration/multifd/tcp/plain/none",
                    test_multifd_tcp_none);
+    qtest_add_func("/migration/multifd/tcp/plain/zero-page/multifd",
+                   test_multifd_tcp_zero_page_multifd);
     /*
      * This test is flaky and sometimes fails in CI and otherwise:
      * don't run unless user opts in via environment variable.
@@ -2786,12 +3186,18 @@ int main(int argc, char **argv)
         qtest_add_func("/migration/multifd/tcp/plain/cancel",
                        test_multifd_tcp_cancel);
     }
+    qtest_add_func("/migration/multifd/tcp/plain/xbzrle",
+                   test_multifd_tcp_xbzrle);
     qtest_add_func("/migration/multifd/tcp/plain/zlib",
                    test_multifd_tcp_zlib);
 #ifdef CONFIG_ZSTD
     qtest_add_func("/migration/multifd/tcp/plain/zstd",
                    test_multifd_tcp_zstd);
 #endif
+#ifdef CONFIG_LZ4
+    qtest_add_func("/migration/multifd/tcp/plain/lz4",
+                   test_multifd_tcp_lz4);
+#endif
 #ifdef CONFIG_GNUTLS
     qtest_add_func("/migration/multifd/tcp/tls/psk/match",
                    test_multifd_tcp_tls_psk_match);
@@ -2816,6 +3222,8 @@ int main(int argc, char **argv)
                        test_precopy_unix_dirty_ring);
         qtest_add_func("/migration/vcpu_dirty_limit",
                        test_vcpu_dirty_limit);
+        qtest_add_func("/migration/dirty_limit",
+                       test_migrate_dirty_limit);
     }
 
     ret = g_test_run();
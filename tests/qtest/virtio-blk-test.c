@@ -12,6 +12,8 @@
 #include "libqtest-single.h"
 #include "qemu/bswap.h"
 #include "qemu/module.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
 #include "standard-headers/linux/virtio_blk.h"
 #include "standard-headers/linux/virtio_pci.h"
 #include "libqos/qgraph.h"
@@ -721,6 +723,135 @@ static void pci_hotplug(void *obj, void *data, QGuestAllocator *t_alloc)
     qpci_unplug_acpi_device_test(qts, "drv1", PCI_SLOT_HP);
 }
 
+/* Read the first sector of the device through @vq */
+static void iothread_vq_mapping_read(QTestState *qts, QVirtioDevice *dev,
+                                     QGuestAllocator *alloc, QVirtQueue *vq)
+{
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    uint32_t free_head;
+
+    req.type = VIRTIO_BLK_T_IN;
+    req.ioprio = 1;
+    req.sector = 0;
+    req.data = g_malloc0(512);
+
+    req_addr = virtio_blk_request(alloc, dev, &req, 512);
+
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, 16, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 16, 512, true, true);
+    qvirtqueue_add(qts, vq, req_addr + 528, 1, true, false);
+
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_BLK_TIMEOUT_US);
+    g_assert_cmpint(readb(req_addr + 528), ==, 0);
+
+    guest_free(alloc, req_addr);
+}
+
+/*
+ * Serve the two virtqueues of a hotplugged device from two IOThreads and
+ * check that query-blockstats accounts each request to its virtqueue.
+ */
+static void iothread_vq_mapping(void *obj, void *data,
+                                QGuestAllocator *t_alloc)
+{
+    QVirtioPCIDevice *dev1 = obj;
+    QVirtioPCIDevice *dev;
+    QTestState *qts = dev1->pdev->bus->qts;
+    QVirtQueue *vq[2];
+    QDict *rsp;
+    QList *stats;
+    const QListEntry *entry;
+    uint64_t features;
+    bool found = false;
+    int i;
+
+    if (dev1->pdev->bus->not_hotpluggable) {
+        g_test_skip("pci bus does not support hotplug");
+        return;
+    }
+
+    for (i = 0; i < 2; i++) {
+        qtest_qmp_assert_success(qts,
+                                 "{ 'execute': 'object-add', 'arguments': "
+                                 "  { 'qom-type': 'iothread', "
+                                 "    'id': 'iothread%d' } }", i);
+    }
+
+    qtest_qmp_device_add(qts, "virtio-blk-pci", "drv1",
+                         "{'addr': %s, 'drive': 'drive1', 'num-queues': 2, "
+                         " 'iothread-vq-mapping': [ "
+                         "   {'iothread': 'iothread0'}, "
+                         "   {'iothread': 'iothread1'} ] }",
+                         stringify(PCI_SLOT_HP) ".0");
+
+    dev = virtio_pci_new(dev1->pdev->bus,
+                         &(QPCIAddress) { .devfn = QPCI_DEVFN(PCI_SLOT_HP, 0) });
+    g_assert_nonnull(dev);
+    qvirtio_pci_device_enable(dev);
+    qvirtio_start_device(&dev->vdev);
+
+    features = qvirtio_get_features(&dev->vdev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                    (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                    (1u << VIRTIO_RING_F_EVENT_IDX) |
+                    (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(&dev->vdev, features);
+
+    for (i = 0; i < 2; i++) {
+        vq[i] = qvirtqueue_setup(&dev->vdev, t_alloc, i);
+    }
+    qvirtio_set_driver_ok(&dev->vdev);
+
+    /* One read on the first virtqueue, two on the second */
+    iothread_vq_mapping_read(qts, &dev->vdev, t_alloc, vq[0]);
+    iothread_vq_mapping_read(qts, &dev->vdev, t_alloc, vq[1]);
+    iothread_vq_mapping_read(qts, &dev->vdev, t_alloc, vq[1]);
+
+    rsp = qtest_qmp(qts, "{ 'execute': 'query-blockstats' }");
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(rsp, "return"), entry) {
+        QDict *blockstats = qobject_to(QDict, qlist_entry_obj(entry));
+        QDict *ds;
+
+        if (!qdict_haskey(blockstats, "device") ||
+            strcmp(qdict_get_str(blockstats, "device"), "drive1")) {
+            continue;
+        }
+        found = true;
+
+        ds = qdict_get_qdict(blockstats, "stats");
+        g_assert_cmpint(qdict_get_int(ds, "rd_operations"), ==, 3);
+
+        stats = qdict_get_qlist(ds, "queues");
+        g_assert_nonnull(stats);
+        g_assert_cmpint(qlist_size(stats), ==, 2);
+        for (i = 0; i < 2; i++) {
+            QDict *qs = qobject_to(QDict, qlist_pop(stats));
+
+            g_assert_cmpint(qdict_get_int(qs, "queue"), ==, i);
+            g_assert_cmpint(qdict_get_int(qs, "rd-operations"), ==, i + 1);
+            g_assert_cmpint(qdict_get_int(qs, "rd-bytes"), ==, (i + 1) * 512);
+            qobject_unref(qs);
+        }
+    }
+    g_assert(found);
+    qobject_unref(rsp);
+
+    for (i = 0; i < 2; i++) {
+        qvirtqueue_cleanup(dev->vdev.bus, vq[i], t_alloc);
+    }
+    qvirtio_pci_device_disable(dev);
+    qos_object_destroy((QOSGraphObject *)dev);
+
+    /* unplug the disk, this drops the IOThread references */
+    qpci_unplug_acpi_device_test(qts, "drv1", PCI_SLOT_HP);
+}
+
 /*
  * Check that setting the vring addr on a non-existent virtqueue does
  * not crash.
@@ -802,6 +933,8 @@ static void register_virtio_blk_test(void)
     qos_add_test("nxvirtq", "virtio-blk-pci",
                       test_nonexistent_virtqueue, &opts);
     qos_add_test("hotplug", "virtio-blk-pci", pci_hotplug, &opts);
+    qos_add_test("iothread-vq-mapping", "virtio-blk-pci",
+                 iothread_vq_mapping, &opts);
 }
 
 libqos_init(register_virtio_blk_test);
@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Test coroutine file descriptor operations submitted to the AioContext
+ *
+ * Copyright Red Hat
+ *
+ * The operations go through the io_uring that the AioContext uses for file
+ * descriptor monitoring.  A glib event loop normally makes the AioContext fall
+ * back to epoll or poll, so the tests use a private AioContext that keeps
+ * io_uring when it is run from glib.
+ */
+#include "qemu/osdep.h"
+#include "block/aio.h"
+#include "qapi/error.h"
+#include "qemu/sockets.h"
+#include "qemu/coroutine-core.h"
+
+static AioContext *ctx;
+
+static void nop_prep(struct io_uring_sqe *sqe, AioFdOp *op)
+{
+    io_uring_prep_nop(sqe);
+}
+
+static void coroutine_fn co_submit_nop(void *opaque)
+{
+    int *ret = opaque;
+    AioFdOp op = {
+        .prep = nop_prep,
+    };
+
+    *ret = aio_co_submit_fd_op(ctx, &op);
+}
+
+static void test_fd_op(bool use_gsource)
+{
+    Coroutine *co;
+    int ret = -EINPROGRESS;
+
+    if (!aio_fd_ops_supported(ctx)) {
+        g_test_skip("io_uring is not available");
+        return;
+    }
+
+    co = qemu_coroutine_create(co_submit_nop, &ret);
+    aio_co_enter(ctx, co);
+    g_assert_cmpint(ret, ==, -EINPROGRESS);
+
+    while (ret == -EINPROGRESS) {
+        if (use_gsource) {
+            g_main_context_iteration(NULL, true);
+        } else {
+            aio_poll(ctx, true);
+        }
+    }
+    g_assert_cmpint(ret, ==, 0);
+}
+
+static void test_aio_fd_op(void)
+{
+    test_fd_op(false);
+}
+
+static void test_source_fd_op(void)
+{
+    test_fd_op(true);
+}
+
+typedef struct {
+    AioFdOp op;
+    int fd;
+    char buf[16];
+    size_t len;
+    ssize_t ret;
+    bool done;
+} FdOpTestData;
+
+static void coroutine_fn co_recvmsg(void *opaque)
+{
+    FdOpTestData *data = opaque;
+    struct iovec iov = { .iov_base = data->buf, .iov_len = sizeof(data->buf) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    data->ret = aio_co_recvmsg(ctx, &data->op, data->fd, &msg);
+    data->done = true;
+}
+
+static void coroutine_fn co_sendmsg(void *opaque)
+{
+    FdOpTestData *data = opaque;
+    struct iovec iov = { .iov_base = data->buf, .iov_len = data->len };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    data->ret = aio_co_sendmsg(ctx, &data->op, data->fd, &msg);
+    data->done = true;
+}
+
+static void fd_op_start(FdOpTestData *data, CoroutineEntry *entry)
+{
+    data->done = false;
+    aio_co_enter(ctx, qemu_coroutine_create(entry, data));
+}
+
+static void fd_op_wait(FdOpTestData *data)
+{
+    while (!data->done) {
+        aio_poll(ctx, true);
+    }
+}
+
+static void test_fd_op_socketpair(void)
+{
+    FdOpTestData r = {}, w = { .len = 5 };
+    int sv[2];
+
+    if (!aio_fd_ops_supported(ctx)) {
+        g_test_skip("io_uring is not available");
+        return;
+    }
+
+    g_assert_cmpint(qemu_socketpair(AF_UNIX, SOCK_STREAM, 0, sv), ==, 0);
+    r.fd = sv[0];
+    w.fd = sv[1];
+    memcpy(w.buf, "hello", w.len);
+
+    /* The read is submitted first and has to wait for the data */
+    fd_op_start(&r, co_recvmsg);
+    fd_op_start(&w, co_sendmsg);
+    fd_op_wait(&w);
+    fd_op_wait(&r);
+
+    g_assert_cmpint(w.ret, ==, 5);
+    g_assert_cmpint(r.ret, ==, 5);
+    g_assert(!memcmp(r.buf, "hello", 5));
+
+    close(sv[0]);
+    close(sv[1]);
+}
+
+static void cancel_bh(void *opaque)
+{
+    FdOpTestData *data = opaque;
+
+    if (!data->done) {
+        aio_fd_op_cancel(ctx, &data->op);
+    }
+}
+
+static void *cancel_thread(void *opaque)
+{
+    aio_bh_schedule_oneshot(ctx, cancel_bh, opaque);
+    return NULL;
+}
+
+static void fd_op_cancel_from_thread(FdOpTestData *data)
+{
+    QemuThread thread;
+
+    qemu_thread_create(&thread, "cancel_thread", cancel_thread, data,
+                       QEMU_THREAD_JOINABLE);
+    qemu_thread_join(&thread);
+}
+
+static void test_fd_op_cancel(void)
+{
+    FdOpTestData r = {};
+    ssize_t first;
+    int sv[2];
+
+    if (!aio_fd_ops_supported(ctx)) {
+        g_test_skip("io_uring is not available");
+        return;
+    }
+
+    g_assert_cmpint(qemu_socketpair(AF_UNIX, SOCK_STREAM, 0, sv), ==, 0);
+    r.fd = sv[0];
+
+    /* Cancel a read that waits for data from another thread */
+    fd_op_start(&r, co_recvmsg);
+    aio_poll(ctx, false);
+    g_assert(!r.done);
+    fd_op_cancel_from_thread(&r);
+    fd_op_wait(&r);
+
+    /* Older kernels interrupt the worker that is blocked in the read */
+    g_assert(r.ret == -ECANCELED || r.ret == -EINTR);
+
+    /* A cancellation after completion must not break the next operation */
+    g_assert_cmpint(write(sv[1], "abc", 3), ==, 3);
+    fd_op_start(&r, co_recvmsg);
+    fd_op_wait(&r);
+    g_assert_cmpint(r.ret, ==, 3);
+
+    fd_op_cancel_from_thread(&r);
+    aio_poll(ctx, false); /* the bottom half finds the read completed */
+    g_assert_cmpint(write(sv[1], "defgh", 5), ==, 5);
+    fd_op_start(&r, co_recvmsg);
+    fd_op_wait(&r);
+    g_assert_cmpint(r.ret, ==, 5);
+    g_assert(!memcmp(r.buf, "defgh", 5));
+
+    /*
+     * Cancel a read that the data completes at the same time.  The next read
+     * reuses the AioFdOp and must not be hit by the cancellation.
+     */
+    fd_op_start(&r, co_recvmsg);
+    aio_poll(ctx, false);
+    g_assert(!r.done);
+    g_assert_cmpint(write(sv[1], "abc", 3), ==, 3);
+    aio_fd_op_cancel(ctx, &r.op);
+    fd_op_wait(&r);
+    g_assert(r.ret == 3 || r.ret == -ECANCELED || r.ret == -EINTR);
+    first = MAX(r.ret, 0);
+
+    g_assert_cmpint(write(sv[1], "defgh", 5), ==, 5);
+    fd_op_start(&r, co_recvmsg);
+    fd_op_wait(&r);
+    g_assert_cmpint(first + r.ret, ==, 8);
+
+    close(sv[0]);
+    close(sv[1]);
+}
+
+int main(int argc, char **argv)
+{
+    GSource *src;
+
+    ctx = aio_context_new(&error_abort);
+    aio_context_set_g_source_io_uring(ctx, true);
+    qemu_set_current_aio_context(ctx);
+
+    src = aio_get_g_source(ctx);
+    g_source_attach(src, NULL);
+    g_source_unref(src);
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/aio/coroutine/fd-op",            test_aio_fd_op);
+    g_test_add_func("/aio/coroutine/fd-op/socketpair", test_fd_op_socketpair);
+    g_test_add_func("/aio/coroutine/fd-op/cancel",     test_fd_op_cancel);
+    g_test_add_func("/aio-gsource/coroutine/fd-op",    test_source_fd_op);
+    return g_test_run();
+}
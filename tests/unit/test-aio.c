@@ -488,6 +488,95 @@ static void test_timer_schedule(void)
     timer_del(&data.timer);
 }
 
+#ifdef CONFIG_POSIX
+typedef struct {
+    EventNotifier e;
+    bool pending;
+    int handled;
+    int poll_calls;
+    int poll_hits;
+} PollTestData;
+
+static bool poll_test_poll(void *opaque)
+{
+    PollTestData *data = container_of(opaque, PollTestData, e);
+
+    data->poll_calls++;
+    data->poll_hits += data->pending;
+    return data->pending;
+}
+
+static void poll_test_handle(EventNotifier *e)
+{
+    PollTestData *data = container_of(e, PollTestData, e);
+
+    event_notifier_test_and_clear(e);
+    data->pending = false;
+    data->handled++;
+}
+
+/* Signal @data and run the event loop until it has been handled */
+static void poll_test_kick(PollTestData *data)
+{
+    data->pending = true;
+    event_notifier_set(&data->e);
+    while (data->pending) {
+        aio_poll(ctx, true);
+    }
+}
+
+static void test_poll_busy_and_idle(void)
+{
+    PollTestData busy = {}, idle = {};
+    int64_t deadline = g_get_monotonic_time() + 10 * G_USEC_PER_SEC;
+    int busy_hits, idle_calls, i;
+    bool removed = false;
+
+    aio_context_set_poll_params(ctx, 10 * SCALE_MS, 0, 2, &error_abort);
+
+    event_notifier_init(&busy.e, false);
+    event_notifier_init(&idle.e, false);
+    aio_set_event_notifier(ctx, &busy.e, poll_test_handle, poll_test_poll,
+                           poll_test_handle);
+    aio_set_event_notifier(ctx, &idle.e, poll_test_handle, poll_test_poll,
+                           poll_test_handle);
+
+    /* Handlers join the poll set when their fd fires */
+    poll_test_kick(&idle);
+
+    /*
+     * The idle handler is polled along with the busy one until it has not
+     * fired for longer than the maximum polling time
+     */
+    do {
+        busy_hits = busy.poll_hits;
+        idle_calls = idle.poll_calls;
+        poll_test_kick(&busy);
+        removed = idle_calls > 0 && busy.poll_hits > busy_hits &&
+                  idle.poll_calls == idle_calls;
+    } while (!removed && g_get_monotonic_time() < deadline);
+    g_assert(removed);
+
+    /* The busy handler keeps polling, the idle one is left alone */
+    busy_hits = busy.poll_hits;
+    for (i = 0; i < 10; i++) {
+        poll_test_kick(&busy);
+    }
+    g_assert_cmpint(busy.poll_hits, >, busy_hits);
+    g_assert_cmpint(idle.poll_calls, ==, idle_calls);
+
+    /* The idle handler is only handled through its fd again */
+    poll_test_kick(&idle);
+    g_assert_cmpint(idle.handled, ==, 2);
+
+    aio_set_event_notifier(ctx, &busy.e, NULL, NULL, NULL);
+    aio_set_event_notifier(ctx, &idle.e, NULL, NULL, NULL);
+    event_notifier_cleanup(&busy.e);
+    event_notifier_cleanup(&idle.e);
+    aio_context_set_poll_params(ctx, 0, 0, 0, &error_abort);
+}
+#endif
+
 /* Now the same tests, using the context as a GSource.  They are
  * very similar to the ones above, with g_main_context_iteration
  * replacing aio_poll.  However:
@@ -912,6 +1001,9 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/wait/no-flush-cb",  test_wait_event_notifier_noflush);
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
+#ifdef CONFIG_POSIX
+    g_test_add_func("/aio/poll/busy-and-idle",      test_poll_busy_and_idle);
+#endif
 
     g_test_add_func("/aio/coroutine/queue-chaining", test_queue_chaining);
     g_test_add_func("/aio/coroutine/worker-thread-co-enter", test_worker_thread_co_enter);
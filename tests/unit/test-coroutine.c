@@ -449,6 +449,58 @@ static void test_lifecycle(void)
     g_assert(done); /* expect done to be true (second time) */
 }
 
+/*
+ * Check that coroutines with a small stack work and are counted in their
+ * own class
+ */
+
+static void coroutine_fn yield_and_exit(void *opaque)
+{
+    char buf[1024];
+    bool *done = opaque;
+
+    /* Touch the stack across a yield */
+    memset(buf, 0x5a, sizeof(buf));
+    qemu_coroutine_yield();
+    g_assert_cmpint(buf[sizeof(buf) - 1], ==, 0x5a);
+    *done = true;
+}
+
+static void test_small_stack(void)
+{
+    CoroutinePoolStats before[COROUTINE_STACK__MAX];
+    CoroutinePoolStats after[COROUTINE_STACK__MAX];
+    CoroutinePoolStats *small = &after[COROUTINE_STACK_SMALL];
+    Coroutine *coroutine;
+    bool done = false;
+
+    qemu_coroutine_get_stats(before);
+
+    coroutine = qemu_coroutine_create_sized(yield_and_exit, &done,
+                                            COROUTINE_STACK_SMALL);
+    qemu_coroutine_enter(coroutine);
+    g_assert(!done);
+
+    qemu_coroutine_get_stats(after);
+    g_assert_cmpint(small->stack_size, ==, COROUTINE_SMALL_STACK_SIZE);
+    g_assert_cmpint(small->pool_hits + small->pool_misses, ==,
+                    before[COROUTINE_STACK_SMALL].pool_hits +
+                    before[COROUTINE_STACK_SMALL].pool_misses + 1);
+    g_assert_cmpint(small->in_use, ==, 1);
+    g_assert_cmpint(small->allocated, >=, 1);
+    g_assert_cmpint(small->max_allocated, >=, small->allocated);
+    g_assert_cmpint(after[COROUTINE_STACK_DEFAULT].pool_hits +
+                    after[COROUTINE_STACK_DEFAULT].pool_misses, ==,
+                    before[COROUTINE_STACK_DEFAULT].pool_hits +
+                    before[COROUTINE_STACK_DEFAULT].pool_misses);
+
+    qemu_coroutine_enter(coroutine);
+    g_assert(done);
+
+    qemu_coroutine_get_stats(after);
+    g_assert_cmpint(small->in_use, ==, 0);
+}
+
 
 #define RECORD_SIZE 10 /* Leave some room for expansion */
 struct coroutine_position {
@@ -650,6 +702,7 @@ int main(int argc, char **argv)
     }
 
     g_test_add_func("/basic/lifecycle", test_lifecycle);
+    g_test_add_func("/basic/small-stack", test_small_stack);
     g_test_add_func("/basic/yield", test_yield);
     g_test_add_func("/basic/nesting", test_nesting);
     g_test_add_func("/basic/self", test_self);
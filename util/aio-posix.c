@@ -21,6 +21,8 @@
 #include "qemu/rcu_queue.h"
 #include "qemu/sockets.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
+#include "qapi/error.h"
 #include "trace.h"
 #include "aio-posix.h"
 
@@ -64,6 +66,16 @@ static AioHandler *find_aio_handler(AioContext *ctx, int fd)
     return NULL;
 }
 
+/*
+ * Whether glib polls the file descriptors of handlers directly.  Otherwise
+ * the fd monitoring implementation reports them in ->gsource_dispatch(), and
+ * polling them in glib as well would dispatch them twice.
+ */
+static bool aio_handler_uses_g_source_poll(AioContext *ctx)
+{
+    return !ctx->fdmon_ops->gsource_dispatch;
+}
+
 static bool aio_remove_fd_handler(AioContext *ctx, AioHandler *node)
 {
     /* If the GSource is in the process of being destroyed then
@@ -71,7 +83,8 @@ static bool aio_remove_fd_handler(AioContext *ctx, AioHandler *node)
      * removal in that case, because glib cleans up its state during
      * destruction anyway.
      */
-    if (!g_source_is_destroyed(&ctx->source)) {
+    if (aio_handler_uses_g_source_poll(ctx) &&
+        !g_source_is_destroyed(&ctx->source)) {
         g_source_remove_poll(&ctx->source, &node->pfd);
     }
 
@@ -149,7 +162,9 @@ void aio_set_fd_handler(AioContext *ctx,
         } else {
             new_node->pfd = node->pfd;
         }
-        g_source_add_poll(&ctx->source, &new_node->pfd);
+        if (aio_handler_uses_g_source_poll(ctx)) {
+            g_source_add_poll(&ctx->source, &new_node->pfd);
+        }
 
         new_node->pfd.events = (io_read ? G_IO_IN | G_IO_HUP | G_IO_ERR : 0);
         new_node->pfd.events |= (io_write ? G_IO_OUT | G_IO_ERR : 0);
@@ -263,6 +278,10 @@ bool aio_prepare(AioContext *ctx)
     poll_set_started(ctx, &ready_list, false);
     /* TODO what to do with this list? */
 
+    if (ctx->fdmon_ops->gsource_prepare) {
+        ctx->fdmon_ops->gsource_prepare(ctx);
+    }
+
     return false;
 }
 
@@ -271,6 +290,11 @@ bool aio_pending(AioContext *ctx)
     AioHandler *node;
     bool result = false;
 
+    if (ctx->fdmon_ops->gsource_check &&
+        ctx->fdmon_ops->gsource_check(ctx)) {
+        return true;
+    }
+
     /*
      * We have to walk very carefully in case aio_set_fd_handler is
      * called while we're walking.
@@ -342,6 +366,7 @@ static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
         if (ctx->poll_started && node->io_poll_begin) {
             node->io_poll_begin(node->opaque);
         }
+        node->poll_wait_ns = 0;
         QLIST_INSERT_HEAD(&ctx->poll_aio_handlers, node, node_poll);
     }
     if (!QLIST_IS_INSERTED(node, node_deleted) &&
@@ -421,6 +446,12 @@ void aio_dispatch(AioContext *ctx)
 {
     qemu_lockcnt_inc(&ctx->list_lock);
     aio_bh_poll(ctx);
+    if (ctx->fdmon_ops->gsource_dispatch) {
+        AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
+
+        ctx->fdmon_ops->gsource_dispatch(ctx, &ready_list);
+        aio_dispatch_ready_handlers(ctx, &ready_list);
+    }
     aio_dispatch_handlers(ctx);
     aio_free_deleted_handlers(ctx);
     qemu_lockcnt_dec(&ctx->list_lock);
@@ -464,6 +495,16 @@ static bool fdmon_supports_polling(AioContext *ctx)
     return ctx->fdmon_ops->need_wait != aio_poll_disabled;
 }
 
+/*
+ * A handler whose polling time has dropped to zero and that has not fired
+ * for longer than the maximum polling time would only be polled for the
+ * sake of other handlers, but never catch an event itself.
+ */
+static bool poll_handler_not_worth_polling(AioContext *ctx, AioHandler *node)
+{
+    return node->poll_ns == 0 && node->poll_wait_ns > ctx->poll_max_ns;
+}
+
 static bool remove_idle_poll_handlers(AioContext *ctx,
                                       AioHandlerList *ready_list,
                                       int64_t now)
@@ -485,7 +526,8 @@ static bool remove_idle_poll_handlers(AioContext *ctx,
     QLIST_FOREACH_SAFE(node, &ctx->poll_aio_handlers, node_poll, tmp) {
         if (node->poll_idle_timeout == 0LL) {
             node->poll_idle_timeout = now + POLL_IDLE_INTERVAL_NS;
-        } else if (now >= node->poll_idle_timeout) {
+        } else if (now >= node->poll_idle_timeout ||
+                   poll_handler_not_worth_polling(ctx, node)) {
             trace_poll_remove(ctx, node, node->pfd.fd);
             node->poll_idle_timeout = 0LL;
             QLIST_SAFE_REMOVE(node, node_poll);
@@ -508,6 +550,21 @@ static bool remove_idle_poll_handlers(AioContext *ctx,
     return progress;
 }
 
+/* Polling statistics are only written by the home thread */
+static void poll_stat_add(uint64_t *stat, uint64_t n)
+{
+    qatomic_set_u64(stat, *stat + n);
+}
+
+/* Returns the AioPollStats::hit_hist bin for a hit after @ns */
+static unsigned poll_hit_hist_bin(int64_t ns)
+{
+    uint64_t us = ns / SCALE_US;
+    unsigned bin = us ? 64 - clz64(us) : 0;
+
+    return MIN(bin, AIO_POLL_HIT_HIST_BINS - 1);
+}
+
 /* run_poll_handlers:
  * @ctx: the AioContext
  * @ready_list: the list to place ready handlers on
@@ -548,6 +605,15 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
         assert(!(max_ns && progress));
     } while (elapsed_time < max_ns && !ctx->fdmon_ops->need_wait(ctx));
 
+    /* A successful ->io_poll() sets *timeout to 0 */
+    poll_stat_add(&ctx->poll_total_ns, elapsed_time);
+    if (*timeout == 0) {
+        poll_stat_add(&ctx->poll_hits, 1);
+        poll_stat_add(&ctx->poll_hit_hist[poll_hit_hist_bin(elapsed_time)], 1);
+    } else {
+        poll_stat_add(&ctx->poll_misses, 1);
+    }
+
     if (remove_idle_poll_handlers(ctx, ready_list,
                                   start_time + elapsed_time)) {
         *timeout = 0;
@@ -578,12 +644,20 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
 static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
                           int64_t *timeout)
 {
+    AioHandler *node;
+    int64_t poll_ns = 0;
     int64_t max_ns;
 
     if (QLIST_EMPTY_RCU(&ctx->poll_aio_handlers)) {
         return false;
     }
 
+    /* Poll for as long as the handler that benefits most from it needs */
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        poll_ns = MAX(poll_ns, node->poll_ns);
+    }
+    ctx->poll_ns = MIN(poll_ns, ctx->poll_max_ns);
+
     max_ns = qemu_soonest_timeout(*timeout, ctx->poll_ns);
     if (max_ns && !ctx->fdmon_ops->need_wait(ctx)) {
         /*
@@ -599,6 +673,80 @@ static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
     return false;
 }
 
+static void shrink_polling_time(AioContext *ctx, AioHandler *node)
+{
+    int64_t old = node->poll_ns;
+
+    if (ctx->poll_shrink) {
+        node->poll_ns /= ctx->poll_shrink;
+    } else {
+        node->poll_ns = 0;
+    }
+
+    trace_poll_shrink(ctx, node, old, node->poll_ns);
+}
+
+static void grow_polling_time(AioContext *ctx, AioHandler *node)
+{
+    int64_t old = node->poll_ns;
+    int64_t grow = ctx->poll_grow;
+
+    if (grow == 0) {
+        grow = 2;
+    }
+
+    if (node->poll_ns) {
+        node->poll_ns *= grow;
+    } else {
+        node->poll_ns = 4000; /* start polling at 4 microseconds */
+    }
+
+    if (node->poll_ns > ctx->poll_max_ns) {
+        node->poll_ns = ctx->poll_max_ns;
+    }
+
+    trace_poll_grow(ctx, node, old, node->poll_ns);
+}
+
+/*
+ * adjust_polling_time:
+ * @ctx: the AioContext
+ * @block_ns: how long this aio_poll() call waited for events
+ *
+ * Adjust the polling time of each polled handler to the time it waited for
+ * its last event, so that a busy handler keeps the event loop polling while
+ * the polling time of handlers that fire rarely drops to zero.  The waiting
+ * time excludes the time spent dispatching events.
+ */
+static void adjust_polling_time(AioContext *ctx, int64_t block_ns)
+{
+    AioHandler *node;
+
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        int64_t wait_ns = node->poll_wait_ns + block_ns;
+
+        if (!QLIST_IS_INSERTED(node, node_ready)) {
+            /* Polling could not have caught an event for this handler */
+            node->poll_wait_ns = wait_ns;
+            if (node->poll_ns && wait_ns > ctx->poll_max_ns) {
+                shrink_polling_time(ctx, node);
+            }
+            continue;
+        }
+
+        node->poll_wait_ns = 0;
+        if (wait_ns <= node->poll_ns) {
+            /* This is the sweet spot, no adjustment needed */
+        } else if (wait_ns > ctx->poll_max_ns) {
+            /* We'd have to poll for too long, poll less */
+            shrink_polling_time(ctx, node);
+        } else if (node->poll_ns < ctx->poll_max_ns) {
+            /* There is room to grow, poll longer */
+            grow_polling_time(ctx, node);
+        }
+    }
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
@@ -606,6 +754,8 @@ bool aio_poll(AioContext *ctx, bool blocking)
     bool use_notify_me;
     int64_t timeout;
     int64_t start = 0;
+    uint64_t start_poll_ns = 0;
+    bool blocked = false;
 
     /*
      * There cannot be two concurrent aio_poll calls for the same AioContext (or
@@ -623,6 +773,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     if (ctx->poll_max_ns) {
         start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        start_poll_ns = ctx->poll_total_ns;
     }
 
     timeout = blocking ? aio_compute_timeout(ctx) : 0;
@@ -668,6 +819,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
         }
 
         ctx->fdmon_ops->wait(ctx, &ready_list, timeout);
+        blocked = timeout != 0;
     }
 
     if (use_notify_me) {
@@ -682,40 +834,11 @@ bool aio_poll(AioContext *ctx, bool blocking)
     if (ctx->poll_max_ns) {
         int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
 
-        if (block_ns <= ctx->poll_ns) {
-            /* This is the sweet spot, no adjustment needed */
-        } else if (block_ns > ctx->poll_max_ns) {
-            /* We'd have to poll for too long, poll less */
-            int64_t old = ctx->poll_ns;
-
-            if (ctx->poll_shrink) {
-                ctx->poll_ns /= ctx->poll_shrink;
-            } else {
-                ctx->poll_ns = 0;
-            }
-
-            trace_poll_shrink(ctx, old, ctx->poll_ns);
-        } else if (ctx->poll_ns < ctx->poll_max_ns &&
-                   block_ns < ctx->poll_max_ns) {
-            /* There is room to grow, poll longer */
-            int64_t old = ctx->poll_ns;
-            int64_t grow = ctx->poll_grow;
-
-            if (grow == 0) {
-                grow = 2;
-            }
-
-            if (ctx->poll_ns) {
-                ctx->poll_ns *= grow;
-            } else {
-                ctx->poll_ns = 4000; /* start polling at 4 microseconds */
-            }
-
-            if (ctx->poll_ns > ctx->poll_max_ns) {
-                ctx->poll_ns = ctx->poll_max_ns;
-            }
-
-            trace_poll_grow(ctx, old, ctx->poll_ns);
+        adjust_polling_time(ctx, block_ns);
+        if (blocked) {
+            /* Leave out the time that polling before the wait took */
+            poll_stat_add(&ctx->poll_block_ns,
+                          block_ns - (ctx->poll_total_ns - start_poll_ns));
         }
     }
 
@@ -753,14 +876,42 @@ void aio_context_destroy(AioContext *ctx)
 
 void aio_context_use_g_source(AioContext *ctx)
 {
+    AioHandler *node;
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (ctx->fdmon_io_uring_g_source) {
+        /* fdmon-io_uring runs from glib through its gsource_*() callbacks */
+        return;
+    }
+#endif
+
     /*
-     * Disable io_uring when the glib main loop is used because it doesn't
-     * support mixed glib/aio_poll() usage. It relies on aio_poll() being
-     * called regularly so that changes to the monitored file descriptors are
-     * submitted, otherwise a list of pending fd handlers builds up.
+     * Otherwise disable io_uring when the glib main loop is used because
+     * mixed glib/aio_poll() usage is opt-in.  It relies on aio_poll() or the
+     * GSource callbacks being called regularly so that changes to the
+     * monitored file descriptors are submitted, otherwise a list of pending
+     * fd handlers builds up.
      */
+    if (aio_handler_uses_g_source_poll(ctx)) {
+        return;
+    }
+
     fdmon_io_uring_destroy(ctx);
     aio_free_deleted_handlers(ctx);
+
+    /* glib polls the file descriptors of existing handlers from now on */
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        if (!QLIST_IS_INSERTED(node, node_deleted)) {
+            g_source_add_poll(&ctx->source, &node->pfd);
+        }
+    }
+}
+
+void aio_context_set_g_source_io_uring(AioContext *ctx, bool enable)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    ctx->fdmon_io_uring_g_source = enable;
+#endif
 }
 
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
@@ -788,3 +939,26 @@ void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
 
     aio_notify(ctx);
 }
+
+void aio_context_get_poll_stats(AioContext *ctx, AioPollStats *stats)
+{
+    int i;
+
+    stats->hits = qatomic_read_u64(&ctx->poll_hits);
+    stats->misses = qatomic_read_u64(&ctx->poll_misses);
+    stats->poll_ns = qatomic_read_u64(&ctx->poll_total_ns);
+    stats->block_ns = qatomic_read_u64(&ctx->poll_block_ns);
+    for (i = 0; i < AIO_POLL_HIT_HIST_BINS; i++) {
+        stats->hit_hist[i] = qatomic_read_u64(&ctx->poll_hit_hist[i]);
+    }
+}
+
+bool aio_context_set_io_uring_sqpoll(AioContext *ctx, int cpu, Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    return fdmon_io_uring_set_sqpoll(ctx, cpu, errp);
+#else
+    error_setg(errp, "io_uring is not supported by this build");
+    return false;
+#endif
+}
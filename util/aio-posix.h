@@ -38,6 +38,13 @@ struct AioHandler {
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
     bool poll_ready; /* has polling detected an event? */
+
+    /*
+     * Adaptive polling state, only used in poll_aio_handlers.  The event
+     * loop polls for as long as the handler with the highest poll_ns needs.
+     */
+    int64_t poll_ns;      /* polling time for this handler in nanoseconds */
+    int64_t poll_wait_ns; /* time waited for events since this handler's last */
 };
 
 /* Add a handler to a ready list */
@@ -68,6 +75,7 @@ static inline void fdmon_epoll_disable(AioContext *ctx)
 #ifdef CONFIG_LINUX_IO_URING
 bool fdmon_io_uring_setup(AioContext *ctx);
 void fdmon_io_uring_destroy(AioContext *ctx);
+bool fdmon_io_uring_set_sqpoll(AioContext *ctx, int cpu, Error **errp);
 #else
 static inline bool fdmon_io_uring_setup(AioContext *ctx)
 {
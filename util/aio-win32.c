@@ -430,6 +430,10 @@ void aio_context_use_g_source(AioContext *ctx)
 {
 }
 
+void aio_context_set_g_source_io_uring(AioContext *ctx, bool enable)
+{
+}
+
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink, Error **errp)
 {
@@ -442,3 +446,14 @@ void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
                                 Error **errp)
 {
 }
+
+void aio_context_get_poll_stats(AioContext *ctx, AioPollStats *stats)
+{
+    *stats = (AioPollStats) {};
+}
+
+bool aio_context_set_io_uring_sqpoll(AioContext *ctx, int cpu, Error **errp)
+{
+    error_setg(errp, "io_uring is not supported on this host");
+    return false;
+}
@@ -30,6 +30,7 @@
 #include "block/graph-lock.h"
 #include "qemu/main-loop.h"
 #include "qemu/atomic.h"
+#include "qom/object.h"
 #include "qemu/rcu_queue.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine_int.h"
@@ -367,6 +368,9 @@ aio_ctx_finalize(GSource     *source)
     unsigned flags;
 
     thread_pool_free(ctx->thread_pool);
+    if (ctx->thread_pool_context) {
+        object_unref(OBJECT(ctx->thread_pool_context));
+    }
 
 #ifdef CONFIG_LINUX_AIO
     if (ctx->linux_aio) {
@@ -435,7 +439,8 @@ GSource *aio_get_g_source(AioContext *ctx)
 ThreadPool *aio_get_thread_pool(AioContext *ctx)
 {
     if (!ctx->thread_pool) {
-        ctx->thread_pool = thread_pool_new(ctx);
+        /* Pairs with the load in readers of statistics in other threads */
+        qatomic_store_release(&ctx->thread_pool, thread_pool_new(ctx));
     }
     return ctx->thread_pool;
 }
@@ -457,6 +462,23 @@ LinuxAioState *aio_get_linux_aio(AioContext *ctx)
     assert(ctx->linux_aio);
     return ctx->linux_aio;
 }
+
+LinuxAioState *aio_try_current_linux_aio(void)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    Error *local_err = NULL;
+
+    if (likely(ctx->linux_aio) || ctx->linux_aio_failed) {
+        return ctx->linux_aio;
+    }
+
+    if (!aio_setup_linux_aio(ctx, &local_err)) {
+        error_reportf_err(local_err, "Unable to use native AIO, "
+                                     "falling back to thread pool: ");
+        ctx->linux_aio_failed = true;
+    }
+    return ctx->linux_aio;
+}
 #endif
 
 #ifdef CONFIG_LINUX_IO_URING
@@ -466,7 +488,7 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(ctx, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
@@ -480,6 +502,23 @@ LuringState *aio_get_linux_io_uring(AioContext *ctx)
     assert(ctx->linux_io_uring);
     return ctx->linux_io_uring;
 }
+
+LuringState *aio_try_current_linux_io_uring(void)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    Error *local_err = NULL;
+
+    if (likely(ctx->linux_io_uring) || ctx->linux_io_uring_failed) {
+        return ctx->linux_io_uring;
+    }
+
+    if (!aio_setup_linux_io_uring(ctx, &local_err)) {
+        error_reportf_err(local_err, "Unable to use linux io_uring, "
+                                     "falling back to thread pool: ");
+        ctx->linux_io_uring_failed = true;
+    }
+    return ctx->linux_io_uring;
+}
 #endif
 
 void aio_notify(AioContext *ctx)
@@ -617,6 +656,7 @@ AioContext *aio_context_new(Error **errp)
 
     ctx->thread_pool_min = 0;
     ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
+    ctx->thread_pool_context = NULL;
 
     register_aiocontext(ctx);
 
@@ -755,7 +795,8 @@ void qemu_set_current_aio_context(AioContext *ctx)
 }
 
 void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
-                                        int64_t max, Error **errp)
+                                        int64_t max, ThreadContext *tc,
+                                        Error **errp)
 {
 
     if (min > max || !max || min > INT_MAX || max > INT_MAX) {
@@ -766,6 +807,14 @@ void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
     ctx->thread_pool_min = min;
     ctx->thread_pool_max = max;
 
+    if (tc) {
+        object_ref(OBJECT(tc));
+    }
+    if (ctx->thread_pool_context) {
+        object_unref(OBJECT(ctx->thread_pool_context));
+    }
+    ctx->thread_pool_context = tc;
+
     if (ctx->thread_pool) {
         thread_pool_update_params(ctx->thread_pool, ctx);
     }
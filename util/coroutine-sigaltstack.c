@@ -145,7 +145,7 @@ static void coroutine_trampoline(int signal)
     coroutine_bootstrap(self, co);
 }
 
-Coroutine *qemu_coroutine_new(void)
+Coroutine *qemu_coroutine_new(CoroutineStackClass stack_class)
 {
     CoroutineSigAltStack *co;
     CoroutineThreadState *coTS;
@@ -168,8 +168,9 @@ Coroutine *qemu_coroutine_new(void)
      */
 
     co = g_malloc0(sizeof(*co));
-    co->stack_size = COROUTINE_STACK_SIZE;
-    co->stack = qemu_alloc_stack(&co->stack_size);
+    co->stack_size = qemu_coroutine_stack_size(stack_class);
+    co->stack = qemu_coroutine_stack_alloc(stack_class, &co->stack_size);
+    co->base.stack_class = stack_class;
     co->base.entry_arg = &old_env; /* stash away our jmp_buf */
 
     coTS = coroutine_get_thread_state();
@@ -266,7 +267,7 @@ void qemu_coroutine_delete(Coroutine *co_)
 {
     CoroutineSigAltStack *co = DO_UPCAST(CoroutineSigAltStack, base, co_);
 
-    qemu_free_stack(co->stack, co->stack_size);
+    qemu_coroutine_stack_free(co_->stack_class, co->stack, co->stack_size);
     g_free(co);
 }
 
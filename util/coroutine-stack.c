@@ -0,0 +1,245 @@
+/*
+ * Coroutine stack arena
+ *
+ * Copyright (c) 2023 QEMU contributors
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+/*
+ * Stacks of each size class are carved out of chunks that are mapped
+ * STACK_CHUNK_SLOTS stacks at a time.  Memory is only committed when the
+ * coroutine touches it, and a freed stack is returned to the kernel with
+ * MADV_DONTNEED but keeps its slot, so creating a coroutine after a pool
+ * miss costs neither an mmap() nor an mprotect() for the guard page once
+ * the slot has been used before.
+ *
+ * Each slot keeps the guard page that qemu_alloc_stack() sets up: without
+ * it a coroutine that overflows its stack would silently corrupt the stack
+ * of its neighbour instead of crashing.
+ *
+ * Allocation only happens when the coroutine pools are empty and stacks
+ * are freed from whichever thread deletes the coroutine, so a single lock
+ * protects all arenas.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/coroutine_int.h"
+#include "qemu/madvise.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+
+#define STACK_CHUNK_SLOTS 64
+
+typedef struct StackChunk {
+    void *base;
+    unsigned int nr_used;
+    DECLARE_BITMAP(used, STACK_CHUNK_SLOTS);
+    DECLARE_BITMAP(guarded, STACK_CHUNK_SLOTS); /* guard page is set up */
+    QLIST_ENTRY(StackChunk) next;
+} StackChunk;
+
+typedef struct StackArena {
+    size_t slot_size;   /* guard page + stack */
+    QLIST_HEAD(, StackChunk) chunks;
+    uint64_t max_depth; /* deepest use of a freed stack */
+} StackArena;
+
+static QemuMutex arena_lock;
+static StackArena arenas[COROUTINE_STACK__MAX];
+
+static void __attribute__((constructor)) coroutine_stack_init(void)
+{
+    qemu_mutex_init(&arena_lock);
+}
+
+static size_t stack_slot_size(CoroutineStackClass stack_class)
+{
+    size_t pagesz = qemu_real_host_page_size();
+
+    return ROUND_UP(qemu_coroutine_stack_size(stack_class), pagesz) + pagesz;
+}
+
+static void *stack_slot(StackArena *arena, StackChunk *chunk,
+                        unsigned long slot)
+{
+    return chunk->base + slot * arena->slot_size;
+}
+
+/* Bytes of the stack in @slot that are resident.  */
+static uint64_t stack_slot_depth(StackArena *arena, void *slot)
+{
+#ifdef CONFIG_LINUX
+    size_t pagesz = qemu_real_host_page_size();
+    size_t pages = arena->slot_size / pagesz;
+    g_autofree unsigned char *vec = g_malloc(pages);
+    uint64_t depth = 0;
+    size_t i;
+
+    if (mincore(slot, arena->slot_size, vec) < 0) {
+        return 0;
+    }
+    for (i = 0; i < pages; i++) {
+        depth += (vec[i] & 1) ? pagesz : 0;
+    }
+    return depth;
+#else
+    return 0;
+#endif
+}
+
+static StackChunk *stack_chunk_new(StackArena *arena)
+{
+    StackChunk *chunk = g_new0(StackChunk, 1);
+    size_t size = arena->slot_size * STACK_CHUNK_SLOTS;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+#if defined(MAP_STACK) && defined(__OpenBSD__)
+    /* See qemu_alloc_stack() */
+    flags |= MAP_STACK;
+#endif
+
+    chunk->base = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (chunk->base == MAP_FAILED) {
+        perror("failed to allocate memory for stack");
+        abort();
+    }
+
+    /* Transparent huge pages would commit far more than the stack uses */
+    qemu_madvise(chunk->base, size, QEMU_MADV_NOHUGEPAGE);
+
+    QLIST_INSERT_HEAD(&arena->chunks, chunk, next);
+    return chunk;
+}
+
+void *qemu_coroutine_stack_alloc(CoroutineStackClass stack_class, size_t *sz)
+{
+    StackArena *arena = &arenas[stack_class];
+    size_t pagesz = qemu_real_host_page_size();
+    StackChunk *chunk;
+    unsigned long slot;
+    void *stack, *guardpage;
+
+#ifdef CONFIG_DEBUG_STACK_USAGE
+    /* qemu_alloc_stack() fills the stack with a pattern to measure usage */
+    *sz = qemu_coroutine_stack_size(stack_class);
+    return qemu_alloc_stack(sz);
+#endif
+
+    QEMU_LOCK_GUARD(&arena_lock);
+    if (!arena->slot_size) {
+        arena->slot_size = stack_slot_size(stack_class);
+        QLIST_INIT(&arena->chunks);
+    }
+
+    QLIST_FOREACH(chunk, &arena->chunks, next) {
+        if (chunk->nr_used < STACK_CHUNK_SLOTS) {
+            break;
+        }
+    }
+    if (!chunk) {
+        chunk = stack_chunk_new(arena);
+    }
+
+    slot = find_first_zero_bit(chunk->used, STACK_CHUNK_SLOTS);
+    assert(slot < STACK_CHUNK_SLOTS);
+    set_bit(slot, chunk->used);
+    chunk->nr_used++;
+
+    stack = stack_slot(arena, chunk, slot);
+    if (!test_bit(slot, chunk->guarded)) {
+#if defined(HOST_HPPA)
+        /* stack grows up */
+        guardpage = stack + arena->slot_size - pagesz;
+#else
+        /* stack grows down */
+        guardpage = stack;
+#endif
+        if (mprotect(guardpage, pagesz, PROT_NONE) != 0) {
+            perror("failed to set up stack guard page");
+            abort();
+        }
+        set_bit(slot, chunk->guarded);
+    }
+
+    *sz = arena->slot_size;
+    return stack;
+}
+
+void qemu_coroutine_stack_free(CoroutineStackClass stack_class, void *stack,
+                               size_t sz)
+{
+    StackArena *arena = &arenas[stack_class];
+    StackChunk *chunk;
+    unsigned long slot;
+
+#ifdef CONFIG_DEBUG_STACK_USAGE
+    qemu_free_stack(stack, sz);
+    return;
+#endif
+
+    assert(sz == arena->slot_size);
+
+    QEMU_LOCK_GUARD(&arena_lock);
+    QLIST_FOREACH(chunk, &arena->chunks, next) {
+        if (stack >= chunk->base &&
+            stack < chunk->base + arena->slot_size * STACK_CHUNK_SLOTS) {
+            break;
+        }
+    }
+    assert(chunk);
+
+    slot = (stack - chunk->base) / arena->slot_size;
+    assert(test_bit(slot, chunk->used));
+
+    arena->max_depth = MAX(arena->max_depth, stack_slot_depth(arena, stack));
+
+    clear_bit(slot, chunk->used);
+    if (--chunk->nr_used == 0) {
+        QLIST_REMOVE(chunk, next);
+        munmap(chunk->base, arena->slot_size * STACK_CHUNK_SLOTS);
+        g_free(chunk);
+        return;
+    }
+
+    /* Keep the guard page, give the rest back */
+#if defined(HOST_HPPA)
+    qemu_madvise(stack, sz - qemu_real_host_page_size(), QEMU_MADV_DONTNEED);
+#else
+    qemu_madvise(stack + qemu_real_host_page_size(),
+                 sz - qemu_real_host_page_size(), QEMU_MADV_DONTNEED);
+#endif
+}
+
+void qemu_coroutine_stack_get_usage(CoroutineStackClass stack_class,
+                                    uint64_t *committed, uint64_t *max_depth)
+{
+    StackArena *arena = &arenas[stack_class];
+    StackChunk *chunk;
+    unsigned long slot;
+    uint64_t depth;
+
+    *committed = 0;
+    *max_depth = 0;
+
+    QEMU_LOCK_GUARD(&arena_lock);
+    *max_depth = arena->max_depth;
+    if (!arena->slot_size) {
+        return;
+    }
+
+    QLIST_FOREACH(chunk, &arena->chunks, next) {
+        for (slot = find_first_bit(chunk->used, STACK_CHUNK_SLOTS);
+             slot < STACK_CHUNK_SLOTS;
+             slot = find_next_bit(chunk->used, STACK_CHUNK_SLOTS, slot + 1)) {
+            depth = stack_slot_depth(arena, stack_slot(arena, chunk, slot));
+            *committed += depth;
+            *max_depth = MAX(*max_depth, depth);
+        }
+    }
+}
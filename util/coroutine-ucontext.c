@@ -179,7 +179,7 @@ static void coroutine_trampoline(int i0, int i1)
     }
 }
 
-Coroutine *qemu_coroutine_new(void)
+Coroutine *qemu_coroutine_new(CoroutineStackClass stack_class)
 {
     CoroutineUContext *co;
     ucontext_t old_uc, uc;
@@ -200,12 +200,14 @@ Coroutine *qemu_coroutine_new(void)
     }
 
     co = g_malloc0(sizeof(*co));
-    co->stack_size = COROUTINE_STACK_SIZE;
-    co->stack = qemu_alloc_stack(&co->stack_size);
+    co->stack_size = qemu_coroutine_stack_size(stack_class);
+    co->stack = qemu_coroutine_stack_alloc(stack_class, &co->stack_size);
 #ifdef CONFIG_SAFESTACK
-    co->unsafe_stack_size = COROUTINE_STACK_SIZE;
-    co->unsafe_stack = qemu_alloc_stack(&co->unsafe_stack_size);
+    co->unsafe_stack_size = qemu_coroutine_stack_size(stack_class);
+    co->unsafe_stack = qemu_coroutine_stack_alloc(stack_class,
+                                                  &co->unsafe_stack_size);
 #endif
+    co->base.stack_class = stack_class;
     co->base.entry_arg = &old_env; /* stash away our jmp_buf */
 
     uc.uc_link = &old_uc;
@@ -277,9 +279,10 @@ void qemu_coroutine_delete(Coroutine *co_)
     valgrind_stack_deregister(co);
 #endif
 
-    qemu_free_stack(co->stack, co->stack_size);
+    qemu_coroutine_stack_free(co_->stack_class, co->stack, co->stack_size);
 #ifdef CONFIG_SAFESTACK
-    qemu_free_stack(co->unsafe_stack, co->unsafe_stack_size);
+    qemu_coroutine_stack_free(co_->stack_class, co->unsafe_stack,
+                              co->unsafe_stack_size);
 #endif
     g_free(co);
 }
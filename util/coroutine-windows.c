@@ -69,12 +69,13 @@ static void CALLBACK coroutine_trampoline(void *co_)
     }
 }
 
-Coroutine *qemu_coroutine_new(void)
+Coroutine *qemu_coroutine_new(CoroutineStackClass stack_class)
 {
-    const size_t stack_size = COROUTINE_STACK_SIZE;
+    const size_t stack_size = qemu_coroutine_stack_size(stack_class);
     CoroutineWin32 *co;
 
     co = g_malloc0(sizeof(*co));
+    co->base.stack_class = stack_class;
     co->fiber = CreateFiber(stack_size, coroutine_trampoline, &co->base);
     return &co->base;
 }
@@ -87,6 +88,14 @@ void qemu_coroutine_delete(Coroutine *co_)
     g_free(co);
 }
 
+void qemu_coroutine_stack_get_usage(CoroutineStackClass stack_class,
+                                    uint64_t *committed, uint64_t *max_depth)
+{
+    /* Fiber stacks are managed by Windows */
+    *committed = 0;
+    *max_depth = 0;
+}
+
 Coroutine *qemu_coroutine_self(void)
 {
     Coroutine *current = get_current();
@@ -19,9 +19,11 @@
  * 4. Nanosecond timeouts are supported so it requires fewer syscalls than
  *    epoll(7).
  *
- * This code only monitors file descriptors and does not do asynchronous disk
- * I/O.  Implementing disk I/O efficiently has other requirements and should
- * use a separate io_uring so it does not make sense to unify the code.
+ * Asynchronous disk I/O from block/io_uring.c shares the ring with file
+ * descriptor monitoring (see aio_co_submit_fd_op()), so that the requests
+ * that coroutines issue during one aio_poll() iteration and the file
+ * descriptor monitoring changes are all submitted by the io_uring_enter(2)
+ * call that waits for the next events.
  *
  * File descriptor monitoring is implemented using the following operations:
  *
@@ -34,22 +36,42 @@
  *    for events.  This operation self-cancels if another event completes
  *    before the timeout.
  *
+ * In addition, coroutines can submit other requests with aio_co_submit_fd_op(),
+ * e.g. IORING_OP_RECVMSG and IORING_OP_SENDMSG on sockets with
+ * aio_co_recvmsg() and aio_co_sendmsg().  Waiting for the completion instead
+ * of for readiness saves the recvmsg(2)/sendmsg(2) system call that would
+ * follow the readiness notification.  The user_data of an AioFdOp is not its
+ * address but a tag made of an index into ctx->fd_op_slots and the generation
+ * of that slot, which is bumped whenever the slot is freed.  A cancellation
+ * therefore cannot hit another operation that reuses the memory or the slot
+ * later.  process_cqe() tells AioFdOps apart from AioHandlers by the
+ * FDMON_IO_URING_FD_OP bit.  IORING_OP_ASYNC_CANCEL requests for AioFdOps are
+ * queued on ctx->fd_op_cancel_list.
+ *
  * io_uring calls the submission queue the "sq ring" and the completion queue
  * the "cq ring".  Ring entries are called "sqe" and "cqe", respectively.
  *
  * The code is structured so that sq/cq rings are only modified within
  * fdmon_io_uring_wait().  Changes to AioHandlers are made by enqueuing them on
  * ctx->submit_list so that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD
- * and/or IORING_OP_POLL_REMOVE sqes for them.
+ * and/or IORING_OP_POLL_REMOVE sqes for them.  AioFdOps are likewise enqueued
+ * on ctx->fd_op_list.
+ *
+ * When the AioContext is run from glib's event loop instead, glib polls the
+ * ring file descriptor and the gsource_*() callbacks take the place of
+ * fdmon_io_uring_wait(): pending sqes are submitted before glib waits and
+ * cqes are processed when the GSource is dispatched.
  */
 
 #include "qemu/osdep.h"
 #include <poll.h>
 #include "qemu/rcu_queue.h"
+#include "qapi/error.h"
 #include "aio-posix.h"
 
 enum {
     FDMON_IO_URING_ENTRIES  = 128, /* sq/cq ring size */
+    FDMON_IO_URING_MIN_FD_OP_SLOTS = 16,
 
     /* AioHandler::flags */
     FDMON_IO_URING_PENDING  = (1 << 0),
@@ -57,6 +79,81 @@ enum {
     FDMON_IO_URING_REMOVE   = (1 << 2),
 };
 
+/* Set in the user_data of AioFdOps, see fd_op_user_data() */
+#define FDMON_IO_URING_FD_OP ((uint64_t)1)
+
+typedef QSIMPLEQ_HEAD(, AioFdOp) AioFdOpList;
+
+typedef struct AioFdOpCancel {
+    uint64_t user_data;
+    QSLIST_ENTRY(AioFdOpCancel) next;
+} AioFdOpCancel;
+
+typedef struct AioFdOpSlot {
+    AioFdOp *op; /* NULL if the slot is free */
+    uint32_t gen;
+    unsigned int next_free;
+} AioFdOpSlot;
+
+/* Returns the index of a free slot, growing ctx->fd_op_slots if needed */
+static unsigned int fd_op_slot_alloc(AioContext *ctx, AioFdOp *op)
+{
+    AioFdOpSlot *slot;
+    unsigned int idx;
+
+    if (ctx->fd_op_free_slot == ctx->fd_op_nr_slots) {
+        unsigned int nr = MAX(ctx->fd_op_nr_slots * 2,
+                              FDMON_IO_URING_MIN_FD_OP_SLOTS);
+        unsigned int i;
+
+        /* The new slots form the free list, which was empty */
+        ctx->fd_op_slots = g_renew(AioFdOpSlot, ctx->fd_op_slots, nr);
+        for (i = ctx->fd_op_nr_slots; i < nr; i++) {
+            ctx->fd_op_slots[i] = (AioFdOpSlot) { .next_free = i + 1 };
+        }
+        ctx->fd_op_nr_slots = nr;
+    }
+
+    idx = ctx->fd_op_free_slot;
+    slot = &ctx->fd_op_slots[idx];
+    ctx->fd_op_free_slot = slot->next_free;
+    slot->op = op;
+    return idx;
+}
+
+static void fd_op_slot_free(AioContext *ctx, unsigned int idx)
+{
+    AioFdOpSlot *slot = &ctx->fd_op_slots[idx];
+
+    slot->op = NULL;
+    slot->gen++; /* stale cancellations no longer match */
+    slot->next_free = ctx->fd_op_free_slot;
+    ctx->fd_op_free_slot = idx;
+}
+
+static bool fd_op_slots_empty(AioContext *ctx)
+{
+    unsigned int i;
+
+    for (i = 0; i < ctx->fd_op_nr_slots; i++) {
+        if (ctx->fd_op_slots[i].op) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* AioHandler pointers are aligned, so bit 0 is free for FDMON_IO_URING_FD_OP */
+static inline uint64_t fd_op_user_data(unsigned int idx, uint32_t gen)
+{
+    return ((uint64_t)gen << 32) | ((uint64_t)idx << 1) | FDMON_IO_URING_FD_OP;
+}
+
+static inline unsigned int fd_op_user_data_to_slot(uint64_t user_data)
+{
+    return (uint32_t)user_data >> 1;
+}
+
 static inline int poll_events_from_pfd(int pfd_events)
 {
     return (pfd_events & G_IO_IN ? POLLIN : 0) |
@@ -199,13 +296,50 @@ static void add_timeout_sqe(AioContext *ctx, int64_t ns)
     io_uring_prep_timeout(sqe, &ts, 1, 0);
 }
 
-/* Add sqes from ctx->submit_list for submission */
+static void add_fd_op_sqe(AioContext *ctx, AioFdOp *op)
+{
+    struct io_uring_sqe *sqe = get_sqe(ctx);
+
+    op->prep(sqe, op);
+    sqe->user_data = op->tag;
+}
+
+static void add_fd_op_cancel_sqe(AioContext *ctx, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe(ctx);
+
+    /* io_uring_prep_cancel() takes a pointer in older liburing versions */
+    io_uring_prep_rw(IORING_OP_ASYNC_CANCEL, sqe, -1, NULL, 0, 0);
+    sqe->addr = user_data;
+}
+
+/*
+ * Add sqes from ctx->submit_list, ctx->fd_op_list and ctx->fd_op_cancel_list
+ * for submission
+ */
 static void fill_sq_ring(AioContext *ctx)
 {
     AioHandlerSList submit_list;
+    QSLIST_HEAD(, AioFdOpCancel) cancel_list;
+    AioFdOpCancel *cancel;
     AioHandler *node;
+    AioFdOp *op;
     unsigned flags;
 
+    while ((op = QSIMPLEQ_FIRST(&ctx->fd_op_list))) {
+        QSIMPLEQ_REMOVE_HEAD(&ctx->fd_op_list, next);
+        add_fd_op_sqe(ctx, op);
+    }
+
+    /* After the AioFdOps, which they might refer to */
+    cancel_list = ctx->fd_op_cancel_list;
+    QSLIST_INIT(&ctx->fd_op_cancel_list);
+    while ((cancel = QSLIST_FIRST(&cancel_list))) {
+        QSLIST_REMOVE_HEAD(&cancel_list, next);
+        add_fd_op_cancel_sqe(ctx, cancel->user_data);
+        g_free(cancel);
+    }
+
     QSLIST_MOVE_ATOMIC(&submit_list, &ctx->submit_list);
 
     while ((node = dequeue(&submit_list, &flags))) {
@@ -219,19 +353,33 @@ static void fill_sq_ring(AioContext *ctx)
     }
 }
 
-/* Returns true if a handler became ready */
+/* Returns true if a handler became ready or an AioFdOp completed */
 static bool process_cqe(AioContext *ctx,
                         AioHandlerList *ready_list,
+                        AioFdOpList *done_list,
                         struct io_uring_cqe *cqe)
 {
     AioHandler *node = io_uring_cqe_get_data(cqe);
     unsigned flags;
 
-    /* poll_timeout and poll_remove have a zero user_data field */
-    if (!node) {
+    /* poll_timeout, poll_remove and cancel have a zero user_data field */
+    if (!cqe->user_data) {
         return false;
     }
 
+    if (cqe->user_data & FDMON_IO_URING_FD_OP) {
+        unsigned int idx = fd_op_user_data_to_slot(cqe->user_data);
+        AioFdOp *op;
+
+        assert(idx < ctx->fd_op_nr_slots);
+        op = ctx->fd_op_slots[idx].op;
+        assert(op && op->tag == cqe->user_data);
+        fd_op_slot_free(ctx, idx);
+        op->ret = cqe->res;
+        QSIMPLEQ_INSERT_TAIL(done_list, op, next);
+        return true;
+    }
+
     /*
      * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
      * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
@@ -250,7 +398,8 @@ static bool process_cqe(AioContext *ctx,
     return true;
 }
 
-static int process_cq_ring(AioContext *ctx, AioHandlerList *ready_list)
+static int process_cq_ring(AioContext *ctx, AioHandlerList *ready_list,
+                           AioFdOpList *done_list)
 {
     struct io_uring *ring = &ctx->fdmon_io_uring;
     struct io_uring_cqe *cqe;
@@ -259,7 +408,7 @@ static int process_cq_ring(AioContext *ctx, AioHandlerList *ready_list)
     unsigned head;
 
     io_uring_for_each_cqe(ring, head, cqe) {
-        if (process_cqe(ctx, ready_list, cqe)) {
+        if (process_cqe(ctx, ready_list, done_list, cqe)) {
             num_ready++;
         }
 
@@ -270,9 +419,27 @@ static int process_cq_ring(AioContext *ctx, AioHandlerList *ready_list)
     return num_ready;
 }
 
+/*
+ * Reenter the coroutines of completed AioFdOps.  This is done only after the
+ * cq ring has been advanced because the coroutines may enqueue new requests.
+ */
+static void complete_fd_ops(AioFdOpList *done_list)
+{
+    AioFdOp *op;
+
+    while ((op = QSIMPLEQ_FIRST(done_list))) {
+        Coroutine *co = op->co;
+
+        QSIMPLEQ_REMOVE_HEAD(done_list, next);
+        op->co = NULL;
+        aio_co_wake(co);
+    }
+}
+
 static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
                                int64_t timeout)
 {
+    AioFdOpList done_list = QSIMPLEQ_HEAD_INITIALIZER(done_list);
     unsigned wait_nr = 1; /* block until at least one cqe is ready */
     int ret;
 
@@ -290,7 +457,36 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
 
     assert(ret >= 0);
 
-    return process_cq_ring(ctx, ready_list);
+    ret = process_cq_ring(ctx, ready_list, &done_list);
+    complete_fd_ops(&done_list);
+    return ret;
+}
+
+static void fdmon_io_uring_gsource_prepare(AioContext *ctx)
+{
+    int ret;
+
+    fill_sq_ring(ctx);
+
+    do {
+        ret = io_uring_submit(&ctx->fdmon_io_uring);
+    } while (ret == -EINTR);
+
+    assert(ret >= 0);
+}
+
+static bool fdmon_io_uring_gsource_check(AioContext *ctx)
+{
+    return io_uring_cq_ready(&ctx->fdmon_io_uring);
+}
+
+static void fdmon_io_uring_gsource_dispatch(AioContext *ctx,
+                                            AioHandlerList *ready_list)
+{
+    AioFdOpList done_list = QSIMPLEQ_HEAD_INITIALIZER(done_list);
+
+    process_cq_ring(ctx, ready_list, &done_list);
+    complete_fd_ops(&done_list);
 }
 
 static bool fdmon_io_uring_need_wait(AioContext *ctx)
@@ -310,6 +506,12 @@ static bool fdmon_io_uring_need_wait(AioContext *ctx)
         return true;
     }
 
+    /* Are there AioFdOps or cancellations to submit? */
+    if (!QSIMPLEQ_EMPTY(&ctx->fd_op_list) ||
+        !QSLIST_EMPTY(&ctx->fd_op_cancel_list)) {
+        return true;
+    }
+
     return false;
 }
 
@@ -317,6 +519,9 @@ static const FDMonOps fdmon_io_uring_ops = {
     .update = fdmon_io_uring_update,
     .wait = fdmon_io_uring_wait,
     .need_wait = fdmon_io_uring_need_wait,
+    .gsource_prepare = fdmon_io_uring_gsource_prepare,
+    .gsource_check = fdmon_io_uring_gsource_check,
+    .gsource_dispatch = fdmon_io_uring_gsource_dispatch,
 };
 
 bool fdmon_io_uring_setup(AioContext *ctx)
@@ -329,6 +534,18 @@ bool fdmon_io_uring_setup(AioContext *ctx)
     }
 
     QSLIST_INIT(&ctx->submit_list);
+    QSIMPLEQ_INIT(&ctx->fd_op_list);
+    QSLIST_INIT(&ctx->fd_op_cancel_list);
+    ctx->fd_op_slots = NULL;
+    ctx->fd_op_nr_slots = 0;
+    ctx->fd_op_free_slot = 0;
+
+    ctx->fdmon_io_uring_pfd = (GPollFD) {
+        .fd = ctx->fdmon_io_uring.ring_fd,
+        .events = G_IO_IN,
+    };
+    g_source_add_poll(&ctx->source, &ctx->fdmon_io_uring_pfd);
+
     ctx->fdmon_ops = &fdmon_io_uring_ops;
     return true;
 }
@@ -336,10 +553,27 @@ bool fdmon_io_uring_setup(AioContext *ctx)
 void fdmon_io_uring_destroy(AioContext *ctx)
 {
     if (ctx->fdmon_ops == &fdmon_io_uring_ops) {
+        AioFdOpCancel *cancel;
         AioHandler *node;
 
+        /* Nobody may be waiting for an AioFdOp at this point */
+        assert(QSIMPLEQ_EMPTY(&ctx->fd_op_list));
+        assert(fd_op_slots_empty(ctx));
+        g_free(ctx->fd_op_slots);
+        ctx->fd_op_slots = NULL;
+        ctx->fd_op_nr_slots = 0;
+        ctx->fd_op_free_slot = 0;
+
+        if (!g_source_is_destroyed(&ctx->source)) {
+            g_source_remove_poll(&ctx->source, &ctx->fdmon_io_uring_pfd);
+        }
         io_uring_queue_exit(&ctx->fdmon_io_uring);
 
+        while ((cancel = QSLIST_FIRST(&ctx->fd_op_cancel_list))) {
+            QSLIST_REMOVE_HEAD(&ctx->fd_op_cancel_list, next);
+            g_free(cancel);
+        }
+
         /* Move handlers due to be removed onto the deleted list */
         while ((node = QSLIST_FIRST_RCU(&ctx->submit_list))) {
             unsigned flags = qatomic_fetch_and(&node->flags,
@@ -357,3 +591,105 @@ void fdmon_io_uring_destroy(AioContext *ctx)
         ctx->fdmon_ops = &fdmon_poll_ops;
     }
 }
+
+bool fdmon_io_uring_set_sqpoll(AioContext *ctx, int cpu, Error **errp)
+{
+    struct io_uring_params params = {
+        .flags = IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF,
+        .sq_thread_cpu = cpu,
+    };
+    struct io_uring ring;
+    int ret;
+
+    if (ctx->fdmon_ops != &fdmon_io_uring_ops) {
+        error_setg(errp, "The event loop does not use io_uring");
+        return false;
+    }
+
+    ret = io_uring_queue_init_params(FDMON_IO_URING_ENTRIES, &ring, &params);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to create io_uring with a "
+                         "submission queue polling thread on CPU %d", cpu);
+        return false;
+    }
+
+    /*
+     * Nothing has been submitted to the old ring yet, AioHandlers that were
+     * already added are still waiting on ctx->submit_list.
+     */
+    assert(!io_uring_sq_ready(&ctx->fdmon_io_uring));
+    assert(!io_uring_cq_ready(&ctx->fdmon_io_uring));
+    assert(fd_op_slots_empty(ctx));
+
+    io_uring_queue_exit(&ctx->fdmon_io_uring);
+    ctx->fdmon_io_uring = ring;
+    ctx->fdmon_io_uring_pfd.fd = ring.ring_fd;
+    return true;
+}
+
+bool aio_fd_ops_supported(AioContext *ctx)
+{
+    return ctx->fdmon_ops == &fdmon_io_uring_ops;
+}
+
+int coroutine_fn aio_co_submit_fd_op(AioContext *ctx, AioFdOp *op)
+{
+    unsigned int idx;
+
+    assert(ctx == qemu_get_current_aio_context());
+    assert(aio_fd_ops_supported(ctx));
+
+    op->co = qemu_coroutine_self();
+    idx = fd_op_slot_alloc(ctx, op);
+    op->tag = fd_op_user_data(idx, ctx->fd_op_slots[idx].gen);
+    QSIMPLEQ_INSERT_TAIL(&ctx->fd_op_list, op, next);
+
+    /* Submitted and completed by fdmon_io_uring_wait() */
+    qemu_coroutine_yield();
+    assert(!op->co);
+
+    return op->ret;
+}
+
+static void prep_recvmsg(struct io_uring_sqe *sqe, AioFdOp *op)
+{
+    io_uring_prep_recvmsg(sqe, op->fd, op->msg, 0);
+}
+
+static void prep_sendmsg(struct io_uring_sqe *sqe, AioFdOp *op)
+{
+    io_uring_prep_sendmsg(sqe, op->fd, op->msg, 0);
+}
+
+ssize_t coroutine_fn aio_co_recvmsg(AioContext *ctx, AioFdOp *op, int fd,
+                                    struct msghdr *msg)
+{
+    *op = (AioFdOp) {
+        .prep = prep_recvmsg,
+        .fd = fd,
+        .msg = msg,
+    };
+    return aio_co_submit_fd_op(ctx, op);
+}
+
+ssize_t coroutine_fn aio_co_sendmsg(AioContext *ctx, AioFdOp *op, int fd,
+                                    struct msghdr *msg)
+{
+    *op = (AioFdOp) {
+        .prep = prep_sendmsg,
+        .fd = fd,
+        .msg = msg,
+    };
+    return aio_co_submit_fd_op(ctx, op);
+}
+
+void aio_fd_op_cancel(AioContext *ctx, AioFdOp *op)
+{
+    AioFdOpCancel *cancel = g_new(AioFdOpCancel, 1);
+
+    assert(ctx == qemu_get_current_aio_context());
+    assert(op->co);
+
+    cancel->user_data = op->tag;
+    QSLIST_INSERT_HEAD(&ctx->fd_op_cancel_list, cancel, next);
+}
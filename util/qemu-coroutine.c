@@ -16,6 +16,7 @@
 #include "trace.h"
 #include "qemu/thread.h"
 #include "qemu/atomic.h"
+#include "qemu/stats64.h"
 #include "qemu/coroutine_int.h"
 #include "qemu/coroutine-tls.h"
 #include "block/aio.h"
@@ -31,62 +32,139 @@ enum {
     POOL_INITIAL_MAX_SIZE = 64,
 };
 
-/** Free list to speed up creation */
-static QSLIST_HEAD(, Coroutine) release_pool = QSLIST_HEAD_INITIALIZER(pool);
+typedef QSLIST_HEAD(, Coroutine) CoroutineQSList;
+
+/** Free lists to speed up creation, one per stack size class */
+static CoroutineQSList release_pool[COROUTINE_STACK__MAX];
 static unsigned int pool_max_size = POOL_INITIAL_MAX_SIZE;
-static unsigned int release_pool_size;
+static unsigned int release_pool_size[COROUTINE_STACK__MAX];
 
-typedef QSLIST_HEAD(, Coroutine) CoroutineQSList;
-QEMU_DEFINE_STATIC_CO_TLS(CoroutineQSList, alloc_pool);
-QEMU_DEFINE_STATIC_CO_TLS(unsigned int, alloc_pool_size);
-QEMU_DEFINE_STATIC_CO_TLS(Notifier, coroutine_pool_cleanup_notifier);
+/** Coroutines that exist, including pooled ones */
+static unsigned int allocated[COROUTINE_STACK__MAX];
+static Stat64 max_allocated[COROUTINE_STACK__MAX];
+
+/*
+ * Written with qatomic_set_u64() by a single thread, so that updating them
+ * does not need atomic read-modify-write operations.
+ */
+typedef struct CoroutineClassStats {
+    uint64_t hits;        /* created from a pool */
+    uint64_t misses;      /* created with qemu_coroutine_new() */
+    uint64_t terminated;
+} CoroutineClassStats;
+
+typedef struct CoroutineAllocPool {
+    CoroutineQSList list;
+    unsigned int size;
+    /* Only written by the owning thread */
+    CoroutineClassStats stats;
+} CoroutineAllocPool;
+
+typedef struct CoroutineThreadPools {
+    CoroutineAllocPool pools[COROUTINE_STACK__MAX];
+    Notifier cleanup_notifier;
+    QLIST_ENTRY(CoroutineThreadPools) next;
+} CoroutineThreadPools;
+
+QEMU_DEFINE_STATIC_CO_TLS(CoroutineThreadPools, thread_pools);
+
+/*
+ * Threads that use coroutines, so that statistics can be collected.  The
+ * statistics of threads that have exited are added to exited_stats, which
+ * is protected by thread_pools_lock.
+ */
+static QemuMutex thread_pools_lock;
+static QLIST_HEAD(, CoroutineThreadPools) thread_pools_list =
+    QLIST_HEAD_INITIALIZER(thread_pools_list);
+static CoroutineClassStats exited_stats[COROUTINE_STACK__MAX];
+
+static void __attribute__((constructor)) coroutine_pool_init(void)
+{
+    qemu_mutex_init(&thread_pools_lock);
+}
+
+static void coroutine_free(Coroutine *co)
+{
+    qatomic_dec(&allocated[co->stack_class]);
+    qemu_coroutine_delete(co);
+}
 
 static void coroutine_pool_cleanup(Notifier *n, void *value)
 {
+    CoroutineThreadPools *tp = container_of(n, CoroutineThreadPools,
+                                            cleanup_notifier);
     Coroutine *co;
     Coroutine *tmp;
-    CoroutineQSList *alloc_pool = get_ptr_alloc_pool();
+    int i;
+
+    for (i = 0; i < COROUTINE_STACK__MAX; i++) {
+        CoroutineAllocPool *pool = &tp->pools[i];
+
+        QSLIST_FOREACH_SAFE(co, &pool->list, pool_next, tmp) {
+            QSLIST_REMOVE_HEAD(&pool->list, pool_next);
+            coroutine_free(co);
+        }
+    }
+
+    QEMU_LOCK_GUARD(&thread_pools_lock);
+    QLIST_REMOVE(tp, next);
+    for (i = 0; i < COROUTINE_STACK__MAX; i++) {
+        CoroutineClassStats *stats = &tp->pools[i].stats;
 
-    QSLIST_FOREACH_SAFE(co, alloc_pool, pool_next, tmp) {
-        QSLIST_REMOVE_HEAD(alloc_pool, pool_next);
-        qemu_coroutine_delete(co);
+        exited_stats[i].hits += stats->hits;
+        exited_stats[i].misses += stats->misses;
+        exited_stats[i].terminated += stats->terminated;
     }
 }
 
-Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
+static CoroutineThreadPools *coroutine_get_thread_pools(void)
 {
+    CoroutineThreadPools *tp = get_ptr_thread_pools();
+
+    if (unlikely(!tp->cleanup_notifier.notify)) {
+        /* First use in this thread; register the destructor.  */
+        tp->cleanup_notifier.notify = coroutine_pool_cleanup;
+        qemu_thread_atexit_add(&tp->cleanup_notifier);
+
+        QEMU_LOCK_GUARD(&thread_pools_lock);
+        QLIST_INSERT_HEAD(&thread_pools_list, tp, next);
+    }
+    return tp;
+}
+
+Coroutine *qemu_coroutine_create_sized(CoroutineEntry *entry, void *opaque,
+                                       CoroutineStackClass stack_class)
+{
+    CoroutineThreadPools *tp = coroutine_get_thread_pools();
+    CoroutineAllocPool *pool = &tp->pools[stack_class];
     Coroutine *co = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
-        CoroutineQSList *alloc_pool = get_ptr_alloc_pool();
-
-        co = QSLIST_FIRST(alloc_pool);
+        co = QSLIST_FIRST(&pool->list);
         if (!co) {
-            if (release_pool_size > POOL_MIN_BATCH_SIZE) {
-                /* Slow path; a good place to register the destructor, too.  */
-                Notifier *notifier = get_ptr_coroutine_pool_cleanup_notifier();
-                if (!notifier->notify) {
-                    notifier->notify = coroutine_pool_cleanup;
-                    qemu_thread_atexit_add(notifier);
-                }
-
+            if (release_pool_size[stack_class] > POOL_MIN_BATCH_SIZE) {
                 /* This is not exact; there could be a little skew between
                  * release_pool_size and the actual size of release_pool.  But
                  * it is just a heuristic, it does not need to be perfect.
                  */
-                set_alloc_pool_size(qatomic_xchg(&release_pool_size, 0));
-                QSLIST_MOVE_ATOMIC(alloc_pool, &release_pool);
-                co = QSLIST_FIRST(alloc_pool);
+                pool->size = qatomic_xchg(&release_pool_size[stack_class], 0);
+                QSLIST_MOVE_ATOMIC(&pool->list, &release_pool[stack_class]);
+                co = QSLIST_FIRST(&pool->list);
             }
         }
         if (co) {
-            QSLIST_REMOVE_HEAD(alloc_pool, pool_next);
-            set_alloc_pool_size(get_alloc_pool_size() - 1);
+            QSLIST_REMOVE_HEAD(&pool->list, pool_next);
+            pool->size--;
         }
     }
 
-    if (!co) {
-        co = qemu_coroutine_new();
+    if (co) {
+        qatomic_set_u64(&pool->stats.hits, pool->stats.hits + 1);
+    } else {
+        co = qemu_coroutine_new(stack_class);
+        qatomic_set_u64(&pool->stats.misses, pool->stats.misses + 1);
+        stat64_max(&max_allocated[stack_class],
+                   qatomic_fetch_inc(&allocated[stack_class]) + 1);
     }
 
     co->entry = entry;
@@ -95,24 +173,36 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
     return co;
 }
 
+Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
+{
+    return qemu_coroutine_create_sized(entry, opaque, COROUTINE_STACK_DEFAULT);
+}
+
 static void coroutine_delete(Coroutine *co)
 {
+    CoroutineStackClass stack_class = co->stack_class;
+    CoroutineThreadPools *tp = coroutine_get_thread_pools();
+    CoroutineAllocPool *pool = &tp->pools[stack_class];
+
     co->caller = NULL;
+    qatomic_set_u64(&pool->stats.terminated, pool->stats.terminated + 1);
 
     if (CONFIG_COROUTINE_POOL) {
-        if (release_pool_size < qatomic_read(&pool_max_size) * 2) {
-            QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
-            qatomic_inc(&release_pool_size);
+        if (release_pool_size[stack_class] <
+            qatomic_read(&pool_max_size) * 2) {
+            QSLIST_INSERT_HEAD_ATOMIC(&release_pool[stack_class], co,
+                                      pool_next);
+            qatomic_inc(&release_pool_size[stack_class]);
             return;
         }
-        if (get_alloc_pool_size() < qatomic_read(&pool_max_size)) {
-            QSLIST_INSERT_HEAD(get_ptr_alloc_pool(), co, pool_next);
-            set_alloc_pool_size(get_alloc_pool_size() + 1);
+        if (pool->size < qatomic_read(&pool_max_size)) {
+            QSLIST_INSERT_HEAD(&pool->list, co, pool_next);
+            pool->size++;
             return;
         }
     }
 
-    qemu_coroutine_delete(co);
+    coroutine_free(co);
 }
 
 void qemu_aio_coroutine_enter(AioContext *ctx, Coroutine *co)
@@ -230,3 +320,34 @@ void qemu_coroutine_dec_pool_size(unsigned int removing_pool_size)
 {
     qatomic_sub(&pool_max_size, removing_pool_size);
 }
+
+void qemu_coroutine_get_stats(CoroutinePoolStats *stats)
+{
+    CoroutineThreadPools *tp;
+    int i;
+
+    QEMU_LOCK_GUARD(&thread_pools_lock);
+    for (i = 0; i < COROUTINE_STACK__MAX; i++) {
+        CoroutinePoolStats *s = &stats[i];
+        uint64_t hits = exited_stats[i].hits;
+        uint64_t misses = exited_stats[i].misses;
+        uint64_t terminated = exited_stats[i].terminated;
+
+        QLIST_FOREACH(tp, &thread_pools_list, next) {
+            CoroutineClassStats *stats = &tp->pools[i].stats;
+
+            hits += qatomic_read_u64(&stats->hits);
+            misses += qatomic_read_u64(&stats->misses);
+            terminated += qatomic_read_u64(&stats->terminated);
+        }
+
+        s->stack_size = qemu_coroutine_stack_size(i);
+        s->pool_hits = hits;
+        s->pool_misses = misses;
+        /* The counters of other threads may be read at different times */
+        s->in_use = hits + misses > terminated ? hits + misses - terminated : 0;
+        s->allocated = qatomic_read(&allocated[i]);
+        s->max_allocated = stat64_get(&max_allocated[i]);
+        qemu_coroutine_stack_get_usage(i, &s->committed, &s->max_depth);
+    }
+}
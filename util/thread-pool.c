@@ -17,11 +17,26 @@
 #include "qemu/osdep.h"
 #include "qemu/queue.h"
 #include "qemu/thread.h"
+#include "qemu/thread-context.h"
 #include "qemu/coroutine.h"
+#include "qemu/stats64.h"
+#include "qemu/timer.h"
+#include "qom/object.h"
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
 
+/*
+ * Each worker thread has its own queue of requests.  The AioContext
+ * thread collects the requests that are submitted while it dispatches
+ * events and hands them out in one go from a bottom half, first to idle
+ * workers and then round-robin.  A worker that runs out of work takes
+ * requests from the shared queue or steals half of the longest queue of
+ * another worker before going to sleep, so pool->lock is only taken by
+ * workers when they are out of work.  Completed requests are pushed to a
+ * lock-free list that the completion bottom half processes in batches.
+ */
+
 static void do_spawn_thread(ThreadPool *pool);
 
 typedef struct ThreadPoolElement ThreadPoolElement;
@@ -32,65 +47,277 @@ enum ThreadState {
     THREAD_DONE,
 };
 
+typedef struct ThreadPoolQueue {
+    QemuMutex lock;
+    QTAILQ_HEAD(, ThreadPoolElement) reqs;
+    /* Written under lock, read without it to pick a victim for stealing */
+    unsigned int len;
+} ThreadPoolQueue;
+
 struct ThreadPoolElement {
     BlockAIOCB common;
     ThreadPool *pool;
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+    /* Moving state out of THREAD_QUEUED is protected by the lock of the
+     * queue holding the request.  After that, only the worker thread can
+     * write to it.  Reads and writes of state and ret are ordered with
+     * memory barriers.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* Submission time, for the queue latency statistics.  */
+    int64_t submit_ns;
+
+    /* The queue holding the request, or NULL while it is on the pool's
+     * submit_list.  Changing it requires pool->lock.
+     */
+    ThreadPoolQueue *queue;
+
+    /* Access to this list is protected by the lock of queue.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
-    /* This list is only written by the thread pool's mother thread.  */
+    /* Pushed atomically once state is THREAD_DONE.  */
+    QSLIST_ENTRY(ThreadPoolElement) done;
+
+    /* These lists are only written by the thread pool's mother thread.  */
+    QSIMPLEQ_ENTRY(ThreadPoolElement) completed;
     QLIST_ENTRY(ThreadPoolElement) all;
 };
 
+typedef struct ThreadPoolWorker ThreadPoolWorker;
+
+struct ThreadPoolWorker {
+    ThreadPool *pool;
+    ThreadPoolQueue queue;
+
+    /* The following variables are protected by pool->lock.  */
+    QemuCond request_cond;
+    bool idle;
+    QLIST_ENTRY(ThreadPoolWorker) next;
+    QLIST_ENTRY(ThreadPoolWorker) idle_next;
+};
+
 struct ThreadPool {
     AioContext *ctx;
     QEMUBH *completion_bh;
+    QEMUBH *submit_bh;
     QemuMutex lock;
     QemuCond worker_stopped;
-    QemuCond request_cond;
     QEMUBH *new_thread_bh;
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) completed;
+
+    /* Requests waiting for submit_bh.  Only the mother thread adds to
+     * it, submit_lock protects it against thread_pool_cancel().
+     */
+    QemuMutex submit_lock;
+    QTAILQ_HEAD(, ThreadPoolElement) submit_list;
+
+    /* Written by the worker threads with atomic operations.  */
+    QSLIST_HEAD(, ThreadPoolElement) done_list;
+
+    /* Requests that no worker could take yet */
+    ThreadPoolQueue shared;
 
     /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    QLIST_HEAD(, ThreadPoolWorker) workers;
+    QLIST_HEAD(, ThreadPoolWorker) idle_workers;
+    ThreadPoolWorker *next_worker; /* round-robin position in workers */
+    ThreadContext *thread_context;
     int cur_threads;
-    int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
     int min_threads;
     int max_threads;
+
+    /* Statistics, see ThreadPoolStats */
+    unsigned int queue_depth;
+    Stat64 max_queue_depth;
+    Stat64 completed_reqs;
+    Stat64 stolen_reqs;
+    Stat64 queue_ns;
+    Stat64 max_queue_ns;
+    Stat64 run_ns;
 };
 
+static void thread_pool_queue_init(ThreadPoolQueue *queue)
+{
+    qemu_mutex_init(&queue->lock);
+    QTAILQ_INIT(&queue->reqs);
+    queue->len = 0;
+}
+
+static void thread_pool_queue_destroy(ThreadPoolQueue *queue)
+{
+    assert(QTAILQ_EMPTY(&queue->reqs));
+    qemu_mutex_destroy(&queue->lock);
+}
+
+static void thread_pool_queue_push(ThreadPoolQueue *queue,
+                                   ThreadPoolElement *req)
+{
+    QEMU_LOCK_GUARD(&queue->lock);
+    req->queue = queue;
+    QTAILQ_INSERT_TAIL(&queue->reqs, req, reqs);
+    qatomic_set(&queue->len, queue->len + 1);
+}
+
+/* Takes the oldest request of the queue and marks it as running.  */
+static ThreadPoolElement *thread_pool_queue_pop(ThreadPoolQueue *queue)
+{
+    ThreadPoolElement *req;
+
+    QEMU_LOCK_GUARD(&queue->lock);
+    req = QTAILQ_FIRST(&queue->reqs);
+    if (req) {
+        QTAILQ_REMOVE(&queue->reqs, req, reqs);
+        qatomic_set(&queue->len, queue->len - 1);
+        req->state = THREAD_ACTIVE;
+    }
+    return req;
+}
+
+/*
+ * Moves up to @n requests from @from to @to, taking the newest ones so
+ * that the owner of @from keeps working on the oldest.  Called with
+ * pool->lock taken.  Returns the number of requests moved.
+ */
+static unsigned int thread_pool_queue_move(ThreadPoolQueue *from,
+                                           ThreadPoolQueue *to,
+                                           unsigned int n)
+{
+    QTAILQ_HEAD(, ThreadPoolElement) moving = QTAILQ_HEAD_INITIALIZER(moving);
+    ThreadPoolElement *req;
+    unsigned int moved = 0;
+
+    qemu_mutex_lock(&from->lock);
+    while (moved < n && (req = QTAILQ_LAST(&from->reqs))) {
+        QTAILQ_REMOVE(&from->reqs, req, reqs);
+        QTAILQ_INSERT_HEAD(&moving, req, reqs);
+        moved++;
+    }
+    qatomic_set(&from->len, from->len - moved);
+    qemu_mutex_unlock(&from->lock);
+
+    if (moved) {
+        qemu_mutex_lock(&to->lock);
+        while ((req = QTAILQ_FIRST(&moving))) {
+            QTAILQ_REMOVE(&moving, req, reqs);
+            req->queue = to;
+            QTAILQ_INSERT_TAIL(&to->reqs, req, reqs);
+        }
+        qatomic_set(&to->len, to->len + moved);
+        qemu_mutex_unlock(&to->lock);
+    }
+    return moved;
+}
+
+/* Called with pool->lock taken.  */
+static void thread_pool_wake_worker(ThreadPoolWorker *worker)
+{
+    assert(worker->idle);
+    QLIST_REMOVE(worker, idle_next);
+    worker->idle = false;
+    qemu_cond_signal(&worker->request_cond);
+}
+
+/*
+ * Fills the worker's queue from the shared queue or from the longest
+ * queue of another worker.  Called with pool->lock taken.  Returns
+ * whether the worker has work to do.
+ */
+static bool thread_pool_find_work(ThreadPool *pool, ThreadPoolWorker *worker)
+{
+    ThreadPoolWorker *victim = NULL, *w;
+    unsigned int len, max_len = 0, n;
+
+    if (qatomic_read(&worker->queue.len)) {
+        return true;
+    }
+
+    len = qatomic_read(&pool->shared.len);
+    if (len) {
+        return thread_pool_queue_move(&pool->shared, &worker->queue,
+                                      DIV_ROUND_UP(len, 2));
+    }
+
+    QLIST_FOREACH(w, &pool->workers, next) {
+        len = qatomic_read(&w->queue.len);
+        if (w != worker && len > max_len) {
+            victim = w;
+            max_len = len;
+        }
+    }
+    if (!victim) {
+        return false;
+    }
+
+    n = thread_pool_queue_move(&victim->queue, &worker->queue,
+                               DIV_ROUND_UP(max_len, 2));
+    trace_thread_pool_steal(pool, worker, victim, n);
+    stat64_add(&pool->stolen_reqs, n);
+    return n;
+}
+
+static void thread_pool_complete(ThreadPool *pool, ThreadPoolElement *req)
+{
+    QSLIST_INSERT_HEAD_ATOMIC(&pool->done_list, req, done);
+    qemu_bh_schedule(pool->completion_bh);
+}
+
+static void thread_pool_run(ThreadPool *pool, ThreadPoolElement *req)
+{
+    int64_t start_ns = get_clock();
+    int64_t queue_ns = start_ns - req->submit_ns;
+    int ret;
+
+    qatomic_dec(&pool->queue_depth);
+    stat64_add(&pool->queue_ns, queue_ns);
+    stat64_max(&pool->max_queue_ns, queue_ns);
+
+    ret = req->func(req->arg);
+
+    stat64_add(&pool->run_ns, get_clock() - start_ns);
+    stat64_add(&pool->completed_reqs, 1);
+
+    req->ret = ret;
+    /* Write ret before state.  */
+    smp_wmb();
+    req->state = THREAD_DONE;
+
+    thread_pool_complete(pool, req);
+}
+
 static void *worker_thread(void *opaque)
 {
-    ThreadPool *pool = opaque;
+    ThreadPoolWorker *worker = opaque;
+    ThreadPool *pool = worker->pool;
+    ThreadPoolElement *req;
 
     qemu_mutex_lock(&pool->lock);
     pool->pending_threads--;
+    QLIST_INSERT_HEAD(&pool->workers, worker, next);
     do_spawn_thread(pool);
 
     while (pool->cur_threads <= pool->max_threads) {
-        ThreadPoolElement *req;
         int ret;
 
-        if (QTAILQ_EMPTY(&pool->request_list)) {
-            pool->idle_threads++;
-            ret = qemu_cond_timedwait(&pool->request_cond, &pool->lock, 10000);
-            pool->idle_threads--;
+        if (!thread_pool_find_work(pool, worker)) {
+            worker->idle = true;
+            QLIST_INSERT_HEAD(&pool->idle_workers, worker, idle_next);
+            ret = qemu_cond_timedwait(&worker->request_cond, &pool->lock,
+                                      10000);
+            if (worker->idle) {
+                QLIST_REMOVE(worker, idle_next);
+                worker->idle = false;
+            }
             if (ret == 0 &&
-                QTAILQ_EMPTY(&pool->request_list) &&
+                !qatomic_read(&worker->queue.len) &&
                 pool->cur_threads > pool->min_threads) {
                 /* Timed out + no work to do + no need for warm threads = exit.  */
                 break;
@@ -102,36 +329,40 @@ static void *worker_thread(void *opaque)
             continue;
         }
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
         qemu_mutex_unlock(&pool->lock);
+        while ((req = thread_pool_queue_pop(&worker->queue))) {
+            thread_pool_run(pool, req);
+        }
+        qemu_mutex_lock(&pool->lock);
+    }
 
-        ret = req->func(req->arg);
-
-        req->ret = ret;
-        /* Write ret before state.  */
-        smp_wmb();
-        req->state = THREAD_DONE;
+    QLIST_REMOVE(worker, next);
+    if (pool->next_worker == worker) {
+        pool->next_worker = NULL;
+    }
 
-        qemu_bh_schedule(pool->completion_bh);
-        qemu_mutex_lock(&pool->lock);
+    /*
+     * Hand requests that were queued after we decided to exit over to
+     * another thread.
+     */
+    if (thread_pool_queue_move(&worker->queue, &pool->shared, UINT_MAX) &&
+        !QLIST_EMPTY(&pool->idle_workers)) {
+        thread_pool_wake_worker(QLIST_FIRST(&pool->idle_workers));
     }
 
     pool->cur_threads--;
     qemu_cond_signal(&pool->worker_stopped);
     qemu_mutex_unlock(&pool->lock);
 
-    /*
-     * Wake up another thread, in case we got a wakeup but decided
-     * to exit due to pool->cur_threads > pool->max_threads.
-     */
-    qemu_cond_signal(&pool->request_cond);
+    thread_pool_queue_destroy(&worker->queue);
+    qemu_cond_destroy(&worker->request_cond);
+    g_free(worker);
     return NULL;
 }
 
 static void do_spawn_thread(ThreadPool *pool)
 {
+    ThreadPoolWorker *worker;
     QemuThread t;
 
     /* Runs with lock taken.  */
@@ -142,7 +373,23 @@ static void do_spawn_thread(ThreadPool *pool)
     pool->new_threads--;
     pool->pending_threads++;
 
-    qemu_thread_create(&t, "worker", worker_thread, pool, QEMU_THREAD_DETACHED);
+    worker = g_new0(ThreadPoolWorker, 1);
+    worker->pool = pool;
+    thread_pool_queue_init(&worker->queue);
+    qemu_cond_init(&worker->request_cond);
+
+    /*
+     * A thread context places the worker on the host CPUs and NUMA nodes
+     * it was configured with.
+     */
+    if (pool->thread_context) {
+        thread_context_create_thread(pool->thread_context, &t, "worker",
+                                     worker_thread, worker,
+                                     QEMU_THREAD_DETACHED);
+    } else {
+        qemu_thread_create(&t, "worker", worker_thread, worker,
+                           QEMU_THREAD_DETACHED);
+    }
 }
 
 static void spawn_thread_bh_fn(void *opaque)
@@ -170,25 +417,87 @@ static void spawn_thread(ThreadPool *pool)
     }
 }
 
-static void thread_pool_completion_bh(void *opaque)
+/*
+ * Distributes the requests submitted since the last call: one to each
+ * idle worker, so that each wakeup finds work, and the rest round-robin.
+ * Workers that become idle later steal from the longest queue.
+ */
+static void thread_pool_submit_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *req;
+    ThreadPoolWorker *worker;
+    unsigned int n = 0;
+
+    qemu_mutex_lock(&pool->lock);
+    qemu_mutex_lock(&pool->submit_lock);
+    while ((req = QTAILQ_FIRST(&pool->submit_list))) {
+        QTAILQ_REMOVE(&pool->submit_list, req, reqs);
+        n++;
+
+        worker = QLIST_FIRST(&pool->idle_workers);
+        if (worker) {
+            thread_pool_queue_push(&worker->queue, req);
+            thread_pool_wake_worker(worker);
+            continue;
+        }
 
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
+        if (pool->cur_threads < pool->max_threads) {
+            /* The new thread takes it from the shared queue */
+            spawn_thread(pool);
+            thread_pool_queue_push(&pool->shared, req);
             continue;
         }
 
+        worker = pool->next_worker ? QLIST_NEXT(pool->next_worker, next) :
+                                     NULL;
+        if (!worker) {
+            worker = QLIST_FIRST(&pool->workers);
+        }
+        pool->next_worker = worker;
+        thread_pool_queue_push(worker ? &worker->queue : &pool->shared, req);
+    }
+    qemu_mutex_unlock(&pool->submit_lock);
+    qemu_mutex_unlock(&pool->lock);
+
+    trace_thread_pool_submit_batch(pool, n);
+}
+
+static void thread_pool_completion_bh(void *opaque)
+{
+    ThreadPool *pool = opaque;
+    ThreadPoolElement *elem;
+
+    for (;;) {
+        if (QSIMPLEQ_EMPTY(&pool->completed)) {
+            QSIMPLEQ_HEAD(, ThreadPoolElement) batch =
+                QSIMPLEQ_HEAD_INITIALIZER(batch);
+            QSLIST_HEAD(, ThreadPoolElement) done;
+
+            /* done_list is LIFO, reverse it to complete in order */
+            QSLIST_MOVE_ATOMIC(&done, &pool->done_list);
+            while ((elem = QSLIST_FIRST(&done))) {
+                QSLIST_REMOVE_HEAD(&done, done);
+                QSIMPLEQ_INSERT_HEAD(&batch, elem, completed);
+            }
+            QSIMPLEQ_CONCAT(&pool->completed, &batch);
+        }
+
+        elem = QSIMPLEQ_FIRST(&pool->completed);
+        if (!elem) {
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&pool->completed, completed);
+
+        /* Read state before ret.  */
+        smp_rmb();
+        assert(elem->state == THREAD_DONE);
+
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
         QLIST_REMOVE(elem, all);
 
         if (elem->common.cb) {
-            /* Read state before ret.  */
-            smp_rmb();
-
             /* Schedule ourselves in case elem->common.cb() calls aio_poll() to
              * wait for another request that completed at the same time.
              */
@@ -197,16 +506,12 @@ restart:
             elem->common.cb(elem->common.opaque, elem->ret);
 
             /* We can safely cancel the completion_bh here regardless of someone
-             * else having scheduled it meanwhile because we reenter the
-             * completion function anyway (goto restart).
+             * else having scheduled it meanwhile because we look at done_list
+             * again before returning.
              */
             qemu_bh_cancel(pool->completion_bh);
-
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            qemu_aio_unref(elem);
         }
+        qemu_aio_unref(elem);
     }
 }
 
@@ -214,18 +519,34 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 {
     ThreadPoolElement *elem = (ThreadPoolElement *)acb;
     ThreadPool *pool = elem->pool;
+    ThreadPoolQueue *queue;
+    bool cancelled = false;
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
     QEMU_LOCK_GUARD(&pool->lock);
-    if (elem->state == THREAD_QUEUED) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
+    queue = elem->queue;
+    if (!queue) {
+        qemu_mutex_lock(&pool->submit_lock);
+        QTAILQ_REMOVE(&pool->submit_list, elem, reqs);
+        qemu_mutex_unlock(&pool->submit_lock);
+        cancelled = true;
+    } else {
+        qemu_mutex_lock(&queue->lock);
+        if (elem->state == THREAD_QUEUED) {
+            QTAILQ_REMOVE(&queue->reqs, elem, reqs);
+            qatomic_set(&queue->len, queue->len - 1);
+            cancelled = true;
+        }
+        qemu_mutex_unlock(&queue->lock);
+    }
 
-        elem->state = THREAD_DONE;
+    if (cancelled) {
+        qatomic_dec(&pool->queue_depth);
         elem->ret = -ECANCELED;
+        elem->state = THREAD_DONE;
+        thread_pool_complete(pool, elem);
     }
-
 }
 
 static AioContext *thread_pool_get_aio_context(BlockAIOCB *acb)
@@ -256,18 +577,21 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
     req->arg = arg;
     req->state = THREAD_QUEUED;
     req->pool = pool;
+    req->queue = NULL;
+    req->submit_ns = get_clock();
 
     QLIST_INSERT_HEAD(&pool->head, req, all);
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
-    }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
+    stat64_max(&pool->max_queue_depth,
+               qatomic_fetch_inc(&pool->queue_depth) + 1);
+
+    /* Requests submitted until submit_bh runs are handed out together */
+    qemu_mutex_lock(&pool->submit_lock);
+    QTAILQ_INSERT_TAIL(&pool->submit_list, req, reqs);
+    qemu_mutex_unlock(&pool->submit_lock);
+    qemu_bh_schedule(pool->submit_bh);
     return &req->common;
 }
 
@@ -300,11 +624,25 @@ void thread_pool_submit(ThreadPoolFunc *func, void *arg)
 
 void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
 {
+    ThreadPoolWorker *worker, *next;
+    int excess;
+
     qemu_mutex_lock(&pool->lock);
 
     pool->min_threads = ctx->thread_pool_min;
     pool->max_threads = ctx->thread_pool_max;
 
+    /* Only affects threads created from now on */
+    if (pool->thread_context != ctx->thread_pool_context) {
+        if (pool->thread_context) {
+            object_unref(OBJECT(pool->thread_context));
+        }
+        pool->thread_context = ctx->thread_pool_context;
+        if (pool->thread_context) {
+            object_ref(OBJECT(pool->thread_context));
+        }
+    }
+
     /*
      * We either have to:
      *  - Increase the number available of threads until over the min_threads
@@ -318,11 +656,35 @@ void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
         spawn_thread(pool);
     }
 
-    for (int i = pool->cur_threads; i > pool->max_threads; i--) {
-        qemu_cond_signal(&pool->request_cond);
+    excess = pool->cur_threads - pool->max_threads;
+    QLIST_FOREACH_SAFE(worker, &pool->idle_workers, idle_next, next) {
+        if (excess-- <= 0) {
+            break;
+        }
+        thread_pool_wake_worker(worker);
+    }
+
+    qemu_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (!pool) {
+        return;
     }
 
+    qemu_mutex_lock(&pool->lock);
+    stats->workers = pool->cur_threads;
     qemu_mutex_unlock(&pool->lock);
+
+    stats->queue_depth = qatomic_read(&pool->queue_depth);
+    stats->max_queue_depth = stat64_get(&pool->max_queue_depth);
+    stats->completed = stat64_get(&pool->completed_reqs);
+    stats->stolen = stat64_get(&pool->stolen_reqs);
+    stats->queue_ns = stat64_get(&pool->queue_ns);
+    stats->max_queue_ns = stat64_get(&pool->max_queue_ns);
+    stats->run_ns = stat64_get(&pool->run_ns);
 }
 
 static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
@@ -334,13 +696,19 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     memset(pool, 0, sizeof(*pool));
     pool->ctx = ctx;
     pool->completion_bh = aio_bh_new(ctx, thread_pool_completion_bh, pool);
+    pool->submit_bh = aio_bh_new(ctx, thread_pool_submit_bh, pool);
     qemu_mutex_init(&pool->lock);
+    qemu_mutex_init(&pool->submit_lock);
     qemu_cond_init(&pool->worker_stopped);
-    qemu_cond_init(&pool->request_cond);
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
-    QTAILQ_INIT(&pool->request_list);
+    QSIMPLEQ_INIT(&pool->completed);
+    QTAILQ_INIT(&pool->submit_list);
+    QSLIST_INIT(&pool->done_list);
+    thread_pool_queue_init(&pool->shared);
+    QLIST_INIT(&pool->workers);
+    QLIST_INIT(&pool->idle_workers);
 
     thread_pool_update_params(pool, ctx);
 }
@@ -354,6 +722,8 @@ ThreadPool *thread_pool_new(AioContext *ctx)
 
 void thread_pool_free(ThreadPool *pool)
 {
+    ThreadPoolWorker *worker, *next;
+
     if (!pool) {
         return;
     }
@@ -369,16 +739,23 @@ void thread_pool_free(ThreadPool *pool)
 
     /* Wait for worker threads to terminate */
     pool->max_threads = 0;
-    qemu_cond_broadcast(&pool->request_cond);
+    QLIST_FOREACH_SAFE(worker, &pool->idle_workers, idle_next, next) {
+        thread_pool_wake_worker(worker);
+    }
     while (pool->cur_threads > 0) {
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
     }
 
     qemu_mutex_unlock(&pool->lock);
 
+    if (pool->thread_context) {
+        object_unref(OBJECT(pool->thread_context));
+    }
+    qemu_bh_delete(pool->submit_bh);
     qemu_bh_delete(pool->completion_bh);
-    qemu_cond_destroy(&pool->request_cond);
+    thread_pool_queue_destroy(&pool->shared);
     qemu_cond_destroy(&pool->worker_stopped);
+    qemu_mutex_destroy(&pool->submit_lock);
     qemu_mutex_destroy(&pool->lock);
     g_free(pool);
 }